@@ -45,6 +45,18 @@
 #endif
 
 
+/*
+ * library version, and the same numbers for the library actually linked
+ */
+#define MUMMY_VERSION_MAJOR 1
+#define MUMMY_VERSION_MINOR 0
+#define MUMMY_VERSION_PATCH 3
+#define MUMMY_VERSION_STRING "1.0.3"
+#define MUMMY_VERSION_NUMBER \
+    (MUMMY_VERSION_MAJOR * 10000 + MUMMY_VERSION_MINOR * 100 + \
+     MUMMY_VERSION_PATCH)
+
+
 /*
  * serialized object types
  */
@@ -86,6 +98,20 @@
 #define MUMMY_SPECIAL_NAN 0x20
 
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* everything declared from here on is the library's exported API, even when
+   it is built with hidden visibility by default */
+#if defined(__GNUC__) && __GNUC__ >= 4
+#pragma GCC visibility push(default)
+#endif
+
+int mummy_version(void);
+const char *mummy_version_string(void);
+
+
 /* string with offset */
 typedef struct {
     char *data;
@@ -100,8 +126,8 @@ mummy_string *mummy_string_wrap(char *, int);
 /*************
  * reading API
  */
-#define mummy_type(str) (str)->data[(str)->offset] & 0x7fffffff
-#define mummy_string_space(str) (str)->len - (str)->offset
+#define mummy_type(str) ((str)->data[(str)->offset] & 0x7fffffff)
+#define mummy_string_space(str) ((str)->len - (str)->offset)
 
 /* read atoms */
 int mummy_read_bool(mummy_string *, char *);
@@ -114,6 +140,8 @@ int mummy_point_to_string(mummy_string *, char **, int *);
 int mummy_read_utf8(mummy_string *, int, char **, int *);
 int mummy_point_to_utf8(mummy_string *, char **, int *);
 int mummy_read_decimal(mummy_string *, char *, int16_t *, uint16_t *, char **);
+int mummy_read_legacy_decimal(
+        mummy_string *, char *, int16_t *, uint16_t *, char **);
 int mummy_read_specialnum(mummy_string *, char *);
 int mummy_read_fraction(mummy_string *, int64_t *, int64_t *);
 int mummy_read_date(mummy_string *, short *, char *, char *);
@@ -125,6 +153,96 @@ int mummy_read_timedelta(mummy_string *, int *, int *, int *);
 /* determine container sizes */
 int mummy_container_size(mummy_string *, uint32_t *);
 
+/* one decoded item, for walking a buffer a tag at a time without
+   allocating. strings, huge ints and decimal digits point into the buffer,
+   containers report only their item (or pair) count. */
+typedef struct {
+    int type; /* MUMMY_TYPE_* */
+    union {
+        int64_t i; /* bool, the int types, and specialnum flags */
+        double f;
+        uint32_t size;
+        struct {
+            char *data;
+            int len;
+        } s;
+        struct {
+            int64_t numerator;
+            int64_t denominator;
+        } fraction;
+        struct {
+            int16_t year;
+            uint8_t month, day, hour, minute, second;
+            int32_t microsecond;
+        } dt; /* date, time and datetime */
+        struct {
+            int32_t days, seconds, microseconds;
+        } delta;
+        struct {
+            int8_t sign;
+            int16_t exponent;
+            uint16_t count;
+            char *digits; /* packed two per byte, low 4 bits first */
+        } decimal;
+    } v;
+} mummy_token;
+
+int mummy_read_token(mummy_string *, mummy_token *);
+
+/* event-driven walking. mummy_walk reads tokens from the string's offset on
+   and calls back for each one, without allocating. strings, huge ints and
+   decimal digits point into the buffer and only last until the callback
+   returns. any callback may be NULL to ignore those events, and decimals,
+   special numbers, fractions and the date and time types all go to `other`.
+
+   callbacks return 0 to carry on. MUMMY_WALK_SKIP from a begin_* skips the
+   container's contents (and its end), and from a hash key's event skips the
+   value that goes with it. anything else stops the walk and is returned from
+   mummy_walk, and should be positive (MUMMY_WALK_STOP, say) to keep clear of
+   the error codes.
+
+   mummy_walk returns 0 when the string runs out between top-level values, -1
+   when it runs out in the middle of one, -2 for an unknown type and -3 when
+   containers nest more than MUMMY_WALK_MAX_DEPTH deep. the walker is left
+   where it stopped each time, so after -1 (or a stop) more data can be added
+   to the end of the string (or what's before its offset dropped) and the
+   same walker passed to mummy_walk again to pick up from there. compressed
+   strings have to be decompressed first. */
+#define MUMMY_WALK_SKIP 1
+#define MUMMY_WALK_STOP 2
+#define MUMMY_WALK_MAX_DEPTH 256
+
+typedef struct {
+    int (*null)(void *);
+    int (*boolean)(void *, char);
+    int (*integer)(void *, int64_t);
+    int (*huge)(void *, char *, int);
+    int (*floating)(void *, double);
+    int (*string)(void *, char *, int);
+    int (*utf8)(void *, char *, int);
+    int (*begin_list)(void *, uint32_t);
+    int (*begin_tuple)(void *, uint32_t);
+    int (*begin_set)(void *, uint32_t);
+    int (*begin_hash)(void *, uint32_t);
+    int (*end)(void *);
+    int (*other)(void *, mummy_token *);
+} mummy_walk_callbacks;
+
+typedef struct {
+    const mummy_walk_callbacks *callbacks;
+    void *ctx;
+    int depth;
+    int skip_depth; /* the container being skipped, or 0 */
+    char skip_value; /* skip the next item, a hash key said to */
+    struct {
+        uint64_t left; /* items still to come (twice the pairs of a hash) */
+        char hash;
+    } stack[MUMMY_WALK_MAX_DEPTH];
+} mummy_walker;
+
+void mummy_walker_init(mummy_walker *, const mummy_walk_callbacks *, void *);
+int mummy_walk(mummy_walker *, mummy_string *);
+
 int mummy_string_decompress(mummy_string *, char, char *);
 
 /*************
@@ -162,6 +280,149 @@ int mummy_open_hash(mummy_string *, int);
 
 int mummy_string_compress(mummy_string *);
 
+/* rewrite a payload from the old format (before the decimal layout changed)
+   onto the end of a string in the current one */
+int mummy_upgrade_legacy(mummy_string *, mummy_string *);
+
+/* transcoding, appending one top-level value to the second string from the
+   first one's offset on, without building anything in between. JSON comes
+   out compact and in UTF-8, with dates and times as ISO 8601 strings,
+   decimals and fractions as numbers and time differences as seconds. for
+   msgpack, datetimes (naive, taken as UTC) become timestamps and the other
+   types msgpack lacks ride in extension type 0x4d as their mummy bytes, so
+   they come back out of mummy_from_msgpack unchanged. each returns 0, -1 if
+   the input is truncated, -2 for an unknown type, -3 past
+   MUMMY_WALK_MAX_DEPTH, EINVAL for input it can't represent or ENOMEM, and
+   on failure leaves the output string's offset where it was */
+int mummy_to_json(mummy_string *, mummy_string *);
+int mummy_from_json(mummy_string *, mummy_string *);
+int mummy_to_msgpack(mummy_string *, mummy_string *);
+int mummy_from_msgpack(mummy_string *, mummy_string *);
+
+/* the lowercase name of a MUMMY_TYPE_* ("shortutf8", "medhash"), or NULL */
+const char *mummy_type_name(int);
+
+/* byte accounting, for seeing where the bytes in payloads go. each call to
+   mummy_profile_add walks one (decompressed) value from the string's offset
+   on and adds it to the totals: counts and bytes for each type code, so the
+   cost of each width class shows, the hash keys apart from the values, and
+   for each path down to max_depth levels the bytes of its subtrees and what
+   they come to lzf compressed one by one. paths are spelled ".key" and
+   "[]" (any item of a list, tuple or set) from the top, which is "".
+
+   the estimates are what the same values would have taken with varints for
+   the ints, lengths and counts (zigzagged, after the type byte), and with
+   every string key written once into a table shared by all the values and
+   each use of one a type byte and a varint index.
+
+   mummy_profile_add returns what mummy_walk would, or ENOMEM, and leaves
+   the string's offset after the value */
+#define MUMMY_PROFILE_TYPES (MUMMY_TYPE_FRACTION + 1)
+
+typedef struct {
+    char *path;
+    int type; /* MUMMY_TYPE_*, the widest of one kind at several widths, or
+                 -1 for different kinds */
+    uint64_t count;
+    uint64_t items; /* in all the containers */
+    uint64_t bytes; /* of the whole subtrees */
+    uint64_t key_bytes; /* of the keys naming them */
+    uint64_t compressed; /* the bytes again, lzf compressed where it helps */
+} mummy_profile_path;
+
+typedef struct {
+    int max_depth;
+    uint64_t values;
+    uint64_t bytes;
+    uint64_t counts[MUMMY_PROFILE_TYPES];
+    uint64_t sizes[MUMMY_PROFILE_TYPES]; /* containers just their headers */
+    uint64_t key_count;
+    uint64_t key_bytes;
+    uint64_t distinct_keys; /* string keys */
+    uint64_t header_bytes; /* type bytes, lengths and counts */
+    uint64_t varint_bytes;
+    uint64_t keytable_bytes;
+    mummy_profile_path *paths; /* in the order they were first seen */
+    size_t npaths;
+    struct mummy_profile_state *state;
+} mummy_profile;
+
+mummy_profile *mummy_profile_new(int);
+int mummy_profile_add(mummy_profile *, mummy_string *);
+void mummy_profile_free(mummy_profile *);
+
+/* running counters, kept only when the library is built with MUMMY_STATS
+   defined (mummy_stats_enabled says whether it was). each thread counts into
+   its own block, so counting takes no locks; mummy_stats_read adds up every
+   thread's, including those that have exited, and mummy_stats_reset zeroes
+   them all. while other threads are counting, what they've done since the
+   last read or reset may not all show.
+
+   the library counts compression, decompression and the reallocs of
+   growing strings itself. encoders and decoders built on it report each
+   value they finish with mummy_stats_encoded or mummy_stats_decoded, giving
+   the offset it started at and its depth, 1 for the top-level value; those
+   count the type and the depth, and a top-level value as a call and its
+   bytes. they do nothing without MUMMY_STATS */
+#define MUMMY_STATS_TYPES (MUMMY_TYPE_FRACTION + 1)
+
+typedef struct {
+    uint64_t encodes; /* top-level values */
+    uint64_t encoded_bytes; /* of them, before compression */
+    uint64_t decodes;
+    uint64_t decoded_bytes; /* after decompression */
+    uint64_t compress_attempts;
+    uint64_t compress_saves; /* attempts that came out smaller */
+    uint64_t compress_bytes_in; /* of the saves */
+    uint64_t compress_bytes_out;
+    uint64_t decompressions;
+    uint64_t decompressed_bytes;
+    uint64_t reallocs;
+    uint64_t max_depth;
+    uint64_t encoded_types[MUMMY_STATS_TYPES];
+    uint64_t decoded_types[MUMMY_STATS_TYPES];
+} mummy_stats;
+
+int mummy_stats_enabled(void);
+mummy_stats *mummy_stats_local(void); /* this thread's, NULL if disabled */
+void mummy_stats_read(mummy_stats *);
+void mummy_stats_reset(void);
+void mummy_stats_encoded(mummy_string *, int, int);
+void mummy_stats_decoded(mummy_string *, int, int);
+
+#ifdef MUMMY_STATS
+    #define mummy_stats_count(field, n) do {                  \
+        mummy_stats *_stats = mummy_stats_local();            \
+        if (_stats) _stats->field += (n);                     \
+    } while (0)
+#else
+    #define mummy_stats_count(field, n) ((void)0)
+#endif
+
+/* allocation tracking, in a library built with MUMMY_TRACK_ALLOC defined
+   (mummy_alloc_tracking says whether it was). mummy_alloc_track has the
+   calling thread's mallocs, callocs, reallocs and frees counted into
+   `stats`, or into nothing when NULL, and returns where they were going
+   before, so a caller can count one stretch of work and then put back an
+   enclosing one. the counts add to what's in `stats` already, and sizes are
+   as the allocator rounded them. a buffer the library hands over (such as
+   mummy_read_decimal's digits) and the caller frees stays live in the counts.
+   without MUMMY_TRACK_ALLOC nothing is counted and it always returns NULL */
+typedef struct {
+    uint64_t allocs; /* including reallocs */
+    uint64_t frees;
+    uint64_t bytes; /* allocated, a realloc counting as its new size */
+    int64_t live; /* allocated less freed */
+    int64_t peak; /* the highest live reached */
+} mummy_alloc_stats;
+
+int mummy_alloc_tracking(void);
+mummy_alloc_stats *mummy_alloc_track(mummy_alloc_stats *);
+void *mummy_alloc_malloc(size_t);
+void *mummy_alloc_calloc(size_t, size_t);
+void *mummy_alloc_realloc(void *, size_t);
+void mummy_alloc_free(void *);
+
 void mummy_string_free(mummy_string *str, char);
 
 #define mummy_string_makespace(str, size)                     \
@@ -175,6 +436,15 @@ void mummy_string_free(mummy_string *str, char);
             return ENOMEM;                                    \
         }                                                     \
         str->data = temp;                                     \
+        mummy_stats_count(reallocs, 1);                       \
     }
 
+#if defined(__GNUC__) && __GNUC__ >= 4
+#pragma GCC visibility pop
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* _MUMMY_H */
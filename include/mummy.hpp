@@ -0,0 +1,1232 @@
+#ifndef _MUMMY_HPP
+#define _MUMMY_HPP
+
+/*
+ * a header-only C++17 layer over mummy.h
+ *
+ *     std::map<std::string, std::vector<int>> value{{"a", {1, 2, 3}}};
+ *     mummy::buffer data = mummy::encode(value);
+ *     auto same = mummy::decode<decltype(value)>(data.view());
+ *
+ * how each C++ type is written and read is picked at compile time by
+ * mummy::codec<T>, so there's none of the per-object type checking the
+ * python extension has to do. out of the box that covers:
+ *
+ *  - bool, the integral types (the narrowest mummy int that holds the value,
+ *    the same as mummy_feed_int, with the checks that can't matter for the
+ *    type compiled out) and float/double
+ *  - std::string, std::string_view and string literals as utf8, and
+ *    mummy::bytes_view as a byte string. either kind reads back as any of
+ *    them, and string_view/bytes_view read without copying
+ *  - std::vector (a list, reads from a list, tuple or set), std::map and
+ *    std::unordered_map (a hash), std::optional (null when empty)
+ *  - std::chrono durations as time differences, and system_clock time
+ *    points as (naive, UTC) datetimes
+ *  - plain structs declared with MUMMY_STRUCT, see the end of this file
+ *
+ * other types get in by specializing codec with two static functions:
+ *
+ *     template <> struct mummy::codec<point> {
+ *         static void encode(mummy::writer &out, const point &p) {
+ *             out.open_tuple(2).encode(p.x).encode(p.y);
+ *         }
+ *         static point decode(mummy::reader &in) {
+ *             in.read_sequence();
+ *             return {in.decode<int>(), in.decode<int>()};
+ *         }
+ *     };
+ *
+ * errors are thrown: std::bad_alloc when out of memory, mummy::error for
+ * anything else.
+ */
+
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <array>
+#include <map>
+#include <memory>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "mummy.h"
+
+
+namespace mummy {
+
+/* invalid data, or data that doesn't fit the type asked for. code() is the
+   C API's return code where there was one */
+class error : public std::runtime_error {
+public:
+    explicit error(const char *what, int code = 0)
+        : std::runtime_error(what), code_(code) {}
+
+    int code() const noexcept { return code_; }
+
+private:
+    int code_;
+};
+
+/* raw bytes, to be written as a mummy byte string rather than utf8 */
+struct bytes_view {
+    std::string_view data;
+};
+
+template <class T, class Enable = void>
+struct codec;
+
+/* how MUMMY_STRUCT types (and maps) are laid out. hash writes a struct as a
+   hash of its field names, the way a python dict of it would be. message is
+   the positional layout of a schemas.Message (that isn't PACKED) whose SCHEMA
+   matches the struct: a list of the required fields' values in the order of
+   their names, then those of the std::optional fields, null when empty. maps
+   become lists of alternating keys and values, as schemas does with dicts */
+enum class layout { hash, message };
+
+class writer;
+class reader;
+
+
+namespace detail {
+
+inline void
+check(int rc) {
+    switch (rc) {
+    case 0:
+        return;
+    case ENOMEM:
+        throw std::bad_alloc();
+    case EINVAL:
+        throw error("invalid mummy (bad decimal digit)", rc);
+    case -2:
+        throw error("invalid mummy (unrecognized type)", rc);
+    default:
+        throw error("invalid mummy (incorrect length)", rc);
+    }
+}
+
+/* whether `value` fits in N, which is answered at compile time (so the test
+   and whatever branch it guards drop out) when every T does */
+template <class N, class T>
+constexpr bool
+fits(T value) noexcept {
+    using limits = std::numeric_limits<N>;
+    using tlimits = std::numeric_limits<T>;
+
+    if constexpr (std::is_signed_v<T>) {
+        if constexpr (tlimits::min() >= limits::min() &&
+                tlimits::max() <= limits::max())
+            return true;
+        else
+            return value >= limits::min() && value <= limits::max();
+    } else {
+        using unsigned_n = std::make_unsigned_t<N>;
+        if constexpr (tlimits::max() <= unsigned_n(limits::max()))
+            return true;
+        else
+            return value <= unsigned_n(limits::max());
+    }
+}
+
+constexpr std::int64_t US_PER_SECOND = 1000000;
+constexpr std::int64_t US_PER_DAY = 86400 * US_PER_SECOND;
+
+constexpr std::int64_t
+floor_div(std::int64_t a, std::int64_t b) noexcept {
+    return a / b - ((a % b) < 0);
+}
+
+/* proleptic gregorian date <-> days since 1970-01-01 */
+constexpr std::int64_t
+days_from_civil(std::int64_t y, unsigned m, unsigned d) noexcept {
+    y -= m <= 2;
+    const std::int64_t era = (y >= 0 ? y : y - 399) / 400;
+    const unsigned yoe = unsigned(y - era * 400);
+    const unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + std::int64_t(doe) - 719468;
+}
+
+constexpr void
+civil_from_days(std::int64_t z, std::int64_t &y, unsigned &m,
+        unsigned &d) noexcept {
+    z += 719468;
+    const std::int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    const unsigned doe = unsigned(z - era * 146097);
+    const unsigned yoe =
+        (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const unsigned mp = (5 * doy + 2) / 153;
+    d = doy - (153 * mp + 2) / 5 + 1;
+    m = mp < 10 ? mp + 3 : mp - 9;
+    y = std::int64_t(yoe) + era * 400 + (m <= 2);
+}
+
+struct free_deleter {
+    void operator()(char *p) const noexcept { std::free(p); }
+};
+
+inline int
+checked_size(std::size_t size) {
+    if (size > std::size_t(std::numeric_limits<int>::max()))
+        throw error("string too long for a mummy");
+    return int(size);
+}
+
+} // namespace detail
+
+
+/* an owned mummy_string. move-only, and a moved-from buffer is empty */
+class buffer {
+public:
+    explicit buffer(int capacity = 256)
+        : str_(mummy_string_new(capacity > 0 ? capacity : 1)) {
+        if (!str_) throw std::bad_alloc();
+    }
+
+    /* take over a mummy_string (and its data) from the C API */
+    explicit buffer(mummy_string *str) noexcept : str_(str) {}
+
+    buffer(buffer &&other) noexcept
+        : str_(std::exchange(other.str_, nullptr)) {}
+
+    buffer &
+    operator=(buffer &&other) noexcept {
+        if (this != &other) {
+            reset();
+            str_ = std::exchange(other.str_, nullptr);
+        }
+        return *this;
+    }
+
+    buffer(const buffer &) = delete;
+    buffer &operator=(const buffer &) = delete;
+
+    ~buffer() { reset(); }
+
+    const char *data() const noexcept { return str_ ? str_->data : nullptr; }
+    std::size_t size() const noexcept { return str_ ? str_->offset : 0; }
+    std::string_view view() const noexcept { return {data(), size()}; }
+    bool empty() const noexcept { return !size(); }
+
+    /* lzf compress the contents in place, when that's worth it */
+    void compress() { detail::check(mummy_string_compress(str_)); }
+
+    bool compressed() const noexcept {
+        return size() && (str_->data[0] & 0x80);
+    }
+
+    mummy_string *get() noexcept { return str_; }
+    const mummy_string *get() const noexcept { return str_; }
+
+    /* hand the mummy_string back to the C API, to mummy_string_free */
+    mummy_string *release() noexcept { return std::exchange(str_, nullptr); }
+
+private:
+    void
+    reset() noexcept {
+        if (str_) mummy_string_free(str_, 1);
+        str_ = nullptr;
+    }
+
+    mummy_string *str_;
+};
+
+
+/* writes values one after another into a buffer. containers are written as
+   their item count (pairs, for hashes) followed by that many items */
+class writer {
+public:
+    explicit writer(int capacity = 256, layout structs = layout::hash)
+        : buf_(capacity), layout_(structs) {}
+
+    template <class T>
+    writer &
+    encode(const T &value) {
+        codec<T>::encode(*this, value);
+        return *this;
+    }
+
+    /* the buffer written so far, optionally compressed. the writer starts
+       over with a new one */
+    buffer
+    finish(bool compress = true) {
+        if (compress) buf_.compress();
+        buffer out(std::move(buf_));
+        buf_ = buffer();
+        return out;
+    }
+
+    std::string_view view() const noexcept { return buf_.view(); }
+    void clear() noexcept { buf_.get()->offset = 0; }
+    layout struct_layout() const noexcept { return layout_; }
+
+    writer &
+    write_null() {
+        *reserve(1) = MUMMY_TYPE_NULL;
+        advance(1);
+        return *this;
+    }
+
+    writer &
+    write_bool(bool value) {
+        char *out = reserve(2);
+        out[0] = MUMMY_TYPE_BOOL;
+        out[1] = value ? 1 : 0;
+        advance(2);
+        return *this;
+    }
+
+    template <class T>
+    writer &
+    write_int(T value) {
+        static_assert(std::is_integral_v<T> && !std::is_same_v<T, bool>,
+                "write_int takes an integral type");
+
+        if constexpr (std::is_unsigned_v<T> &&
+                sizeof(T) >= sizeof(std::int64_t)) {
+            if (!detail::fits<std::int64_t>(value))
+                return write_huge_unsigned(std::uint64_t(value));
+        }
+
+        const std::int64_t num = std::int64_t(value);
+        if (detail::fits<std::int8_t>(value))
+            return put_int(MUMMY_TYPE_CHAR, 1, num);
+        if (detail::fits<std::int16_t>(value))
+            return put_int(MUMMY_TYPE_SHORT, 2, num);
+        if (detail::fits<std::int32_t>(value))
+            return put_int(MUMMY_TYPE_INT, 4, num);
+        return put_int(MUMMY_TYPE_LONG, 8, num);
+    }
+
+    writer &
+    write_float(double value) {
+        std::uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return put_int(MUMMY_TYPE_FLOAT, 8, std::int64_t(bits));
+    }
+
+    writer &
+    write_utf8(std::string_view value) {
+        detail::check(mummy_feed_utf8(buf_.get(), const_cast<char *>(
+                value.data()), detail::checked_size(value.size())));
+        return *this;
+    }
+
+    writer &
+    write_bytes(std::string_view value) {
+        detail::check(mummy_feed_string(buf_.get(), const_cast<char *>(
+                value.data()), detail::checked_size(value.size())));
+        return *this;
+    }
+
+    writer &
+    write_date(int year, int month, int day) {
+        detail::check(mummy_feed_date(buf_.get(), year, month, day));
+        return *this;
+    }
+
+    writer &
+    write_time(int hour, int minute, int second, int microsecond) {
+        detail::check(mummy_feed_time(
+                buf_.get(), hour, minute, second, microsecond));
+        return *this;
+    }
+
+    writer &
+    write_datetime(int year, int month, int day, int hour, int minute,
+            int second, int microsecond) {
+        detail::check(mummy_feed_datetime(buf_.get(), year, month, day,
+                hour, minute, second, microsecond));
+        return *this;
+    }
+
+    writer &
+    write_timedelta(int days, int seconds, int microseconds) {
+        detail::check(mummy_feed_timedelta(
+                buf_.get(), days, seconds, microseconds));
+        return *this;
+    }
+
+    writer &
+    write_fraction(std::int64_t numerator, std::int64_t denominator) {
+        detail::check(mummy_feed_fraction(
+                buf_.get(), numerator, denominator));
+        return *this;
+    }
+
+    writer &
+    open_list(std::uint32_t count) {
+        detail::check(mummy_open_list(buf_.get(), int(count)));
+        return *this;
+    }
+
+    writer &
+    open_tuple(std::uint32_t count) {
+        detail::check(mummy_open_tuple(buf_.get(), int(count)));
+        return *this;
+    }
+
+    writer &
+    open_set(std::uint32_t count) {
+        detail::check(mummy_open_set(buf_.get(), int(count)));
+        return *this;
+    }
+
+    writer &
+    open_hash(std::uint32_t count) {
+        detail::check(mummy_open_hash(buf_.get(), int(count)));
+        return *this;
+    }
+
+private:
+    /* room for `size` more bytes, grown the same way as
+       mummy_string_makespace */
+    char *
+    reserve(int size) {
+        mummy_string *str = buf_.get();
+        if (str->len - str->offset < size) {
+            int len = str->len ? str->len : 1;
+            while (len - str->offset < size) len <<= 1;
+            char *data = static_cast<char *>(std::realloc(str->data, len));
+            if (!data) throw std::bad_alloc();
+            str->data = data;
+            str->len = len;
+        }
+        return str->data + str->offset;
+    }
+
+    void advance(int size) noexcept { buf_.get()->offset += size; }
+
+    /* a type byte then the low `width` bytes of num, big-endian */
+    writer &
+    put_int(char type, int width, std::int64_t num) {
+        char *out = reserve(width + 1);
+        const std::uint64_t bits = std::uint64_t(num);
+        out[0] = type;
+        for (int i = 0; i < width; ++i)
+            out[width - i] = char((bits >> (i * 8)) & 0xff);
+        advance(width + 1);
+        return *this;
+    }
+
+    /* past INT64_MAX: a 9 byte huge, the same as the python side writes */
+    writer &
+    write_huge_unsigned(std::uint64_t value) {
+        char *out = reserve(14);
+        out[0] = MUMMY_TYPE_HUGE;
+        out[1] = out[2] = out[3] = 0;
+        out[4] = 9;
+        out[5] = 0;
+        for (int i = 0; i < 8; ++i)
+            out[13 - i] = char((value >> (i * 8)) & 0xff);
+        advance(14);
+        return *this;
+    }
+
+    buffer buf_;
+    layout layout_;
+};
+
+
+/* reads values back one after another. compressed data is decompressed into
+   a buffer the reader owns, otherwise it reads in place, and the
+   string_views it hands out point into one or the other */
+class reader {
+public:
+    explicit reader(std::string_view data, layout structs = layout::hash)
+        : layout_(structs) {
+        str_.data = const_cast<char *>(data.data());
+        str_.offset = 0;
+        str_.len = detail::checked_size(data.size());
+
+        if (str_.len && (str_.data[0] & 0x80)) {
+            char owned = 0;
+            int rc = mummy_string_decompress(&str_, 0, &owned);
+            if (rc == ENOMEM) throw std::bad_alloc();
+            if (rc) throw error("lzf decompression failed", rc);
+            if (owned) decompressed_.reset(str_.data);
+        }
+    }
+
+    explicit reader(const buffer &data, layout structs = layout::hash)
+        : reader(data.view(), structs) {}
+
+    template <class T>
+    T
+    decode() {
+        return codec<T>::decode(*this);
+    }
+
+    template <class T>
+    reader &
+    decode(T &out) {
+        out = codec<T>::decode(*this);
+        return *this;
+    }
+
+    bool done() const noexcept { return str_.offset >= str_.len; }
+    layout struct_layout() const noexcept { return layout_; }
+
+    /* the MUMMY_TYPE_* of the next value, without reading it */
+    int
+    peek() const {
+        if (done()) throw error("invalid mummy (incorrect length)", -1);
+        return mummy_type(&str_);
+    }
+
+    /* the next tag. see mummy_token in mummy.h */
+    const mummy_token &
+    next() {
+        if (done()) throw error("invalid mummy (incorrect length)", -1);
+        detail::check(mummy_read_token(&str_, &token_));
+        return token_;
+    }
+
+    /* step over the next value, containers and all */
+    void
+    skip() {
+        std::uint64_t pending = 1;
+        while (pending--) {
+            const mummy_token &token = next();
+            switch (token.type) {
+            case MUMMY_TYPE_SHORTHASH:
+            case MUMMY_TYPE_MEDHASH:
+            case MUMMY_TYPE_LONGHASH:
+                pending += std::uint64_t(token.v.size) * 2;
+                break;
+            case MUMMY_TYPE_SHORTLIST:
+            case MUMMY_TYPE_MEDLIST:
+            case MUMMY_TYPE_LONGLIST:
+            case MUMMY_TYPE_SHORTTUPLE:
+            case MUMMY_TYPE_MEDTUPLE:
+            case MUMMY_TYPE_LONGTUPLE:
+            case MUMMY_TYPE_SHORTSET:
+            case MUMMY_TYPE_MEDSET:
+            case MUMMY_TYPE_LONGSET:
+                pending += token.v.size;
+                break;
+            }
+        }
+    }
+
+    void
+    read_null() {
+        if (next().type != MUMMY_TYPE_NULL) mismatch("null");
+    }
+
+    bool
+    read_bool() {
+        if (next().type != MUMMY_TYPE_BOOL) mismatch("bool");
+        return token_.v.i != 0;
+    }
+
+    template <class T>
+    T
+    read_int() {
+        static_assert(std::is_integral_v<T> && !std::is_same_v<T, bool>,
+                "read_int takes an integral type");
+
+        switch (next().type) {
+        case MUMMY_TYPE_CHAR:
+        case MUMMY_TYPE_SHORT:
+        case MUMMY_TYPE_INT:
+        case MUMMY_TYPE_LONG:
+            return narrow<T>(token_.v.i);
+        case MUMMY_TYPE_HUGE:
+            return read_huge<T>();
+        }
+        mismatch("int");
+    }
+
+    /* floats, or ints converted */
+    double
+    read_float() {
+        switch (next().type) {
+        case MUMMY_TYPE_FLOAT:
+            return token_.v.f;
+        case MUMMY_TYPE_CHAR:
+        case MUMMY_TYPE_SHORT:
+        case MUMMY_TYPE_INT:
+        case MUMMY_TYPE_LONG:
+            return double(token_.v.i);
+        }
+        mismatch("float");
+    }
+
+    /* a byte or utf8 string, in place */
+    std::string_view
+    read_string() {
+        switch (next().type) {
+        case MUMMY_TYPE_SHORTSTR:
+        case MUMMY_TYPE_MEDSTR:
+        case MUMMY_TYPE_LONGSTR:
+        case MUMMY_TYPE_SHORTUTF8:
+        case MUMMY_TYPE_MEDUTF8:
+        case MUMMY_TYPE_LONGUTF8:
+            return {token_.v.s.data, std::size_t(token_.v.s.len)};
+        }
+        mismatch("string");
+    }
+
+    /* the item count of a list, tuple or set */
+    std::uint32_t
+    read_sequence() {
+        switch (next().type) {
+        case MUMMY_TYPE_SHORTLIST:
+        case MUMMY_TYPE_MEDLIST:
+        case MUMMY_TYPE_LONGLIST:
+        case MUMMY_TYPE_SHORTTUPLE:
+        case MUMMY_TYPE_MEDTUPLE:
+        case MUMMY_TYPE_LONGTUPLE:
+        case MUMMY_TYPE_SHORTSET:
+        case MUMMY_TYPE_MEDSET:
+        case MUMMY_TYPE_LONGSET:
+            check_items(token_.v.size);
+            return token_.v.size;
+        }
+        mismatch("list, tuple or set");
+    }
+
+    /* the pair count of a hash */
+    std::uint32_t
+    read_hash() {
+        switch (next().type) {
+        case MUMMY_TYPE_SHORTHASH:
+        case MUMMY_TYPE_MEDHASH:
+        case MUMMY_TYPE_LONGHASH:
+            check_items(std::uint64_t(token_.v.size) * 2);
+            return token_.v.size;
+        }
+        mismatch("hash");
+    }
+
+    /* total microseconds of a time difference */
+    std::int64_t
+    read_timedelta() {
+        if (next().type != MUMMY_TYPE_TIMEDELTA) mismatch("timedelta");
+        return token_.v.delta.days * detail::US_PER_DAY +
+            token_.v.delta.seconds * detail::US_PER_SECOND +
+            token_.v.delta.microseconds;
+    }
+
+    /* microseconds since 1970-01-01 of a datetime, or a date's midnight */
+    std::int64_t
+    read_datetime() {
+        const int type = next().type;
+        if (type != MUMMY_TYPE_DATETIME && type != MUMMY_TYPE_DATE)
+            mismatch("datetime");
+
+        const auto &dt = token_.v.dt;
+        std::int64_t us = detail::days_from_civil(
+                dt.year, dt.month, dt.day) * detail::US_PER_DAY;
+        if (type == MUMMY_TYPE_DATETIME)
+            us += (dt.hour * 3600 + dt.minute * 60 + dt.second) *
+                detail::US_PER_SECOND + dt.microsecond;
+        return us;
+    }
+
+private:
+    /* every item takes at least a byte, so a container claiming more than
+       the rest of the input holds is corrupt, and is caught before a codec
+       reserves room for it */
+    void
+    check_items(std::uint64_t items) const {
+        if (items > std::uint64_t(str_.len - str_.offset))
+            throw error("invalid mummy (incorrect length)", -1);
+    }
+
+    [[noreturn]] static void
+    mismatch(const char *expected) {
+        throw error((std::string("mummy type mismatch, expected ") +
+                    expected).c_str());
+    }
+
+    template <class T>
+    static T
+    narrow(std::int64_t value) {
+        if constexpr (std::is_signed_v<T>) {
+            if (!detail::fits<T>(value))
+                throw error("mummy int out of range");
+        } else {
+            if (value < 0 || !detail::fits<T>(std::uint64_t(value)))
+                throw error("mummy int out of range");
+        }
+        return T(value);
+    }
+
+    /* huges beyond int64 only make it through as an unsigned 64 bit int */
+    template <class T>
+    T
+    read_huge() {
+        const unsigned char *data =
+            reinterpret_cast<const unsigned char *>(token_.v.s.data);
+        int len = token_.v.s.len;
+        std::uint64_t bits = 0;
+        bool negative = len && (data[0] & 0x80);
+
+        if (len == 9 && !data[0]) {
+            ++data;
+            --len;
+            if (!(data[0] & 0x80)) negative = false;
+            else if constexpr (std::is_unsigned_v<T> && sizeof(T) >= 8) {
+                for (int i = 0; i < 8; ++i) bits = (bits << 8) | data[i];
+                return T(bits);
+            } else {
+                throw error("mummy int out of range");
+            }
+        }
+        if (len > 8) throw error("mummy int out of range");
+
+        for (int i = 0; i < len; ++i) bits = (bits << 8) | data[i];
+        if (negative && len < 8) bits |= ~std::uint64_t(0) << (len * 8);
+        return narrow<T>(std::int64_t(bits));
+    }
+
+    mummy_string str_;
+    mummy_token token_;
+    layout layout_;
+    std::unique_ptr<char, detail::free_deleter> decompressed_;
+};
+
+
+/* encode a value on its own, compressed if that's worth it */
+template <class T>
+buffer
+encode(const T &value, bool compress = true,
+        layout structs = layout::hash) {
+    writer out(256, structs);
+    out.encode(value);
+    return out.finish(compress);
+}
+
+/* decode a value from the start of `data`. string_views (and bytes_views)
+   can't outlive a compressed `data`'s temporary reader, use a reader for
+   those */
+template <class T>
+T
+decode(std::string_view data, layout structs = layout::hash) {
+    reader in(data, structs);
+    return in.decode<T>();
+}
+
+
+/*
+ * codecs
+ */
+
+template <>
+struct codec<bool> {
+    static void encode(writer &out, bool value) { out.write_bool(value); }
+    static bool decode(reader &in) { return in.read_bool(); }
+};
+
+template <class T>
+struct codec<T, std::enable_if_t<
+        std::is_integral_v<T> && !std::is_same_v<T, bool>>> {
+    static void encode(writer &out, T value) { out.write_int(value); }
+    static T decode(reader &in) { return in.read_int<T>(); }
+};
+
+template <class T>
+struct codec<T, std::enable_if_t<std::is_floating_point_v<T>>> {
+    static void encode(writer &out, T value) { out.write_float(value); }
+    static T decode(reader &in) { return T(in.read_float()); }
+};
+
+template <>
+struct codec<std::nullptr_t> {
+    static void encode(writer &out, std::nullptr_t) { out.write_null(); }
+    static std::nullptr_t decode(reader &in) {
+        in.read_null();
+        return nullptr;
+    }
+};
+
+template <>
+struct codec<std::string> {
+    static void encode(writer &out, const std::string &value) {
+        out.write_utf8(value);
+    }
+    static std::string decode(reader &in) {
+        return std::string(in.read_string());
+    }
+};
+
+template <>
+struct codec<std::string_view> {
+    static void encode(writer &out, std::string_view value) {
+        out.write_utf8(value);
+    }
+    static std::string_view decode(reader &in) { return in.read_string(); }
+};
+
+template <std::size_t N>
+struct codec<char[N]> {
+    static void encode(writer &out, const char (&value)[N]) {
+        out.write_utf8(value);
+    }
+};
+
+template <>
+struct codec<const char *> {
+    static void encode(writer &out, const char *value) {
+        out.write_utf8(value);
+    }
+};
+
+template <>
+struct codec<bytes_view> {
+    static void encode(writer &out, bytes_view value) {
+        out.write_bytes(value.data);
+    }
+    static bytes_view decode(reader &in) { return {in.read_string()}; }
+};
+
+template <class T, class A>
+struct codec<std::vector<T, A>> {
+    static void encode(writer &out, const std::vector<T, A> &value) {
+        if (value.size() > std::numeric_limits<std::uint32_t>::max())
+            throw error("too many items for a mummy list");
+        out.open_list(std::uint32_t(value.size()));
+        for (const auto &item : value) codec<T>::encode(out, item);
+    }
+
+    static std::vector<T, A> decode(reader &in) {
+        std::vector<T, A> result;
+        std::uint32_t count = in.read_sequence();
+        result.reserve(count);
+        while (count--) result.push_back(codec<T>::decode(in));
+        return result;
+    }
+};
+
+namespace detail {
+
+template <class Map>
+struct map_codec {
+    using K = typename Map::key_type;
+    using V = typename Map::mapped_type;
+
+    static void encode(writer &out, const Map &value) {
+        if (value.size() > std::numeric_limits<std::uint32_t>::max() / 2)
+            throw error("too many items for a mummy hash");
+        if (out.struct_layout() == layout::message)
+            out.open_list(std::uint32_t(value.size()) * 2);
+        else
+            out.open_hash(std::uint32_t(value.size()));
+        for (const auto &pair : value) {
+            codec<K>::encode(out, pair.first);
+            codec<V>::encode(out, pair.second);
+        }
+    }
+
+    static Map decode(reader &in) {
+        Map result;
+        std::uint32_t count;
+        if (in.struct_layout() == layout::message) {
+            count = in.read_sequence();
+            if (count % 2) throw error("odd length for a mummy message map");
+            count /= 2;
+        } else {
+            count = in.read_hash();
+        }
+        while (count--) {
+            K key = codec<K>::decode(in);
+            result.insert_or_assign(std::move(key), codec<V>::decode(in));
+        }
+        return result;
+    }
+};
+
+} // namespace detail
+
+template <class K, class V, class C, class A>
+struct codec<std::map<K, V, C, A>>
+    : detail::map_codec<std::map<K, V, C, A>> {};
+
+template <class K, class V, class H, class E, class A>
+struct codec<std::unordered_map<K, V, H, E, A>>
+    : detail::map_codec<std::unordered_map<K, V, H, E, A>> {};
+
+template <class T>
+struct codec<std::optional<T>> {
+    static void encode(writer &out, const std::optional<T> &value) {
+        if (value) codec<T>::encode(out, *value);
+        else out.write_null();
+    }
+
+    static std::optional<T> decode(reader &in) {
+        if (in.peek() == MUMMY_TYPE_NULL) {
+            in.read_null();
+            return std::nullopt;
+        }
+        return codec<T>::decode(in);
+    }
+};
+
+/* a python timedelta: days, then seconds and microseconds that are never
+   negative */
+template <class R, class P>
+struct codec<std::chrono::duration<R, P>> {
+    using duration = std::chrono::duration<R, P>;
+
+    static void encode(writer &out, const duration &value) {
+        const std::int64_t us = std::chrono::duration_cast<
+            std::chrono::microseconds>(value).count();
+        const std::int64_t days = detail::floor_div(us, detail::US_PER_DAY);
+        const std::int64_t rest = us - days * detail::US_PER_DAY;
+
+        if (!detail::fits<std::int32_t>(days))
+            throw error("duration too long for a mummy timedelta");
+        out.write_timedelta(int(days), int(rest / detail::US_PER_SECOND),
+                int(rest % detail::US_PER_SECOND));
+    }
+
+    static duration decode(reader &in) {
+        return std::chrono::duration_cast<duration>(
+                std::chrono::microseconds(in.read_timedelta()));
+    }
+};
+
+/* a naive python datetime, in UTC */
+template <class D>
+struct codec<std::chrono::time_point<std::chrono::system_clock, D>> {
+    using time_point = std::chrono::time_point<std::chrono::system_clock, D>;
+
+    static void encode(writer &out, const time_point &value) {
+        const std::int64_t us = std::chrono::duration_cast<
+            std::chrono::microseconds>(value.time_since_epoch()).count();
+        const std::int64_t days = detail::floor_div(us, detail::US_PER_DAY);
+        std::int64_t rest = us - days * detail::US_PER_DAY;
+        std::int64_t year;
+        unsigned month, day;
+
+        detail::civil_from_days(days, year, month, day);
+        if (year < 1 || year > 9999)
+            throw error("time point out of range for a mummy datetime");
+
+        const int microsecond = int(rest % detail::US_PER_SECOND);
+        rest /= detail::US_PER_SECOND;
+        out.write_datetime(int(year), int(month), int(day), int(rest / 3600),
+                int(rest / 60 % 60), int(rest % 60), microsecond);
+    }
+
+    static time_point decode(reader &in) {
+        return time_point(std::chrono::duration_cast<D>(
+                std::chrono::microseconds(in.read_datetime())));
+    }
+};
+
+
+/*
+ * MUMMY_STRUCT
+ *
+ * at namespace scope next to a plain struct, with the fields to write:
+ *
+ *     struct user {
+ *         std::int64_t id;
+ *         std::string name;
+ *         std::optional<std::string> email;
+ *     };
+ *     MUMMY_STRUCT(user, id, name, email)
+ *
+ * gives the struct a codec, with everything about its fields (names, types,
+ * and the order they go in for layout::message) worked out at compile time.
+ * empty std::optional fields are left out of a hash. reading a hash takes
+ * the keys in whatever order they come, but checks the order they're written
+ * in first, fields missing from it are left value-initialized and unknown
+ * keys are skipped. up to 32 fields.
+ */
+
+namespace detail {
+
+template <class M>
+struct field_desc {
+    std::string_view name;
+    M member;
+};
+
+template <class M>
+field_desc(const char *, M) -> field_desc<M>;
+
+template <class T>
+struct is_optional : std::false_type {};
+
+template <class T>
+struct is_optional<std::optional<T>> : std::true_type {};
+
+template <class T>
+using fields_of = decltype(mummy_fields(static_cast<const T *>(nullptr)));
+
+template <class T>
+struct struct_codec {
+    static constexpr auto fields =
+        mummy_fields(static_cast<const T *>(nullptr));
+    static constexpr std::size_t size =
+        std::tuple_size_v<std::remove_const_t<decltype(fields)>>;
+
+    template <std::size_t I>
+    using member_t = std::remove_cv_t<std::remove_reference_t<decltype(
+            std::declval<T &>().*(std::get<I>(fields).member))>>;
+
+    template <std::size_t... I>
+    static constexpr std::array<std::string_view, size>
+    field_names(std::index_sequence<I...>) {
+        return {{std::get<I>(fields).name...}};
+    }
+
+    template <std::size_t... I>
+    static constexpr std::array<bool, size>
+    field_optional(std::index_sequence<I...>) {
+        return {{is_optional<member_t<I>>::value...}};
+    }
+
+    static constexpr auto names =
+        field_names(std::make_index_sequence<size>());
+    static constexpr auto optional =
+        field_optional(std::make_index_sequence<size>());
+
+    /* layout::message: required fields by name, then optional ones */
+    static constexpr std::array<std::size_t, size>
+    message_order() {
+        std::array<std::size_t, size> order{};
+        for (std::size_t i = 0; i < size; ++i) {
+            std::size_t j = i;
+            for (; j && (optional[order[j - 1]] > optional[i] ||
+                        (optional[order[j - 1]] == optional[i] &&
+                         names[order[j - 1]] > names[i])); --j)
+                order[j] = order[j - 1];
+            order[j] = i;
+        }
+        return order;
+    }
+
+    static constexpr auto order = message_order();
+
+    static constexpr std::size_t
+    required() {
+        std::size_t count = 0;
+        for (bool opt : optional) count += !opt;
+        return count;
+    }
+
+    template <std::size_t I>
+    static bool
+    present(const T &value) {
+        if constexpr (is_optional<member_t<I>>::value)
+            return value.*(std::get<I>(fields).member) != std::nullopt;
+        else
+            return true;
+    }
+
+    template <std::size_t I>
+    static void
+    encode_field(writer &out, const T &value) {
+        codec<member_t<I>>::encode(out, value.*(std::get<I>(fields).member));
+    }
+
+    template <std::size_t I>
+    static void
+    decode_field(reader &in, T &value) {
+        value.*(std::get<I>(fields).member) = codec<member_t<I>>::decode(in);
+    }
+
+    template <std::size_t... I>
+    static void
+    encode_hash(writer &out, const T &value, std::index_sequence<I...>) {
+        out.open_hash((std::uint32_t(present<I>(value)) + ... + 0));
+        ((present<I>(value) ?
+          (out.write_utf8(names[I]), encode_field<I>(out, value)) :
+          void()), ...);
+    }
+
+    template <std::size_t... I>
+    static void
+    encode_message(writer &out, const T &value, std::index_sequence<I...>) {
+        out.open_list(std::uint32_t(size));
+        (encode_field<order[I]>(out, value), ...);
+    }
+
+    template <std::size_t... I>
+    static void
+    decode_at(reader &in, T &value, std::size_t index,
+            std::index_sequence<I...>) {
+        ((index == I && (decode_field<I>(in, value), true)) || ...);
+    }
+
+    /* the field named `key`, looking from `hint` on first, or size */
+    static std::size_t
+    find(std::string_view key, std::size_t hint) noexcept {
+        for (std::size_t i = hint; i < size; ++i)
+            if (names[i] == key) return i;
+        for (std::size_t i = 0; i < hint && i < size; ++i)
+            if (names[i] == key) return i;
+        return size;
+    }
+
+    static void
+    decode_hash(reader &in, T &value) {
+        std::uint32_t count = in.read_hash();
+        std::size_t next = 0;
+        while (count--) {
+            std::size_t index = find(in.read_string(), next);
+            if (index == size) {
+                in.skip();
+                continue;
+            }
+            decode_at(in, value, index, std::make_index_sequence<size>());
+            next = index + 1;
+        }
+    }
+
+    template <std::size_t... I>
+    static void
+    decode_message(reader &in, T &value, std::index_sequence<I...>) {
+        std::uint32_t count = in.read_sequence();
+        if (count < required())
+            throw error("mummy message too short for the struct");
+
+        std::uint32_t seen = 0;
+        ((seen++ < count ? decode_field<order[I]>(in, value) : void()), ...);
+
+        /* wildcard keys and values a python schema might have left */
+        while (count-- > size) in.skip();
+    }
+
+    static void
+    encode(writer &out, const T &value) {
+        if (out.struct_layout() == layout::message)
+            encode_message(out, value, std::make_index_sequence<size>());
+        else
+            encode_hash(out, value, std::make_index_sequence<size>());
+    }
+
+    static T
+    decode(reader &in) {
+        T value{};
+        if (in.struct_layout() == layout::message)
+            decode_message(in, value, std::make_index_sequence<size>());
+        else
+            decode_hash(in, value);
+        return value;
+    }
+};
+
+} // namespace detail
+
+template <class T>
+struct codec<T, std::void_t<detail::fields_of<T>>>
+    : detail::struct_codec<T> {};
+
+} // namespace mummy
+
+
+#define MUMMY_STRUCT(Type, ...)                                             \
+    [[maybe_unused]] constexpr auto                                         \
+    mummy_fields(const Type *) {                                            \
+        return std::make_tuple(MUMMY_DETAIL_FIELDS(Type, __VA_ARGS__));    \
+    }
+
+#define MUMMY_DETAIL_EXPAND(x) x
+#define MUMMY_DETAIL_FIELD(Type, name) \
+    ::mummy::detail::field_desc{#name, &Type::name}
+#define MUMMY_DETAIL_FIELDS_1(Type, a) MUMMY_DETAIL_FIELD(Type, a)
+#define MUMMY_DETAIL_FIELDS_2(Type, a, ...) MUMMY_DETAIL_FIELD(Type, a), \
+    MUMMY_DETAIL_EXPAND(MUMMY_DETAIL_FIELDS_1(Type, __VA_ARGS__))
+#define MUMMY_DETAIL_FIELDS_3(Type, a, ...) MUMMY_DETAIL_FIELD(Type, a), \
+    MUMMY_DETAIL_EXPAND(MUMMY_DETAIL_FIELDS_2(Type, __VA_ARGS__))
+#define MUMMY_DETAIL_FIELDS_4(Type, a, ...) MUMMY_DETAIL_FIELD(Type, a), \
+    MUMMY_DETAIL_EXPAND(MUMMY_DETAIL_FIELDS_3(Type, __VA_ARGS__))
+#define MUMMY_DETAIL_FIELDS_5(Type, a, ...) MUMMY_DETAIL_FIELD(Type, a), \
+    MUMMY_DETAIL_EXPAND(MUMMY_DETAIL_FIELDS_4(Type, __VA_ARGS__))
+#define MUMMY_DETAIL_FIELDS_6(Type, a, ...) MUMMY_DETAIL_FIELD(Type, a), \
+    MUMMY_DETAIL_EXPAND(MUMMY_DETAIL_FIELDS_5(Type, __VA_ARGS__))
+#define MUMMY_DETAIL_FIELDS_7(Type, a, ...) MUMMY_DETAIL_FIELD(Type, a), \
+    MUMMY_DETAIL_EXPAND(MUMMY_DETAIL_FIELDS_6(Type, __VA_ARGS__))
+#define MUMMY_DETAIL_FIELDS_8(Type, a, ...) MUMMY_DETAIL_FIELD(Type, a), \
+    MUMMY_DETAIL_EXPAND(MUMMY_DETAIL_FIELDS_7(Type, __VA_ARGS__))
+#define MUMMY_DETAIL_FIELDS_9(Type, a, ...) MUMMY_DETAIL_FIELD(Type, a), \
+    MUMMY_DETAIL_EXPAND(MUMMY_DETAIL_FIELDS_8(Type, __VA_ARGS__))
+#define MUMMY_DETAIL_FIELDS_10(Type, a, ...) MUMMY_DETAIL_FIELD(Type, a), \
+    MUMMY_DETAIL_EXPAND(MUMMY_DETAIL_FIELDS_9(Type, __VA_ARGS__))
+#define MUMMY_DETAIL_FIELDS_11(Type, a, ...) MUMMY_DETAIL_FIELD(Type, a), \
+    MUMMY_DETAIL_EXPAND(MUMMY_DETAIL_FIELDS_10(Type, __VA_ARGS__))
+#define MUMMY_DETAIL_FIELDS_12(Type, a, ...) MUMMY_DETAIL_FIELD(Type, a), \
+    MUMMY_DETAIL_EXPAND(MUMMY_DETAIL_FIELDS_11(Type, __VA_ARGS__))
+#define MUMMY_DETAIL_FIELDS_13(Type, a, ...) MUMMY_DETAIL_FIELD(Type, a), \
+    MUMMY_DETAIL_EXPAND(MUMMY_DETAIL_FIELDS_12(Type, __VA_ARGS__))
+#define MUMMY_DETAIL_FIELDS_14(Type, a, ...) MUMMY_DETAIL_FIELD(Type, a), \
+    MUMMY_DETAIL_EXPAND(MUMMY_DETAIL_FIELDS_13(Type, __VA_ARGS__))
+#define MUMMY_DETAIL_FIELDS_15(Type, a, ...) MUMMY_DETAIL_FIELD(Type, a), \
+    MUMMY_DETAIL_EXPAND(MUMMY_DETAIL_FIELDS_14(Type, __VA_ARGS__))
+#define MUMMY_DETAIL_FIELDS_16(Type, a, ...) MUMMY_DETAIL_FIELD(Type, a), \
+    MUMMY_DETAIL_EXPAND(MUMMY_DETAIL_FIELDS_15(Type, __VA_ARGS__))
+#define MUMMY_DETAIL_FIELDS_17(Type, a, ...) MUMMY_DETAIL_FIELD(Type, a), \
+    MUMMY_DETAIL_EXPAND(MUMMY_DETAIL_FIELDS_16(Type, __VA_ARGS__))
+#define MUMMY_DETAIL_FIELDS_18(Type, a, ...) MUMMY_DETAIL_FIELD(Type, a), \
+    MUMMY_DETAIL_EXPAND(MUMMY_DETAIL_FIELDS_17(Type, __VA_ARGS__))
+#define MUMMY_DETAIL_FIELDS_19(Type, a, ...) MUMMY_DETAIL_FIELD(Type, a), \
+    MUMMY_DETAIL_EXPAND(MUMMY_DETAIL_FIELDS_18(Type, __VA_ARGS__))
+#define MUMMY_DETAIL_FIELDS_20(Type, a, ...) MUMMY_DETAIL_FIELD(Type, a), \
+    MUMMY_DETAIL_EXPAND(MUMMY_DETAIL_FIELDS_19(Type, __VA_ARGS__))
+#define MUMMY_DETAIL_FIELDS_21(Type, a, ...) MUMMY_DETAIL_FIELD(Type, a), \
+    MUMMY_DETAIL_EXPAND(MUMMY_DETAIL_FIELDS_20(Type, __VA_ARGS__))
+#define MUMMY_DETAIL_FIELDS_22(Type, a, ...) MUMMY_DETAIL_FIELD(Type, a), \
+    MUMMY_DETAIL_EXPAND(MUMMY_DETAIL_FIELDS_21(Type, __VA_ARGS__))
+#define MUMMY_DETAIL_FIELDS_23(Type, a, ...) MUMMY_DETAIL_FIELD(Type, a), \
+    MUMMY_DETAIL_EXPAND(MUMMY_DETAIL_FIELDS_22(Type, __VA_ARGS__))
+#define MUMMY_DETAIL_FIELDS_24(Type, a, ...) MUMMY_DETAIL_FIELD(Type, a), \
+    MUMMY_DETAIL_EXPAND(MUMMY_DETAIL_FIELDS_23(Type, __VA_ARGS__))
+#define MUMMY_DETAIL_FIELDS_25(Type, a, ...) MUMMY_DETAIL_FIELD(Type, a), \
+    MUMMY_DETAIL_EXPAND(MUMMY_DETAIL_FIELDS_24(Type, __VA_ARGS__))
+#define MUMMY_DETAIL_FIELDS_26(Type, a, ...) MUMMY_DETAIL_FIELD(Type, a), \
+    MUMMY_DETAIL_EXPAND(MUMMY_DETAIL_FIELDS_25(Type, __VA_ARGS__))
+#define MUMMY_DETAIL_FIELDS_27(Type, a, ...) MUMMY_DETAIL_FIELD(Type, a), \
+    MUMMY_DETAIL_EXPAND(MUMMY_DETAIL_FIELDS_26(Type, __VA_ARGS__))
+#define MUMMY_DETAIL_FIELDS_28(Type, a, ...) MUMMY_DETAIL_FIELD(Type, a), \
+    MUMMY_DETAIL_EXPAND(MUMMY_DETAIL_FIELDS_27(Type, __VA_ARGS__))
+#define MUMMY_DETAIL_FIELDS_29(Type, a, ...) MUMMY_DETAIL_FIELD(Type, a), \
+    MUMMY_DETAIL_EXPAND(MUMMY_DETAIL_FIELDS_28(Type, __VA_ARGS__))
+#define MUMMY_DETAIL_FIELDS_30(Type, a, ...) MUMMY_DETAIL_FIELD(Type, a), \
+    MUMMY_DETAIL_EXPAND(MUMMY_DETAIL_FIELDS_29(Type, __VA_ARGS__))
+#define MUMMY_DETAIL_FIELDS_31(Type, a, ...) MUMMY_DETAIL_FIELD(Type, a), \
+    MUMMY_DETAIL_EXPAND(MUMMY_DETAIL_FIELDS_30(Type, __VA_ARGS__))
+#define MUMMY_DETAIL_FIELDS_32(Type, a, ...) MUMMY_DETAIL_FIELD(Type, a), \
+    MUMMY_DETAIL_EXPAND(MUMMY_DETAIL_FIELDS_31(Type, __VA_ARGS__))
+#define MUMMY_DETAIL_PICK( \
+        _1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, \
+        _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, \
+        _31, _32, name, ...) name
+#define MUMMY_DETAIL_FIELDS(Type, ...) \
+    MUMMY_DETAIL_EXPAND(MUMMY_DETAIL_PICK(__VA_ARGS__, \
+        MUMMY_DETAIL_FIELDS_32, MUMMY_DETAIL_FIELDS_31, \
+        MUMMY_DETAIL_FIELDS_30, MUMMY_DETAIL_FIELDS_29, \
+        MUMMY_DETAIL_FIELDS_28, MUMMY_DETAIL_FIELDS_27, \
+        MUMMY_DETAIL_FIELDS_26, MUMMY_DETAIL_FIELDS_25, \
+        MUMMY_DETAIL_FIELDS_24, MUMMY_DETAIL_FIELDS_23, \
+        MUMMY_DETAIL_FIELDS_22, MUMMY_DETAIL_FIELDS_21, \
+        MUMMY_DETAIL_FIELDS_20, MUMMY_DETAIL_FIELDS_19, \
+        MUMMY_DETAIL_FIELDS_18, MUMMY_DETAIL_FIELDS_17, \
+        MUMMY_DETAIL_FIELDS_16, MUMMY_DETAIL_FIELDS_15, \
+        MUMMY_DETAIL_FIELDS_14, MUMMY_DETAIL_FIELDS_13, \
+        MUMMY_DETAIL_FIELDS_12, MUMMY_DETAIL_FIELDS_11, \
+        MUMMY_DETAIL_FIELDS_10, MUMMY_DETAIL_FIELDS_9, MUMMY_DETAIL_FIELDS_8, \
+        MUMMY_DETAIL_FIELDS_7, MUMMY_DETAIL_FIELDS_6, MUMMY_DETAIL_FIELDS_5, \
+        MUMMY_DETAIL_FIELDS_4, MUMMY_DETAIL_FIELDS_3, MUMMY_DETAIL_FIELDS_2, \
+        MUMMY_DETAIL_FIELDS_1) \
+        (Type, __VA_ARGS__))
+
+#endif /* _MUMMY_HPP */
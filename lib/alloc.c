@@ -0,0 +1,118 @@
+#include <string.h>
+
+#include "mummy.h"
+#include "alloc.h"
+
+#ifdef MUMMY_TRACK_ALLOC
+
+#if defined(__APPLE__)
+    #include <malloc/malloc.h>
+    #define usable_size(ptr) malloc_size(ptr)
+#elif defined(__FreeBSD__)
+    #include <malloc_np.h>
+    #define usable_size(ptr) malloc_usable_size(ptr)
+#else
+    #include <malloc.h>
+    #define usable_size(ptr) malloc_usable_size(ptr)
+#endif
+
+static MUMMY_THREAD_LOCAL mummy_alloc_stats *tracking = NULL;
+
+/* `ptr` was just allocated, in place of `old` bytes */
+static void
+count_alloc(void *ptr, size_t old) {
+    mummy_alloc_stats *stats = tracking;
+    size_t size;
+
+    if (!stats || !ptr) return;
+    size = usable_size(ptr);
+    ++stats->allocs;
+    stats->bytes += size;
+    stats->live += (int64_t)size - (int64_t)old;
+    if (stats->live > stats->peak) stats->peak = stats->live;
+}
+
+int
+mummy_alloc_tracking(void) {
+    return 1;
+}
+
+mummy_alloc_stats *
+mummy_alloc_track(mummy_alloc_stats *stats) {
+    mummy_alloc_stats *previous = tracking;
+
+    tracking = stats;
+    return previous;
+}
+
+/* the parenthesized names get past alloc.h's macros to the real thing */
+
+void *
+mummy_alloc_malloc(size_t size) {
+    void *ptr = (malloc)(size);
+
+    count_alloc(ptr, 0);
+    return ptr;
+}
+
+void *
+mummy_alloc_calloc(size_t count, size_t size) {
+    void *ptr = (calloc)(count, size);
+
+    count_alloc(ptr, 0);
+    return ptr;
+}
+
+void *
+mummy_alloc_realloc(void *ptr, size_t size) {
+    size_t old = (ptr && tracking) ? usable_size(ptr) : 0;
+    void *result = (realloc)(ptr, size);
+
+    count_alloc(result, old);
+    return result;
+}
+
+void
+mummy_alloc_free(void *ptr) {
+    mummy_alloc_stats *stats = tracking;
+
+    if (stats && ptr) {
+        ++stats->frees;
+        stats->live -= usable_size(ptr);
+    }
+    (free)(ptr);
+}
+
+#else /* MUMMY_TRACK_ALLOC */
+
+int
+mummy_alloc_tracking(void) {
+    return 0;
+}
+
+mummy_alloc_stats *
+mummy_alloc_track(mummy_alloc_stats *stats) {
+    return NULL;
+}
+
+void *
+mummy_alloc_malloc(size_t size) {
+    return malloc(size);
+}
+
+void *
+mummy_alloc_calloc(size_t count, size_t size) {
+    return calloc(count, size);
+}
+
+void *
+mummy_alloc_realloc(void *ptr, size_t size) {
+    return realloc(ptr, size);
+}
+
+void
+mummy_alloc_free(void *ptr) {
+    free(ptr);
+}
+
+#endif /* MUMMY_TRACK_ALLOC */
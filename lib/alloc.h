@@ -0,0 +1,26 @@
+#ifndef _MUMMY_ALLOC_H
+#define _MUMMY_ALLOC_H
+
+/* only a pointer is ever thread-local, which fits in the static TLS block
+   even for a dlopen()ed python extension, so initial-exec is safe and
+   reading it doesn't cost a call into the dynamic linker */
+#if defined(__GNUC__)
+    #define MUMMY_THREAD_LOCAL __thread __attribute__((tls_model("initial-exec")))
+#else
+    #define MUMMY_THREAD_LOCAL _Thread_local
+#endif
+
+/*
+ * in an allocation tracking build (MUMMY_TRACK_ALLOC defined) this sends
+ * malloc, calloc, realloc and free through mummy_alloc_*, so that whatever
+ * includes it is counted by mummy_alloc_track. it has to come after every
+ * header that declares them, and (malloc)(n) still reaches the real one.
+ */
+#ifdef MUMMY_TRACK_ALLOC
+    #define malloc(size) mummy_alloc_malloc(size)
+    #define calloc(count, size) mummy_alloc_calloc(count, size)
+    #define realloc(ptr, size) mummy_alloc_realloc(ptr, size)
+    #define free(ptr) mummy_alloc_free(ptr)
+#endif
+
+#endif /* _MUMMY_ALLOC_H */
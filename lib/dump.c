@@ -4,15 +4,17 @@
 
 #include "lzf.h"
 #include "mummy.h"
+#include "unaligned.h"
+#include "alloc.h"
 
-inline int
+int
 mummy_feed_null(mummy_string *str) {
     mummy_string_makespace(str, 1);
     str->data[str->offset++] = MUMMY_TYPE_NULL;
     return 0;
 }
 
-inline int
+int
 mummy_feed_bool(mummy_string *str, char b) {
     mummy_string_makespace(str, 2);
     str->data[str->offset++] = MUMMY_TYPE_BOOL;
@@ -20,7 +22,7 @@ mummy_feed_bool(mummy_string *str, char b) {
     return 0;
 }
 
-inline int
+int
 mummy_feed_int(mummy_string *str, int64_t num) {
     if (-128 <= num && num < 128) {
         mummy_string_makespace(str, 2);
@@ -29,43 +31,46 @@ mummy_feed_int(mummy_string *str, int64_t num) {
     } else if (-32768 <= num && num < 32768) {
         mummy_string_makespace(str, 3);
         str->data[str->offset++] = MUMMY_TYPE_SHORT;
-        *((int16_t *)(str->data + str->offset)) = htons((int16_t)num);
+        mummy_pack16(str->data + str->offset, (int16_t)num);
         str->offset += 2;
     } else if (-2147483648LL <= num && num < 2147483648LL) {
         mummy_string_makespace(str, 5);
         str->data[str->offset++] = MUMMY_TYPE_INT;
-        *((int32_t *)(str->data + str->offset)) = htonl((int32_t)num);
+        mummy_pack32(str->data + str->offset, (int32_t)num);
         str->offset += 4;
     } else {
         mummy_string_makespace(str, 9);
         str->data[str->offset++] = MUMMY_TYPE_LONG;
-        *((int64_t *)(str->data + str->offset)) = htonll((int64_t)num);
+        mummy_pack64(str->data + str->offset, (int64_t)num);
         str->offset += 8;
     }
     return 0;
 }
 
-inline int
+int
 mummy_feed_huge(mummy_string *str, char *data, int len) {
     mummy_string_makespace(str, len + 5);
     str->data[str->offset++] = MUMMY_TYPE_HUGE;
-    *(uint32_t *)(str->data + str->offset) = htonl(len);
+    mummy_pack32(str->data + str->offset, len);
     str->offset += 4;
     memcpy(str->data + str->offset, data, len);
     str->offset += len;
     return 0;
 }
 
-inline int
+int
 mummy_feed_float(mummy_string *str, double num) {
+    uint64_t bits;
+
+    memcpy(&bits, &num, 8);
     mummy_string_makespace(str, 9);
     str->data[str->offset++] = MUMMY_TYPE_FLOAT;
-    *(uint64_t *)(str->data + str->offset) = htonll(*(uint64_t *)(&num));
+    mummy_pack64(str->data + str->offset, bits);
     str->offset += 8;
     return 0;
 }
 
-inline int
+int
 mummy_feed_string(mummy_string *str, char *data, int len) {
     if (len < 256) {
         mummy_string_makespace(str, 2 + len);
@@ -75,12 +80,12 @@ mummy_feed_string(mummy_string *str, char *data, int len) {
     } else if (len < 65536) {
         mummy_string_makespace(str, 3 + len);
         str->data[str->offset++] = MUMMY_TYPE_MEDSTR;
-        *(uint16_t *)(str->data + str->offset) = htons((uint16_t)len);
+        mummy_pack16(str->data + str->offset, (uint16_t)len);
         str->offset += 2;
     } else {
         mummy_string_makespace(str, 5 + len);
         str->data[str->offset++] = MUMMY_TYPE_LONGSTR;
-        *(uint32_t *)(str->data + str->offset) = htonl((uint32_t)len);
+        mummy_pack32(str->data + str->offset, (uint32_t)len);
         str->offset += 4;
     }
     memcpy(str->data + str->offset, data, len);
@@ -88,7 +93,7 @@ mummy_feed_string(mummy_string *str, char *data, int len) {
     return 0;
 }
 
-inline int
+int
 mummy_feed_utf8(mummy_string *str, char *data, int len) {
     if (len < 256) {
         mummy_string_makespace(str, 2 + len);
@@ -98,12 +103,12 @@ mummy_feed_utf8(mummy_string *str, char *data, int len) {
     } else if (len < 65536) {
         mummy_string_makespace(str, 3 + len);
         str->data[str->offset++] = MUMMY_TYPE_MEDUTF8;
-        *(uint16_t *)(str->data + str->offset) = htons((uint16_t)len);
+        mummy_pack16(str->data + str->offset, (uint16_t)len);
         str->offset += 2;
     } else {
         mummy_string_makespace(str, 5 + len);
         str->data[str->offset++] = MUMMY_TYPE_LONGUTF8;
-        *(uint32_t *)(str->data + str->offset) = htonl((uint32_t)len);
+        mummy_pack32(str->data + str->offset, (uint32_t)len);
         str->offset += 4;
     }
     memcpy(str->data + str->offset, data, len);
@@ -117,7 +122,7 @@ mummy_feed_utf8(mummy_string *str, char *data, int len) {
  * - unsigned short of number of digits
  * - digits (nums 0-9) paired up in bytes, low 4 bits then high 4
  */
-inline int
+int
 mummy_feed_decimal(
         mummy_string *str, char is_neg, int16_t exponent, uint16_t count, char *digits) {
     int i;
@@ -127,15 +132,15 @@ mummy_feed_decimal(
 
     str->data[str->offset++] = MUMMY_TYPE_DECIMAL;
     str->data[str->offset++] = is_neg ? 1 : 0;
-    *(int16_t *)(str->data + str->offset) = htons(exponent);
+    mummy_pack16(str->data + str->offset, exponent);
     str->offset += 2;
-    *(uint16_t *)(str->data + str->offset) = htons(count);
+    mummy_pack16(str->data + str->offset, count);
     str->offset += 2;
 
     for (i = 0; i < count; ++i) {
         digit = digits[i];
         if (digit < 0 || digit > 9) {
-            str -> offset -= 5;
+            str->offset -= 6;
             return EINVAL;
         }
         if (i & 1)
@@ -159,9 +164,9 @@ mummy_va_feed_decimal(
 
     str->data[str->offset++] = MUMMY_TYPE_DECIMAL;
     str->data[str->offset++] = is_neg ? 2 : 0;
-    *(uint16_t *)(str->data + str->offset) = htons(exponent);
+    mummy_pack16(str->data + str->offset, exponent);
     str->offset += 2;
-    *(uint16_t *)(str->data + str->offset) = htons(count);
+    mummy_pack16(str->data + str->offset, count);
     str->offset += 2;
 
     va_start(arglist, count);
@@ -181,7 +186,7 @@ mummy_va_feed_decimal(
 }
 */
 
-inline int
+int
 mummy_feed_infinity(mummy_string *str, char is_neg) {
     mummy_string_makespace(str, 2);
     str->data[str->offset++] = MUMMY_TYPE_SPECIALNUM;
@@ -189,7 +194,7 @@ mummy_feed_infinity(mummy_string *str, char is_neg) {
     return 0;
 }
 
-inline int
+int
 mummy_feed_nan(mummy_string *str, char is_snan) {
     mummy_string_makespace(str, 2);
     str->data[str->offset++] = MUMMY_TYPE_SPECIALNUM;
@@ -197,29 +202,29 @@ mummy_feed_nan(mummy_string *str, char is_snan) {
     return 0;
 }
 
-inline int
+int
 mummy_feed_fraction(mummy_string *str, int64_t numerator, int64_t denominator) {
     mummy_string_makespace(str, 17);
     str->data[str->offset++] = MUMMY_TYPE_FRACTION;
-    *((int64_t *)(str->data + str->offset)) = htonll(numerator);
+    mummy_pack64(str->data + str->offset, numerator);
     str->offset += 8;
-    *((int64_t *)(str->data + str->offset)) = htonll(denominator);
+    mummy_pack64(str->data + str->offset, denominator);
     str->offset += 8;
     return 0;
 }
 
-inline int
+int
 mummy_feed_date(mummy_string *str, unsigned short year, char month, char day) {
     mummy_string_makespace(str, 5);
     str->data[str->offset++] = MUMMY_TYPE_DATE;
-    *(uint16_t *)(str->data + str->offset) = htons(year);
+    mummy_pack16(str->data + str->offset, year);
     str->offset += 2;
     str->data[str->offset++] = month;
     str->data[str->offset++] = day;
     return 0;
 }
 
-inline int
+int
 mummy_feed_time(mummy_string *str, char hour, char minute, char second,
         int microsecond) {
     mummy_string_makespace(str, 8);
@@ -227,43 +232,45 @@ mummy_feed_time(mummy_string *str, char hour, char minute, char second,
     str->data[str->offset++] = hour;
     str->data[str->offset++] = minute;
     str->data[str->offset++] = second;
-    *(uint32_t *)(str->data + str->offset) = htonl(microsecond);
-    str->offset += 3;
+    str->data[str->offset++] = (microsecond >> 16) & 0xff;
+    str->data[str->offset++] = (microsecond >> 8) & 0xff;
+    str->data[str->offset++] = microsecond & 0xff;
     return 0;
 }
 
-inline int
+int
 mummy_feed_datetime(mummy_string *str, short year, char month, char day,
         char hour, char minute, char second, int microsecond) {
     mummy_string_makespace(str, 11);
     str->data[str->offset++] = MUMMY_TYPE_DATETIME;
-    *(uint16_t *)(str->data + str->offset) = htons(year);
+    mummy_pack16(str->data + str->offset, year);
     str->offset += 2;
     str->data[str->offset++] = month;
     str->data[str->offset++] = day;
     str->data[str->offset++] = hour;
     str->data[str->offset++] = minute;
     str->data[str->offset++] = second;
-    *(uint32_t *)(str->data + str->offset) = htonl(microsecond);
-    str->offset += 3;
+    str->data[str->offset++] = (microsecond >> 16) & 0xff;
+    str->data[str->offset++] = (microsecond >> 8) & 0xff;
+    str->data[str->offset++] = microsecond & 0xff;
     return 0;
 }
 
-inline int
+int
 mummy_feed_timedelta(mummy_string *str, int days, int seconds,
         int microseconds) {
     mummy_string_makespace(str, 13);
     str->data[str->offset++] = MUMMY_TYPE_TIMEDELTA;
-    *(int32_t *)(str->data + str->offset) = htonl(days);
+    mummy_pack32(str->data + str->offset, days);
     str->offset += 4;
-    *(int32_t *)(str->data + str->offset) = htonl(seconds);
+    mummy_pack32(str->data + str->offset, seconds);
     str->offset += 4;
-    *(int32_t *)(str->data + str->offset) = htonl(microseconds);
+    mummy_pack32(str->data + str->offset, microseconds);
     str->offset += 4;
     return 0;
 }
 
-inline int
+int
 mummy_open_list(mummy_string *str, int len) {
     if (len < 256) {
         mummy_string_makespace(str, 2);
@@ -273,18 +280,18 @@ mummy_open_list(mummy_string *str, int len) {
     } else if (len < 65536) {
         mummy_string_makespace(str, 3);
         str->data[str->offset++] = MUMMY_TYPE_MEDLIST;
-        *(uint16_t *)(str->data + str->offset) = htons((uint16_t)len);
+        mummy_pack16(str->data + str->offset, (uint16_t)len);
         str->offset += 2;
     } else {
         mummy_string_makespace(str, 5);
         str->data[str->offset++] = MUMMY_TYPE_LONGLIST;
-        *(uint32_t *)(str->data + str->offset) = htonl((uint32_t)len);
+        mummy_pack32(str->data + str->offset, (uint32_t)len);
         str->offset += 4;
     }
     return 0;
 }
 
-inline int
+int
 mummy_open_tuple(mummy_string *str, int len) {
     if (len < 256) {
         mummy_string_makespace(str, 2);
@@ -294,18 +301,18 @@ mummy_open_tuple(mummy_string *str, int len) {
     } else if (len < 65536) {
         mummy_string_makespace(str, 3);
         str->data[str->offset++] = MUMMY_TYPE_MEDTUPLE;
-        *(uint16_t *)(str->data + str->offset) = htons((uint16_t)len);
+        mummy_pack16(str->data + str->offset, (uint16_t)len);
         str->offset += 2;
     } else {
         mummy_string_makespace(str, 5);
         str->data[str->offset++] = MUMMY_TYPE_LONGTUPLE;
-        *(uint32_t *)(str->data + str->offset) = htonl((uint32_t)len);
+        mummy_pack32(str->data + str->offset, (uint32_t)len);
         str->offset += 4;
     }
     return 0;
 }
 
-inline int
+int
 mummy_open_set(mummy_string *str, int len) {
     if (len < 256) {
         mummy_string_makespace(str, 2);
@@ -315,18 +322,18 @@ mummy_open_set(mummy_string *str, int len) {
     } else if (len < 65536) {
         mummy_string_makespace(str, 3);
         str->data[str->offset++] = MUMMY_TYPE_MEDSET;
-        *(uint16_t *)(str->data + str->offset) = htons((uint16_t)len);
+        mummy_pack16(str->data + str->offset, (uint16_t)len);
         str->offset += 2;
     } else {
         mummy_string_makespace(str, 5);
         str->data[str->offset++] = MUMMY_TYPE_LONGSET;
-        *(uint32_t *)(str->data + str->offset) = htonl((uint32_t)len);
+        mummy_pack32(str->data + str->offset, (uint32_t)len);
         str->offset += 4;
     }
     return 0;
 }
 
-inline int
+int
 mummy_open_hash(mummy_string *str, int len) {
     if (len < 256) {
         mummy_string_makespace(str, 2);
@@ -336,12 +343,12 @@ mummy_open_hash(mummy_string *str, int len) {
     } else if (len < 65536) {
         mummy_string_makespace(str, 3);
         str->data[str->offset++] = MUMMY_TYPE_MEDHASH;
-        *(uint16_t *)(str->data + str->offset) = htons((uint16_t)len);
+        mummy_pack16(str->data + str->offset, (uint16_t)len);
         str->offset += 2;
     } else {
         mummy_string_makespace(str, 5);
         str->data[str->offset++] = MUMMY_TYPE_LONGHASH;
-        *(uint32_t *)(str->data + str->offset) = htonl((uint32_t)len);
+        mummy_pack32(str->data + str->offset, (uint32_t)len);
         str->offset += 4;
     }
     return 0;
@@ -0,0 +1,887 @@
+#include <errno.h>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "mummy.h"
+#include "alloc.h"
+
+
+/* how many bytes from the start of `data` can go through a JSON string as
+   they are, up to the first quote, backslash or control character, or with
+   `ascii` the first byte that isn't */
+static int
+clean_run(const char *data, int len, int ascii) {
+    int i = 0;
+
+#if defined(__SSE2__)
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1f);
+    __m128i chunk, found;
+    int mask;
+
+    for (; i + 16 <= len; i += 16) {
+        chunk = _mm_loadu_si128((const __m128i *)(data + i));
+        found = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                    _mm_cmpeq_epi8(chunk, backslash)),
+                _mm_cmpeq_epi8(_mm_max_epu8(chunk, control), control));
+        if (ascii) found = _mm_or_si128(found, chunk);
+        if ((mask = _mm_movemask_epi8(found)))
+            return i + __builtin_ctz(mask);
+    }
+#endif
+
+    for (; i < len; ++i) {
+        unsigned char c = (unsigned char)data[i];
+        if (c == '"' || c == '\\' || c < 0x20 || (ascii && c >= 0x80))
+            break;
+    }
+    return i;
+}
+
+static int
+put(mummy_string *out, const char *data, int len) {
+    mummy_string_makespace(out, len);
+    memcpy(out->data + out->offset, data, len);
+    out->offset += len;
+    return 0;
+}
+
+static int
+put_char(mummy_string *out, char c) {
+    mummy_string_makespace(out, 1);
+    out->data[out->offset++] = c;
+    return 0;
+}
+
+static int
+reserve(mummy_string *out, int size) {
+    mummy_string_makespace(out, size);
+    return 0;
+}
+
+/* the length of the utf8 character at the start of `data`, or minus the
+   number of bytes that make up an invalid one (the "maximal subpart" that
+   python's decode(errors="replace") puts one U+FFFD in for) */
+static int
+utf8_char(const unsigned char *data, int len) {
+    unsigned char c = data[0], low = 0x80, high = 0xbf;
+    int more, i;
+
+    if (c >= 0xc2 && c <= 0xdf) {
+        more = 1;
+    } else if (c >= 0xe0 && c <= 0xef) {
+        more = 2;
+        if (c == 0xe0) low = 0xa0; /* overlong */
+        if (c == 0xed) high = 0x9f; /* surrogates */
+    } else if (c >= 0xf0 && c <= 0xf4) {
+        more = 3;
+        if (c == 0xf0) low = 0x90; /* overlong */
+        if (c == 0xf4) high = 0x8f; /* past U+10FFFF */
+    } else {
+        return -1;
+    }
+
+    for (i = 1; i <= more; ++i) {
+        if (i == len || data[i] < low || data[i] > high) return -i;
+        low = 0x80;
+        high = 0xbf;
+    }
+    return i;
+}
+
+/* a JSON string of (what's taken to be) utf8, escaped the way python's
+   json.dumps does with ensure_ascii=False. anything that isn't valid utf8
+   (bytes strings needn't be) becomes U+FFFD, as decoding with
+   errors="replace" has it */
+static int
+put_string(mummy_string *out, const char *data, int len) {
+    static const char hex[] = "0123456789abcdef";
+    char escape[6] = {'\\', 'u', '0', '0', 0, 0};
+    int run, size, rc;
+    unsigned char c;
+
+    if ((rc = put_char(out, '"'))) return rc;
+    while (len) {
+        /* ascii that needs no escaping, and valid utf8, go out as they are */
+        for (run = 0;;) {
+            run += clean_run(data + run, len - run, 1);
+            if (run == len || (unsigned char)data[run] < 0x80) break;
+            size = utf8_char((const unsigned char *)data + run, len - run);
+            if (size < 0) break;
+            run += size;
+        }
+        if (run && (rc = put(out, data, run))) return rc;
+        if (run == len) break;
+
+        data += run;
+        len -= run;
+        c = (unsigned char)data[0];
+        if (c >= 0x80) {
+            size = -utf8_char((const unsigned char *)data, len);
+            if ((rc = put(out, "\xef\xbf\xbd", 3))) return rc;
+            data += size;
+            len -= size;
+            continue;
+        }
+        ++data;
+        --len;
+
+        escape[1] = 0;
+        switch (c) {
+        case '"': escape[1] = '"'; break;
+        case '\\': escape[1] = '\\'; break;
+        case '\n': escape[1] = 'n'; break;
+        case '\r': escape[1] = 'r'; break;
+        case '\t': escape[1] = 't'; break;
+        case '\b': escape[1] = 'b'; break;
+        case '\f': escape[1] = 'f'; break;
+        }
+        if (escape[1]) {
+            rc = put(out, escape, 2);
+        } else {
+            escape[1] = 'u';
+            escape[4] = hex[c >> 4];
+            escape[5] = hex[c & 0xf];
+            rc = put(out, escape, 6);
+        }
+        if (rc) return rc;
+    }
+    return put_char(out, '"');
+}
+
+/* a double the way python's repr() has it: the fewest digits that read back
+   the same, positional from 1e-4 up to 1e16 and with a ".0" if whole */
+static int
+format_double(char *buf, double x) {
+    char text[32], p[20], *c;
+    int precision, exponent, count = 0, len = 0, i;
+
+    if (isnan(x)) return sprintf(buf, "NaN");
+    if (isinf(x)) return sprintf(buf, x < 0 ? "-Infinity" : "Infinity");
+    if (x == 0) return sprintf(buf, signbit(x) ? "-0.0" : "0.0");
+    if (x < 0) buf[len++] = '-';
+
+    /* a normal double that reads back at 15 digits does with trailing zeros
+       cut, but subnormals have fewer bits and can need fewer digits */
+    precision = fabs(x) < DBL_MIN ? 1 : 15;
+    for (; precision < 17; ++precision) {
+        snprintf(text, sizeof(text), "%.*e", precision - 1, fabs(x));
+        if (strtod(text, NULL) == fabs(x)) break;
+    }
+    if (precision == 17)
+        snprintf(text, sizeof(text), "%.16e", fabs(x));
+
+    /* d.ddde[+-]xx down to the bare digits and the exponent */
+    for (c = text; *c != 'e'; ++c)
+        if (*c != '.') p[count++] = *c;
+    exponent = atoi(c + 1);
+    while (count > 1 && p[count - 1] == '0') --count;
+
+    if (exponent < -4 || exponent >= 16) {
+        buf[len++] = p[0];
+        if (count > 1) {
+            buf[len++] = '.';
+            memcpy(buf + len, p + 1, count - 1);
+            len += count - 1;
+        }
+        return len + sprintf(buf + len, "e%c%02d",
+                exponent < 0 ? '-' : '+', abs(exponent));
+    }
+
+    if (exponent < 0) {
+        buf[len++] = '0';
+        buf[len++] = '.';
+        for (i = -1; i > exponent; --i) buf[len++] = '0';
+        memcpy(buf + len, p, count);
+        return len + count;
+    }
+
+    for (i = 0; i <= exponent; ++i) buf[len++] = i < count ? p[i] : '0';
+    buf[len++] = '.';
+    if (count > exponent + 1) {
+        memcpy(buf + len, p + exponent + 1, count - exponent - 1);
+        len += count - exponent - 1;
+    } else {
+        buf[len++] = '0';
+    }
+    return len;
+}
+
+/* big-endian two's complement, in decimal */
+static int
+put_huge(mummy_string *out, const char *data, int len) {
+    unsigned char *mag;
+    char *digits;
+    int i, start = 0, pos, negative, rc;
+    uint64_t rem;
+
+    if (!len) return put_char(out, '0');
+
+    /* each byte makes at most 3 digits, plus a sign */
+    if (!(mag = malloc(len))) return ENOMEM;
+    if (!(digits = malloc(len * 3 + 10))) {
+        free(mag);
+        return ENOMEM;
+    }
+
+    memcpy(mag, data, len);
+    if ((negative = mag[0] & 0x80)) {
+        for (i = 0; i < len; ++i) mag[i] = ~mag[i];
+        for (i = len - 1; i >= 0 && !++mag[i]; --i);
+    }
+
+    pos = len * 3 + 10;
+    while (start < len && !mag[start]) ++start;
+    if (start == len) digits[--pos] = '0';
+
+    /* nine digits at a time */
+    while (start < len) {
+        rem = 0;
+        for (i = start; i < len; ++i) {
+            rem = (rem << 8) | mag[i];
+            mag[i] = (unsigned char)(rem / 1000000000);
+            rem %= 1000000000;
+        }
+        while (start < len && !mag[start]) ++start;
+        for (i = 0; i < 9 && (rem || start < len); ++i) {
+            digits[--pos] = '0' + rem % 10;
+            rem /= 10;
+        }
+    }
+    if (negative) digits[--pos] = '-';
+
+    rc = put(out, digits + pos, len * 3 + 10 - pos);
+    free(mag);
+    free(digits);
+    return rc;
+}
+
+
+/*
+ * mummy -> JSON, as mummy_walk callbacks
+ */
+
+typedef struct {
+    mummy_string *out;
+    int depth;
+    struct {
+        char hash;
+        uint64_t count;
+    } stack[MUMMY_WALK_MAX_DEPTH];
+} json_writer;
+
+/* put the comma or colon before the next item, and say whether it's a hash
+   key (which JSON has to have as a string) */
+static int
+json_item(json_writer *json, char *is_key) {
+    char sep = 0;
+
+    *is_key = 0;
+    if (!json->depth) return 0;
+
+    if (json->stack[json->depth - 1].hash) {
+        *is_key = !(json->stack[json->depth - 1].count & 1);
+        if (json->stack[json->depth - 1].count) sep = *is_key ? ',' : ':';
+    } else if (json->stack[json->depth - 1].count) {
+        sep = ',';
+    }
+    json->stack[json->depth - 1].count++;
+    return sep ? put_char(json->out, sep) : 0;
+}
+
+/* the top-level value is finished once there's nothing left open */
+static int
+json_done(json_writer *json) {
+    return json->depth ? 0 : MUMMY_WALK_STOP;
+}
+
+/* text that's a string in a key, and bare otherwise */
+static int
+json_scalar(json_writer *json, const char *text, int len) {
+    char is_key;
+    int rc;
+
+    if ((rc = json_item(json, &is_key))) return rc;
+    if (is_key && (rc = put_char(json->out, '"'))) return rc;
+    if ((rc = put(json->out, text, len))) return rc;
+    if (is_key && (rc = put_char(json->out, '"'))) return rc;
+    return json_done(json);
+}
+
+static int
+json_null(void *ctx) {
+    return json_scalar(ctx, "null", 4);
+}
+
+static int
+json_boolean(void *ctx, char value) {
+    return value ? json_scalar(ctx, "true", 4) : json_scalar(ctx, "false", 5);
+}
+
+static int
+json_integer(void *ctx, int64_t value) {
+    char buf[24];
+    return json_scalar(ctx, buf, sprintf(buf, "%lld", (long long)value));
+}
+
+static int
+json_floating(void *ctx, double value) {
+    char buf[32];
+    return json_scalar(ctx, buf, format_double(buf, value));
+}
+
+static int
+json_huge(void *ctx, char *data, int len) {
+    json_writer *json = ctx;
+    char is_key;
+    int rc;
+
+    if ((rc = json_item(json, &is_key))) return rc;
+    if (is_key && (rc = put_char(json->out, '"'))) return rc;
+    if ((rc = put_huge(json->out, data, len))) return rc;
+    if (is_key && (rc = put_char(json->out, '"'))) return rc;
+    return json_done(json);
+}
+
+static int
+json_string(void *ctx, char *data, int len) {
+    json_writer *json = ctx;
+    char is_key;
+    int rc;
+
+    if ((rc = json_item(json, &is_key))) return rc;
+    if ((rc = put_string(json->out, data, len))) return rc;
+    return json_done(json);
+}
+
+static int
+json_begin(json_writer *json, char hash) {
+    char is_key;
+    int rc;
+
+    if ((rc = json_item(json, &is_key))) return rc;
+    if (is_key) return EINVAL;
+
+    json->stack[json->depth].hash = hash;
+    json->stack[json->depth].count = 0;
+    json->depth++;
+    return put_char(json->out, hash ? '{' : '[');
+}
+
+static int
+json_begin_sequence(void *ctx, uint32_t size) {
+    return json_begin(ctx, 0);
+}
+
+static int
+json_begin_hash(void *ctx, uint32_t size) {
+    return json_begin(ctx, 1);
+}
+
+static int
+json_end(void *ctx) {
+    json_writer *json = ctx;
+    int rc;
+
+    --json->depth;
+    if ((rc = put_char(json->out, json->stack[json->depth].hash ? '}' : ']')))
+        return rc;
+    return json_done(json);
+}
+
+/* a decimal's exact digits as a JSON number */
+static int
+json_decimal(json_writer *json, mummy_token *token) {
+    char buf[8], is_key;
+    int i, rc, len;
+
+    if ((rc = json_item(json, &is_key))) return rc;
+    if ((rc = reserve(json->out, token->v.decimal.count + 3))) return rc;
+
+    if (is_key) json->out->data[json->out->offset++] = '"';
+    if (token->v.decimal.sign) json->out->data[json->out->offset++] = '-';
+    for (i = 0; i < token->v.decimal.count; ++i)
+        json->out->data[json->out->offset++] = '0' + ((i & 1)
+                ? ((unsigned char)token->v.decimal.digits[i >> 1] >> 4)
+                : (token->v.decimal.digits[i >> 1] & 0x0f));
+    if (token->v.decimal.exponent) {
+        len = sprintf(buf, "e%d", token->v.decimal.exponent);
+        if ((rc = put(json->out, buf, len))) return rc;
+    }
+    if (is_key && (rc = put_char(json->out, '"'))) return rc;
+    return json_done(json);
+}
+
+/* what has no JSON type: dates and times as isoformat() strings, time
+   differences as total_seconds(), fractions as their float value, and
+   decimals exactly, with special values as the float ones are */
+static int
+json_other(void *ctx, mummy_token *token) {
+    json_writer *json = ctx;
+    char buf[48], is_key;
+    int len = 0, rc;
+
+    switch (token->type) {
+    case MUMMY_TYPE_DATE:
+    case MUMMY_TYPE_DATETIME:
+        len = sprintf(buf, "\"%04d-%02d-%02d", token->v.dt.year,
+                token->v.dt.month, token->v.dt.day);
+        if (token->type == MUMMY_TYPE_DATE) break;
+        buf[len++] = 'T';
+        /* fall through */
+    case MUMMY_TYPE_TIME:
+        if (!len) buf[len++] = '"';
+        len += sprintf(buf + len, "%02d:%02d:%02d", token->v.dt.hour,
+                token->v.dt.minute, token->v.dt.second);
+        if (token->v.dt.microsecond)
+            len += sprintf(buf + len, ".%06d", (int)token->v.dt.microsecond);
+        break;
+    case MUMMY_TYPE_TIMEDELTA:
+        /* in microseconds it would overflow an int64 past 106751 days */
+        return json_floating(ctx, token->v.delta.days * 86400.0 +
+                token->v.delta.seconds + token->v.delta.microseconds / 1e6);
+    case MUMMY_TYPE_FRACTION:
+        return json_floating(ctx, (double)token->v.fraction.numerator /
+                (double)token->v.fraction.denominator);
+    case MUMMY_TYPE_SPECIALNUM:
+        /* high 4 bits 1 for infinity, 2 for NaN; low bit the sign */
+        if ((token->v.i & 0xf0) == 0x20) return json_scalar(ctx, "NaN", 3);
+        if (token->v.i & 1) return json_scalar(ctx, "-Infinity", 9);
+        return json_scalar(ctx, "Infinity", 8);
+    case MUMMY_TYPE_DECIMAL:
+        return json_decimal(json, token);
+    default:
+        return EINVAL;
+    }
+
+    buf[len++] = '"';
+    if ((rc = json_item(json, &is_key))) return rc;
+    if ((rc = put(json->out, buf, len))) return rc;
+    return json_done(json);
+}
+
+static const mummy_walk_callbacks json_callbacks = {
+    json_null,
+    json_boolean,
+    json_integer,
+    json_huge,
+    json_floating,
+    json_string,
+    json_string,
+    json_begin_sequence,
+    json_begin_sequence,
+    json_begin_sequence,
+    json_begin_hash,
+    json_end,
+    json_other
+};
+
+int
+mummy_to_json(mummy_string *str, mummy_string *out) {
+    mummy_walker walker;
+    json_writer json;
+    int start = out->offset, rc;
+
+    json.out = out;
+    json.depth = 0;
+    mummy_walker_init(&walker, &json_callbacks, &json);
+
+    rc = mummy_walk(&walker, str);
+    if (rc == MUMMY_WALK_STOP) return 0;
+
+    out->offset = start;
+    return rc ? rc : -1;
+}
+
+
+/*
+ * JSON -> mummy
+ */
+
+static void
+skip_space(mummy_string *str) {
+    char c;
+    while (str->offset < str->len) {
+        c = str->data[str->offset];
+        if (c != ' ' && c != '\n' && c != '\r' && c != '\t') break;
+        ++str->offset;
+    }
+}
+
+/* the size of the header for a container or string of `count` */
+static int
+header_size(uint32_t count) {
+    return count < 256 ? 2 : count < 65536 ? 3 : 5;
+}
+
+/* the item came in at `start` after five bytes left for its header, write
+   the smallest header that fits over them and close up the gap */
+static void
+write_header(mummy_string *out, int start, char short_type, char med_type,
+        char long_type, uint32_t count) {
+    int size = header_size(count);
+    char *header = out->data + start;
+
+    if (size < 5) {
+        memmove(header + size, header + 5, out->offset - start - 5);
+        out->offset -= 5 - size;
+    }
+
+    switch (size) {
+    case 2:
+        header[0] = short_type;
+        header[1] = (char)count;
+        break;
+    case 3:
+        header[0] = med_type;
+        header[1] = (char)(count >> 8);
+        header[2] = (char)count;
+        break;
+    default:
+        header[0] = long_type;
+        header[1] = (char)(count >> 24);
+        header[2] = (char)(count >> 16);
+        header[3] = (char)(count >> 8);
+        header[4] = (char)count;
+    }
+}
+
+static int
+parse_literal(mummy_string *str, const char *word, int len) {
+    int space = mummy_string_space(str);
+
+    if (memcmp(str->data + str->offset, word, space < len ? space : len))
+        return EINVAL;
+    if (space < len) return -1;
+    str->offset += len;
+    return 0;
+}
+
+static int
+hex_digit(char c) {
+    if ('0' <= c && c <= '9') return c - '0';
+    if ('a' <= c && c <= 'f') return c - 'a' + 10;
+    if ('A' <= c && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static int
+parse_hex4(const char *data, uint32_t *result) {
+    int i, digit;
+
+    *result = 0;
+    for (i = 0; i < 4; ++i) {
+        if ((digit = hex_digit(data[i])) < 0) return EINVAL;
+        *result = (*result << 4) | digit;
+    }
+    return 0;
+}
+
+/* a JSON string (the offset is at its opening quote) to a mummy utf8 */
+static int
+parse_string(mummy_string *str, mummy_string *out) {
+    const char *data = str->data + str->offset + 1, *end;
+    int len = mummy_string_space(str) - 1, run, raw, start, rc;
+    uint32_t code, low;
+    char *dest;
+
+    /* find the closing quote first, for an upper bound on the length */
+    for (raw = 0;;) {
+        raw += clean_run(data + raw, len - raw, 0);
+        if (raw >= len) return -1;
+        if (data[raw] == '"') break;
+        if (data[raw] != '\\') {
+            str->offset += raw + 1;
+            return EINVAL;
+        }
+        raw += 2;
+    }
+    end = data + raw;
+
+    start = out->offset;
+    if ((rc = reserve(out, raw + 5))) return rc;
+    dest = out->data + start + 5;
+
+    while (data < end) {
+        run = clean_run(data, (int)(end - data), 0);
+        memcpy(dest, data, run);
+        dest += run;
+        data += run;
+        if (data == end) break;
+
+        /* a backslash, and we know there's something after it */
+        switch (data[1]) {
+        case '"': *dest++ = '"'; break;
+        case '\\': *dest++ = '\\'; break;
+        case '/': *dest++ = '/'; break;
+        case 'b': *dest++ = '\b'; break;
+        case 'f': *dest++ = '\f'; break;
+        case 'n': *dest++ = '\n'; break;
+        case 'r': *dest++ = '\r'; break;
+        case 't': *dest++ = '\t'; break;
+        case 'u':
+            if (end - data < 6 || parse_hex4(data + 2, &code)) goto invalid;
+            if (0xdc00 <= code && code < 0xe000) goto invalid;
+            if (0xd800 <= code && code < 0xdc00) {
+                if (end - data < 12 || data[6] != '\\' || data[7] != 'u' ||
+                        parse_hex4(data + 8, &low) ||
+                        low < 0xdc00 || low >= 0xe000)
+                    goto invalid;
+                code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                data += 6;
+            }
+            if (code < 0x80) {
+                *dest++ = (char)code;
+            } else if (code < 0x800) {
+                *dest++ = (char)(0xc0 | (code >> 6));
+                *dest++ = (char)(0x80 | (code & 0x3f));
+            } else if (code < 0x10000) {
+                *dest++ = (char)(0xe0 | (code >> 12));
+                *dest++ = (char)(0x80 | ((code >> 6) & 0x3f));
+                *dest++ = (char)(0x80 | (code & 0x3f));
+            } else {
+                *dest++ = (char)(0xf0 | (code >> 18));
+                *dest++ = (char)(0x80 | ((code >> 12) & 0x3f));
+                *dest++ = (char)(0x80 | ((code >> 6) & 0x3f));
+                *dest++ = (char)(0x80 | (code & 0x3f));
+            }
+            data += 4;
+            break;
+        default:
+            goto invalid;
+        }
+        data += 2;
+    }
+
+    out->offset = (int)(dest - out->data);
+    write_header(out, start, MUMMY_TYPE_SHORTUTF8, MUMMY_TYPE_MEDUTF8,
+            MUMMY_TYPE_LONGUTF8, (uint32_t)(out->offset - start - 5));
+    str->offset += raw + 2;
+    return 0;
+
+invalid:
+    str->offset = (int)(data - str->data);
+    return EINVAL;
+}
+
+/* an int too big for a long, written the same as python does it */
+static int
+feed_huge_decimal(mummy_string *out, const char *digits, int count,
+        char negative) {
+    unsigned char *mag, *bytes;
+    int size = count / 2 + 2, i, j, chunk, top, bits, width, rc;
+    uint64_t carry, scale;
+
+    if (!(mag = calloc(size, 1))) return ENOMEM;
+
+    /* nine decimal digits at a time into the big-endian magnitude */
+    for (i = 0; i < count; i += chunk) {
+        chunk = count - i < 9 ? count - i : 9;
+        carry = 0;
+        scale = 1;
+        for (j = 0; j < chunk; ++j) {
+            carry = carry * 10 + (digits[i + j] - '0');
+            scale *= 10;
+        }
+        for (j = size - 1; j >= 0; --j) {
+            carry += mag[j] * scale;
+            mag[j] = (unsigned char)carry;
+            carry >>= 8;
+        }
+    }
+
+    for (top = 0; top < size - 1 && !mag[top]; ++top);
+    for (bits = 0; mag[top] >> bits; ++bits);
+    bits += (size - top - 1) * 8;
+
+    /* as many bytes as python's (abs(x).bit_length() >> 3) + 1 */
+    width = (bits >> 3) + 1;
+    bytes = mag + size - width;
+    if (negative) {
+        for (i = 0; i < width; ++i) bytes[i] = ~bytes[i];
+        for (i = width - 1; i >= 0 && !++bytes[i]; --i);
+    }
+
+    rc = mummy_feed_huge(out, (char *)bytes, width);
+    free(mag);
+    return rc;
+}
+
+static int
+parse_number(mummy_string *str, mummy_string *out) {
+    const char *start = str->data + str->offset, *p = start;
+    const char *end = str->data + str->len, *digits, *c;
+    char negative = 0, integral = 1, buf[64], *copy;
+    uint64_t value = 0;
+    int rc, len;
+    double num;
+
+    if (*p == '-') {
+        negative = 1;
+        if (++p == end) return -1;
+        if (*p == 'I') {
+            str->offset++;
+            if ((rc = parse_literal(str, "Infinity", 8))) return rc;
+            return mummy_feed_float(out, -INFINITY);
+        }
+    }
+
+    digits = p;
+    if (*p == '0') {
+        ++p;
+    } else if ('1' <= *p && *p <= '9') {
+        while (p < end && '0' <= *p && *p <= '9') ++p;
+    } else {
+        str->offset = (int)(p - str->data);
+        return EINVAL;
+    }
+
+    if (p < end && *p == '.') {
+        integral = 0;
+        if (++p == end) return -1;
+        if (*p < '0' || *p > '9') goto invalid;
+        while (p < end && '0' <= *p && *p <= '9') ++p;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        integral = 0;
+        if (++p < end && (*p == '+' || *p == '-')) ++p;
+        if (p == end) return -1;
+        if (*p < '0' || *p > '9') goto invalid;
+        while (p < end && '0' <= *p && *p <= '9') ++p;
+    }
+
+    len = (int)(p - start);
+    str->offset += len;
+
+    if (integral) {
+        if (p - digits <= 19) {
+            for (c = digits; c < p; ++c) value = value * 10 + (*c - '0');
+            if (value <= (uint64_t)INT64_MAX)
+                return mummy_feed_int(out,
+                        negative ? -(int64_t)value : (int64_t)value);
+            if (negative && value == (uint64_t)INT64_MAX + 1)
+                return mummy_feed_int(out, INT64_MIN);
+        }
+        return feed_huge_decimal(out, digits, (int)(p - digits), negative);
+    }
+
+    /* strtod wants it terminated */
+    copy = len < (int)sizeof(buf) ? buf : malloc(len + 1);
+    if (!copy) return ENOMEM;
+    memcpy(copy, start, len);
+    copy[len] = 0;
+    num = strtod(copy, NULL);
+    if (copy != buf) free(copy);
+    return mummy_feed_float(out, num);
+
+invalid:
+    str->offset = (int)(p - str->data);
+    return EINVAL;
+}
+
+static int parse_value(mummy_string *, mummy_string *, int);
+
+static int
+parse_container(mummy_string *str, mummy_string *out, int depth, char hash) {
+    char close = hash ? '}' : ']';
+    uint32_t count = 0;
+    int start = out->offset, rc;
+
+    if (depth >= MUMMY_WALK_MAX_DEPTH) return -3;
+
+    /* the header goes in at the end, once the count is known */
+    if ((rc = reserve(out, 5))) return rc;
+    out->offset += 5;
+    ++str->offset;
+
+    skip_space(str);
+    if (str->offset >= str->len) return -1;
+    if (str->data[str->offset] == close) {
+        ++str->offset;
+    } else for (;;) {
+        if (hash) {
+            skip_space(str);
+            if (str->offset >= str->len) return -1;
+            if (str->data[str->offset] != '"') return EINVAL;
+            if ((rc = parse_string(str, out))) return rc;
+            skip_space(str);
+            if (str->offset >= str->len) return -1;
+            if (str->data[str->offset] != ':') return EINVAL;
+            ++str->offset;
+        }
+        if ((rc = parse_value(str, out, depth + 1))) return rc;
+        ++count;
+
+        skip_space(str);
+        if (str->offset >= str->len) return -1;
+        if (str->data[str->offset] == close) {
+            ++str->offset;
+            break;
+        }
+        if (str->data[str->offset] != ',') return EINVAL;
+        ++str->offset;
+    }
+
+    if (hash)
+        write_header(out, start, MUMMY_TYPE_SHORTHASH, MUMMY_TYPE_MEDHASH,
+                MUMMY_TYPE_LONGHASH, count);
+    else
+        write_header(out, start, MUMMY_TYPE_SHORTLIST, MUMMY_TYPE_MEDLIST,
+                MUMMY_TYPE_LONGLIST, count);
+    return 0;
+}
+
+static int
+parse_value(mummy_string *str, mummy_string *out, int depth) {
+    int rc;
+
+    skip_space(str);
+    if (str->offset >= str->len) return -1;
+
+    switch (str->data[str->offset]) {
+    case '{':
+        return parse_container(str, out, depth, 1);
+    case '[':
+        return parse_container(str, out, depth, 0);
+    case '"':
+        return parse_string(str, out);
+    case 't':
+        if ((rc = parse_literal(str, "true", 4))) return rc;
+        return mummy_feed_bool(out, 1);
+    case 'f':
+        if ((rc = parse_literal(str, "false", 5))) return rc;
+        return mummy_feed_bool(out, 0);
+    case 'n':
+        if ((rc = parse_literal(str, "null", 4))) return rc;
+        return mummy_feed_null(out);
+    /* python's json allows these too */
+    case 'N':
+        if ((rc = parse_literal(str, "NaN", 3))) return rc;
+        return mummy_feed_float(out, NAN);
+    case 'I':
+        if ((rc = parse_literal(str, "Infinity", 8))) return rc;
+        return mummy_feed_float(out, INFINITY);
+    }
+    return parse_number(str, out);
+}
+
+int
+mummy_from_json(mummy_string *str, mummy_string *out) {
+    int start = out->offset, rc;
+
+    if (!(rc = parse_value(str, out, 0))) {
+        skip_space(str);
+        if (str->offset < str->len) rc = EINVAL;
+    }
+    if (rc) out->offset = start;
+    return rc;
+}
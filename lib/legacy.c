@@ -0,0 +1,49 @@
+#include <errno.h>
+#include <string.h>
+
+#include "mummy.h"
+#include "alloc.h"
+
+
+/* rewrite an uncompressed mummy in the old format onto the end of str.
+   the formats differ only in how decimals are laid out, so every other
+   token is copied across as it is */
+int
+mummy_upgrade_legacy(mummy_string *legacy, mummy_string *str) {
+    mummy_token token;
+    char flags, *digits;
+    int16_t exponent;
+    uint16_t count;
+    int start, size, rc;
+
+    while (legacy->offset < legacy->len) {
+        if (mummy_type(legacy) == MUMMY_TYPE_DECIMAL) {
+            if ((rc = mummy_read_legacy_decimal(
+                    legacy, &flags, &exponent, &count, &digits)))
+                return rc;
+
+            if (!(flags & 1))
+                rc = mummy_feed_decimal(
+                        str, flags & 2, exponent, count, digits);
+            else if (flags & 4)
+                rc = mummy_feed_infinity(str, flags & 2);
+            else
+                rc = mummy_feed_nan(str, flags & 8);
+
+            free(digits);
+            if (rc) return rc;
+            continue;
+        }
+
+        start = legacy->offset;
+        if ((rc = mummy_read_token(legacy, &token))) return rc;
+        size = legacy->offset - start;
+
+        {
+            mummy_string_makespace(str, size);
+        }
+        memcpy(str->data + str->offset, legacy->data + start, size);
+        str->offset += size;
+    }
+    return 0;
+}
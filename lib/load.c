@@ -3,9 +3,11 @@
 
 #include "lzf.h"
 #include "mummy.h"
+#include "unaligned.h"
+#include "alloc.h"
 
 
-inline int
+int
 mummy_read_bool(mummy_string *str, char *result) {
     if (mummy_string_space(str) < 2) return -1;
     *result = str->data[str->offset + 1] ? 1 : 0;
@@ -13,7 +15,7 @@ mummy_read_bool(mummy_string *str, char *result) {
     return 0;
 }
 
-inline int
+int
 mummy_read_int(mummy_string *str, int64_t *result) {
     if (mummy_string_space(str) < 1) return -1;
 
@@ -25,31 +27,31 @@ mummy_read_int(mummy_string *str, int64_t *result) {
         return 0;
     case MUMMY_TYPE_SHORT:
         if (mummy_string_space(str) < 2) return -1;
-        *result = (int16_t)ntohs(*(int16_t *)(str->data + str->offset));
+        *result = (int16_t)mummy_unpack16(str->data + str->offset);
         str->offset += 2;
         return 0;
     case MUMMY_TYPE_INT:
         if (mummy_string_space(str) < 4) return -1;
-        *result = (int32_t)ntohl(*(int32_t *)(str->data + str->offset));
+        *result = (int32_t)mummy_unpack32(str->data + str->offset);
         str->offset += 4;
         return 0;
     case MUMMY_TYPE_LONG:
         if (mummy_string_space(str) < 8) return -1;
-        *result = ntohll(*(int64_t *)(str->data + str->offset));
+        *result = mummy_unpack64(str->data + str->offset);
         str->offset += 8;
         return 0;
     }
     return -2;
 }
 
-inline int
+int
 mummy_read_huge(mummy_string *str, int upto,
         char **result, int *result_len) {
     uint32_t len;
 
     if (mummy_string_space(str) < 5) return -1;
 
-    len = ntohl(*(uint32_t *)(str->data + str->offset + 1));
+    len = mummy_unpack32(str->data + str->offset + 1);
     if (mummy_string_space(str) - 5 < len) return -1;
     *result_len = len;
     if (len > upto) return -3;
@@ -58,13 +60,13 @@ mummy_read_huge(mummy_string *str, int upto,
     return 0;
 }
 
-inline int
+int
 mummy_point_to_huge(mummy_string *str, char **buf, int *result_len) {
     uint32_t len;
 
     if (mummy_string_space(str) < 5) return -1;
 
-    len = ntohl(*(uint32_t *)(str->data + str->offset + 1));
+    len = mummy_unpack32(str->data + str->offset + 1);
     if (mummy_string_space(str) - 5 < len) return -1;
     *result_len = len;
     *buf = str->data + str->offset + 5;
@@ -72,19 +74,19 @@ mummy_point_to_huge(mummy_string *str, char **buf, int *result_len) {
     return 0;
 }
 
-inline int
+int
 mummy_read_float(mummy_string *str, double *result) {
     uint64_t output;
 
     if (mummy_string_space(str) < 9) return -1;
 
-    output = ntohll(*(uint64_t *)(str->data + str->offset + 1));
-    *result = *(double *)&output;
+    output = mummy_unpack64(str->data + str->offset + 1);
+    memcpy(result, &output, 8);
     str->offset += 9;
     return 0;
 }
 
-inline int
+int
 mummy_read_string(mummy_string *str, int upto, char **result, int *result_len) {
     uint32_t len;
 
@@ -102,7 +104,7 @@ mummy_read_string(mummy_string *str, int upto, char **result, int *result_len) {
         return 0;
     case MUMMY_TYPE_MEDSTR:
         if (mummy_string_space(str) < 2) return -1;
-        len = (uint32_t)ntohs(*(uint16_t *)(str->data + str->offset));
+        len = (uint32_t)mummy_unpack16(str->data + str->offset);
         if (mummy_string_space(str) - 2 < len) return -1;
         *result_len = len;
         if (len > upto) return -3;
@@ -111,7 +113,7 @@ mummy_read_string(mummy_string *str, int upto, char **result, int *result_len) {
         return 0;
     case MUMMY_TYPE_LONGSTR:
         if (mummy_string_space(str) < 4) return -1;
-        len = ntohl(*(uint32_t *)(str->data + str->offset));
+        len = mummy_unpack32(str->data + str->offset);
         if (mummy_string_space(str) - 4 < len) return -1;
         *result_len = len;
         if (len > upto) return -3;
@@ -122,7 +124,7 @@ mummy_read_string(mummy_string *str, int upto, char **result, int *result_len) {
     return -2;
 }
 
-inline int
+int
 mummy_point_to_string(mummy_string *str, char **target, int *result_len) {
     uint32_t len;
 
@@ -139,7 +141,7 @@ mummy_point_to_string(mummy_string *str, char **target, int *result_len) {
         return 0;
     case MUMMY_TYPE_MEDSTR:
         if (mummy_string_space(str) < 2) return -1;
-        len = (uint32_t)ntohs(*(uint16_t *)(str->data + str->offset));
+        len = (uint32_t)mummy_unpack16(str->data + str->offset);
         if (mummy_string_space(str) - 2 < len) return -1;
         *result_len = len;
         *target = str->data + str->offset + 2;
@@ -147,7 +149,7 @@ mummy_point_to_string(mummy_string *str, char **target, int *result_len) {
         return 0;
     case MUMMY_TYPE_LONGSTR:
         if (mummy_string_space(str) < 4) return -1;
-        len = ntohl(*(uint32_t *)(str->data + str->offset));
+        len = mummy_unpack32(str->data + str->offset);
         if (mummy_string_space(str) - 4 < len) return -1;
         *result_len = len;
         *target = str->data + str->offset + 4;
@@ -157,7 +159,7 @@ mummy_point_to_string(mummy_string *str, char **target, int *result_len) {
     return -2;
 }
 
-inline int
+int
 mummy_read_utf8(mummy_string *str, int upto, char **result, int *result_len) {
     uint32_t len;
 
@@ -175,7 +177,7 @@ mummy_read_utf8(mummy_string *str, int upto, char **result, int *result_len) {
         return 0;
     case MUMMY_TYPE_MEDUTF8:
         if (mummy_string_space(str) < 2) return -1;
-        len = (uint32_t)ntohs(*(uint16_t *)(str->data + str->offset));
+        len = (uint32_t)mummy_unpack16(str->data + str->offset);
         if (mummy_string_space(str) - 2 < len) return -1;
         *result_len = len;
         if (len > upto) return -3;
@@ -184,7 +186,7 @@ mummy_read_utf8(mummy_string *str, int upto, char **result, int *result_len) {
         return 0;
     case MUMMY_TYPE_LONGUTF8:
         if (mummy_string_space(str) < 4) return -1;
-        len = ntohl(*(uint32_t *)(str->data + str->offset));
+        len = mummy_unpack32(str->data + str->offset);
         if (mummy_string_space(str) - 4 < len) return -1;
         *result_len = len;
         if (len > upto) return -3;
@@ -195,7 +197,7 @@ mummy_read_utf8(mummy_string *str, int upto, char **result, int *result_len) {
     return -2;
 }
 
-inline int
+int
 mummy_point_to_utf8(mummy_string *str, char **target, int *result_len) {
     uint32_t len;
 
@@ -212,7 +214,7 @@ mummy_point_to_utf8(mummy_string *str, char **target, int *result_len) {
         return 0;
     case MUMMY_TYPE_MEDUTF8:
         if (mummy_string_space(str) < 2) return -1;
-        len = ntohs(*(uint16_t *)(str->data + str->offset));
+        len = mummy_unpack16(str->data + str->offset);
         if (mummy_string_space(str) - 2 < len) return -1;
         *result_len = len;
         *target = str->data + str->offset + 2;
@@ -220,7 +222,7 @@ mummy_point_to_utf8(mummy_string *str, char **target, int *result_len) {
         return 0;
     case MUMMY_TYPE_LONGUTF8:
         if (mummy_string_space(str) < 4) return -1;
-        len = ntohl(*(uint32_t *)(str->data + str->offset));
+        len = mummy_unpack32(str->data + str->offset);
         if (mummy_string_space(str) - 4 < len) return -1;
         *result_len = len;
         *target = str->data + str->offset + 4;
@@ -230,7 +232,7 @@ mummy_point_to_utf8(mummy_string *str, char **target, int *result_len) {
     return -2;
 }
 
-inline int
+int
 mummy_read_decimal(mummy_string *str,
         char *sign, int16_t *exponent, uint16_t *count, char **digits) {
     uint16_t dsize, bytes;
@@ -241,8 +243,8 @@ mummy_read_decimal(mummy_string *str,
     if (mummy_string_space(str) < 6) return -1;
 
     /* regular decimal number */
-    dexpo = ntohs(*(int16_t *)(str->data + str->offset + 2));
-    dsize = ntohs(*(uint16_t *)(str->data + str->offset + 4));
+    dexpo = mummy_unpack16(str->data + str->offset + 2);
+    dsize = mummy_unpack16(str->data + str->offset + 4);
     bytes = (dsize >> 1) + (dsize & 1 ? 1 : 0);
 
     if (mummy_string_space(str) - 6 < bytes) return -1; /* TODO: wat is this */
@@ -265,7 +267,52 @@ mummy_read_decimal(mummy_string *str,
     return 0;
 }
 
-inline int
+/* decimals as the old format wrote them: a flags byte (special, sign,
+   infinity, signaling), and then for finite numbers the exponent, digit
+   count and digits packed high nibble first */
+int
+mummy_read_legacy_decimal(mummy_string *str, char *flags,
+        int16_t *exponent, uint16_t *count, char **digits) {
+    uint16_t dsize, bytes;
+    int i;
+    unsigned char c;
+
+    if (mummy_string_space(str) < 2) return -1;
+    *flags = str->data[str->offset + 1];
+
+    if (*flags & 1) {
+        /* special values are only the flags byte */
+        *exponent = 0;
+        *count = 0;
+        *digits = NULL;
+        str->offset += 2;
+        return 0;
+    }
+
+    if (mummy_string_space(str) < 6) return -1;
+    dsize = mummy_unpack16(str->data + str->offset + 4);
+    bytes = (dsize >> 1) + (dsize & 1);
+
+    if (mummy_string_space(str) - 6 < bytes) return -1;
+    if (!(*digits = malloc(dsize))) return ENOMEM;
+
+    *exponent = mummy_unpack16(str->data + str->offset + 2);
+    *count = dsize;
+    str->offset += 6;
+
+    for (i = 0; i < dsize; ++i) {
+        c = str->data[str->offset + (i>>1)];
+        if (i & 1) /* odd, get the low 4 bits */
+            c = c & 0x0f;
+        else /* even, get the high 4 bits */
+            c = 0 | (c >> 4);
+        (*digits)[i] = c;
+    }
+    str->offset += bytes;
+    return 0;
+}
+
+int
 mummy_read_specialnum(mummy_string *str, char *flags) {
     if (mummy_string_space(str) < 2) return -1;
     *flags = str->data[str->offset + 1];
@@ -273,66 +320,70 @@ mummy_read_specialnum(mummy_string *str, char *flags) {
     return 0;
 }
 
-inline int
+int
 mummy_read_fraction(mummy_string *str,
         int64_t *numerator, int64_t *denominator) {
     if (mummy_string_space(str) < 17) return -1;
-    *numerator = ntohll(*(int64_t *)(str->data + str->offset + 1));
+    *numerator = mummy_unpack64(str->data + str->offset + 1);
     str->offset += 9;
-    *denominator = ntohll(*(int64_t *)(str->data + str->offset));
+    *denominator = mummy_unpack64(str->data + str->offset);
     str->offset += 8;
     return 0;
 }
 
-inline int
+int
 mummy_read_date(mummy_string *str, short *year, char *month, char *day) {
     if (mummy_string_space(str) < 5) return -1;
-    *year = ntohs(*(uint16_t *)(str->data + str->offset + 1));
+    *year = mummy_unpack16(str->data + str->offset + 1);
     *month = *(uint8_t *)(str->data + str->offset + 3);
     *day = *(uint8_t *)(str->data + str->offset + 4);
     str->offset += 5;
     return 0;
 }
 
-inline int
+int
 mummy_read_time(mummy_string *str,
         char *hour, char *minute, char *second, int *microsecond) {
     if (mummy_string_space(str) < 7) return -1;
     *hour = *(uint8_t *)(str->data + str->offset + 1);
     *minute = *(uint8_t *)(str->data + str->offset + 2);
     *second = *(uint8_t *)(str->data + str->offset + 3);
-    *microsecond = ntohl(*(uint32_t *)(str->data + str->offset + 4) << 8);
+    *microsecond = (*(uint8_t *)(str->data + str->offset + 4) << 16) |
+        (*(uint8_t *)(str->data + str->offset + 5) << 8) |
+        *(uint8_t *)(str->data + str->offset + 6);
     str->offset += 7;
     return 0;
 }
 
-inline int
+int
 mummy_read_datetime(mummy_string *str, short *year, char *month, char *day,
         char *hour, char *minute, char *second, int *microsecond) {
     if (mummy_string_space(str) < 11) return -1;
-    *year = ntohs(*(uint16_t *)(str->data + str->offset + 1));
+    *year = mummy_unpack16(str->data + str->offset + 1);
     *month = *(uint8_t *)(str->data + str->offset + 3);
     *day = *(uint8_t *)(str->data + str->offset + 4);
     *hour = *(uint8_t *)(str->data + str->offset + 5);
     *minute = *(uint8_t *)(str->data + str->offset + 6);
     *second = *(uint8_t *)(str->data + str->offset + 7);
-    *microsecond = ntohl(*(uint32_t *)(str->data + str->offset + 8) << 8);
+    *microsecond = (*(uint8_t *)(str->data + str->offset + 8) << 16) |
+        (*(uint8_t *)(str->data + str->offset + 9) << 8) |
+        *(uint8_t *)(str->data + str->offset + 10);
     str->offset += 11;
     return 0;
 }
 
-inline int
+int
 mummy_read_timedelta(mummy_string *str, int *days, int *seconds,
         int *microseconds) {
     if (mummy_string_space(str) < 13) return -1;
-    *days = ntohl(*(int32_t *)(str->data + str->offset + 1));
-    *seconds = ntohl(*(int32_t *)(str->data + str->offset + 5));
-    *microseconds = ntohl(*(int32_t *)(str->data + str->offset + 9));
+    *days = mummy_unpack32(str->data + str->offset + 1);
+    *seconds = mummy_unpack32(str->data + str->offset + 5);
+    *microseconds = mummy_unpack32(str->data + str->offset + 9);
     str->offset += 13;
     return 0;
 }
 
-inline int
+int
 mummy_container_size(mummy_string *str, uint32_t *result) {
     switch (mummy_type(str)) {
     case MUMMY_TYPE_SHORTLIST:
@@ -348,7 +399,7 @@ mummy_container_size(mummy_string *str, uint32_t *result) {
     case MUMMY_TYPE_MEDHASH:
     case MUMMY_TYPE_MEDSET:
         if (mummy_string_space(str) < 3) return -1;
-        *result = (uint32_t)ntohs(*(uint16_t *)(str->data + str->offset + 1));
+        *result = (uint32_t)mummy_unpack16(str->data + str->offset + 1);
         str->offset += 3;
         return 0;
     case MUMMY_TYPE_LONGLIST:
@@ -356,9 +407,106 @@ mummy_container_size(mummy_string *str, uint32_t *result) {
     case MUMMY_TYPE_LONGHASH:
     case MUMMY_TYPE_LONGSET:
         if (mummy_string_space(str) < 5) return -1;
-        *result = ntohl(*(uint32_t *)(str->data + str->offset + 1));
+        *result = mummy_unpack32(str->data + str->offset + 1);
         str->offset += 5;
         return 0;
     }
     return -1;
 }
+
+int
+mummy_read_token(mummy_string *str, mummy_token *token) {
+    char c, month, day, hour, minute, second;
+    short year;
+    uint16_t bytes;
+
+    if (mummy_string_space(str) < 1) return -1;
+
+    switch (token->type = mummy_type(str)) {
+    case MUMMY_TYPE_NULL:
+        str->offset++;
+        return 0;
+    case MUMMY_TYPE_BOOL:
+        if (mummy_read_bool(str, &c)) return -1;
+        token->v.i = c;
+        return 0;
+    case MUMMY_TYPE_CHAR:
+    case MUMMY_TYPE_SHORT:
+    case MUMMY_TYPE_INT:
+    case MUMMY_TYPE_LONG:
+        return mummy_read_int(str, &token->v.i);
+    case MUMMY_TYPE_HUGE:
+        return mummy_point_to_huge(str, &token->v.s.data, &token->v.s.len);
+    case MUMMY_TYPE_FLOAT:
+        return mummy_read_float(str, &token->v.f);
+    case MUMMY_TYPE_SHORTSTR:
+    case MUMMY_TYPE_MEDSTR:
+    case MUMMY_TYPE_LONGSTR:
+        return mummy_point_to_string(str, &token->v.s.data, &token->v.s.len);
+    case MUMMY_TYPE_SHORTUTF8:
+    case MUMMY_TYPE_MEDUTF8:
+    case MUMMY_TYPE_LONGUTF8:
+        return mummy_point_to_utf8(str, &token->v.s.data, &token->v.s.len);
+    case MUMMY_TYPE_SHORTLIST:
+    case MUMMY_TYPE_MEDLIST:
+    case MUMMY_TYPE_LONGLIST:
+    case MUMMY_TYPE_SHORTTUPLE:
+    case MUMMY_TYPE_MEDTUPLE:
+    case MUMMY_TYPE_LONGTUPLE:
+    case MUMMY_TYPE_SHORTSET:
+    case MUMMY_TYPE_MEDSET:
+    case MUMMY_TYPE_LONGSET:
+    case MUMMY_TYPE_SHORTHASH:
+    case MUMMY_TYPE_MEDHASH:
+    case MUMMY_TYPE_LONGHASH:
+        return mummy_container_size(str, &token->v.size);
+    case MUMMY_TYPE_DATE:
+        if (mummy_read_date(str, &year, &month, &day)) return -1;
+        token->v.dt.year = year;
+        token->v.dt.month = month;
+        token->v.dt.day = day;
+        return 0;
+    case MUMMY_TYPE_TIME:
+        if (mummy_read_time(str, &hour, &minute, &second,
+                    &token->v.dt.microsecond))
+            return -1;
+        token->v.dt.hour = hour;
+        token->v.dt.minute = minute;
+        token->v.dt.second = second;
+        return 0;
+    case MUMMY_TYPE_DATETIME:
+        if (mummy_read_datetime(str, &year, &month, &day, &hour, &minute,
+                    &second, &token->v.dt.microsecond))
+            return -1;
+        token->v.dt.year = year;
+        token->v.dt.month = month;
+        token->v.dt.day = day;
+        token->v.dt.hour = hour;
+        token->v.dt.minute = minute;
+        token->v.dt.second = second;
+        return 0;
+    case MUMMY_TYPE_TIMEDELTA:
+        return mummy_read_timedelta(str, &token->v.delta.days,
+                &token->v.delta.seconds, &token->v.delta.microseconds);
+    case MUMMY_TYPE_DECIMAL:
+        /* like mummy_read_decimal, but leave the digits packed in place */
+        if (mummy_string_space(str) < 6) return -1;
+        token->v.decimal.sign = str->data[str->offset + 1] ? 1 : 0;
+        token->v.decimal.exponent = mummy_unpack16(
+                str->data + str->offset + 2);
+        token->v.decimal.count = mummy_unpack16(str->data + str->offset + 4);
+        bytes = (token->v.decimal.count >> 1) + (token->v.decimal.count & 1);
+        if (mummy_string_space(str) - 6 < bytes) return -1;
+        token->v.decimal.digits = str->data + str->offset + 6;
+        str->offset += 6 + bytes;
+        return 0;
+    case MUMMY_TYPE_SPECIALNUM:
+        if (mummy_read_specialnum(str, &c)) return -1;
+        token->v.i = c;
+        return 0;
+    case MUMMY_TYPE_FRACTION:
+        return mummy_read_fraction(str, &token->v.fraction.numerator,
+                &token->v.fraction.denominator);
+    }
+    return -2;
+}
@@ -0,0 +1,592 @@
+#include <errno.h>
+#include <string.h>
+
+#include "mummy.h"
+#include "alloc.h"
+
+
+static int
+put(mummy_string *out, const char *data, int len) {
+    mummy_string_makespace(out, len);
+    memcpy(out->data + out->offset, data, len);
+    out->offset += len;
+    return 0;
+}
+
+/* a msgpack type byte, then the low `width` bytes of num big-endian */
+static int
+put_tagged(mummy_string *out, unsigned char type, int width, uint64_t num) {
+    char buf[9];
+    int i;
+
+    buf[0] = (char)type;
+    for (i = 0; i < width; ++i)
+        buf[width - i] = (char)(num >> (i * 8));
+    return put(out, buf, width + 1);
+}
+
+/* the msgpack header for a string, array or map of `size`, from the types
+   for the fixed, 8 (strings only), 16 and 32 bit lengths */
+static int
+put_sized(mummy_string *out, unsigned char fixed, int fixed_max,
+        unsigned char type8, unsigned char type16, unsigned char type32,
+        uint32_t size) {
+    if (fixed_max >= 0 && size <= (uint32_t)fixed_max)
+        return put_tagged(out, fixed | size, 0, 0);
+    if (type8 && size < 256) return put_tagged(out, type8, 1, size);
+    if (size < 65536) return put_tagged(out, type16, 2, size);
+    return put_tagged(out, type32, 4, size);
+}
+
+static int
+put_int(mummy_string *out, int64_t num) {
+    if (num >= 0) {
+        if (num < 128) return put_tagged(out, (unsigned char)num, 0, 0);
+        if (num < 256) return put_tagged(out, 0xcc, 1, num);
+        if (num < 65536) return put_tagged(out, 0xcd, 2, num);
+        if (num <= 0xffffffffLL) return put_tagged(out, 0xce, 4, num);
+        return put_tagged(out, 0xcf, 8, num);
+    }
+    if (num >= -32) return put_tagged(out, (unsigned char)num, 0, 0);
+    if (num >= -128) return put_tagged(out, 0xd0, 1, num);
+    if (num >= -32768) return put_tagged(out, 0xd1, 2, num);
+    if (num >= -2147483648LL) return put_tagged(out, 0xd2, 4, num);
+    return put_tagged(out, 0xd3, 8, num);
+}
+
+/* proleptic gregorian date <-> days since 1970-01-01 */
+static int64_t
+days_from_civil(int64_t y, unsigned m, unsigned d) {
+    int64_t era;
+    unsigned yoe, doy, doe;
+
+    y -= m <= 2;
+    era = (y >= 0 ? y : y - 399) / 400;
+    yoe = (unsigned)(y - era * 400);
+    doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (int64_t)doe - 719468;
+}
+
+static void
+civil_from_days(int64_t z, int64_t *y, unsigned *m, unsigned *d) {
+    int64_t era;
+    unsigned doe, yoe, doy, mp;
+
+    z += 719468;
+    era = (z >= 0 ? z : z - 146096) / 146097;
+    doe = (unsigned)(z - era * 146097);
+    yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    mp = (5 * doy + 2) / 153;
+    *d = doy - (153 * mp + 2) / 5 + 1;
+    *m = mp < 10 ? mp + 3 : mp - 9;
+    *y = (int64_t)yoe + era * 400 + (*m <= 2);
+}
+
+
+/*
+ * mummy -> msgpack, as mummy_walk callbacks
+ */
+
+typedef struct {
+    mummy_string *str;
+    mummy_string *out;
+    mummy_walker *walker;
+} msgpack_writer;
+
+/* the top-level value is finished once there's nothing left open */
+static int
+msgpack_done(msgpack_writer *msgpack, int rc) {
+    if (rc) return rc;
+    return msgpack->walker->depth ? 0 : MUMMY_WALK_STOP;
+}
+
+static int
+msgpack_null(void *ctx) {
+    msgpack_writer *msgpack = ctx;
+    return msgpack_done(msgpack, put_tagged(msgpack->out, 0xc0, 0, 0));
+}
+
+static int
+msgpack_boolean(void *ctx, char value) {
+    msgpack_writer *msgpack = ctx;
+    return msgpack_done(msgpack,
+            put_tagged(msgpack->out, value ? 0xc3 : 0xc2, 0, 0));
+}
+
+static int
+msgpack_integer(void *ctx, int64_t value) {
+    msgpack_writer *msgpack = ctx;
+    return msgpack_done(msgpack, put_int(msgpack->out, value));
+}
+
+/* msgpack ints stop at 64 bits, signed or not */
+static int
+msgpack_huge(void *ctx, char *data, int len) {
+    msgpack_writer *msgpack = ctx;
+    unsigned char *bytes = (unsigned char *)data;
+    uint64_t num = 0;
+    int i;
+
+    if (len == 9 && !bytes[0]) {
+        ++bytes;
+        --len;
+        if (bytes[0] & 0x80) {
+            for (i = 0; i < 8; ++i) num = (num << 8) | bytes[i];
+            return msgpack_done(msgpack,
+                    put_tagged(msgpack->out, 0xcf, 8, num));
+        }
+    }
+    if (len > 8) return EINVAL;
+
+    if (len && (bytes[0] & 0x80)) num = ~(uint64_t)0;
+    for (i = 0; i < len; ++i) num = (num << 8) | bytes[i];
+    return msgpack_done(msgpack, put_int(msgpack->out, (int64_t)num));
+}
+
+static int
+msgpack_floating(void *ctx, double value) {
+    msgpack_writer *msgpack = ctx;
+    uint64_t bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+    return msgpack_done(msgpack, put_tagged(msgpack->out, 0xcb, 8, bits));
+}
+
+static int
+msgpack_string(void *ctx, char *data, int len) {
+    msgpack_writer *msgpack = ctx;
+    int rc;
+
+    if ((rc = put_sized(msgpack->out, 0, -1, 0xc4, 0xc5, 0xc6, len)))
+        return rc;
+    return msgpack_done(msgpack, put(msgpack->out, data, len));
+}
+
+static int
+msgpack_utf8(void *ctx, char *data, int len) {
+    msgpack_writer *msgpack = ctx;
+    int rc;
+
+    if ((rc = put_sized(msgpack->out, 0xa0, 31, 0xd9, 0xda, 0xdb, len)))
+        return rc;
+    return msgpack_done(msgpack, put(msgpack->out, data, len));
+}
+
+static int
+msgpack_begin_sequence(void *ctx, uint32_t size) {
+    msgpack_writer *msgpack = ctx;
+    return put_sized(msgpack->out, 0x90, 15, 0, 0xdc, 0xdd, size);
+}
+
+static int
+msgpack_begin_hash(void *ctx, uint32_t size) {
+    msgpack_writer *msgpack = ctx;
+    return put_sized(msgpack->out, 0x80, 15, 0, 0xde, 0xdf, size);
+}
+
+static int
+msgpack_end(void *ctx) {
+    return msgpack_done(ctx, 0);
+}
+
+/* the extension type mummy-only values travel in, as their mummy bytes */
+#define MSGPACK_EXT_MUMMY 0x4d
+#define MSGPACK_EXT_TIMESTAMP -1
+
+static void
+store(char *buf, int width, uint64_t num) {
+    int i;
+    for (i = 0; i < width; ++i)
+        buf[width - 1 - i] = (char)(num >> (i * 8));
+}
+
+static int
+put_ext(mummy_string *out, signed char type, const char *data, int len) {
+    char head[6];
+    int size, rc;
+
+    switch (len) {
+    case 1: head[0] = (char)0xd4; size = 1; break;
+    case 2: head[0] = (char)0xd5; size = 1; break;
+    case 4: head[0] = (char)0xd6; size = 1; break;
+    case 8: head[0] = (char)0xd7; size = 1; break;
+    case 16: head[0] = (char)0xd8; size = 1; break;
+    default:
+        if (len < 256) {
+            head[0] = (char)0xc7;
+            store(head + 1, 1, len);
+            size = 2;
+        } else if (len < 65536) {
+            head[0] = (char)0xc8;
+            store(head + 1, 2, len);
+            size = 3;
+        } else {
+            head[0] = (char)0xc9;
+            store(head + 1, 4, len);
+            size = 5;
+        }
+    }
+    head[size++] = type;
+
+    if ((rc = put(out, head, size))) return rc;
+    return put(out, data, len);
+}
+
+/* a naive datetime is taken as UTC, for the timestamp extension */
+static int
+msgpack_timestamp(msgpack_writer *msgpack, mummy_token *token) {
+    char buf[12];
+    int64_t seconds;
+    uint64_t packed;
+    uint32_t nanoseconds;
+
+    seconds = days_from_civil(token->v.dt.year, token->v.dt.month,
+            token->v.dt.day) * 86400 + token->v.dt.hour * 3600 +
+        token->v.dt.minute * 60 + token->v.dt.second;
+    nanoseconds = (uint32_t)token->v.dt.microsecond * 1000;
+
+    /* the smallest of the three layouts that holds it */
+    if (seconds >= 0 && !(seconds >> 34)) {
+        packed = ((uint64_t)nanoseconds << 34) | (uint64_t)seconds;
+        if (!(packed >> 32)) {
+            store(buf, 4, packed);
+            return put_ext(msgpack->out, MSGPACK_EXT_TIMESTAMP, buf, 4);
+        }
+        store(buf, 8, packed);
+        return put_ext(msgpack->out, MSGPACK_EXT_TIMESTAMP, buf, 8);
+    }
+    store(buf, 4, nanoseconds);
+    store(buf + 4, 8, (uint64_t)seconds);
+    return put_ext(msgpack->out, MSGPACK_EXT_TIMESTAMP, buf, 12);
+}
+
+/* datetimes become timestamps, and what msgpack has nothing for (dates,
+   times, time differences, decimals and fractions) goes in an extension
+   as its mummy bytes, which mummy_from_msgpack puts back */
+static int
+msgpack_other(void *ctx, mummy_token *token) {
+    msgpack_writer *msgpack = ctx;
+    int size;
+
+    switch (token->type) {
+    case MUMMY_TYPE_DATETIME:
+        return msgpack_done(msgpack, msgpack_timestamp(msgpack, token));
+    case MUMMY_TYPE_DATE: size = 5; break;
+    case MUMMY_TYPE_TIME: size = 7; break;
+    case MUMMY_TYPE_TIMEDELTA: size = 13; break;
+    case MUMMY_TYPE_SPECIALNUM: size = 2; break;
+    case MUMMY_TYPE_FRACTION: size = 17; break;
+    case MUMMY_TYPE_DECIMAL:
+        size = 6 + (token->v.decimal.count >> 1) +
+            (token->v.decimal.count & 1);
+        break;
+    default:
+        return EINVAL;
+    }
+
+    /* the walk has just read past it */
+    return msgpack_done(msgpack, put_ext(msgpack->out, MSGPACK_EXT_MUMMY,
+                msgpack->str->data + msgpack->str->offset - size, size));
+}
+
+static const mummy_walk_callbacks msgpack_callbacks = {
+    msgpack_null,
+    msgpack_boolean,
+    msgpack_integer,
+    msgpack_huge,
+    msgpack_floating,
+    msgpack_string,
+    msgpack_utf8,
+    msgpack_begin_sequence,
+    msgpack_begin_sequence,
+    msgpack_begin_sequence,
+    msgpack_begin_hash,
+    msgpack_end,
+    msgpack_other
+};
+
+int
+mummy_to_msgpack(mummy_string *str, mummy_string *out) {
+    mummy_walker walker;
+    msgpack_writer msgpack;
+    int start = out->offset, rc;
+
+    msgpack.str = str;
+    msgpack.out = out;
+    msgpack.walker = &walker;
+    mummy_walker_init(&walker, &msgpack_callbacks, &msgpack);
+
+    rc = mummy_walk(&walker, str);
+    if (rc == MUMMY_WALK_STOP) return 0;
+
+    out->offset = start;
+    return rc ? rc : -1;
+}
+
+
+/*
+ * msgpack -> mummy
+ */
+
+/* `width` big-endian bytes from `at` past the offset */
+static int
+load(mummy_string *str, int at, int width, uint64_t *num) {
+    unsigned char *data = (unsigned char *)str->data + str->offset + at;
+    int i;
+
+    if (mummy_string_space(str) < at + width) return -1;
+    *num = 0;
+    for (i = 0; i < width; ++i) *num = (*num << 8) | data[i];
+    return 0;
+}
+
+/* whether `len` bytes past a `head` byte header are all there */
+static int
+holds(mummy_string *str, int head, uint64_t len) {
+    int space = mummy_string_space(str);
+    return space >= head && (uint64_t)(space - head) >= len;
+}
+
+static int
+feed_uint(mummy_string *out, uint64_t num) {
+    char buf[9];
+
+    if (num <= (uint64_t)INT64_MAX) return mummy_feed_int(out, (int64_t)num);
+
+    /* a 9 byte huge, as python writes it */
+    buf[0] = 0;
+    store(buf + 1, 8, num);
+    return mummy_feed_huge(out, buf, 9);
+}
+
+static int
+feed_timestamp(mummy_string *out, const unsigned char *data, int len) {
+    int64_t seconds, days, rest, year;
+    uint32_t nanoseconds = 0;
+    uint64_t packed = 0;
+    unsigned month, day;
+    int i;
+
+    for (i = 0; i < len && i < 8; ++i) packed = (packed << 8) | data[i];
+    switch (len) {
+    case 4:
+        seconds = (int64_t)packed;
+        break;
+    case 8:
+        nanoseconds = (uint32_t)(packed >> 34);
+        seconds = (int64_t)(packed & 0x3ffffffffULL);
+        break;
+    case 12:
+        nanoseconds = (uint32_t)(packed >> 32);
+        seconds = 0;
+        for (i = 4; i < 12; ++i) seconds = (int64_t)(
+                ((uint64_t)seconds << 8) | data[i]);
+        break;
+    default:
+        return EINVAL;
+    }
+    if (nanoseconds >= 1000000000) return EINVAL;
+
+    days = seconds / 86400 - (seconds % 86400 < 0);
+    rest = seconds - days * 86400;
+    if (days < -719162 || days > 2932896) return EINVAL;
+    civil_from_days(days, &year, &month, &day);
+
+    return mummy_feed_datetime(out, (short)year, (char)month, (char)day,
+            (char)(rest / 3600), (char)(rest / 60 % 60), (char)(rest % 60),
+            (int)(nanoseconds / 1000));
+}
+
+/* a mummy-only value has to be one whole non-container token */
+static int
+feed_mummy_ext(mummy_string *out, char *data, int len) {
+    mummy_string value;
+    mummy_token token;
+
+    value.data = data;
+    value.offset = 0;
+    value.len = len;
+    if (mummy_read_token(&value, &token) || value.offset != len ||
+            (MUMMY_TYPE_LONGLIST <= token.type &&
+             token.type <= MUMMY_TYPE_MEDHASH))
+        return EINVAL;
+    return put(out, data, len);
+}
+
+/* write one msgpack item (taking the offset past it), and for an array or
+   map, how many items follow in it */
+static int
+msgpack_item(mummy_string *str, mummy_string *out, uint64_t *items) {
+    unsigned char type;
+    uint64_t num, len;
+    int head, width, rc;
+    char *data;
+    uint32_t bits;
+    float f32;
+    double f64;
+
+    *items = 0;
+    if (mummy_string_space(str) < 1) return -1;
+    type = (unsigned char)str->data[str->offset];
+
+    if (type < 0x80 || type >= 0xe0) {
+        str->offset++;
+        return mummy_feed_int(out, (int8_t)type);
+    }
+    if (type < 0x90) {
+        str->offset++;
+        *items = (type & 0x0f) * 2;
+        return mummy_open_hash(out, type & 0x0f);
+    }
+    if (type < 0xa0) {
+        str->offset++;
+        *items = type & 0x0f;
+        return mummy_open_list(out, type & 0x0f);
+    }
+    if (type < 0xc0) {
+        head = 1;
+        len = type & 0x1f;
+        goto utf8;
+    }
+
+    switch (type) {
+    case 0xc0:
+        str->offset++;
+        return mummy_feed_null(out);
+    case 0xc2:
+    case 0xc3:
+        str->offset++;
+        return mummy_feed_bool(out, type & 1);
+
+    case 0xc4:
+    case 0xc5:
+    case 0xc6:
+        width = 1 << (type - 0xc4);
+        if ((rc = load(str, 1, width, &len))) return rc;
+        head = 1 + width;
+        if (!holds(str, head, len)) return -1;
+        data = str->data + str->offset + head;
+        str->offset += head + (int)len;
+        return mummy_feed_string(out, data, (int)len);
+
+    case 0xc7:
+    case 0xc8:
+    case 0xc9:
+        width = 1 << (type - 0xc7);
+        if ((rc = load(str, 1, width, &len))) return rc;
+        head = 2 + width;
+        goto ext;
+    case 0xd4:
+    case 0xd5:
+    case 0xd6:
+    case 0xd7:
+    case 0xd8:
+        len = 1 << (type - 0xd4);
+        head = 2;
+        goto ext;
+
+    case 0xca:
+        if ((rc = load(str, 1, 4, &num))) return rc;
+        bits = (uint32_t)num;
+        memcpy(&f32, &bits, 4);
+        str->offset += 5;
+        return mummy_feed_float(out, f32);
+    case 0xcb:
+        if ((rc = load(str, 1, 8, &num))) return rc;
+        memcpy(&f64, &num, 8);
+        str->offset += 9;
+        return mummy_feed_float(out, f64);
+
+    case 0xcc:
+    case 0xcd:
+    case 0xce:
+    case 0xcf:
+        width = 1 << (type - 0xcc);
+        if ((rc = load(str, 1, width, &num))) return rc;
+        str->offset += 1 + width;
+        return feed_uint(out, num);
+    case 0xd0:
+    case 0xd1:
+    case 0xd2:
+    case 0xd3:
+        width = 1 << (type - 0xd0);
+        if ((rc = load(str, 1, width, &num))) return rc;
+        str->offset += 1 + width;
+        /* sign extend */
+        if (width < 8 && (num >> (width * 8 - 1)))
+            num |= ~(uint64_t)0 << (width * 8);
+        return mummy_feed_int(out, (int64_t)num);
+
+    case 0xd9:
+    case 0xda:
+    case 0xdb:
+        width = 1 << (type - 0xd9);
+        if ((rc = load(str, 1, width, &len))) return rc;
+        head = 1 + width;
+        goto utf8;
+
+    case 0xdc:
+    case 0xdd:
+        if ((rc = load(str, 1, type == 0xdc ? 2 : 4, &num))) return rc;
+        str->offset += type == 0xdc ? 3 : 5;
+        /* every item takes at least a byte */
+        if (num > (uint64_t)mummy_string_space(str)) return -1;
+        *items = num;
+        return mummy_open_list(out, (int)num);
+    case 0xde:
+    case 0xdf:
+        if ((rc = load(str, 1, type == 0xde ? 2 : 4, &num))) return rc;
+        str->offset += type == 0xde ? 3 : 5;
+        if (num * 2 > (uint64_t)mummy_string_space(str)) return -1;
+        *items = num * 2;
+        return mummy_open_hash(out, (int)num);
+    }
+    return -2;
+
+utf8:
+    if (!holds(str, head, len)) return -1;
+    data = str->data + str->offset + head;
+    str->offset += head + (int)len;
+    return mummy_feed_utf8(out, data, (int)len);
+
+ext:
+    if (!holds(str, head, len)) return -1;
+    data = str->data + str->offset + head;
+    switch ((signed char)str->data[str->offset + head - 1]) {
+    case MSGPACK_EXT_TIMESTAMP:
+        rc = feed_timestamp(out, (unsigned char *)data, (int)len);
+        break;
+    case MSGPACK_EXT_MUMMY:
+        rc = feed_mummy_ext(out, data, (int)len);
+        break;
+    default:
+        rc = EINVAL;
+    }
+    if (!rc) str->offset += head + (int)len;
+    return rc;
+}
+
+int
+mummy_from_msgpack(mummy_string *str, mummy_string *out) {
+    uint64_t left[MUMMY_WALK_MAX_DEPTH], items;
+    int depth = 0, start = out->offset, rc;
+
+    do {
+        if ((rc = msgpack_item(str, out, &items))) break;
+        if (depth) left[depth - 1]--;
+
+        if (items) {
+            if (depth == MUMMY_WALK_MAX_DEPTH) {
+                rc = -3;
+                break;
+            }
+            left[depth++] = items;
+        }
+        while (depth && !left[depth - 1]) --depth;
+    } while (depth);
+
+    if (rc) out->offset = start;
+    return rc;
+}
@@ -1,12 +1,28 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <limits.h>
 
 #include "lzf.h"
 #include "mummy.h"
+#include "unaligned.h"
+#include "probes.h"
+#include "alloc.h"
 
 
-inline mummy_string *
+/* the version of the library actually linked, which may not be the one whose
+   header was compiled against */
+int
+mummy_version(void) {
+    return MUMMY_VERSION_NUMBER;
+}
+
+const char *
+mummy_version_string(void) {
+    return MUMMY_VERSION_STRING;
+}
+
+mummy_string *
 mummy_string_new(int initial_buffer) {
     mummy_string *str;
 
@@ -21,9 +37,10 @@ mummy_string_new(int initial_buffer) {
     return str;
 }
 
-inline mummy_string *
+mummy_string *
 mummy_string_wrap(char *buffer, int size) {
     mummy_string *str = mummy_string_new(0);
+    if (!str) return NULL;
     str->data = buffer;
     str->len = size;
     return str;
@@ -31,7 +48,7 @@ mummy_string_wrap(char *buffer, int size) {
 
 
 /* replacing this with a macro in mummy.h for now
-inline int
+int
 mummy_string_makespace(mummy_string *str, int size) {
     char *temp;
     int oldlen;
@@ -55,7 +72,7 @@ mummy_string_makespace(mummy_string *str, int size) {
 
 /* compress from THE BEGINNING up to the cursor.
    everything after the cursor is thrown away */
-inline int
+int
 mummy_string_compress(mummy_string *str) {
     char *output, *temp;
     int compressed;
@@ -67,11 +84,18 @@ mummy_string_compress(mummy_string *str) {
     if (str->offset <= 6) return 0;
 
     if (!(output = malloc(str->offset - 1))) return ENOMEM;
+    mummy_stats_count(compress_attempts, 1);
+    mummy_probe1(compress__start, str->offset);
     if (0 >= (compressed = lzf_compress(str->data + 1, str->offset - 1,
             output + 5, str->offset - 6))) {
+        mummy_probe2(compress__done, str->offset, 0);
         free(output);
         return 0;
     }
+    mummy_probe2(compress__done, str->offset, compressed + 5);
+    mummy_stats_count(compress_saves, 1);
+    mummy_stats_count(compress_bytes_in, str->offset);
+    mummy_stats_count(compress_bytes_out, compressed + 5);
 
     /* realloc the output buffer down to be a snug fit */
     if (compressed < str->offset - 6) {
@@ -80,14 +104,14 @@ mummy_string_compress(mummy_string *str) {
     }
 
     output[0] = str->data[0] | 0x80;
-    *(uint32_t *)(output + 1) = htonl(str->offset - 1);
+    mummy_pack32(output + 1, str->offset - 1);
     free(str->data);
     str->data = output;
     str->offset = str->len = compressed + 5;
     return 0;
 }
 
-inline int
+int
 mummy_string_decompress(mummy_string *str, char free_buffer, char *rc) {
     uint32_t ucsize;
     char *output;
@@ -95,22 +119,33 @@ mummy_string_decompress(mummy_string *str, char free_buffer, char *rc) {
     *rc = 0;
 
     /* not compressed */
-    if (0 == (str->data[0] & 0x80)) return 0;
-
-    ucsize = ntohl(*(uint32_t *)(str->data + 1));
-    if (NULL == (output = malloc(ucsize + 2)))
+    if (!str->len || 0 == (str->data[0] & 0x80)) return 0;
+    /* the type byte and size, then at least one byte of lzf data */
+    if (str->len <= 5) return EINVAL;
+
+    /* the size comes from the data, and has to fit in the string's int
+       length (with the type byte) before anything is allocated for it */
+    ucsize = mummy_unpack32(str->data + 1);
+    if (ucsize >= INT_MAX - 1) return EINVAL;
+    if (NULL == (output = malloc((size_t)ucsize + 2)))
         return ENOMEM;
 
     output[0] = str->data[0] & 0x7f;
+    mummy_probe1(decompress__start, str->len);
     if (ucsize != lzf_decompress(
             str->data + 5, str->len - 5, output + 1, ucsize + 1)) {
+        mummy_probe2(decompress__done, str->len, 0);
         if (E2BIG == errno || EINVAL == errno) {
             free(output);
             return errno;
         }
+        free(output);
         return -2;
     }
+    mummy_probe2(decompress__done, str->len, ucsize + 1);
 
+    mummy_stats_count(decompressions, 1);
+    mummy_stats_count(decompressed_bytes, ucsize + 1);
     *rc = 1;
     if (free_buffer) free(str->data);
     str->data = output;
@@ -118,7 +153,7 @@ mummy_string_decompress(mummy_string *str, char free_buffer, char *rc) {
     return 0;
 }
 
-inline void
+void
 mummy_string_free(mummy_string *str, char also_buffer) {
     if (also_buffer) free(str->data);
     free(str);
@@ -0,0 +1,29 @@
+#ifndef _MUMMY_PROBES_H
+#define _MUMMY_PROBES_H
+
+/*
+ * static tracepoints in the "mummy" provider, for perf, bpftrace and the
+ * like to attach to (usdt:libmummy.so:mummy:compress__done). they're built
+ * in wherever systemtap's <sys/sdt.h> is installed, unless MUMMY_NO_PROBES
+ * is defined, and each is a single nop until something attaches. sizes are
+ * passed as longs.
+ */
+#if !defined(MUMMY_NO_PROBES) && defined(__has_include)
+    #if __has_include(<sys/sdt.h>)
+        #include <sys/sdt.h>
+        #define MUMMY_HAVE_PROBES 1
+    #endif
+#endif
+
+#ifdef MUMMY_HAVE_PROBES
+    #define mummy_probe0(name) DTRACE_PROBE(mummy, name)
+    #define mummy_probe1(name, a) DTRACE_PROBE1(mummy, name, (long)(a))
+    #define mummy_probe2(name, a, b) \
+        DTRACE_PROBE2(mummy, name, (long)(a), (long)(b))
+#else
+    #define mummy_probe0(name) ((void)0)
+    #define mummy_probe1(name, a) ((void)0)
+    #define mummy_probe2(name, a, b) ((void)0)
+#endif
+
+#endif /* _MUMMY_PROBES_H */
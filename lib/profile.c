@@ -0,0 +1,510 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mummy.h"
+#include "lzf.h"
+#include "alloc.h"
+
+
+/* how much of a key a path spells out */
+#define KEY_MAX 64
+
+/* subtrees shorter than this aren't worth compressing to find out */
+#define SQUEEZE_MIN 16
+
+#define NO_PATH ((size_t)-1)
+
+static const char *type_names[MUMMY_PROFILE_TYPES] = {
+    "null", "bool", "char", "short", "int", "long", "huge", "float",
+    "shortstr", "longstr", "shortutf8", "longutf8",
+    "longlist", "longtuple", "longset", "longhash",
+    "shortlist", "shorttuple", "shortset", "shorthash",
+    "medlist", "medtuple", "medset", "medhash", "medstr", "medutf8",
+    "date", "time", "datetime", "timedelta", "decimal", "specialnum",
+    "fraction"};
+
+const char *
+mummy_type_name(int type) {
+    if (type < 0 || type >= MUMMY_PROFILE_TYPES) return NULL;
+    return type_names[type];
+}
+
+/* the type that stands for all the widths of `type`'s kind (the short one),
+   with how wide this one is among them */
+static int
+kind_of(int type, int *width) {
+    *width = 0;
+    switch (type) {
+    case MUMMY_TYPE_HUGE: (*width)++;
+    case MUMMY_TYPE_LONG: (*width)++;
+    case MUMMY_TYPE_INT: (*width)++;
+    case MUMMY_TYPE_SHORT: (*width)++;
+    case MUMMY_TYPE_CHAR: return MUMMY_TYPE_CHAR;
+    case MUMMY_TYPE_LONGSTR: (*width)++;
+    case MUMMY_TYPE_MEDSTR: (*width)++;
+    case MUMMY_TYPE_SHORTSTR: return MUMMY_TYPE_SHORTSTR;
+    case MUMMY_TYPE_LONGUTF8: (*width)++;
+    case MUMMY_TYPE_MEDUTF8: (*width)++;
+    case MUMMY_TYPE_SHORTUTF8: return MUMMY_TYPE_SHORTUTF8;
+    }
+    if (MUMMY_TYPE_LONGLIST <= type && type <= MUMMY_TYPE_LONGHASH) {
+        *width = 2;
+        return type + 4;
+    }
+    if (MUMMY_TYPE_MEDLIST <= type && type <= MUMMY_TYPE_MEDHASH) {
+        *width = 1;
+        return type - 4;
+    }
+    return type;
+}
+
+static int
+varint_size(uint64_t num) {
+    int size = 1;
+    while (num >>= 7) ++size;
+    return size;
+}
+
+/* names to indexes, holding copies of the names */
+typedef struct {
+    char *name;
+    int len;
+    size_t index;
+} name_slot;
+
+typedef struct {
+    name_slot *slots;
+    size_t size;
+    size_t used;
+} name_table;
+
+static size_t
+hash_name(const char *name, int len) {
+    size_t h = 2166136261u;
+    int i;
+    for (i = 0; i < len; ++i) h = (h ^ (unsigned char)name[i]) * 16777619u;
+    return h;
+}
+
+static int
+grow_names(name_table *t) {
+    size_t size = t->size ? t->size << 1 : 256, i, j;
+    name_slot *slots;
+
+    if (!(slots = calloc(size, sizeof(name_slot)))) return ENOMEM;
+    for (i = 0; i < t->size; ++i) {
+        if (!t->slots[i].name) continue;
+        j = hash_name(t->slots[i].name, t->slots[i].len) & (size - 1);
+        while (slots[j].name) j = (j + 1) & (size - 1);
+        slots[j] = t->slots[i];
+    }
+    free(t->slots);
+    t->slots = slots;
+    t->size = size;
+    return 0;
+}
+
+/* find `name`, or add it as the next index. *added is set if it was new,
+   and *copy to the table's (NUL terminated) copy of the name */
+static int
+lookup_name(name_table *t, const char *name, int len, size_t *index,
+        char *added, char **copy) {
+    size_t i;
+
+    *added = 0;
+    if (2 * (t->used + 1) > t->size && grow_names(t)) return ENOMEM;
+
+    i = hash_name(name, len) & (t->size - 1);
+    while (t->slots[i].name) {
+        if (t->slots[i].len == len && !memcmp(t->slots[i].name, name, len)) {
+            *index = t->slots[i].index;
+            *copy = t->slots[i].name;
+            return 0;
+        }
+        i = (i + 1) & (t->size - 1);
+    }
+
+    if (!(t->slots[i].name = *copy = malloc(len + 1))) return ENOMEM;
+    memcpy(t->slots[i].name, name, len);
+    t->slots[i].name[len] = 0;
+    t->slots[i].len = len;
+    t->slots[i].index = *index = t->used++;
+    *added = 1;
+    return 0;
+}
+
+static void
+free_names(name_table *t) {
+    size_t i;
+    for (i = 0; i < t->size; ++i) free(t->slots[i].name);
+    free(t->slots);
+}
+
+struct mummy_profile_state {
+    mummy_walker walker;
+    mummy_profile *profile;
+    mummy_string *str;
+    int mark; /* where the token being called back for starts */
+    int start; /* and the value being added */
+    char done;
+
+    name_table path_names;
+    size_t paths_cap;
+    name_table keys;
+
+    int64_t varint_change;
+    uint64_t string_key_bytes;
+    uint64_t key_refs;
+    uint64_t key_table;
+
+    char *path;
+    int path_cap;
+    int key_end; /* the length of the path with the last key added */
+    uint64_t key_size; /* and that key's bytes */
+
+    char *scratch; /* lzf output */
+    int scratch_len;
+
+    int depth;
+    struct {
+        int path_len;
+        int start;
+        size_t path;
+        char hash;
+        char record; /* the paths inside are being recorded */
+        uint64_t seen;
+    } levels[MUMMY_WALK_MAX_DEPTH];
+};
+
+static int
+ensure_path(struct mummy_profile_state *st, int len) {
+    int cap = st->path_cap ? st->path_cap : 256;
+    char *path;
+
+    if (len <= st->path_cap) return 0;
+    while (cap < len) cap <<= 1;
+    if (!(path = realloc(st->path, cap))) return ENOMEM;
+    st->path = path;
+    st->path_cap = cap;
+    return 0;
+}
+
+/* the path so far, added if it's new */
+static size_t
+find_path(struct mummy_profile_state *st, int len, int type) {
+    mummy_profile *p = st->profile;
+    mummy_profile_path *entry;
+    size_t index;
+    char added, *copy;
+    int kind, width, old_width;
+
+    if (lookup_name(&st->path_names, st->path, len, &index, &added, &copy))
+        return NO_PATH;
+
+    if (!added) {
+        entry = &p->paths[index];
+        if (entry->type >= 0 && entry->type != type) {
+            kind = kind_of(type, &width);
+            if (kind != kind_of(entry->type, &old_width)) entry->type = -1;
+            else if (width > old_width) entry->type = type;
+        }
+        return index;
+    }
+
+    if (p->npaths == st->paths_cap) {
+        st->paths_cap = st->paths_cap ? st->paths_cap << 1 : 64;
+        if (!(entry = realloc(p->paths,
+                        st->paths_cap * sizeof(mummy_profile_path))))
+            return NO_PATH;
+        p->paths = entry;
+    }
+    entry = &p->paths[p->npaths++];
+    memset(entry, 0, sizeof(mummy_profile_path));
+    entry->path = copy; /* freed with the table */
+    entry->type = type;
+    return index;
+}
+
+/* spell a hash key onto the end of the path at `len` */
+static int
+add_key(struct mummy_profile_state *st, int len, const char *key,
+        int key_len) {
+    int i;
+
+    if (key_len > KEY_MAX) key_len = KEY_MAX;
+    st->path[len++] = '.';
+    for (i = 0; i < key_len; ++i) {
+        st->path[len++] = (unsigned char)key[i] < 0x20 || key[i] == '.' ||
+            key[i] == '[' ? '?' : key[i];
+    }
+    return len;
+}
+
+/* what `len` bytes from `start` lzf compress to, if that's any smaller */
+static int64_t
+squeeze(struct mummy_profile_state *st, int start, int len) {
+    unsigned int packed;
+    char *scratch;
+
+    if (len < SQUEEZE_MIN) return len;
+    if (len > st->scratch_len) {
+        if (!(scratch = realloc(st->scratch, len))) return -1;
+        st->scratch = scratch;
+        st->scratch_len = len;
+    }
+    packed = lzf_compress(st->str->data + start, len, st->scratch, len - 1);
+    return packed ? (int64_t)packed : len;
+}
+
+static int
+count_key(struct mummy_profile_state *st, int kind, int bytes) {
+    mummy_profile *p = st->profile;
+    size_t index;
+    char added, *copy;
+
+    p->key_count++;
+    p->key_bytes += bytes;
+    st->key_size = bytes;
+    if (kind != MUMMY_TYPE_SHORTSTR && kind != MUMMY_TYPE_SHORTUTF8) return 0;
+
+    /* keyed by the whole token, so the type byte tells bytes from text */
+    if (lookup_name(&st->keys, st->str->data + st->mark, bytes, &index,
+                &added, &copy))
+        return ENOMEM;
+    st->string_key_bytes += bytes;
+    st->key_refs += 1 + varint_size(index);
+    if (added) {
+        p->distinct_keys++;
+        st->key_table += bytes;
+    }
+    return 0;
+}
+
+/* `len` is a string's length or a container's count, and `num` an int's
+   value, for the varint estimate */
+static int
+profile_item(struct mummy_profile_state *st, int begin, uint32_t len,
+        int64_t num, const char *key, int key_len) {
+    mummy_profile *p = st->profile;
+    int type = (unsigned char)st->str->data[st->mark], width, rc;
+    int kind = kind_of(type, &width), depth = st->depth;
+    int bytes = st->str->offset - st->mark, header = 1;
+    int path_len = 0, record = 1, is_string = 0;
+    int64_t squeezed = bytes;
+    size_t path = NO_PATH;
+
+    p->counts[type]++;
+    p->sizes[type] += bytes;
+
+    switch (kind) {
+    case MUMMY_TYPE_CHAR:
+        if (type != MUMMY_TYPE_HUGE)
+            st->varint_change += 1 + varint_size(
+                    ((uint64_t)num << 1) ^ (uint64_t)(num >> 63)) - bytes;
+        break;
+    case MUMMY_TYPE_SHORTSTR:
+    case MUMMY_TYPE_SHORTUTF8:
+        is_string = 1;
+        header = bytes - len;
+        st->varint_change += 1 + varint_size(len) - header;
+        break;
+    case MUMMY_TYPE_SHORTLIST:
+    case MUMMY_TYPE_SHORTTUPLE:
+    case MUMMY_TYPE_SHORTSET:
+    case MUMMY_TYPE_SHORTHASH:
+        header = bytes;
+        st->varint_change += 1 + varint_size(len) - header;
+        break;
+    }
+    p->header_bytes += header;
+
+    if (depth) {
+        record = st->levels[depth - 1].record;
+        if (st->levels[depth - 1].hash &&
+                !(st->levels[depth - 1].seen++ & 1)) {
+            /* a key, naming the value that comes next */
+            if ((rc = count_key(st, kind, bytes))) return rc;
+            if (record) {
+                if (ensure_path(st,
+                            st->levels[depth - 1].path_len + KEY_MAX + 3))
+                    return ENOMEM;
+                st->key_end = add_key(st, st->levels[depth - 1].path_len,
+                        key ? key : "?", key ? key_len : 1);
+            }
+            record = 0;
+        } else if (st->levels[depth - 1].hash) {
+            path_len = st->key_end;
+        } else {
+            st->levels[depth - 1].seen++;
+            path_len = st->levels[depth - 1].path_len;
+            if (record) {
+                if (ensure_path(st, path_len + 3)) return ENOMEM;
+                memcpy(st->path + path_len, "[]", 2);
+                path_len += 2;
+            }
+        }
+    }
+
+    if (record && depth <= p->max_depth) {
+        if (NO_PATH == (path = find_path(st, path_len, type))) return ENOMEM;
+        p->paths[path].count++;
+        if (depth && st->levels[depth - 1].hash)
+            p->paths[path].key_bytes += st->key_size;
+        if (begin) {
+            p->paths[path].items += len;
+        } else {
+            if (is_string && (squeezed = squeeze(st, st->mark, bytes)) < 0)
+                return ENOMEM;
+            p->paths[path].bytes += bytes;
+            p->paths[path].compressed += squeezed;
+        }
+    }
+
+    st->mark = st->str->offset;
+
+    if (begin) {
+        st->levels[depth].path_len = path_len;
+        st->levels[depth].start = st->mark - bytes;
+        st->levels[depth].path = path;
+        st->levels[depth].hash = kind == MUMMY_TYPE_SHORTHASH;
+        st->levels[depth].record = record && depth < p->max_depth;
+        st->levels[depth].seen = 0;
+        st->depth++;
+        return 0;
+    }
+    if (depth) return 0;
+    st->done = 1;
+    return MUMMY_WALK_STOP;
+}
+
+static int
+profile_atom(void *ctx) {
+    return profile_item(ctx, 0, 0, 0, NULL, 0);
+}
+
+static int
+profile_boolean(void *ctx, char value) {
+    return profile_item(ctx, 0, 0, 0, NULL, 0);
+}
+
+static int
+profile_integer(void *ctx, int64_t value) {
+    char key[24];
+    return profile_item(ctx, 0, 0, value, key,
+            sprintf(key, "%" PRId64, value));
+}
+
+static int
+profile_huge(void *ctx, char *data, int len) {
+    return profile_item(ctx, 0, 0, 0, NULL, 0);
+}
+
+static int
+profile_floating(void *ctx, double value) {
+    return profile_item(ctx, 0, 0, 0, NULL, 0);
+}
+
+static int
+profile_string(void *ctx, char *data, int len) {
+    return profile_item(ctx, 0, len, 0, data, len);
+}
+
+static int
+profile_begin(void *ctx, uint32_t size) {
+    return profile_item(ctx, 1, size, 0, NULL, 0);
+}
+
+static int
+profile_other(void *ctx, mummy_token *token) {
+    return profile_item(ctx, 0, 0, 0, NULL, 0);
+}
+
+static int
+profile_end(void *ctx) {
+    struct mummy_profile_state *st = ctx;
+    mummy_profile *p = st->profile;
+    int depth = --st->depth;
+    int len = st->str->offset - st->levels[depth].start;
+    int64_t squeezed;
+
+    st->mark = st->str->offset;
+    if (st->levels[depth].path != NO_PATH) {
+        if ((squeezed = squeeze(st, st->levels[depth].start, len)) < 0)
+            return ENOMEM;
+        p->paths[st->levels[depth].path].bytes += len;
+        p->paths[st->levels[depth].path].compressed += squeezed;
+    }
+    if (depth) return 0;
+    st->done = 1;
+    return MUMMY_WALK_STOP;
+}
+
+static const mummy_walk_callbacks profile_callbacks = {
+    profile_atom,
+    profile_boolean,
+    profile_integer,
+    profile_huge,
+    profile_floating,
+    profile_string,
+    profile_string,
+    profile_begin,
+    profile_begin,
+    profile_begin,
+    profile_begin,
+    profile_end,
+    profile_other
+};
+
+mummy_profile *
+mummy_profile_new(int max_depth) {
+    mummy_profile *p;
+
+    if (!(p = calloc(1, sizeof(mummy_profile)))) return NULL;
+    if (!(p->state = calloc(1, sizeof(struct mummy_profile_state)))) {
+        free(p);
+        return NULL;
+    }
+    p->state->profile = p;
+    p->max_depth = max_depth < 0 ? 0 : max_depth;
+    return p;
+}
+
+int
+mummy_profile_add(mummy_profile *p, mummy_string *str) {
+    struct mummy_profile_state *st = p->state;
+    int rc;
+
+    if (ensure_path(st, 1)) return ENOMEM;
+    st->str = str;
+    st->mark = st->start = str->offset;
+    st->depth = 0;
+    st->done = 0;
+    mummy_walker_init(&st->walker, &profile_callbacks, st);
+
+    rc = mummy_walk(&st->walker, str);
+    if (rc == MUMMY_WALK_STOP && st->done) rc = 0;
+    else if (!rc) rc = -1;
+
+    if (!rc) {
+        p->values++;
+        p->bytes += str->offset - st->start;
+    }
+    p->varint_bytes = p->bytes + st->varint_change;
+    p->keytable_bytes = p->bytes - st->string_key_bytes + st->key_refs +
+        st->key_table;
+    return rc;
+}
+
+void
+mummy_profile_free(mummy_profile *p) {
+    if (!p) return;
+    free_names(&p->state->path_names);
+    free_names(&p->state->keys);
+    free(p->state->path);
+    free(p->state->scratch);
+    free(p->state);
+    free(p->paths);
+    free(p);
+}
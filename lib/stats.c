@@ -0,0 +1,179 @@
+#include <string.h>
+
+#include "mummy.h"
+#include "alloc.h"
+
+#ifdef MUMMY_STATS
+
+#include <pthread.h>
+
+/* one thread's counters, on the list of the living ones */
+typedef struct block {
+    mummy_stats stats;
+    struct block *prev, *next;
+} block;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t key;
+static block *threads = NULL;
+static mummy_stats exited; /* what threads counted before they ended */
+static MUMMY_THREAD_LOCAL block *local = NULL;
+
+static void
+add(mummy_stats *into, const mummy_stats *from) {
+    int i;
+
+    into->encodes += from->encodes;
+    into->encoded_bytes += from->encoded_bytes;
+    into->decodes += from->decodes;
+    into->decoded_bytes += from->decoded_bytes;
+    into->compress_attempts += from->compress_attempts;
+    into->compress_saves += from->compress_saves;
+    into->compress_bytes_in += from->compress_bytes_in;
+    into->compress_bytes_out += from->compress_bytes_out;
+    into->decompressions += from->decompressions;
+    into->decompressed_bytes += from->decompressed_bytes;
+    into->reallocs += from->reallocs;
+    if (from->max_depth > into->max_depth) into->max_depth = from->max_depth;
+    for (i = 0; i < MUMMY_STATS_TYPES; ++i) {
+        into->encoded_types[i] += from->encoded_types[i];
+        into->decoded_types[i] += from->decoded_types[i];
+    }
+}
+
+/* the key's destructor, run as a thread that counted anything exits */
+static void
+retire(void *ptr) {
+    block *b = ptr;
+
+    pthread_mutex_lock(&lock);
+    if (b->prev) b->prev->next = b->next;
+    else threads = b->next;
+    if (b->next) b->next->prev = b->prev;
+    add(&exited, &b->stats);
+    pthread_mutex_unlock(&lock);
+
+    local = NULL;
+    (free)(b);
+}
+
+static void
+make_key(void) {
+    pthread_key_create(&key, retire);
+}
+
+int
+mummy_stats_enabled(void) {
+    return 1;
+}
+
+mummy_stats *
+mummy_stats_local(void) {
+    block *b = local;
+
+    if (b) return &b->stats;
+
+    /* the real allocator, so that a thread's first count isn't taken for
+       an allocation by whatever it was counting */
+    pthread_once(&key_once, make_key);
+    if (!(b = (calloc)(1, sizeof(block)))) return NULL;
+    if (pthread_setspecific(key, b)) {
+        (free)(b);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&lock);
+    b->next = threads;
+    if (threads) threads->prev = b;
+    threads = b;
+    pthread_mutex_unlock(&lock);
+
+    local = b;
+    return &b->stats;
+}
+
+void
+mummy_stats_read(mummy_stats *result) {
+    block *b;
+
+    pthread_mutex_lock(&lock);
+    *result = exited;
+    for (b = threads; b; b = b->next) add(result, &b->stats);
+    pthread_mutex_unlock(&lock);
+}
+
+void
+mummy_stats_reset(void) {
+    block *b;
+
+    pthread_mutex_lock(&lock);
+    memset(&exited, 0, sizeof(mummy_stats));
+    for (b = threads; b; b = b->next)
+        memset(&b->stats, 0, sizeof(mummy_stats));
+    pthread_mutex_unlock(&lock);
+}
+
+/* a value finished from `start` to the string's offset */
+static void
+count_value(mummy_string *str, int start, int depth, int decoded) {
+    mummy_stats *stats;
+    int type = str->data[start] & 0x7f;
+
+    if (!(stats = mummy_stats_local())) return;
+    if ((uint64_t)depth > stats->max_depth) stats->max_depth = depth;
+    if (decoded) {
+        if (type < MUMMY_STATS_TYPES) ++stats->decoded_types[type];
+        if (depth == 1) {
+            ++stats->decodes;
+            stats->decoded_bytes += str->offset - start;
+        }
+    } else {
+        if (type < MUMMY_STATS_TYPES) ++stats->encoded_types[type];
+        if (depth == 1) {
+            ++stats->encodes;
+            stats->encoded_bytes += str->offset - start;
+        }
+    }
+}
+
+void
+mummy_stats_encoded(mummy_string *str, int start, int depth) {
+    count_value(str, start, depth, 0);
+}
+
+void
+mummy_stats_decoded(mummy_string *str, int start, int depth) {
+    count_value(str, start, depth, 1);
+}
+
+#else /* MUMMY_STATS */
+
+int
+mummy_stats_enabled(void) {
+    return 0;
+}
+
+mummy_stats *
+mummy_stats_local(void) {
+    return NULL;
+}
+
+void
+mummy_stats_read(mummy_stats *result) {
+    memset(result, 0, sizeof(mummy_stats));
+}
+
+void
+mummy_stats_reset(void) {
+}
+
+void
+mummy_stats_encoded(mummy_string *str, int start, int depth) {
+}
+
+void
+mummy_stats_decoded(mummy_string *str, int start, int depth) {
+}
+
+#endif /* MUMMY_STATS */
@@ -0,0 +1,53 @@
+#ifndef _MUMMY_UNALIGNED_H
+#define _MUMMY_UNALIGNED_H
+
+#include <string.h>
+
+#include "mummy.h"
+
+/*
+ * big-endian integers at any offset into a buffer. nothing in a mummy string
+ * is aligned, so these go through memcpy rather than a cast pointer, which
+ * would be a misaligned access and break strict aliasing. compilers turn
+ * each one into a single load or store wherever the target allows it.
+ */
+static inline uint16_t
+mummy_unpack16(const char *buf) {
+    uint16_t value;
+    memcpy(&value, buf, 2);
+    return ntohs(value);
+}
+
+static inline uint32_t
+mummy_unpack32(const char *buf) {
+    uint32_t value;
+    memcpy(&value, buf, 4);
+    return ntohl(value);
+}
+
+static inline uint64_t
+mummy_unpack64(const char *buf) {
+    uint64_t value;
+    memcpy(&value, buf, 8);
+    return ntohll(value);
+}
+
+static inline void
+mummy_pack16(char *buf, uint16_t value) {
+    value = htons(value);
+    memcpy(buf, &value, 2);
+}
+
+static inline void
+mummy_pack32(char *buf, uint32_t value) {
+    value = htonl(value);
+    memcpy(buf, &value, 4);
+}
+
+static inline void
+mummy_pack64(char *buf, uint64_t value) {
+    value = htonll(value);
+    memcpy(buf, &value, 8);
+}
+
+#endif /* _MUMMY_UNALIGNED_H */
@@ -0,0 +1,145 @@
+#include "mummy.h"
+
+
+void
+mummy_walker_init(mummy_walker *walker,
+        const mummy_walk_callbacks *callbacks, void *ctx) {
+    walker->callbacks = callbacks;
+    walker->ctx = ctx;
+    walker->depth = 0;
+    walker->skip_depth = 0;
+    walker->skip_value = 0;
+}
+
+static int
+begin_container(mummy_walker *walker, mummy_token *token, char skipping) {
+    const mummy_walk_callbacks *cb = walker->callbacks;
+    int (*begin)(void *, uint32_t);
+    char hash = 0;
+    int rc;
+
+    switch (token->type) {
+    case MUMMY_TYPE_SHORTLIST:
+    case MUMMY_TYPE_MEDLIST:
+    case MUMMY_TYPE_LONGLIST:
+        begin = cb->begin_list;
+        break;
+    case MUMMY_TYPE_SHORTTUPLE:
+    case MUMMY_TYPE_MEDTUPLE:
+    case MUMMY_TYPE_LONGTUPLE:
+        begin = cb->begin_tuple;
+        break;
+    case MUMMY_TYPE_SHORTSET:
+    case MUMMY_TYPE_MEDSET:
+    case MUMMY_TYPE_LONGSET:
+        begin = cb->begin_set;
+        break;
+    default:
+        begin = cb->begin_hash;
+        hash = 1;
+    }
+
+    walker->stack[walker->depth].left = (uint64_t)token->v.size << hash;
+    walker->stack[walker->depth].hash = hash;
+    walker->depth++;
+
+    if (skipping) {
+        if (!walker->skip_depth) walker->skip_depth = walker->depth;
+        return 0;
+    }
+    if (!begin) return 0;
+    if (MUMMY_WALK_SKIP != (rc = begin(walker->ctx, token->v.size)))
+        return rc;
+    walker->skip_depth = walker->depth;
+    return 0;
+}
+
+static int
+atom(mummy_walker *walker, mummy_token *token) {
+    const mummy_walk_callbacks *cb = walker->callbacks;
+    void *ctx = walker->ctx;
+
+    switch (token->type) {
+    case MUMMY_TYPE_NULL:
+        return cb->null ? cb->null(ctx) : 0;
+    case MUMMY_TYPE_BOOL:
+        return cb->boolean ? cb->boolean(ctx, (char)token->v.i) : 0;
+    case MUMMY_TYPE_CHAR:
+    case MUMMY_TYPE_SHORT:
+    case MUMMY_TYPE_INT:
+    case MUMMY_TYPE_LONG:
+        return cb->integer ? cb->integer(ctx, token->v.i) : 0;
+    case MUMMY_TYPE_HUGE:
+        return cb->huge ? cb->huge(ctx, token->v.s.data, token->v.s.len) : 0;
+    case MUMMY_TYPE_FLOAT:
+        return cb->floating ? cb->floating(ctx, token->v.f) : 0;
+    case MUMMY_TYPE_SHORTSTR:
+    case MUMMY_TYPE_MEDSTR:
+    case MUMMY_TYPE_LONGSTR:
+        return cb->string
+            ? cb->string(ctx, token->v.s.data, token->v.s.len) : 0;
+    case MUMMY_TYPE_SHORTUTF8:
+    case MUMMY_TYPE_MEDUTF8:
+    case MUMMY_TYPE_LONGUTF8:
+        return cb->utf8 ? cb->utf8(ctx, token->v.s.data, token->v.s.len) : 0;
+    }
+    return cb->other ? cb->other(ctx, token) : 0;
+}
+
+int
+mummy_walk(mummy_walker *walker, mummy_string *str) {
+    mummy_token token;
+    int rc, offset;
+    char skipping, is_key;
+
+    for (;;) {
+        /* close up finished containers, quietly for skipped ones */
+        while (walker->depth && !walker->stack[walker->depth - 1].left) {
+            skipping = walker->skip_depth != 0;
+            if (walker->depth-- == walker->skip_depth) walker->skip_depth = 0;
+            if (!skipping && walker->callbacks->end &&
+                    (rc = walker->callbacks->end(walker->ctx)) &&
+                    rc != MUMMY_WALK_SKIP)
+                return rc;
+        }
+
+        if (str->offset >= str->len) return walker->depth ? -1 : 0;
+
+        /* the readers can move the offset before failing, and it has to be
+           left at a token boundary to carry on from */
+        offset = str->offset;
+        if ((rc = mummy_read_token(str, &token))) {
+            str->offset = offset;
+            return rc;
+        }
+
+        if (MUMMY_TYPE_LONGLIST <= token.type &&
+                token.type <= MUMMY_TYPE_MEDHASH &&
+                walker->depth == MUMMY_WALK_MAX_DEPTH) {
+            str->offset = offset;
+            return -3;
+        }
+
+        is_key = 0;
+        if (walker->depth) {
+            is_key = walker->stack[walker->depth - 1].hash &&
+                !(walker->stack[walker->depth - 1].left & 1);
+            walker->stack[walker->depth - 1].left--;
+        }
+
+        skipping = walker->skip_depth || walker->skip_value;
+        walker->skip_value = 0;
+
+        if (MUMMY_TYPE_LONGLIST <= token.type &&
+                token.type <= MUMMY_TYPE_MEDHASH)
+            rc = begin_container(walker, &token, skipping);
+        else if (skipping)
+            rc = 0;
+        else if (MUMMY_WALK_SKIP == (rc = atom(walker, &token))) {
+            walker->skip_value = is_key;
+            rc = 0;
+        }
+
+        if (rc) return rc;
+    }
+}
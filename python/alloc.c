@@ -0,0 +1,82 @@
+#include "mummypy.h"
+
+#ifdef MUMMY_TRACK_ALLOC
+
+/* the list the innermost open track_allocations() block on this thread is
+   collecting calls into, or NULL, and the interpreter it belongs to. a
+   thread can move between subinterpreters, and calls made in the others
+   are left alone */
+static MUMMY_THREAD_LOCAL PyObject *capture = NULL;
+static MUMMY_THREAD_LOCAL PyInterpreterState *capture_interp = NULL;
+
+#define current_interp() (PyThreadState_GET()->interp)
+
+void
+mummypy_alloc_enter(mummypy_alloc_call *call) {
+    if (!(call->active = capture && capture_interp == current_interp()))
+        return;
+    memset(&call->stats, 0, sizeof(mummy_alloc_stats));
+    call->outer = mummy_alloc_track(&call->stats);
+}
+
+void
+mummypy_alloc_leave(mummypy_alloc_call *call, const char *name) {
+    mummy_alloc_stats *stats = &call->stats, *outer = call->outer;
+    PyObject *record, *type, *value, *traceback;
+
+    if (!call->active) return;
+    mummy_alloc_track(outer);
+
+    if (outer) {
+        if (outer->live + stats->peak > outer->peak)
+            outer->peak = outer->live + stats->peak;
+        outer->allocs += stats->allocs;
+        outer->frees += stats->frees;
+        outer->bytes += stats->bytes;
+        outer->live += stats->live;
+        return;
+    }
+    if (!capture) return;
+
+    /* the call may be on its way out with an exception, which stays put */
+    PyErr_Fetch(&type, &value, &traceback);
+    record = Py_BuildValue("{s:s,s:K,s:K,s:K,s:L,s:L}",
+            "call", name,
+            "allocs", (unsigned PY_LONG_LONG)stats->allocs,
+            "frees", (unsigned PY_LONG_LONG)stats->frees,
+            "bytes", (unsigned PY_LONG_LONG)stats->bytes,
+            "peak", (PY_LONG_LONG)stats->peak,
+            "live", (PY_LONG_LONG)stats->live);
+    if (!record || PyList_Append(capture, record)) PyErr_Clear();
+    Py_XDECREF(record);
+    PyErr_Restore(type, value, traceback);
+}
+
+/* start collecting this thread's calls into `calls`, or stop with None,
+   and return what was being collected into before */
+PyObject *
+python_alloc_capture(PyObject *self, PyObject *calls) {
+    PyObject *previous = capture ? capture : Py_None;
+
+    if (calls != Py_None && !PyList_Check(calls)) {
+        PyErr_SetString(PyExc_TypeError, "calls must be a list or None");
+        return NULL;
+    }
+    if (capture && capture_interp != current_interp()) {
+        PyErr_SetString(PyExc_RuntimeError, "allocations are already being "
+                "tracked on this thread in another interpreter");
+        return NULL;
+    }
+
+    if (previous == Py_None) Py_INCREF(previous);
+    if (calls == Py_None) {
+        capture = NULL;
+    } else {
+        Py_INCREF(calls);
+        capture = calls;
+        capture_interp = current_interp();
+    }
+    return previous;
+}
+
+#endif /* MUMMY_TRACK_ALLOC */
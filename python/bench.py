@@ -1,143 +1,336 @@
 #!/usr/bin/env python
+"""
+benchmark mummy's encoding and decoding over representative data
 
+each corpus is timed in four phases: encode (dumps without compression),
+encode_lzf (dumps with it), decode (loads of the plain bytes) and decode_lzf
+(loads of the compressed ones). a phase is warmed up, then its loop count is
+picked so one sample takes --min-time, and --samples of those are taken with
+the garbage collector off. the times reported are per operation, and MB/s is
+of the uncompressed mummy bytes at the median.
+
+    bench.py                           # everything, as a table
+    bench.py -c rpc -c wide -p encode  # some corpora and phases
+    bench.py --json new.json           # save the results...
+    bench.py --compare old.json        # ...or check them against a saved run
+
+--compare exits 1 if any median got slower by more than --threshold percent,
+so running it on a baseline checkout with --json and then on a change with
+--compare judges the change.
+"""
+
+from __future__ import print_function
+
+import argparse
+import datetime
+import decimal
+import fractions
+import gc
+import json
+import os
+import platform
 import random
 import sys
 import time
+import timeit
 
 import mummy
-import oldmummy
-
-try:
-    import cPickle
-except ImportError:
-    import pickle as cPickle
-import string
-
-try:
-    import bson
-except ImportError:
-    bson = None
-try:
-    import yajl
-except ImportError:
-    yajl = None
-try:
-    import cjson
-except ImportError:
-    cjson = None
-try:
-    import simplejson
-except ImportError:
-    simplejson = None
-try:
-	import wbin
-except ImportError:
-	wbin = None
-try:
-    import msgpack
-except ImportError:
-    msgpack = None
-
-
-test_data = [
-"'this is a test'",
-'''[{
-    "name": "foo",
-    "type": "bar",
-    "count": 1,
-    "info": {
-        "x": 203,
-        "y": 102,
-        "z": list(range(5))
+
+
+if sys.version_info[0] >= 3:
+    unichr = chr
+    xrange = range
+
+
+def rpc_corpus(rand):
+    "a small request message, the kind sent thousands of times a second"
+    return {
+        u"method": u"user.get",
+        u"id": rand.randrange(1 << 20),
+        u"auth": u"".join(rand.choice(u"0123456789abcdef")
+            for i in xrange(32)),
+        u"params": {u"user_id": rand.randrange(1 << 40),
+            u"fields": [u"name", u"email", u"created"], u"limit": 20},
     }
-}] * 100''',
-"{'x': 203, 'y': 102, 'z': list(range(5))}",
-"[0, 1, 2, 3, 4]", 
-"{'a': {}}",
-#"[]",
-#"[[]] * 500",
-#"[random.random() for i in xrange(1000)]",
-#"[None] * 5000",
-#"[dict.fromkeys(map(str, range(20)), 14.3)] * 100",
+
+def wide_corpus(rand):
+    "rows of forty mixed fields, like a page of database results"
+    def row(i):
+        record = {}
+        for j in xrange(40):
+            kind = j % 8
+            if kind == 0:
+                value = rand.randrange(128)
+            elif kind == 1:
+                value = rand.randrange(1 << 15)
+            elif kind == 2:
+                value = rand.randrange(1 << 40)
+            elif kind == 3:
+                value = rand.random() * 1000
+            elif kind == 4:
+                value = u"value %d" % rand.randrange(1000)
+            elif kind == 5:
+                value = rand.random() < 0.5
+            elif kind == 6:
+                value = None
+            else:
+                value = b"bytes" * rand.randrange(1, 4)
+            record[u"field_%02d" % j] = value
+        return record
+    return [row(i) for i in xrange(200)]
+
+def numeric_corpus(rand):
+    "long lists of ints of all widths and of floats"
+    return {
+        u"ints": [rand.randrange(-1 << (8 * w - 1), 1 << (8 * w - 1))
+            for w in (1, 2, 4, 8) for i in xrange(2500)],
+        u"floats": [rand.gauss(0, 1e6) for i in xrange(10000)],
+    }
+
+def deep_corpus(rand):
+    "nesting a hundred levels deep, alternating hashes and lists"
+    node = {u"leaf": True}
+    for level in xrange(100):
+        if level % 2:
+            node = [level, node]
+        else:
+            node = {u"level": level, u"child": node}
+    return [node] * 10
+
+def strings_corpus(rand):
+    "text of all lengths, some of it outside ascii, and some bytes"
+    alphabet = u"abcdefghijklmnopqrstuvwxyz " + u"".join(
+            unichr(c) for c in (0xe9, 0xfc, 0x3b1, 0x4e2d, 0x1f600
+                if sys.maxunicode > 0xffff else 0x263a))
+    def text(size):
+        return u"".join(rand.choice(alphabet) for i in xrange(size))
+    return {
+        u"short": [text(rand.randrange(1, 32)) for i in xrange(500)],
+        u"long": [text(rand.randrange(256, 4096)) for i in xrange(20)],
+        u"bytes": [bytes(bytearray(rand.randrange(256)
+            for j in xrange(rand.randrange(1, 300)))) for i in xrange(200)],
+    }
+
+def temporal_corpus(rand):
+    "decimal, date and time heavy records, like a ledger"
+    start = datetime.datetime(2020, 1, 1)
+    def entry(i):
+        when = start + datetime.timedelta(seconds=rand.randrange(1 << 26),
+                microseconds=rand.randrange(1000000))
+        return {
+            u"when": when,
+            u"day": when.date(),
+            u"at": when.time(),
+            u"amount": decimal.Decimal(rand.randrange(-10 ** 9, 10 ** 9)) /
+                100,
+            u"rate": decimal.Decimal("0.%06d" % rand.randrange(10 ** 6)),
+            u"share": fractions.Fraction(rand.randrange(1, 100),
+                rand.randrange(100, 1000)),
+            u"held": datetime.timedelta(seconds=rand.randrange(1 << 20)),
+        }
+    return [entry(i) for i in xrange(500)]
+
+CORPORA = [
+    ("rpc", rpc_corpus),
+    ("wide", wide_corpus),
+    ("numeric", numeric_corpus),
+    ("deep", deep_corpus),
+    ("strings", strings_corpus),
+    ("temporal", temporal_corpus),
 ]
 
+PHASES = ["encode", "encode_lzf", "decode", "decode_lzf"]
+
+
+def phase_call(phase, value, plain, packed):
+    if phase == "encode":
+        return mummy.dumps, (value, None, False)
+    if phase == "encode_lzf":
+        return mummy.dumps, (value,)
+    if phase == "decode":
+        return mummy.loads, (plain,)
+    return mummy.loads, (packed,)
+
+def time_loops(func, args, loops):
+    timer = timeit.default_timer
+    r = xrange(loops)
+    start = timer()
+    for i in r:
+        func(*args)
+    return timer() - start
+
+def measure(func, args, samples, min_time, warmup):
+    "per-call times of `samples` runs of a calibrated number of loops"
+    loops = 1
+    while True:
+        elapsed = time_loops(func, args, loops)
+        if elapsed >= min_time:
+            break
+        loops = max(loops * 2, int(loops * min_time / max(elapsed, 1e-9)))
+
+    spent = 0.0
+    while spent < warmup:
+        spent += time_loops(func, args, loops)
+
+    enabled = gc.isenabled()
+    gc.disable()
+    try:
+        times = [time_loops(func, args, loops) / loops
+                for i in xrange(samples)]
+    finally:
+        if enabled:
+            gc.enable()
+    return loops, sorted(times)
+
+def percentile(ordered, pct):
+    "linearly interpolated, from a sorted list"
+    at = (len(ordered) - 1) * pct / 100.0
+    low = int(at)
+    high = min(low + 1, len(ordered) - 1)
+    return ordered[low] + (ordered[high] - ordered[low]) * (at - low)
+
+def pin(cpu):
+    if not hasattr(os, "sched_setaffinity"):
+        print("can't pin to a cpu on this python", file=sys.stderr)
+        return None
+    os.sched_setaffinity(0, [cpu])
+    return cpu
+
+
+def run(args):
+    results = []
+    for name, make in CORPORA:
+        if args.corpus and name not in args.corpus:
+            continue
+        value = make(random.Random(args.seed))
+        plain = mummy.dumps(value, None, False)
+        packed = mummy.dumps(value)
+        if mummy.loads(packed) != value:
+            raise AssertionError("%s doesn't round trip" % name)
+
+        for phase in PHASES:
+            if args.phase and phase not in args.phase:
+                continue
+            func, call_args = phase_call(phase, value, plain, packed)
+            loops, times = measure(func, call_args, args.samples,
+                    args.min_time, args.warmup)
+            median = percentile(times, 50)
+            results.append({
+                "corpus": name,
+                "phase": phase,
+                "bytes": len(plain),
+                "compressed_bytes": len(packed),
+                "loops": loops,
+                "samples": len(times),
+                "min_ns": times[0] * 1e9,
+                "median_ns": median * 1e9,
+                "p90_ns": percentile(times, 90) * 1e9,
+                "p99_ns": percentile(times, 99) * 1e9,
+                "max_ns": times[-1] * 1e9,
+                "mb_per_s": len(plain) / median / 1e6,
+            })
+            report(results[-1])
+    return results
+
+def describe_ns(ns):
+    for unit, scale in (("s", 1e9), ("ms", 1e6), ("us", 1e3)):
+        if ns >= scale:
+            return "%.2f%s" % (ns / scale, unit)
+    return "%.0fns" % ns
+
+def report(r):
+    print("%-9s %-11s %9d %9d %10s %10s %10s %9.1f" % (r["corpus"],
+        r["phase"], r["bytes"], r["compressed_bytes"],
+        describe_ns(r["median_ns"]), describe_ns(r["p90_ns"]),
+        describe_ns(r["p99_ns"]), r["mb_per_s"]))
+    sys.stdout.flush()
+
+def compare(results, baseline, threshold):
+    "print each median against the baseline's, and count the regressions"
+    before = dict(((r["corpus"], r["phase"]), r) for r in baseline["results"])
+    regressions = 0
+    print("\n%-9s %-11s %10s %10s %8s" % ("corpus", "phase", "before",
+        "after", "change"))
+    for r in results:
+        old = before.get((r["corpus"], r["phase"]))
+        if old is None:
+            continue
+        change = 100.0 * (r["median_ns"] - old["median_ns"]) / \
+                old["median_ns"]
+        flag = ""
+        if change > threshold:
+            flag = "  slower"
+            regressions += 1
+        elif change < -threshold:
+            flag = "  faster"
+        print("%-9s %-11s %10s %10s %+7.1f%%%s" % (r["corpus"], r["phase"],
+            describe_ns(old["median_ns"]), describe_ns(r["median_ns"]),
+            change, flag))
+    return regressions
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0],
+            formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("-c", "--corpus", action="append",
+            choices=[name for name, make in CORPORA],
+            help="run only this corpus (repeatable)")
+    parser.add_argument("-p", "--phase", action="append", choices=PHASES,
+            help="run only this phase (repeatable)")
+    parser.add_argument("--samples", type=int, default=25,
+            help="timed samples per phase (25)")
+    parser.add_argument("--min-time", type=float, default=0.01,
+            help="seconds one sample should take at least (0.01)")
+    parser.add_argument("--warmup", type=float, default=0.1,
+            help="seconds of untimed running first (0.1)")
+    parser.add_argument("--cpu", type=int,
+            help="pin the process to this cpu")
+    parser.add_argument("--seed", type=int, default=1,
+            help="for generating the corpora (1)")
+    parser.add_argument("--json", metavar="FILE",
+            help="also write the results to FILE")
+    parser.add_argument("--compare", metavar="FILE",
+            help="compare against results saved with --json")
+    parser.add_argument("--threshold", type=float, default=5.0,
+            help="percent slower that --compare counts as a regression (5)")
+    args = parser.parse_args(argv)
+
+    baseline = None
+    if args.compare:
+        with open(args.compare) as fp:
+            baseline = json.load(fp)
+
+    cpu = pin(args.cpu) if args.cpu is not None else None
+    meta = {
+        "python": platform.python_implementation() + " " +
+            platform.python_version(),
+        "mummy": mummy.__version__,
+        "extension": mummy.has_extension,
+        "machine": platform.machine(),
+        "platform": platform.platform(),
+        "cpu": cpu,
+        "seed": args.seed,
+        "samples": args.samples,
+        "when": time.strftime("%Y-%m-%dT%H:%M:%SZ", time.gmtime()),
+    }
+    print("%s, mummy %s, C extension: %s" % (meta["python"], meta["mummy"],
+        meta["extension"]))
+    print("%-9s %-11s %9s %9s %10s %10s %10s %9s" % ("corpus", "phase",
+        "bytes", "lzf", "median", "p90", "p99", "MB/s"))
+
+    results = run(args)
+
+    if args.json:
+        with open(args.json, "w") as fp:
+            json.dump({"meta": meta, "results": results}, fp, indent=2,
+                    sort_keys=True)
+            fp.write("\n")
+
+    if baseline is not None:
+        if compare(results, baseline, args.threshold):
+            return 1
+    return 0
 
-def ttt(f, data=None, x=10*1000):
-    start = time.time()
-    while x:
-        x -= 1
-        foo = f(data)
-    return time.time()-start
-
-
-def profile(serial, deserial, data, x=10*1000):
-    squashed = serial(data)
-    return (ttt(serial, data, x), ttt(deserial, squashed, x), len(squashed))
-
-
-def equalish(a, b):
-    if isinstance(a, (tuple, list)) and isinstance(b, (tuple, list)):
-        a, b = tuple(a), tuple(b)
-        for suba, subb in zip(a, b):
-            if not equalish(suba, subb):
-                return False
-        return True
-    if isinstance(a, dict) and isinstance(b, dict):
-        return equalish(a.items(), b.items())
-    return a == b
-
-
-def test(serial, deserial, data):
-    assert equalish(deserial(serial(data)), data)
-
-
-def format(flt, prec=3):
-    s = str(round(flt, prec))
-    return padright(s, s.index(".") + 4, "0")
-
-
-def padright(s, upto, padchar=" "):
-    return s + (padchar * (upto - len(s)))
-
-
-contenders = [
-        ('mummy', (lambda s: mummy.dumps(s), mummy.loads)),
-        ('oldmummy', (lambda s: oldmummy.dumps(s), oldmummy.loads))]
-if wbin:
-	contenders.append(('wirebin', (wbin.serialize, wbin.deserialize)))
-if msgpack:
-    contenders.append(('msgpack', (msgpack.dumps, msgpack.loads)))
-if yajl:
-    contenders.append(('py-yajl', (yajl.dumps, yajl.loads)))
-if cjson:
-    contenders.append(('cjson', (cjson.encode, cjson.decode)))
-if bson:
-    contenders.append(('bson', (bson.BSON.encode, lambda s: bson.BSON(s).decode())))
-#contenders.append(('cPickle (protocol 2)',
-#    (lambda x: cPickle.dumps(x, 2), cPickle.loads)))
-#contenders.append(('cPickle (protocol 1)',
-#    (lambda x: cPickle.dumps(x, 1), cPickle.loads)))
-#contenders.append(('cPickle (protocol 0)', (cPickle.dumps, cPickle.loads)))
-#if simplejson:
-#    contenders.append(('simplejson', (simplejson.dumps, simplejson.loads)))
-#contenders.append(('repr/eval', (repr, eval)))
-#contenders.append(('mummy pure-python',
-#	(mummy.pure_python_dumps, mummy.pure_python_loads)))
 
 if __name__ == '__main__':
-    tmpl = string.Template(
-        "$name serialize: $ser  deserialize: $des  total: $tot  size: $size")
-    for sdata in test_data:
-        print sdata
-        data = eval(sdata)
-        for name, (serial, deserial) in contenders:
-            test(serial, deserial, data)
-            x, y, size = profile(serial, deserial, data)
-            print(tmpl.substitute(
-                name=padright(name, 20),
-                ser=format(x, 6),
-                des=format(y, 6),
-                tot=format(x + y, 6),
-                size=size,
-            ))
-        print
+    sys.exit(main())
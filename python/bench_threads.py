@@ -0,0 +1,83 @@
+#!/usr/bin/env python
+"""
+stress mummy.dumps/loads from several threads at once
+
+on a free-threaded python (3.13t and later) the extension runs without the
+GIL, so throughput should grow close to linearly with the thread count until
+it runs out of cores. on a regular build it shows how much the GIL costs.
+
+usage: bench_threads.py [iterations per thread] [max threads]
+"""
+
+import multiprocessing
+import sys
+import threading
+import time
+
+import mummy
+
+
+payload = [{
+    "name": "foo",
+    "type": "bar",
+    "count": 1,
+    "info": {
+        "x": 203,
+        "y": 102,
+        "z": list(range(5)),
+        "ratio": 0.5,
+        "tags": set(["a", "b"]),
+    },
+}] * 100
+
+
+def work(iterations, data, squashed, errors):
+    try:
+        for i in range(iterations):
+            mummy.dumps(data)
+            if mummy.loads(squashed) != data:
+                raise AssertionError("bad roundtrip")
+    except Exception as exc:
+        errors.append(exc)
+
+
+def run(threads, iterations):
+    squashed = mummy.dumps(payload)
+    errors = []
+    workers = [threading.Thread(target=work,
+            args=(iterations, payload, squashed, errors))
+            for i in range(threads)]
+
+    start = time.time()
+    for worker in workers:
+        worker.start()
+    for worker in workers:
+        worker.join()
+    elapsed = time.time() - start
+
+    if errors:
+        raise errors[0]
+    return elapsed
+
+
+def main(iterations=2000, max_threads=None):
+    max_threads = max_threads or multiprocessing.cpu_count()
+
+    gil = getattr(sys, "_is_gil_enabled", lambda: True)()
+    print("python %s, GIL %s, mummy C extension: %s" % (
+        sys.version.split()[0], gil and "enabled" or "disabled",
+        mummy.has_extension))
+
+    base = None
+    threads = 1
+    while threads <= max_threads:
+        elapsed = run(threads, iterations)
+        rate = threads * iterations / elapsed
+        base = base or rate
+        print("%3d threads: %9.0f roundtrips/sec  %5.2fx" % (
+            threads, rate, rate / base))
+        threads <<= 1
+
+
+if __name__ == '__main__':
+    main(*map(int, sys.argv[1:]))
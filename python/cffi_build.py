@@ -0,0 +1,178 @@
+"""
+cffi build script for mummy._mummy_cffi, the binding to the C core that is
+used in place of the CPython extension on PyPy
+"""
+
+import os
+
+from cffi import FFI
+
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+ffibuilder = FFI()
+
+ffibuilder.cdef("""
+#define MUMMY_TYPE_NULL ...
+#define MUMMY_TYPE_BOOL ...
+#define MUMMY_TYPE_CHAR ...
+#define MUMMY_TYPE_SHORT ...
+#define MUMMY_TYPE_INT ...
+#define MUMMY_TYPE_LONG ...
+#define MUMMY_TYPE_HUGE ...
+#define MUMMY_TYPE_FLOAT ...
+#define MUMMY_TYPE_SHORTSTR ...
+#define MUMMY_TYPE_LONGSTR ...
+#define MUMMY_TYPE_SHORTUTF8 ...
+#define MUMMY_TYPE_LONGUTF8 ...
+#define MUMMY_TYPE_LONGLIST ...
+#define MUMMY_TYPE_LONGTUPLE ...
+#define MUMMY_TYPE_LONGSET ...
+#define MUMMY_TYPE_LONGHASH ...
+#define MUMMY_TYPE_SHORTLIST ...
+#define MUMMY_TYPE_SHORTTUPLE ...
+#define MUMMY_TYPE_SHORTSET ...
+#define MUMMY_TYPE_SHORTHASH ...
+#define MUMMY_TYPE_MEDLIST ...
+#define MUMMY_TYPE_MEDTUPLE ...
+#define MUMMY_TYPE_MEDSET ...
+#define MUMMY_TYPE_MEDHASH ...
+#define MUMMY_TYPE_MEDSTR ...
+#define MUMMY_TYPE_MEDUTF8 ...
+#define MUMMY_TYPE_DATE ...
+#define MUMMY_TYPE_TIME ...
+#define MUMMY_TYPE_DATETIME ...
+#define MUMMY_TYPE_TIMEDELTA ...
+#define MUMMY_TYPE_DECIMAL ...
+#define MUMMY_TYPE_SPECIALNUM ...
+#define MUMMY_TYPE_FRACTION ...
+
+#define MUMMY_SPECIAL_INFINITY ...
+#define MUMMY_SPECIAL_NAN ...
+
+#define ENOMEM ...
+#define EINVAL ...
+
+typedef struct {
+    char *data;
+    int offset;
+    int len;
+} mummy_string;
+
+typedef struct {
+    int type;
+    union {
+        int64_t i;
+        double f;
+        uint32_t size;
+        struct {
+            char *data;
+            int len;
+        } s;
+        struct {
+            int64_t numerator;
+            int64_t denominator;
+        } fraction;
+        struct {
+            int16_t year;
+            uint8_t month, day, hour, minute, second;
+            int32_t microsecond;
+        } dt;
+        struct {
+            int32_t days, seconds, microseconds;
+        } delta;
+        struct {
+            int8_t sign;
+            int16_t exponent;
+            uint16_t count;
+            char *digits;
+        } decimal;
+    } v;
+} mummy_token;
+
+/* char arguments are declared int8_t so that python ints pass straight
+   through instead of needing to be length-1 bytestrings */
+mummy_string *mummy_string_new(int);
+mummy_string *mummy_string_wrap(char *, int);
+void mummy_string_free(mummy_string *, int8_t);
+int mummy_string_compress(mummy_string *);
+int mummy_string_decompress(mummy_string *, int8_t, char *);
+
+int mummy_read_token(mummy_string *, mummy_token *);
+
+int mummy_feed_null(mummy_string *);
+int mummy_feed_bool(mummy_string *, int8_t);
+int mummy_feed_int(mummy_string *, int64_t);
+int mummy_feed_huge(mummy_string *, char *, int);
+int mummy_feed_float(mummy_string *, double);
+int mummy_feed_string(mummy_string *, char *, int);
+int mummy_feed_utf8(mummy_string *, char *, int);
+int mummy_feed_decimal(mummy_string *, int8_t, int16_t, uint16_t, char *);
+int mummy_feed_infinity(mummy_string *, int8_t);
+int mummy_feed_nan(mummy_string *, int8_t);
+int mummy_feed_fraction(mummy_string *, int64_t, int64_t);
+int mummy_feed_date(mummy_string *, unsigned short, int8_t, int8_t);
+int mummy_feed_time(mummy_string *, int8_t, int8_t, int8_t, int);
+int mummy_feed_datetime(
+        mummy_string *, short, int8_t, int8_t, int8_t, int8_t, int8_t, int);
+int mummy_feed_timedelta(mummy_string *, int, int, int);
+
+int mummy_open_list(mummy_string *, int);
+int mummy_open_tuple(mummy_string *, int);
+int mummy_open_set(mummy_string *, int);
+int mummy_open_hash(mummy_string *, int);
+int mummy_upgrade_legacy(mummy_string *, mummy_string *);
+
+int mummy_to_json(mummy_string *, mummy_string *);
+int mummy_from_json(mummy_string *, mummy_string *);
+int mummy_to_msgpack(mummy_string *, mummy_string *);
+int mummy_from_msgpack(mummy_string *, mummy_string *);
+
+#define MUMMY_PROFILE_TYPES ...
+
+typedef struct {
+    char *path;
+    int type;
+    uint64_t count;
+    uint64_t items;
+    uint64_t bytes;
+    uint64_t key_bytes;
+    uint64_t compressed;
+} mummy_profile_path;
+
+typedef struct {
+    uint64_t values;
+    uint64_t bytes;
+    uint64_t counts[...];
+    uint64_t sizes[...];
+    uint64_t key_count;
+    uint64_t key_bytes;
+    uint64_t distinct_keys;
+    uint64_t header_bytes;
+    uint64_t varint_bytes;
+    uint64_t keytable_bytes;
+    mummy_profile_path *paths;
+    size_t npaths;
+    ...;
+} mummy_profile;
+
+const char *mummy_type_name(int);
+mummy_profile *mummy_profile_new(int);
+int mummy_profile_add(mummy_profile *, mummy_string *);
+void mummy_profile_free(mummy_profile *);
+""")
+
+ffibuilder.set_source(
+    "mummy._mummy_cffi",
+    '#include <errno.h>\n#include "mummy.h"',
+    sources=[os.path.join(ROOT, path) for path in (
+        'lzf/lzf_c.c', 'lzf/lzf_d.c',
+        'lib/mummy_string.c', 'lib/dump.c', 'lib/load.c',
+        'lib/legacy.c', 'lib/walk.c', 'lib/json.c', 'lib/msgpack.c',
+        'lib/profile.c', 'lib/stats.c', 'lib/alloc.c')],
+    include_dirs=[os.path.join(ROOT, 'lzf'), os.path.join(ROOT, 'include')],
+    extra_compile_args=['-Wall'])
+
+
+if __name__ == "__main__":
+    ffibuilder.compile(verbose=True)
@@ -0,0 +1,697 @@
+#include "lzf.h"
+#include "mummypy.h"
+#include "structmember.h"
+
+
+/* scratch buffers that grew past this get shrunk back after the call */
+#define MUMMYPY_RETAINED_BUFFER 0x100000
+
+
+/*
+ * finding the module (and with it the module state) from a type
+ */
+
+#if !ISPY3 || PY_VERSION_HEX < 0x03090000
+/* before 3.9 there's no way to get from a heap type to its module, but
+   there's also no per-interpreter isolation to get wrong */
+static PyObject *coders_module;
+#endif
+
+PyObject *
+mummypy_type_module(PyTypeObject *type) {
+#if ISPY3 && PY_VERSION_HEX >= 0x03090000
+    return PyType_GetModule(type);
+#else
+    return coders_module;
+#endif
+}
+
+static void
+shrink(mummy_string *str) {
+    char *temp;
+
+    if (str->len <= MUMMYPY_RETAINED_BUFFER) return;
+    if ((temp = realloc(str->data, MUMMYPY_STARTING_BUFFER))) {
+        str->data = temp;
+        str->len = MUMMYPY_STARTING_BUFFER;
+    }
+}
+
+
+/*
+ * Encoder
+ */
+
+typedef struct {
+    PyObject_HEAD
+    PyObject *module;
+    PyObject *default_handler;
+    char compress;
+    int threshold;
+    int busy;
+    mummy_string *str;
+} mummypy_encoder;
+
+static char *encoder_kwargs[] = {"default", "compress", "threshold", NULL};
+
+static PyObject *
+encoder_new(PyTypeObject *type, PyObject *args, PyObject *kwargs) {
+    mummypy_encoder *self;
+    PyObject *default_handler = Py_None, *compress = Py_True, *module;
+    int do_compress, threshold = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|OOi:Encoder",
+                encoder_kwargs, &default_handler, &compress, &threshold))
+        return NULL;
+
+    if (default_handler != Py_None && !PyCallable_Check(default_handler)) {
+        PyErr_SetString(PyExc_TypeError, "default must be callable or None");
+        return NULL;
+    }
+    if ((do_compress = PyObject_IsTrue(compress)) < 0) return NULL;
+    if (!(module = mummypy_type_module(type))) return NULL;
+
+    if (!(self = (mummypy_encoder *)type->tp_alloc(type, 0))) return NULL;
+    if (!(self->str = mummy_string_new(MUMMYPY_STARTING_BUFFER))) {
+        Py_DECREF(self);
+        return PyErr_NoMemory();
+    }
+    Py_INCREF(module);
+    self->module = module;
+    Py_INCREF(default_handler);
+    self->default_handler = default_handler;
+    self->compress = do_compress;
+    self->threshold = threshold;
+    self->busy = 0;
+    return (PyObject *)self;
+}
+
+static int
+encoder_traverse(mummypy_encoder *self, visitproc visit, void *arg) {
+    Py_VISIT(self->module);
+    Py_VISIT(self->default_handler);
+    return 0;
+}
+
+static int
+encoder_clear(mummypy_encoder *self) {
+    Py_CLEAR(self->module);
+    Py_CLEAR(self->default_handler);
+    return 0;
+}
+
+static void
+encoder_dealloc(mummypy_encoder *self) {
+    PyTypeObject *type = Py_TYPE(self);
+
+    PyObject_GC_UnTrack(self);
+    encoder_clear(self);
+    if (self->str) mummy_string_free(self->str, 1);
+    type->tp_free((PyObject *)self);
+#if ISPY3
+    Py_DECREF(type);
+#endif
+}
+
+/* the encoder's buffer, or a new one if the default handler has re-entered
+   this same encoder and the buffer is already in use */
+static mummy_string *
+encoder_acquire(mummypy_encoder *self) {
+    mummy_string *str;
+
+    if (self->busy) {
+        if (!(str = mummy_string_new(MUMMYPY_STARTING_BUFFER)))
+            PyErr_NoMemory();
+        return str;
+    }
+    self->busy = 1;
+    return self->str;
+}
+
+static void
+encoder_release(mummypy_encoder *self, mummy_string *str) {
+    if (str == self->str) {
+        shrink(str);
+        self->busy = 0;
+    } else if (str) {
+        mummy_string_free(str, 1);
+    }
+}
+
+static int
+encoder_dump(mummypy_encoder *self, PyObject *obj, mummy_string *str) {
+    str->offset = 0;
+    return dump_one(mummypy_get_state(self->module), obj, str,
+            self->default_handler, 1);
+}
+
+#define encoder_compress(self, str) \
+    ((self)->compress && (str)->offset >= (self)->threshold)
+
+static PyObject *
+encoder_encode(mummypy_encoder *self, PyObject *obj) {
+    mummypy_alloc_call call;
+    mummy_string *str;
+    PyObject *result = NULL;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    mummypy_alloc_enter(&call);
+
+    if ((str = encoder_acquire(self)) && !encoder_dump(self, obj, str))
+        result = mummypy_result(mummypy_get_state(self->module), str,
+                encoder_compress(self, str));
+    encoder_release(self, str);
+
+    mummypy_alloc_leave(&call, "Encoder.encode");
+    Py_END_CRITICAL_SECTION();
+    return result;
+}
+
+static PyObject *
+encoder_encode_many(mummypy_encoder *self, PyObject *objects) {
+    mummypy_alloc_call call;
+    mummy_string *str;
+    PyObject *iter, *obj, *item, *result;
+
+    if (!(iter = PyObject_GetIter(objects))) return NULL;
+    if (!(result = PyList_New(0))) {
+        Py_DECREF(iter);
+        return NULL;
+    }
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    mummypy_alloc_enter(&call);
+
+    if ((str = encoder_acquire(self))) {
+        while ((obj = PyIter_Next(iter))) {
+            item = encoder_dump(self, obj, str) ? NULL :
+                mummypy_result(mummypy_get_state(self->module), str,
+                        encoder_compress(self, str));
+            Py_DECREF(obj);
+            if (!item || PyList_Append(result, item)) {
+                Py_XDECREF(item);
+                break;
+            }
+            Py_DECREF(item);
+        }
+    }
+    encoder_release(self, str);
+
+    mummypy_alloc_leave(&call, "Encoder.encode_many");
+    Py_END_CRITICAL_SECTION();
+
+    Py_DECREF(iter);
+    if (PyErr_Occurred()) Py_CLEAR(result);
+    return result;
+}
+
+static PyObject *
+encoder_encode_into(mummypy_encoder *self, PyObject *args) {
+    mummypy_alloc_call call;
+    mummy_string *str;
+    PyObject *buffer, *obj;
+    Py_ssize_t size = -1;
+
+    if (!PyArg_ParseTuple(args, "O!O:encode_into", &PyByteArray_Type, &buffer,
+                &obj))
+        return NULL;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    mummypy_alloc_enter(&call);
+
+    if ((str = encoder_acquire(self)) && !encoder_dump(self, obj, str))
+        size = mummypy_append_result(mummypy_get_state(self->module),
+                buffer, str, encoder_compress(self, str));
+    encoder_release(self, str);
+
+    mummypy_alloc_leave(&call, "Encoder.encode_into");
+    Py_END_CRITICAL_SECTION();
+    return size < 0 ? NULL : PyInt_FromSsize_t(size);
+}
+
+static PyMethodDef encoder_methods[] = {
+    {"encode", (PyCFunction)encoder_encode, METH_O,
+        "serialize a native python object into a mummy string\n\
+\n\
+    :param object: the python object to serialize\n\
+\n\
+    :returns: the bytestring of the serialized data\n\
+"},
+    {"encode_many", (PyCFunction)encoder_encode_many, METH_O,
+        "serialize each of an iterable of python objects\n\
+\n\
+    :param objects: the python objects to serialize\n\
+\n\
+    :returns: a list of the bytestrings of each serialized object\n\
+"},
+    {"encode_into", (PyCFunction)encoder_encode_into, METH_VARARGS,
+        "serialize a native python object onto the end of a bytearray\n\
+\n\
+    :param bytearray buffer: where to put the serialized data\n\
+    :param object: the python object to serialize\n\
+\n\
+    :returns: the number of bytes added to the buffer\n\
+"},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyMemberDef encoder_members[] = {
+    {"default", T_OBJECT, offsetof(mummypy_encoder, default_handler),
+        READONLY, "fallback for unserializable objects"},
+    {"compress", T_BOOL, offsetof(mummypy_encoder, compress), READONLY,
+        "whether to attempt to compress the serialized data"},
+    {"threshold", T_INT, offsetof(mummypy_encoder, threshold), READONLY,
+        "the smallest serialized size that compression is attempted on"},
+    {NULL, 0, 0, 0, NULL}
+};
+
+#define ENCODER_DOC "a reusable mummy serializer\n\
+\n\
+the configuration is fixed when the Encoder is created, and it holds on to\n\
+its working buffer between calls, so encode() skips the per-call setup that\n\
+dumps() has to do.\n\
+\n\
+    :param function default:\n\
+        If an object is not serializable and this parameter is provided, this\n\
+        function will be used to generate a fallback value to serialize. It\n\
+        should take one argument (the original object), and return something\n\
+        serializable.\n\
+    :param bool compress:\n\
+        whether or not to attempt to compress the serialized data (default\n\
+        True)\n\
+    :param int threshold:\n\
+        only attempt compression when the serialized data is at least this\n\
+        many bytes (default 0)\n\
+"
+
+
+/*
+ * Decoder
+ */
+
+typedef struct {
+    PyObject_HEAD
+    PyObject *module;
+    mummypy_cached_key *keys;
+    int busy;
+    char legacy;
+    char *scratch;
+    int scratch_len;
+} mummypy_decoder;
+
+static char *decoder_kwargs[] = {"cache_keys", "legacy", NULL};
+
+static PyObject *
+decoder_new(PyTypeObject *type, PyObject *args, PyObject *kwargs) {
+    mummypy_decoder *self;
+    PyObject *cache_keys = Py_True, *legacy = Py_False, *module;
+    int do_cache, is_legacy;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|OO:Decoder",
+                decoder_kwargs, &cache_keys, &legacy))
+        return NULL;
+
+    if ((do_cache = PyObject_IsTrue(cache_keys)) < 0) return NULL;
+    if ((is_legacy = PyObject_IsTrue(legacy)) < 0) return NULL;
+    if (!(module = mummypy_type_module(type))) return NULL;
+
+    if (!(self = (mummypy_decoder *)type->tp_alloc(type, 0))) return NULL;
+    Py_INCREF(module);
+    self->module = module;
+    self->busy = 0;
+    self->legacy = is_legacy;
+    self->scratch = NULL;
+    self->scratch_len = 0;
+    self->keys = NULL;
+    if (do_cache && !(self->keys = calloc(
+                    MUMMYPY_KEYCACHE_SIZE, sizeof(mummypy_cached_key)))) {
+        Py_DECREF(self);
+        return PyErr_NoMemory();
+    }
+    return (PyObject *)self;
+}
+
+static int
+decoder_traverse(mummypy_decoder *self, visitproc visit, void *arg) {
+    int i;
+
+    Py_VISIT(self->module);
+    if (self->keys)
+        for (i = 0; i < MUMMYPY_KEYCACHE_SIZE; ++i)
+            Py_VISIT(self->keys[i].obj);
+    return 0;
+}
+
+static int
+decoder_clear(mummypy_decoder *self) {
+    int i;
+
+    Py_CLEAR(self->module);
+    if (self->keys)
+        for (i = 0; i < MUMMYPY_KEYCACHE_SIZE; ++i)
+            Py_CLEAR(self->keys[i].obj);
+    return 0;
+}
+
+static void
+decoder_dealloc(mummypy_decoder *self) {
+    PyTypeObject *type = Py_TYPE(self);
+
+    PyObject_GC_UnTrack(self);
+    decoder_clear(self);
+    free(self->keys);
+    free(self->scratch);
+    type->tp_free((PyObject *)self);
+#if ISPY3
+    Py_DECREF(type);
+#endif
+}
+
+/* decompress `str` into the decoder's scratch buffer (or a fresh one if
+   `owned`), pointing `str` at the result */
+static int
+decoder_decompress(mummypy_state *state, mummypy_decoder *self,
+        mummy_string *str, int owned) {
+    char *input = str->data, *temp;
+    uint32_t ucsize;
+    uint64_t t;
+
+    if (str->len <= 5) {
+        PyErr_SetString(PyExc_ValueError, "invalid mummy (incorrect length)");
+        return -1;
+    }
+    /* bounded, like mummy_string_decompress, before it's allocated for */
+    ucsize = mummy_unpack32(input + 1);
+    if (ucsize >= INT_MAX - 1) {
+        PyErr_SetString(PyExc_ValueError, "invalid mummy (incorrect length)");
+        return -1;
+    }
+
+    if (owned) {
+        if (!(str->data = malloc((size_t)ucsize + 2))) goto nomem;
+    } else {
+        if (self->scratch_len < (int)ucsize + 2) {
+            if (!(temp = realloc(self->scratch, (size_t)ucsize + 2)))
+                goto nomem;
+            self->scratch = temp;
+            self->scratch_len = ucsize + 2;
+        }
+        str->data = self->scratch;
+    }
+
+    str->data[0] = input[0] & 0x7f;
+    mummy_probe1(decompress__start, str->len);
+    t = state->timing ? mummypy_now() : 0;
+    if (ucsize != lzf_decompress(input + 5, str->len - 5,
+                str->data + 1, ucsize + 1)) {
+        mummy_probe2(decompress__done, str->len, 0);
+        if (owned) free(str->data);
+        PyErr_SetString(PyExc_ValueError, "lzf decompression failed");
+        return -1;
+    }
+    if (t) mummypy_record(state, mummypy_phase_decompress, ucsize + 1, t);
+    mummy_probe2(decompress__done, str->len, ucsize + 1);
+    mummy_stats_count(decompressions, 1);
+    mummy_stats_count(decompressed_bytes, ucsize + 1);
+    str->offset = 0;
+    str->len = ucsize + 1;
+    return 0;
+
+nomem:
+    PyErr_NoMemory();
+    return -1;
+}
+
+static PyObject *
+decode_buffer(mummypy_state *state, mummypy_decoder *self, char *data,
+        Py_ssize_t len, int owned) {
+    mummy_string str, *upgraded;
+    PyObject *result;
+
+    /* the buffer lives on the stack, no allocation for uncompressed data */
+    str.data = data;
+    str.offset = 0;
+    str.len = len;
+
+    if (str.len && (str.data[0] & 0x80) &&
+            decoder_decompress(state, self, &str, owned))
+        return NULL;
+
+    if (self && self->legacy) {
+        /* old-format decimals are rewritten before the regular load */
+        if ((upgraded = mummypy_upgrade(&str))) {
+            upgraded->len = upgraded->offset;
+            upgraded->offset = 0;
+            result = load_one(state, upgraded, owned ? NULL : self->keys);
+            mummy_string_free(upgraded, 1);
+        } else {
+            result = NULL;
+        }
+    } else {
+        result = load_one(state, &str, owned ? NULL : self->keys);
+    }
+
+    if (owned && str.data != data) free(str.data);
+    return result;
+}
+
+/* decode the `len` bytes at `data`, with the scratch buffer and key cache
+   of `decoder` if one is given */
+PyObject *
+mummypy_decode(mummypy_state *state, PyObject *decoder, char *data,
+        Py_ssize_t len) {
+    mummypy_decoder *self = (mummypy_decoder *)decoder;
+    PyObject *result;
+    int owned;
+
+    if (!self) return decode_buffer(state, NULL, data, len, 1);
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+
+    /* a decode that can't have the scratch buffer and key cache to itself
+       goes without */
+    owned = self->busy;
+    self->busy = 1;
+
+    result = decode_buffer(state, self, data, len, owned);
+
+    if (!owned) {
+        if (self->scratch_len > MUMMYPY_RETAINED_BUFFER) {
+            free(self->scratch);
+            self->scratch = NULL;
+            self->scratch_len = 0;
+        }
+        self->busy = 0;
+    }
+    Py_END_CRITICAL_SECTION();
+    return result;
+}
+
+static PyObject *
+decoder_decode(mummypy_decoder *self, PyObject *data) {
+    mummypy_alloc_call call;
+    PyObject *result;
+    Py_buffer view;
+
+    if (PyBytes_CheckExact(data)) {
+        view.obj = NULL;
+        view.buf = PyBytes_AS_STRING(data);
+        view.len = PyBytes_GET_SIZE(data);
+    } else if (PyObject_GetBuffer(data, &view, PyBUF_SIMPLE)) {
+        return NULL;
+    }
+
+    mummypy_alloc_enter(&call);
+    result = mummypy_decode(mummypy_get_state(self->module), (PyObject *)self,
+            view.buf, view.len);
+    mummypy_alloc_leave(&call, "Decoder.decode");
+
+    if (view.obj) PyBuffer_Release(&view);
+    return result;
+}
+
+static PyObject *
+decoder_decode_many(mummypy_decoder *self, PyObject *items) {
+    mummypy_alloc_call call;
+    PyObject *iter, *data, *item, *result;
+
+    if (!(iter = PyObject_GetIter(items))) return NULL;
+    if (!(result = PyList_New(0))) {
+        Py_DECREF(iter);
+        return NULL;
+    }
+
+    /* the decodes each count toward this call, not on their own */
+    mummypy_alloc_enter(&call);
+    while ((data = PyIter_Next(iter))) {
+        item = decoder_decode(self, data);
+        Py_DECREF(data);
+        if (!item || PyList_Append(result, item)) {
+            Py_XDECREF(item);
+            break;
+        }
+        Py_DECREF(item);
+    }
+    mummypy_alloc_leave(&call, "Decoder.decode_many");
+
+    Py_DECREF(iter);
+    if (PyErr_Occurred()) Py_CLEAR(result);
+    return result;
+}
+
+static PyMethodDef decoder_methods[] = {
+    {"decode", (PyCFunction)decoder_decode, METH_O,
+        "deserialize a mummy string to a python object\n\
+\n\
+    :param bytestring serialized:\n\
+        the serialized string to load, or anything else supporting the\n\
+        buffer protocol\n\
+\n\
+    :returns: the python data\n\
+"},
+    {"decode_many", (PyCFunction)decoder_decode_many, METH_O,
+        "deserialize each of an iterable of mummy strings\n\
+\n\
+    :param serialized: the serialized strings to load\n\
+\n\
+    :returns: a list of the python data\n\
+"},
+    {NULL, NULL, 0, NULL}
+};
+
+#define DECODER_DOC "a reusable mummy deserializer\n\
+\n\
+it holds on to its decompression buffer between calls, and keeps a cache of\n\
+recently seen short hash keys so that a key repeated across many records is\n\
+only allocated once.\n\
+\n\
+    :param bool cache_keys:\n\
+        whether to share short string hash keys between decoded objects\n\
+        (default True)\n\
+    :param bool legacy:\n\
+        read mummies written in the old format (by oldmummy), which lays out\n\
+        decimals differently. there's no telling the two apart from the data\n\
+        so this has to be asked for (default False)\n\
+"
+
+
+/*
+ * type objects
+ */
+
+#if ISPY3
+static PyType_Slot encoder_slots[] = {
+    {Py_tp_new, encoder_new},
+    {Py_tp_dealloc, encoder_dealloc},
+    {Py_tp_traverse, encoder_traverse},
+    {Py_tp_clear, encoder_clear},
+    {Py_tp_methods, encoder_methods},
+    {Py_tp_members, encoder_members},
+    {Py_tp_doc, ENCODER_DOC},
+    {0, NULL}
+};
+
+static PyType_Spec encoder_spec = {
+    "_mummy.Encoder",
+    sizeof(mummypy_encoder),
+    0,
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,
+    encoder_slots
+};
+
+static PyType_Slot decoder_slots[] = {
+    {Py_tp_new, decoder_new},
+    {Py_tp_dealloc, decoder_dealloc},
+    {Py_tp_traverse, decoder_traverse},
+    {Py_tp_clear, decoder_clear},
+    {Py_tp_methods, decoder_methods},
+    {Py_tp_doc, DECODER_DOC},
+    {0, NULL}
+};
+
+static PyType_Spec decoder_spec = {
+    "_mummy.Decoder",
+    sizeof(mummypy_decoder),
+    0,
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,
+    decoder_slots
+};
+
+static PyObject *
+add_type(PyObject *module, const char *name, PyType_Spec *spec) {
+    PyObject *type;
+
+#if PY_VERSION_HEX >= 0x03090000
+    type = PyType_FromModuleAndSpec(module, spec, NULL);
+#else
+    type = PyType_FromSpec(spec);
+#endif
+    if (!type) return NULL;
+    if (PyModule_AddObject(module, name, type)) {
+        Py_DECREF(type);
+        return NULL;
+    }
+    return type;
+}
+
+int
+mummypy_add_coders(PyObject *module) {
+    mummypy_state *state = mummypy_get_state(module);
+    PyObject *type;
+
+#if PY_VERSION_HEX < 0x03090000
+    coders_module = module;
+#endif
+    if (!add_type(module, "Encoder", &encoder_spec)) return -1;
+    if (!(type = add_type(module, "Decoder", &decoder_spec))) return -1;
+    Py_INCREF(type);
+    state->decoder_type = type;
+    return add_type(module, "iter_records", &mummypy_records_spec) ? 0 : -1;
+}
+#else
+static PyTypeObject encoder_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "_mummy.Encoder",
+    .tp_basicsize = sizeof(mummypy_encoder),
+    .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,
+    .tp_doc = ENCODER_DOC,
+    .tp_new = encoder_new,
+    .tp_dealloc = (destructor)encoder_dealloc,
+    .tp_traverse = (traverseproc)encoder_traverse,
+    .tp_clear = (inquiry)encoder_clear,
+    .tp_methods = encoder_methods,
+    .tp_members = encoder_members,
+};
+
+static PyTypeObject decoder_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "_mummy.Decoder",
+    .tp_basicsize = sizeof(mummypy_decoder),
+    .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,
+    .tp_doc = DECODER_DOC,
+    .tp_new = decoder_new,
+    .tp_dealloc = (destructor)decoder_dealloc,
+    .tp_traverse = (traverseproc)decoder_traverse,
+    .tp_clear = (inquiry)decoder_clear,
+    .tp_methods = decoder_methods,
+};
+
+int
+mummypy_add_coders(PyObject *module) {
+    coders_module = module;
+    if (PyType_Ready(&encoder_type) || PyType_Ready(&decoder_type) ||
+            PyType_Ready(&mummypy_records_type))
+        return -1;
+    Py_INCREF(&decoder_type);
+    mummypy_global_state.decoder_type = (PyObject *)&decoder_type;
+
+    Py_INCREF(&encoder_type);
+    Py_INCREF(&decoder_type);
+    Py_INCREF(&mummypy_records_type);
+    if (PyModule_AddObject(module, "Encoder", (PyObject *)&encoder_type) ||
+            PyModule_AddObject(module, "Decoder", (PyObject *)&decoder_type))
+        return -1;
+    return PyModule_AddObject(module, "iter_records",
+            (PyObject *)&mummypy_records_type);
+}
+#endif
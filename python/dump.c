@@ -1,22 +1,135 @@
+#include "lzf.h"
 #include "mummypy.h"
+#include "datetime.h"
 
 
-/* import decimal, fraction and datetime at mummy import time */
-extern PyObject *PyDecimalType;
-extern PyObject *PyFractionType;
-extern PyDateTime_CAPI *PyDateTimeCAPI;
+static int dump_item(mummypy_state *, PyObject *, mummy_string *, PyObject *,
+        int);
 
+#ifdef MUMMY_STATS
+/* count each value as it's finished, from the offset it started at */
+static int
+dump_value(mummypy_state *state, PyObject *obj, mummy_string *str,
+        PyObject *default_handler, int depth) {
+    int start = str->offset;
+
+    if (dump_item(state, obj, str, default_handler, depth)) return -1;
+    mummy_stats_encoded(str, start, depth);
+    return 0;
+}
+#else
+#define dump_value dump_item
+#endif
+
+
+/*
+ * mutable containers are locked for as long as they're being dumped (a no-op
+ * unless this is a free-threaded build), and if they still manage to change
+ * size (the default handler can do anything) we bail out rather than write
+ * an item count that doesn't match what follows it.
+ */
 
 static int
-dump_one(PyObject *obj, mummy_string *str, PyObject *default_handler,
-        int depth) {
-    int i, rc = 0;
+changed_size(const char *kind) {
+    PyErr_Format(PyExc_RuntimeError, "%s changed size during dump", kind);
+    return -1;
+}
+
+static int
+dump_list(mummypy_state *state, PyObject *obj, mummy_string *str,
+        PyObject *default_handler, int depth) {
+    Py_ssize_t i, size;
+    PyObject *item;
+    int rc = 0;
+
+    Py_BEGIN_CRITICAL_SECTION(obj);
+    size = PyList_GET_SIZE(obj);
+    if (mummy_open_list(str, size)) {
+        PyErr_NoMemory();
+        rc = -1;
+    }
+    for (i = 0; !rc && i < size; ++i) {
+        if (i >= PyList_GET_SIZE(obj)) {
+            rc = changed_size("list");
+            break;
+        }
+        item = PyList_GET_ITEM(obj, i);
+        Py_INCREF(item);
+        rc = dump_value(state, item, str, default_handler, depth + 1);
+        Py_DECREF(item);
+    }
+    Py_END_CRITICAL_SECTION();
+    return rc;
+}
+
+static int
+dump_set(mummypy_state *state, PyObject *obj, mummy_string *str,
+        PyObject *default_handler, int depth) {
+    Py_ssize_t size, count = 0;
+    PyObject *iterator, *item;
+    int rc = 0;
+
+    /* set iterators already raise if the set changes size under them */
+    size = PySet_GET_SIZE(obj);
+    if (mummy_open_set(str, size)) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    if (!(iterator = PyObject_GetIter(obj))) return -1;
+    while (!rc && (item = PyIter_Next(iterator))) {
+        rc = dump_value(state, item, str, default_handler, depth + 1);
+        Py_DECREF(item);
+        ++count;
+    }
+    Py_DECREF(iterator);
+    if (rc || PyErr_Occurred()) return -1;
+    if (count != size) return changed_size("set");
+    return 0;
+}
+
+static int
+dump_dict(mummypy_state *state, PyObject *obj, mummy_string *str,
+        PyObject *default_handler, int depth) {
+    Py_ssize_t pos = 0, size, count = 0;
+    PyObject *key, *value;
+    int rc = 0;
+
+    Py_BEGIN_CRITICAL_SECTION(obj);
+    size = PyDict_Size(obj);
+    if (mummy_open_hash(str, size)) {
+        PyErr_NoMemory();
+        rc = -1;
+    }
+    while (!rc && PyDict_Next(obj, &pos, &key, &value)) {
+        Py_INCREF(key);
+        Py_INCREF(value);
+        if (!(rc = dump_value(state, key, str, default_handler, depth + 1)))
+            rc = dump_value(state, value, str, default_handler, depth + 1);
+        Py_DECREF(key);
+        Py_DECREF(value);
+        if (!rc && PyDict_Size(obj) != size) rc = changed_size("dict");
+        ++count;
+    }
+    if (!rc && count != size) rc = changed_size("dict");
+    Py_END_CRITICAL_SECTION();
+    return rc;
+}
+
+static int
+dump_item(mummypy_state *state, PyObject *obj, mummy_string *str,
+        PyObject *default_handler, int depth) {
+    int i, overflow, rc = 0;
     size_t size;
     long l;
     long long ll, ll2;
     char c, *buf;
-    PyObject *key, *value, *iterator, *args;
+    PyObject *key, *value, *args;
     Py_ssize_t pst;
+    PyDateTime_CAPI *datetime_capi = state->datetime_capi;
+
+    /* this file's copy of datetime.h's static is never set, the module
+       state's is read instead */
+    (void)PyDateTimeAPI;
 
     /* infinite recursion protection with a max depth */
     if (depth > MUMMYPY_MAX_DEPTH) {
@@ -29,11 +142,6 @@ dump_one(PyObject *obj, mummy_string *str, PyObject *default_handler,
         return -1;
     }
 
-    if (default_handler != Py_None && !PyCallable_Check(default_handler)) {
-        PyErr_SetString(PyExc_TypeError, "default must be callable or None");
-        return -1;
-    }
-
     if (obj == Py_None) {
         rc = mummy_feed_null(str);
         goto done;
@@ -52,9 +160,17 @@ dump_one(PyObject *obj, mummy_string *str, PyObject *default_handler,
 #endif
 
     if (PyLong_CheckExact(obj)) {
-        ll = PyInt_AsLongLong(obj);
-        if (ll == -1 && PyErr_Occurred()) {
-            PyErr_Clear();
+#if MUMMYPY_COMPACT_LONGS
+        /* anything that fits in a machine word is stored inline */
+        if (PyUnstable_Long_IsCompact((PyLongObject *)obj)) {
+            rc = mummy_feed_int(str,
+                    (int64_t)PyUnstable_Long_CompactValue((PyLongObject *)obj));
+            goto done;
+        }
+#endif
+        ll = PyLong_AsLongLongAndOverflow(obj, &overflow);
+        if (ll == -1 && PyErr_Occurred()) return -1;
+        if (overflow) {
             size = _PyLong_NumBits(obj) + 1;
             size = (size >> 3) + (size & 0x7 ? 1 : 0);
 
@@ -63,8 +179,7 @@ dump_one(PyObject *obj, mummy_string *str, PyObject *default_handler,
                 PyErr_SetString(PyExc_MemoryError, "out of memory");
                 return -1;
             }
-            if (_PyLong_AsByteArray((PyLongObject *)obj,
-                        (unsigned char *)buf, size, 0, 1)) {
+            if (mummypy_long_as_bytes(obj, buf, size)) {
                 free(buf);
                 return -1;
             }
@@ -89,93 +204,46 @@ dump_one(PyObject *obj, mummy_string *str, PyObject *default_handler,
     }
 
     if (PyUnicode_CheckExact(obj)) {
-        obj = PyUnicode_AsUTF8String(obj);
-        size = PyBytes_GET_SIZE(obj);
-        rc = mummy_feed_utf8(str, PyBytes_AS_STRING(obj), size);
+#if ISPY3
+        /* the utf8 form is cached on the object, there's no copy to free */
+        if (!(buf = (char *)PyUnicode_AsUTF8AndSize(obj, &pst))) return -1;
+        rc = mummy_feed_utf8(str, buf, pst);
+#else
+        if (!(obj = PyUnicode_AsUTF8String(obj))) return -1;
+        rc = mummy_feed_utf8(str, PyBytes_AS_STRING(obj), PyBytes_GET_SIZE(obj));
+        Py_DECREF(obj);
+#endif
         goto done;
     }
 
-    if (PyList_CheckExact(obj)) {
-        pst = PyList_GET_SIZE(obj);
-        if ((rc = mummy_open_list(str, pst))) {
-            goto done;
-        }
-        if (!pst) goto done;
-        if (!(iterator = PyObject_GetIter(obj))) {
-            goto fail;
-        }
-        while ((obj = PyIter_Next(iterator))) {
-            rc = dump_one(obj, str, default_handler, depth + 1);
-            Py_DECREF(obj);
-            if (rc) {
-                Py_DECREF(iterator);
-                goto fail;
-            }
-        }
-        Py_DECREF(iterator);
-        goto done;
-    }
+    if (PyList_CheckExact(obj))
+        return dump_list(state, obj, str, default_handler, depth);
 
     if (PyTuple_CheckExact(obj)) {
         pst = PyTuple_GET_SIZE(obj);
         if ((rc = mummy_open_tuple(str, pst)))
             goto done;
-        if (!pst) goto done;
-        if (!(iterator = PyObject_GetIter(obj)))
-            goto fail;
-        while ((obj = PyIter_Next(iterator))) {
-            rc = dump_one(obj, str, default_handler, depth + 1);
-            Py_DECREF(obj);
-            if (rc) {
-                Py_DECREF(iterator);
+        for (i = 0; i < pst; ++i)
+            if (dump_value(state, PyTuple_GET_ITEM(obj, i), str,
+                        default_handler, depth + 1))
                 goto fail;
-            }
-        }
-        Py_DECREF(iterator);
         goto done;
     }
 
-    if (PyAnySet_CheckExact(obj)) {
-        pst = PySet_GET_SIZE(obj);
-        if ((rc = mummy_open_set(str, pst)))
-            goto done;
-        if (!pst) goto done;
-        if (!(iterator = PyObject_GetIter(obj)))
-            goto fail;
-        while ((obj = PyIter_Next(iterator))) {
-            rc = dump_one(obj, str, default_handler, depth + 1);
-            Py_DECREF(obj);
-            if (rc) {
-                Py_DECREF(iterator);
-                goto fail;
-            }
-        }
-        Py_DECREF(iterator);
-        goto done;
-    }
+    if (PyAnySet_CheckExact(obj))
+        return dump_set(state, obj, str, default_handler, depth);
 
-    if (PyDict_CheckExact(obj)) {
-        pst = PyDict_Size(obj);
-        if ((rc = mummy_open_hash(str, pst)))
-            goto done;
-        if (!pst) goto done;
-        pst = 0;
-        while (PyDict_Next(obj, &pst, &key, &value)) {
-            if (dump_one(key, str, default_handler, depth + 1)) goto done;
-            if (dump_one(value, str, default_handler, depth + 1)) goto done;
-        }
-        goto done;
-    }
+    if (PyDict_CheckExact(obj))
+        return dump_dict(state, obj, str, default_handler, depth);
 
-    if (Py_TYPE(obj) == PyDateTimeCAPI->DateType) {
+    if (Py_TYPE(obj) == datetime_capi->DateType) {
         buf = (char *)((PyDateTime_Date *)obj)->data;
-        /* the python datetime module inexplicably swaps the year bytes */
-        rc = mummy_feed_date(
-                str, bswap_16(*(unsigned short *)buf), buf[2], buf[3]);
+        /* the python datetime module keeps the year big-endian */
+        rc = mummy_feed_date(str, mummy_unpack16(buf), buf[2], buf[3]);
         goto done;
     }
 
-    if (Py_TYPE(obj) == PyDateTimeCAPI->TimeType) {
+    if (Py_TYPE(obj) == datetime_capi->TimeType) {
         if (((PyDateTime_Time *)obj)->hastzinfo) {
             PyErr_SetString(PyExc_ValueError,
                     "can't serialize datetime objects with tzinfo");
@@ -183,13 +251,12 @@ dump_one(PyObject *obj, mummy_string *str, PyObject *default_handler,
         }
 
         buf = (char *)((PyDateTime_Time *)obj)->data;
-        /* the python datetime module swaps the three microsecond bytes */
         rc = mummy_feed_time(str, *buf, buf[1], buf[2],
-                bswap_32(*(int *)(buf + 3)));
+                PyDateTime_TIME_GET_MICROSECOND(obj));
         goto done;
     }
 
-    if (Py_TYPE(obj) == PyDateTimeCAPI->DateTimeType) {
+    if (Py_TYPE(obj) == datetime_capi->DateTimeType) {
         if (((PyDateTime_DateTime *)obj)->hastzinfo) {
             PyErr_SetString(PyExc_ValueError,
                     "can't serialize datetime objects with tzinfo");
@@ -197,15 +264,14 @@ dump_one(PyObject *obj, mummy_string *str, PyObject *default_handler,
         }
 
         buf = (char *)((PyDateTime_DateTime *)obj)->data;
-        /* the python datetime module inexplicably swaps the year bytes
-           and the THREE microsecond bytes */
-        rc = mummy_feed_datetime(str, bswap_16(*(short *)buf),
+        /* the python datetime module keeps the year big-endian */
+        rc = mummy_feed_datetime(str, mummy_unpack16(buf),
                 buf[2], buf[3], buf[4], buf[5], buf[6],
-                bswap_32(*(int *)(buf + 7)));
+                PyDateTime_DATE_GET_MICROSECOND(obj));
         goto done;
     }
 
-    if (Py_TYPE(obj) == PyDateTimeCAPI->DeltaType) {
+    if (Py_TYPE(obj) == datetime_capi->DeltaType) {
         rc = mummy_feed_timedelta(str,
                 ((PyDateTime_Delta *)obj)->days,
                 ((PyDateTime_Delta *)obj)->seconds,
@@ -213,7 +279,7 @@ dump_one(PyObject *obj, mummy_string *str, PyObject *default_handler,
         goto done;
     }
 
-    if (Py_TYPE(obj) == (PyTypeObject *)PyDecimalType) {
+    if (Py_TYPE(obj) == (PyTypeObject *)state->decimal_type) {
         /* as_tuple() returns (sign, digit, exponent) */
         if (!(obj = PyObject_CallMethod(obj, "as_tuple", NULL))) return -1;
 
@@ -229,20 +295,23 @@ dump_one(PyObject *obj, mummy_string *str, PyObject *default_handler,
             Py_DECREF(value);
             value = key;
         }
-        if (PyString_CheckExact(value)) {
-            c = PyString_AS_STRING(value)[0];
+        if (PyBytes_CheckExact(value)) {
+            c = PyBytes_AS_STRING(value)[0];
             Py_DECREF(value);
             switch (c) {
             case 'n':
+                Py_DECREF(obj);
                 rc = mummy_feed_nan(str, 0);
                 goto done;
             case 'N':
+                Py_DECREF(obj);
                 rc = mummy_feed_nan(str, 1);
                 goto done;
             case 'F':
                 if (!(key = PyInt_FromLong(0))) goto dec_bail0;
                 if (!(value = PyObject_GetItem(obj, key))) goto dec_bail1;
                 Py_DECREF(key);
+                Py_DECREF(obj);
                 rc = mummy_feed_infinity(str, (char)PyInt_AS_LONG(value));
                 Py_DECREF(value);
                 goto done;
@@ -305,36 +374,29 @@ dump_one(PyObject *obj, mummy_string *str, PyObject *default_handler,
             rc = ENOMEM;
             goto done;
         }
-        iterator = PyObject_GetIter(value);
-        if (!iterator) {
-            Py_DECREF(value);
-            goto fail;
-        }
-        i = 0;
-        while ((obj = PyIter_Next(iterator))) {
-            if (!PyInt_CheckExact(obj)) {
+        for (i = 0; i < (int)size; ++i) {
+            key = PyTuple_GET_ITEM(value, i);
+            if (!PyInt_CheckExact(key)) {
                 PyErr_SetString(PyExc_TypeError, "non-int in 'digits'");
-                Py_DECREF(iterator);
-                goto dec_bail0;
+                free(buf);
+                Py_DECREF(value);
+                goto fail;
             }
-            buf[i++] = (char)PyInt_AsLong(obj);
-            Py_DECREF(obj);
+            buf[i] = (char)PyInt_AsLong(key);
         }
-        Py_DECREF(iterator);
         Py_DECREF(value);
 
-        if ((rc = mummy_feed_decimal(
-                str, (char)ll, (int16_t)l, (uint16_t)size, buf))) {
-            if (EINVAL == rc) {
-                PyErr_SetString(PyExc_SystemError,
-                        "mummy dump internal failure");
-                goto fail;
-            }
+        rc = mummy_feed_decimal(
+                str, (char)ll, (int16_t)l, (uint16_t)size, buf);
+        free(buf);
+        if (EINVAL == rc) {
+            PyErr_SetString(PyExc_SystemError, "mummy dump internal failure");
+            goto fail;
         }
         goto done;
     }
 
-    if (Py_TYPE(obj) == (PyTypeObject *)PyFractionType) {
+    if (Py_TYPE(obj) == (PyTypeObject *)state->fraction_type) {
         if (NULL == (value = PyObject_GetAttrString(obj, "numerator")))
             goto fail;
         ll = PyInt_AsLongLong(value);
@@ -363,7 +425,7 @@ dump_one(PyObject *obj, mummy_string *str, PyObject *default_handler,
         PyTuple_SET_ITEM(args, 0, obj);
         if (!(obj = PyObject_Call(default_handler, args, NULL)))
             return -1;
-        rc = dump_one(obj, str, Py_None, depth);
+        rc = dump_item(state, obj, str, Py_None, depth);
         Py_DECREF(args);
         Py_DECREF(obj);
         return rc;
@@ -388,42 +450,220 @@ fail:
     return -1;
 }
 
-static char *dumps_kwargs[] = {"object", "default", "compress", NULL};
+/* a top-level value, the encode phase of whatever is dumping it */
+int
+dump_one(mummypy_state *state, PyObject *obj, mummy_string *str,
+        PyObject *default_handler, int depth) {
+    int start = str->offset, rc;
+    uint64_t t;
+
+    mummypy_phase_start(state, t, encode);
+    rc = dump_value(state, obj, str, default_handler, depth);
+    mummypy_phase_done(state, t, encode, str->offset - start);
+    return rc;
+}
+
+/* compress the dumped data into `output`, which must have room for
+   str->offset - 1 bytes. returns the compressed length, or 0 if it didn't
+   come out any smaller */
+int
+mummypy_compress(mummypy_state *state, mummy_string *str, char *output) {
+    int compressed;
+    uint64_t t;
+
+    if (str->offset <= 6) return 0;
+
+    mummy_stats_count(compress_attempts, 1);
+    mummy_probe1(compress__start, str->offset);
+    t = state->timing ? mummypy_now() : 0;
+    compressed = lzf_compress(str->data + 1, str->offset - 1,
+            output + 5, str->offset - 6);
+    if (t) mummypy_record(state, mummypy_phase_compress, str->offset, t);
+    mummy_probe2(compress__done, str->offset,
+            compressed > 0 ? compressed + 5 : 0);
+    if (compressed <= 0) return 0;
+    mummy_stats_count(compress_saves, 1);
+    mummy_stats_count(compress_bytes_in, str->offset);
+    mummy_stats_count(compress_bytes_out, compressed + 5);
+
+    output[0] = str->data[0] | 0x80;
+    mummy_pack32(output + 1, str->offset - 1);
+    return compressed + 5;
+}
 
+/* copy the dumped data out into a new bytes object. compression is done
+   straight into the bytes object's buffer, the same way (and under the same
+   conditions) as mummy_string_compress */
 PyObject *
-python_dumps(PyObject *self, PyObject *args, PyObject *kwargs) {
+mummypy_result(mummypy_state *state, mummy_string *str, int compress) {
+    PyObject *result;
+    int compressed;
+
+    if (compress && str->offset > 6) {
+        result = PyBytes_FromStringAndSize(NULL, str->offset - 1);
+        if (!result) return NULL;
+
+        if ((compressed = mummypy_compress(state, str,
+                        PyBytes_AS_STRING(result)))) {
+            if (_PyBytes_Resize(&result, compressed)) return NULL;
+            return result;
+        }
+        Py_DECREF(result);
+    }
+
+    return PyBytes_FromStringAndSize(str->data, str->offset);
+}
+
+/* add the dumped data onto the end of a bytearray, compressing straight
+   into it if `compress`. returns the number of bytes added */
+Py_ssize_t
+mummypy_append_result(mummypy_state *state, PyObject *buffer,
+        mummy_string *str, int compress) {
+    Py_ssize_t start = PyByteArray_GET_SIZE(buffer), size;
+    char *output;
+
+    if (PyByteArray_Resize(buffer, start + str->offset)) return -1;
+    output = PyByteArray_AS_STRING(buffer) + start;
+
+    if (!compress || !(size = mummypy_compress(state, str, output))) {
+        memcpy(output, str->data, str->offset);
+        return str->offset;
+    }
+    if (PyByteArray_Resize(buffer, start + size)) return -1;
+    return size;
+}
+
+static char *dumps_kwargs[] = {"object", "default", "compress", NULL};
+
+static PyObject *
+dumps_parsed(PyObject *self, PyObject *obj, PyObject *default_handler,
+        PyObject *compress) {
+    mummypy_state *state = mummypy_get_state(self);
+    mummypy_alloc_call call;
     mummy_string *str;
-    PyObject *obj,
-            *result,
-            *default_handler = Py_None,
-            *compress = Py_True;
+    PyObject *result;
+    int do_compress;
 
-    if (!PyArg_ParseTupleAndKeywords(
-            args, kwargs, "O|OO", dumps_kwargs,
-            &obj, &default_handler, &compress))
+    if (default_handler != Py_None && !PyCallable_Check(default_handler)) {
+        PyErr_SetString(PyExc_TypeError, "default must be callable or None");
         return NULL;
+    }
+    if ((do_compress = PyObject_IsTrue(compress)) < 0) return NULL;
 
-    str = mummy_string_new(MUMMYPY_STARTING_BUFFER);
-    if (!str) return NULL;
+    mummypy_alloc_enter(&call);
+    if (!(str = mummy_string_new(MUMMYPY_STARTING_BUFFER))) {
+        mummypy_alloc_leave(&call, "dumps");
+        return PyErr_NoMemory();
+    }
 
     Py_INCREF(obj);
     Py_INCREF(default_handler);
 
-    if (dump_one(obj, str, default_handler, 1))
+    if (dump_one(state, obj, str, default_handler, 1))
         result = NULL;
-    else {
-        if (PyObject_IsTrue(compress)) {
-            if (mummy_string_compress(str)) {
-                mummy_string_free(str, 1);
+    else
+        result = mummypy_result(state, str, do_compress);
+
+    Py_DECREF(obj);
+    Py_DECREF(default_handler);
+    mummy_string_free(str, 1);
+    mummypy_alloc_leave(&call, "dumps");
+    return result;
+}
+
+#if MUMMYPY_FASTCALL
+/* the positional args come first in `args`, followed by the values of the
+   keyword args named in `kwnames` */
+PyObject *
+python_dumps(PyObject *self, PyObject *const *args, Py_ssize_t nargs,
+        PyObject *kwnames) {
+    PyObject *argv[3] = {NULL, Py_None, Py_True}, *name;
+    Py_ssize_t i, j;
+
+    if (nargs > 3) {
+        PyErr_Format(PyExc_TypeError,
+                "dumps() takes at most 3 arguments (%zd given)", nargs);
+        return NULL;
+    }
+    for (i = 0; i < nargs; ++i) argv[i] = args[i];
+
+    if (kwnames) {
+        for (i = 0; i < PyTuple_GET_SIZE(kwnames); ++i) {
+            name = PyTuple_GET_ITEM(kwnames, i);
+            for (j = 0; dumps_kwargs[j]; ++j)
+                if (!PyUnicode_CompareWithASCIIString(name, dumps_kwargs[j]))
+                    break;
+            if (!dumps_kwargs[j]) {
+                PyErr_Format(PyExc_TypeError,
+                        "'%U' is an invalid keyword argument for dumps()",
+                        name);
+                return NULL;
+            }
+            if (j < nargs) {
+                PyErr_Format(PyExc_TypeError,
+                        "argument for dumps() given by name ('%U') and "
+                        "position (%zd)", name, j + 1);
                 return NULL;
             }
+            argv[j] = args[nargs + i];
         }
+    }
 
-        result = PyBytes_FromStringAndSize(str->data, str->offset);
+    if (!argv[0]) {
+        PyErr_SetString(PyExc_TypeError,
+                "dumps() missing required argument 'object' (pos 1)");
+        return NULL;
     }
 
-    Py_DECREF(obj);
-    Py_DECREF(default_handler);
+    return dumps_parsed(self, argv[0], argv[1], argv[2]);
+}
+#else
+PyObject *
+python_dumps(PyObject *self, PyObject *args, PyObject *kwargs) {
+    PyObject *obj, *default_handler = Py_None, *compress = Py_True;
+
+    if (!PyArg_ParseTupleAndKeywords(
+            args, kwargs, "O|OO", dumps_kwargs,
+            &obj, &default_handler, &compress))
+        return NULL;
+
+    return dumps_parsed(self, obj, default_handler, compress);
+}
+#endif
+
+static char *dumps_into_kwargs[] = {
+    "buffer", "object", "default", "compress", NULL};
+
+PyObject *
+python_dumps_into(PyObject *self, PyObject *args, PyObject *kwargs) {
+    PyObject *buffer, *obj, *default_handler = Py_None, *compress = Py_True;
+    mummypy_state *state = mummypy_get_state(self);
+    mummypy_alloc_call call;
+    mummy_string *str;
+    Py_ssize_t size = -1;
+    int do_compress;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!O|OO:dumps_into",
+                dumps_into_kwargs, &PyByteArray_Type, &buffer, &obj,
+                &default_handler, &compress))
+        return NULL;
+
+    if (default_handler != Py_None && !PyCallable_Check(default_handler)) {
+        PyErr_SetString(PyExc_TypeError, "default must be callable or None");
+        return NULL;
+    }
+    if ((do_compress = PyObject_IsTrue(compress)) < 0) return NULL;
+
+    mummypy_alloc_enter(&call);
+    if (!(str = mummy_string_new(MUMMYPY_STARTING_BUFFER))) {
+        mummypy_alloc_leave(&call, "dumps_into");
+        return PyErr_NoMemory();
+    }
+
+    if (!dump_one(state, obj, str, default_handler, 1))
+        size = mummypy_append_result(state, buffer, str, do_compress);
+
     mummy_string_free(str, 1);
-    return result;
+    mummypy_alloc_leave(&call, "dumps_into");
+    return size < 0 ? NULL : PyInt_FromSsize_t(size);
 }
@@ -1,8 +1,5 @@
 #include "mummypy.h"
-
-extern PyDateTime_CAPI *PyDateTimeCAPI;
-extern PyObject *PyFractionType;
-extern PyObject *PyDecimalType;
+#include "datetime.h"
 
 #define INVALID do {\
                     PyErr_SetString(PyExc_ValueError,\
@@ -20,8 +17,108 @@ python_num(int64_t num) {
 }
 
 
+static PyObject *load_item(
+        mummypy_state *, mummy_string *, mummypy_cached_key *, int);
+
+/* hash keys that are short strings go through the decoder's key cache */
+static PyObject *
+load_key_item(mummypy_state *state, mummy_string *str,
+        mummypy_cached_key *keys, int depth) {
+    mummypy_cached_key *slot;
+    uint32_t hash = 2166136261U;
+    char *data;
+    int i, len, utf8;
+    PyObject *key;
+
+    if (!keys || mummy_string_space(str) < 1)
+        return load_item(state, str, keys, depth);
+
+    switch (mummy_type(str)) {
+    case MUMMY_TYPE_SHORTSTR:
+        utf8 = 0;
+        if (mummy_point_to_string(str, &data, &len)) INVALID;
+        break;
+    case MUMMY_TYPE_SHORTUTF8:
+        utf8 = 1;
+        if (mummy_point_to_utf8(str, &data, &len)) INVALID;
+        break;
+    default:
+        return load_item(state, str, keys, depth);
+    }
+
+    if (len > MUMMYPY_KEYCACHE_MAXLEN) goto uncached;
+
+    /* FNV-1a */
+    for (i = 0; i < len; ++i) hash = (hash ^ (uint8_t)data[i]) * 16777619U;
+    slot = keys + ((hash ^ utf8) & (MUMMYPY_KEYCACHE_SIZE - 1));
+
+    if (slot->obj && slot->utf8 == utf8 && slot->len == len &&
+            !memcmp(slot->data, data, len)) {
+        Py_INCREF(slot->obj);
+        return slot->obj;
+    }
+
+    key = utf8 ? PyUnicode_FromStringAndSize(data, len) :
+            PyBytes_FromStringAndSize(data, len);
+    if (!key) return NULL;
+
+    Py_XDECREF(slot->obj);
+    Py_INCREF(key);
+    slot->obj = key;
+    slot->utf8 = utf8;
+    slot->len = len;
+    memcpy(slot->data, data, len);
+    return key;
+
+uncached:
+    return utf8 ? PyUnicode_FromStringAndSize(data, len) :
+            PyBytes_FromStringAndSize(data, len);
+}
+
+#ifdef MUMMY_STATS
+/* count each value as it's finished, from the offset it started at */
+static PyObject *
+load_value(mummypy_state *state, mummy_string *str, mummypy_cached_key *keys,
+        int depth) {
+    int start = str->offset;
+    PyObject *result;
+
+    if ((result = load_item(state, str, keys, depth)))
+        mummy_stats_decoded(str, start, depth);
+    return result;
+}
+
 static PyObject *
-load_one(mummy_string *str) {
+load_key(mummypy_state *state, mummy_string *str, mummypy_cached_key *keys,
+        int depth) {
+    int start = str->offset;
+    PyObject *result;
+
+    if ((result = load_key_item(state, str, keys, depth)))
+        mummy_stats_decoded(str, start, depth);
+    return result;
+}
+#else
+#define load_value load_item
+#define load_key load_key_item
+#endif
+
+/* a top-level value, the decode phase of whatever is loading it */
+PyObject *
+load_one(mummypy_state *state, mummy_string *str, mummypy_cached_key *keys) {
+    int start = str->offset;
+    PyObject *result;
+    uint64_t t;
+
+    mummypy_phase_start(state, t, decode);
+    result = load_value(state, str, keys, 1);
+    mummypy_phase_done(state, t, decode, str->offset - start);
+    return result;
+}
+
+static PyObject *
+load_item(mummypy_state *state, mummy_string *str, mummypy_cached_key *keys,
+        int depth) {
     int64_t int_result = 0, int_result2;
     int i, microsecond;
     int days, seconds, microseconds;
@@ -31,6 +128,9 @@ load_one(mummy_string *str) {
     double float_result;
     PyObject *result, *key, *value, *triple;
     char *chr_ptr, *buf, flags;
+    PyDateTime_CAPI *datetime_capi = state->datetime_capi;
+
+    (void)PyDateTimeAPI; /* unset here, see dump_item */
 
     if (str->len - str->offset <= 0) {
         INVALID;
@@ -73,7 +173,7 @@ load_one(mummy_string *str) {
     case MUMMY_TYPE_MEDSTR:
     case MUMMY_TYPE_LONGSTR:
         if (mummy_point_to_string(str, &chr_ptr, (int *)&int_result)) INVALID;
-        result = PyString_FromStringAndSize(chr_ptr, int_result);
+        result = PyBytes_FromStringAndSize(chr_ptr, int_result);
         goto done;
 
     case MUMMY_TYPE_SHORTUTF8:
@@ -89,7 +189,8 @@ load_one(mummy_string *str) {
         if (mummy_container_size(str, (uint32_t *)&int_result)) INVALID;
         if (NULL == (result = PyList_New((int)int_result))) goto done;
         for (i = 0; i < int_result; ++i) {
-            if (NULL == (value = load_one(str))) goto fail;
+            value = load_value(state, str, keys, depth + 1);
+            if (NULL == value) goto fail;
             PyList_SET_ITEM(result, i, value);
         }
         goto done;
@@ -100,7 +201,8 @@ load_one(mummy_string *str) {
         if (mummy_container_size(str, (uint32_t *)&int_result)) INVALID;
         if (NULL == (result = PyTuple_New(int_result))) goto done;
         for (i = 0; i < int_result; ++i) {
-            if (NULL == (value = load_one(str))) goto fail;
+            value = load_value(state, str, keys, depth + 1);
+            if (NULL == value) goto fail;
             PyTuple_SET_ITEM(result, i, value);
         }
         goto done;
@@ -111,7 +213,8 @@ load_one(mummy_string *str) {
         if (mummy_container_size(str, (uint32_t *)&int_result)) INVALID;
         if (NULL == (result = PySet_New(NULL))) goto done;
         for (i = 0; i < int_result; ++i) {
-            if (NULL == (value = load_one(str))) goto fail;
+            value = load_value(state, str, keys, depth + 1);
+            if (NULL == value) goto fail;
             if (PySet_Add(result, value)) {
                 Py_DECREF(value);
                 goto fail;
@@ -126,8 +229,9 @@ load_one(mummy_string *str) {
         if (mummy_container_size(str, (uint32_t *)&int_result)) INVALID;
         if (NULL == (result = PyDict_New())) goto done;
         for (i = 0; i < int_result; ++i) {
-            if (NULL == (key = load_one(str))) goto fail;
-            if (NULL == (value = load_one(str))) {
+            key = load_key(state, str, keys, depth + 1);
+            if (NULL == key) goto fail;
+            if (NULL == (value = load_value(state, str, keys, depth + 1))) {
                 Py_DECREF(key);
                 goto fail;
             }
@@ -143,30 +247,30 @@ load_one(mummy_string *str) {
 
     case MUMMY_TYPE_DATE:
         if (mummy_read_date(str, &year, &month, &day)) INVALID;
-        result = PyDateTimeCAPI->Date_FromDate(
-                year, month, day, PyDateTimeCAPI->DateType);
+        result = datetime_capi->Date_FromDate(
+                year, month, day, datetime_capi->DateType);
         goto done;
 
     case MUMMY_TYPE_TIME:
         if (mummy_read_time(str, &hour, &minute, &second, &microsecond))
             INVALID;
-        result = PyDateTimeCAPI->Time_FromTime((int)hour, (int)minute,
-                (int)second, microsecond, Py_None, PyDateTimeCAPI->TimeType);
+        result = datetime_capi->Time_FromTime((int)hour, (int)minute,
+                (int)second, microsecond, Py_None, datetime_capi->TimeType);
         goto done;
 
     case MUMMY_TYPE_DATETIME:
         if (mummy_read_datetime(str, &year, &month, &day,
                     &hour, &minute, &second, &microsecond))
             INVALID;
-        result = PyDateTimeCAPI->DateTime_FromDateAndTime(year, month, day,
+        result = datetime_capi->DateTime_FromDateAndTime(year, month, day,
                 hour, minute, second, microsecond, Py_None,
-                PyDateTimeCAPI->DateTimeType);
+                datetime_capi->DateTimeType);
         goto done;
 
     case MUMMY_TYPE_TIMEDELTA:
         if (mummy_read_timedelta(str, &days, &seconds, &microseconds)) INVALID;
-        result = PyDateTimeCAPI->Delta_FromDelta(days, seconds, microseconds, 1,
-                PyDateTimeCAPI->DeltaType);
+        result = datetime_capi->Delta_FromDelta(days, seconds, microseconds, 1,
+                datetime_capi->DeltaType);
         goto done;
 
     case MUMMY_TYPE_DECIMAL:
@@ -223,7 +327,7 @@ load_one(mummy_string *str) {
             }
             PyTuple_SET_ITEM(triple, 1, value);
 
-            if (NULL == (value = PyString_FromString("F"))) {
+            if (NULL == (value = PyStr_FromString("F"))) {
                 Py_DECREF(triple);
                 return NULL;
             }
@@ -247,7 +351,7 @@ load_one(mummy_string *str) {
             PyTuple_SET_ITEM(triple, 1, value);
 
             /* low byte of flags indicates NaN(0) or sNaN(1) */
-            value = PyString_FromString((flags & 0x01) ? "N" : "n");
+            value = PyStr_FromString((flags & 0x01) ? "N" : "n");
             if (NULL == value) {
                 Py_DECREF(triple);
                 return NULL;
@@ -277,7 +381,7 @@ load_one(mummy_string *str) {
         }
         PyTuple_SET_ITEM(triple, 1, value);
 
-        result = PyObject_Call(PyFractionType, triple, NULL);
+        result = PyObject_Call(state->fraction_type, triple, NULL);
         Py_DECREF(triple);
         return result;
 
@@ -293,7 +397,7 @@ finish_decimal:
         return NULL;
     }
     PyTuple_SET_ITEM(value, 0, triple);
-    result = PyObject_Call(PyDecimalType, value, NULL);
+    result = PyObject_Call(state->decimal_type, value, NULL);
     Py_DECREF(value);
     return result;
 
@@ -309,27 +413,102 @@ fail:
 
 PyObject *
 python_loads(PyObject *self, PyObject *data) {
+    mummypy_state *state = mummypy_get_state(self);
+    mummypy_alloc_call call;
     PyObject *result;
     mummy_string *str;
+    Py_buffer view;
     char err, free_buf = 0;
-
-    if (!PyBytes_CheckExact(data)) {
-        PyErr_SetString(PyExc_TypeError, "argument 1 must be bytes");
+    uint64_t t;
+
+    /* bytes are read in place, and so is anything else with a buffer */
+    if (PyBytes_CheckExact(data)) {
+        view.obj = NULL;
+        view.buf = PyBytes_AS_STRING(data);
+        view.len = PyBytes_GET_SIZE(data);
+    } else if (PyObject_GetBuffer(data, &view, PyBUF_SIMPLE)) {
         return NULL;
     }
 
-    str = mummy_string_wrap(PyBytes_AS_STRING(data), PyBytes_GET_SIZE(data));
+    mummypy_alloc_enter(&call);
+    str = mummy_string_wrap(view.buf, view.len);
 
     /* don't have mummy_string_decompress free the buffer,
-       but have it tell us whether we should or not */
-    if ((err = mummy_string_decompress(str, 0, &free_buf))) {
+       but have it tell us whether we should or not. it fires the probes */
+    t = state->timing ? mummypy_now() : 0;
+    err = mummy_string_decompress(str, 0, &free_buf);
+    if (t && free_buf)
+        mummypy_record(state, mummypy_phase_decompress, str->len, t);
+    if (err) {
         PyErr_Format(PyExc_ValueError, "lzf decompression failed (%d)", err);
-        mummy_string_free(str, free_buf);
-        return NULL;
+        result = NULL;
+    } else {
+        result = load_one(state, str, NULL);
     }
 
-    result = load_one(str);
     mummy_string_free(str, free_buf);
+    mummypy_alloc_leave(&call, "loads");
+    if (view.obj) PyBuffer_Release(&view);
+    return result;
+}
+
+/* a copy of the (uncompressed) old-format mummy `legacy` in the current
+   format, or NULL with an exception set */
+mummy_string *
+mummypy_upgrade(mummy_string *legacy) {
+    mummy_string *str;
+
+    if (!(str = mummy_string_new(legacy->len + 16))) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+
+    switch (mummy_upgrade_legacy(legacy, str)) {
+    case 0:
+        return str;
+    case ENOMEM:
+        PyErr_NoMemory();
+        break;
+    case EINVAL:
+        PyErr_SetString(PyExc_ValueError, "invalid mummy (bad decimal digit)");
+        break;
+    case -2:
+        PyErr_SetString(PyExc_ValueError, "invalid mummy (unrecognized type)");
+        break;
+    default:
+        PyErr_SetString(PyExc_ValueError, "invalid mummy (incorrect length)");
+    }
+    mummy_string_free(str, 1);
+    return NULL;
+}
+
+static char *upgrade_kwargs[] = {"data", "compress", NULL};
+
+PyObject *
+python_upgrade(PyObject *self, PyObject *args, PyObject *kwargs) {
+    PyObject *data, *compress = Py_True, *result = NULL;
+    mummy_string *legacy, *str;
+    Py_buffer view;
+    char err, free_buf = 0;
+    int do_compress;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|O:upgrade",
+                upgrade_kwargs, &data, &compress))
+        return NULL;
+
+    if ((do_compress = PyObject_IsTrue(compress)) < 0) return NULL;
+    if (PyObject_GetBuffer(data, &view, PyBUF_SIMPLE)) return NULL;
+
+    legacy = mummy_string_wrap(view.buf, view.len);
+
+    if ((err = mummy_string_decompress(legacy, 0, &free_buf))) {
+        PyErr_Format(PyExc_ValueError, "lzf decompression failed (%d)", err);
+    } else if ((str = mummypy_upgrade(legacy))) {
+        result = mummypy_result(mummypy_get_state(self), str, do_compress);
+        mummy_string_free(str, 1);
+    }
 
+    mummy_string_free(legacy, free_buf);
+    PyBuffer_Release(&view);
     return result;
 }
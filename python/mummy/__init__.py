@@ -82,14 +82,40 @@ first byte is the type:
         decimal.Decimal, which supports all 4 of these special numbers.
 
 the main implementation is in C, but there is a pure-python version it falls
-back to if the extension is unavailable. the module-global `has_extension` is a
-boolean indicating whether the C extension is in use.
+back to if the extension is unavailable. on PyPy the C core is reached through
+a cffi binding instead (see mummy.cffi_serialization, which also offers a
+`tokens` generator for walking a string one tag at a time). the module-global
+`has_extension` is a boolean indicating whether the C code is in use.
+
+besides dumps/loads on bytes there are dump/load on files, and dump_records
+and iter_records for files holding a series of length-prefixed mummies. with
+the extension these go through a C buffer, and straight to the file
+descriptor when there is one.
+
+data written by oldmummy is the same but for decimals. Decoder(legacy=True)
+reads it, and upgrade (or iter_upgraded, for a lot of it) rewrites it in the
+current format.
+
+to_json/from_json and to_msgpack/from_msgpack convert between mummy and
+those formats in C, without building the python objects in between, and
+profile counts up where the bytes in mummy strings go. an extension built
+with MUMMY_STATS=1 in the environment also keeps counters of all the
+encoding and decoding done, which stats returns and reset_stats zeroes.
+set_timing(True) has the extension time each phase of dumping and loading
+into latency histograms by payload size, read with timings. and with
+MUMMY_TRACK_ALLOC=1 it counts the C core's allocations, call by call, inside
+a track_allocations() block.
 """
 
 from __future__ import absolute_import
 
 from .serialization import \
-        loads, dumps, pure_python_loads, pure_python_dumps, has_extension
+        loads, dumps, pure_python_loads, pure_python_dumps, dumps_into, \
+        dump, load, dump_records, iter_records, \
+        Encoder, Decoder, upgrade, pure_python_upgrade, iter_upgraded, \
+        to_json, from_json, to_msgpack, from_msgpack, pure_python_to_json, \
+        pure_python_from_json, profile, stats, reset_stats, set_timing, \
+        timings, reset_timings, track_allocations, has_extension
 from .schemas import Message, OPTIONAL, UNION, ANY
 
 
@@ -98,4 +124,10 @@ __version__ = ".".join(filter(None, map(str, VERSION)))
 
 
 __all__ = ["loads", "dumps", "pure_python_loads", "pure_python_dumps",
-        "has_extension", "Message", "OPTIONAL", "UNION", "ANY"]
+        "dumps_into", "dump", "load", "dump_records", "iter_records",
+        "Encoder", "Decoder", "upgrade", "pure_python_upgrade",
+        "iter_upgraded", "to_json", "from_json", "to_msgpack",
+        "from_msgpack", "pure_python_to_json", "pure_python_from_json",
+        "profile", "stats", "reset_stats", "set_timing", "timings",
+        "reset_timings", "track_allocations", "has_extension",
+        "Message", "OPTIONAL", "UNION", "ANY"]
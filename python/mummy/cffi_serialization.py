@@ -0,0 +1,592 @@
+"""
+mummy serialization driven through the cffi binding to the C core
+
+this is what PyPy uses in place of the CPython extension: the C library does
+the buffer management, byte-swapping, bounds checking and LZF work, and the
+python objects are built here in plain python where the JIT can see them.
+"""
+
+import binascii
+import datetime
+import decimal
+import fractions
+import sys
+
+from ._mummy_cffi import ffi, lib
+
+
+__all__ = ["cffi_dumps", "cffi_loads", "cffi_upgrade", "cffi_to_json",
+        "cffi_from_json", "cffi_to_msgpack", "cffi_from_msgpack",
+        "cffi_profile", "tokens"]
+
+
+if sys.version_info[0] >= 3:
+    unicode = str
+    long = int
+    xrange = range
+    iteritems = lambda d: d.items()
+else:
+    iteritems = lambda d: d.iteritems()
+    bytes = str
+
+
+MAX_DEPTH = 256
+STARTING_BUFFER = 0x1000
+
+_INT64_MIN = -9223372036854775808
+_INT64_MAX = 9223372036854775807
+
+
+def _check(rc):
+    if rc:
+        raise MemoryError()
+
+
+##
+## DUMPERS
+##
+
+def _dump_none(x, s, depth, default):
+    _check(lib.mummy_feed_null(s))
+
+def _dump_bool(x, s, depth, default):
+    _check(lib.mummy_feed_bool(s, x and 1 or 0))
+
+def _dump_int(x, s, depth, default):
+    if _INT64_MIN <= x <= _INT64_MAX:
+        _check(lib.mummy_feed_int(s, x))
+    else:
+        # big-endian two's complement, sized the same way as the C extension
+        width = (abs(x).bit_length() >> 3) + 1
+        data = binascii.unhexlify(
+                "%0*x" % (width << 1, x & ((1 << (width << 3)) - 1)))
+        _check(lib.mummy_feed_huge(s, data, width))
+
+def _dump_double(x, s, depth, default):
+    _check(lib.mummy_feed_float(s, x))
+
+def _dump_str(x, s, depth, default):
+    _check(lib.mummy_feed_string(s, x, len(x)))
+
+def _dump_utf8(x, s, depth, default):
+    x = x.encode('utf8')
+    _check(lib.mummy_feed_utf8(s, x, len(x)))
+
+def _container_dumper(opener):
+    def dumper(x, s, depth, default):
+        _check(opener(s, len(x)))
+        depth += 1
+        for item in x:
+            _dump(item, s, depth, default)
+    return dumper
+
+_dump_list = _container_dumper(lib.mummy_open_list)
+_dump_tuple = _container_dumper(lib.mummy_open_tuple)
+_dump_set = _container_dumper(lib.mummy_open_set)
+
+def _dump_dict(x, s, depth, default):
+    _check(lib.mummy_open_hash(s, len(x)))
+    depth += 1
+    for key, value in iteritems(x):
+        _dump(key, s, depth, default)
+        _dump(value, s, depth, default)
+
+def _dump_date(x, s, depth, default):
+    _check(lib.mummy_feed_date(s, x.year, x.month, x.day))
+
+def _dump_time(x, s, depth, default):
+    if x.tzinfo is not None:
+        raise ValueError("can't serialize data objects with tzinfo")
+    _check(lib.mummy_feed_time(s, x.hour, x.minute, x.second, x.microsecond))
+
+def _dump_datetime(x, s, depth, default):
+    if x.tzinfo is not None:
+        raise ValueError("can't serialize data objects with tzinfo")
+    _check(lib.mummy_feed_datetime(s, x.year, x.month, x.day,
+            x.hour, x.minute, x.second, x.microsecond))
+
+def _dump_timedelta(x, s, depth, default):
+    _check(lib.mummy_feed_timedelta(s, x.days, x.seconds, x.microseconds))
+
+def _dump_decimal(x, s, depth, default):
+    if x.is_snan():
+        _check(lib.mummy_feed_nan(s, 1))
+    elif x.is_nan():
+        _check(lib.mummy_feed_nan(s, 0))
+    elif x.is_infinite():
+        _check(lib.mummy_feed_infinity(s, int(x < 0)))
+    else:
+        sign, digits, expo = x.as_tuple()
+        if not -32768 <= expo < 32768 or len(digits) >= 65536:
+            raise ValueError("decimal too large")
+        rc = lib.mummy_feed_decimal(
+                s, sign, expo, len(digits), bytes(bytearray(digits)))
+        if rc == lib.EINVAL:
+            raise ValueError("invalid digit")
+        _check(rc)
+
+def _dump_fraction(x, s, depth, default):
+    _check(lib.mummy_feed_fraction(s, x.numerator, x.denominator))
+
+
+_dumpers = {
+    type(None): _dump_none,
+    bool: _dump_bool,
+    int: _dump_int,
+    long: _dump_int,
+    float: _dump_double,
+    bytes: _dump_str,
+    unicode: _dump_utf8,
+    list: _dump_list,
+    tuple: _dump_tuple,
+    set: _dump_set,
+    frozenset: _dump_set,
+    dict: _dump_dict,
+    datetime.date: _dump_date,
+    datetime.time: _dump_time,
+    datetime.datetime: _dump_datetime,
+    datetime.timedelta: _dump_timedelta,
+    decimal.Decimal: _dump_decimal,
+    fractions.Fraction: _dump_fraction,
+}
+
+def _dump(item, s, depth, default):
+    if depth > MAX_DEPTH:
+        raise ValueError("max depth exceeded")
+    dumper = _dumpers.get(type(item))
+    if dumper is None:
+        if default is None:
+            raise TypeError("unserializable type")
+        item = default(item)
+        dumper = _dumpers.get(type(item))
+        if dumper is None:
+            raise TypeError("unserializable type")
+    dumper(item, s, depth, default)
+
+def cffi_dumps(item, default=None, compress=True):
+    """serialize a native python object into a mummy string
+
+    :param object: the python object to serialize
+    :param function default:
+        If the 'object' parameter is not serializable and this parameter is
+        provided, this function will be used to generate a fallback value to
+        serialize. It should take one argument (the original object), and
+        return something serilizable.
+    :param bool compress:
+        whether or not to attempt to compress the serialized data (default
+        True)
+
+    :returns: the bytestring of the serialized data
+    """
+    if default and not hasattr(default, "__call__"):
+        raise TypeError("default must be callable or None")
+
+    s = lib.mummy_string_new(STARTING_BUFFER)
+    if s == ffi.NULL:
+        raise MemoryError()
+    try:
+        _dump(item, s, 1, default)
+        if compress:
+            _check(lib.mummy_string_compress(s))
+        return ffi.buffer(s.data, s.offset)[:]
+    finally:
+        lib.mummy_string_free(s, 1)
+
+
+##
+## LOADERS
+##
+
+# loaders get the token just read by mummy_read_token (the object itself for
+# atoms, just the item count for containers) and must copy out everything
+# they need from it before loading any children, which reuse the same token
+
+def _load_none(s, token):
+    return None
+
+def _load_bool(s, token):
+    return bool(token.v.i)
+
+def _load_int(s, token):
+    return token.v.i
+
+def _load_huge(s, token):
+    data = ffi.buffer(token.v.s.data, token.v.s.len)[:]
+    if not data:
+        return 0
+    num = int(binascii.hexlify(data), 16)
+    if ord(data[:1]) & 0x80:
+        num -= 1 << (len(data) << 3)
+    return num
+
+def _load_float(s, token):
+    return token.v.f
+
+def _load_str(s, token):
+    return ffi.buffer(token.v.s.data, token.v.s.len)[:]
+
+def _load_utf8(s, token):
+    return ffi.buffer(token.v.s.data, token.v.s.len)[:].decode('utf8')
+
+def _load_list(s, token):
+    return [_load(s, token) for i in xrange(token.v.size)]
+
+def _load_tuple(s, token):
+    return tuple(_load_list(s, token))
+
+def _load_set(s, token):
+    return set(_load_list(s, token))
+
+def _load_hash(s, token):
+    result = {}
+    for i in xrange(token.v.size):
+        key = _load(s, token)
+        result[key] = _load(s, token)
+    return result
+
+def _load_date(s, token):
+    dt = token.v.dt
+    return datetime.date(dt.year, dt.month, dt.day)
+
+def _load_time(s, token):
+    dt = token.v.dt
+    return datetime.time(dt.hour, dt.minute, dt.second, dt.microsecond)
+
+def _load_datetime(s, token):
+    dt = token.v.dt
+    return datetime.datetime(dt.year, dt.month, dt.day,
+            dt.hour, dt.minute, dt.second, dt.microsecond)
+
+def _load_timedelta(s, token):
+    delta = token.v.delta
+    return datetime.timedelta(delta.days, delta.seconds, delta.microseconds)
+
+def _load_decimal(s, token):
+    dec = token.v.decimal
+    count = dec.count
+    packed = bytearray(ffi.buffer(dec.digits, (count + 1) >> 1))
+    digits = []
+    for pair in packed:
+        digits.append(pair & 0x0f)
+        digits.append(pair >> 4)
+    del digits[count:]
+    return decimal.Decimal((dec.sign, tuple(digits), dec.exponent))
+
+def _load_specialnum(s, token):
+    flags = token.v.i
+    if flags & lib.MUMMY_SPECIAL_NAN:
+        return decimal.Decimal(flags & 1 and 'sNaN' or 'NaN')
+    if flags & lib.MUMMY_SPECIAL_INFINITY:
+        return decimal.Decimal(flags & 1 and '-Infinity' or 'Infinity')
+    raise ValueError("unrecognized specialnum")
+
+def _load_fraction(s, token):
+    fraction = token.v.fraction
+    return fractions.Fraction(fraction.numerator, fraction.denominator)
+
+
+_loaders = {
+    lib.MUMMY_TYPE_NULL: _load_none,
+    lib.MUMMY_TYPE_BOOL: _load_bool,
+    lib.MUMMY_TYPE_CHAR: _load_int,
+    lib.MUMMY_TYPE_SHORT: _load_int,
+    lib.MUMMY_TYPE_INT: _load_int,
+    lib.MUMMY_TYPE_LONG: _load_int,
+    lib.MUMMY_TYPE_HUGE: _load_huge,
+    lib.MUMMY_TYPE_FLOAT: _load_float,
+    lib.MUMMY_TYPE_SHORTSTR: _load_str,
+    lib.MUMMY_TYPE_MEDSTR: _load_str,
+    lib.MUMMY_TYPE_LONGSTR: _load_str,
+    lib.MUMMY_TYPE_SHORTUTF8: _load_utf8,
+    lib.MUMMY_TYPE_MEDUTF8: _load_utf8,
+    lib.MUMMY_TYPE_LONGUTF8: _load_utf8,
+    lib.MUMMY_TYPE_SHORTLIST: _load_list,
+    lib.MUMMY_TYPE_MEDLIST: _load_list,
+    lib.MUMMY_TYPE_LONGLIST: _load_list,
+    lib.MUMMY_TYPE_SHORTTUPLE: _load_tuple,
+    lib.MUMMY_TYPE_MEDTUPLE: _load_tuple,
+    lib.MUMMY_TYPE_LONGTUPLE: _load_tuple,
+    lib.MUMMY_TYPE_SHORTSET: _load_set,
+    lib.MUMMY_TYPE_MEDSET: _load_set,
+    lib.MUMMY_TYPE_LONGSET: _load_set,
+    lib.MUMMY_TYPE_SHORTHASH: _load_hash,
+    lib.MUMMY_TYPE_MEDHASH: _load_hash,
+    lib.MUMMY_TYPE_LONGHASH: _load_hash,
+    lib.MUMMY_TYPE_DATE: _load_date,
+    lib.MUMMY_TYPE_TIME: _load_time,
+    lib.MUMMY_TYPE_DATETIME: _load_datetime,
+    lib.MUMMY_TYPE_TIMEDELTA: _load_timedelta,
+    lib.MUMMY_TYPE_DECIMAL: _load_decimal,
+    lib.MUMMY_TYPE_SPECIALNUM: _load_specialnum,
+    lib.MUMMY_TYPE_FRACTION: _load_fraction,
+}
+
+_RAW_KINDS = frozenset(kind for kind, loader in _loaders.items()
+        if loader in (_load_str, _load_utf8, _load_huge))
+_CONTAINER_KINDS = frozenset(kind for kind, loader in _loaders.items()
+        if loader in (_load_list, _load_tuple, _load_set, _load_hash))
+
+def _read_token(s, token):
+    rc = lib.mummy_read_token(s, token)
+    if rc == -1:
+        raise ValueError("invalid mummy (incorrect length)")
+    if rc:
+        raise ValueError("invalid mummy (unrecognized type)")
+
+def _load(s, token):
+    _read_token(s, token)
+    return _loaders[token.type](s, token)
+
+class _Reader(object):
+    "a (decompressed if necessary) mummy_string over a python bytestring"
+    def __init__(self, data):
+        if not isinstance(data, bytes):
+            raise TypeError("argument 1 must be a bytestring")
+        if not data:
+            raise ValueError("invalid mummy (incorrect length)")
+
+        # holding the cdata keeps the bytestring pinned in place on PyPy
+        self.buf = ffi.from_buffer(data)
+        self.s = lib.mummy_string_wrap(self.buf, len(data))
+        if self.s == ffi.NULL:
+            raise MemoryError()
+        self.owned = False
+
+        flag = ffi.new("char *")
+        rc = lib.mummy_string_decompress(self.s, 0, flag)
+        if rc:
+            self.close()
+            if rc == lib.ENOMEM:
+                raise MemoryError()
+            raise ValueError("invalid mummy (corrupt compression)")
+        self.owned = flag[0] != b'\0'
+
+    def close(self):
+        if self.s is not None:
+            lib.mummy_string_free(self.s, self.owned)
+            self.s = None
+
+def cffi_loads(data):
+    """convert a mummy string into the python object it represents
+
+    :param bytes data: the serialized string to load
+
+    :returns: the python object
+    """
+    reader = _Reader(data)
+    try:
+        return _load(reader.s, ffi.new("mummy_token *"))
+    finally:
+        reader.close()
+
+def cffi_upgrade(data, compress=True):
+    """rewrite a mummy string from the old format in the current one
+
+    :param bytes data: a string serialized by oldmummy
+    :param bool compress: as for cffi_dumps
+
+    :returns: the bytestring in the current format
+    """
+    reader = _Reader(data)
+    try:
+        s = lib.mummy_string_new(reader.s.len + 16)
+        if s == ffi.NULL:
+            raise MemoryError()
+        try:
+            rc = lib.mummy_upgrade_legacy(reader.s, s)
+            if rc == lib.ENOMEM:
+                raise MemoryError()
+            if rc == lib.EINVAL:
+                raise ValueError("invalid mummy (bad decimal digit)")
+            if rc == -2:
+                raise ValueError("invalid mummy (unrecognized type)")
+            if rc:
+                raise ValueError("invalid mummy (incorrect length)")
+            if compress:
+                _check(lib.mummy_string_compress(s))
+            return ffi.buffer(s.data, s.offset)[:]
+        finally:
+            lib.mummy_string_free(s, 1)
+    finally:
+        reader.close()
+
+def _transcode(convert, s, compress, source, invalid):
+    out = lib.mummy_string_new(s.len + 16)
+    if out == ffi.NULL:
+        raise MemoryError()
+    try:
+        rc = convert(s, out)
+        if rc == lib.ENOMEM:
+            raise MemoryError()
+        if rc == lib.EINVAL:
+            raise ValueError(invalid)
+        if rc == -2:
+            raise ValueError("invalid %s (unrecognized type)" % source)
+        if rc == -3:
+            raise ValueError("%s nested too deeply" % source)
+        if rc:
+            raise ValueError("invalid %s (incorrect length)" % source)
+        if compress:
+            _check(lib.mummy_string_compress(out))
+        return ffi.buffer(out.data, out.offset)[:]
+    finally:
+        lib.mummy_string_free(out, 1)
+
+def _to_format(convert, data, invalid):
+    reader = _Reader(data)
+    try:
+        return _transcode(convert, reader.s, False, "mummy", invalid)
+    finally:
+        reader.close()
+
+def _from_format(convert, data, compress, source, invalid):
+    if isinstance(data, unicode):
+        data = data.encode("utf-8")
+    if not isinstance(data, bytes):
+        raise TypeError("argument 1 must be a bytestring")
+    buf = ffi.from_buffer(data)
+    s = lib.mummy_string_wrap(buf, len(data))
+    if s == ffi.NULL:
+        raise MemoryError()
+    try:
+        return _transcode(convert, s, compress, source, invalid)
+    finally:
+        lib.mummy_string_free(s, 0)
+
+def cffi_to_json(data):
+    """convert a mummy string straight to JSON, as the extension's to_json
+
+    :param bytes data: a string serialized by mummy
+
+    :returns: the JSON as a UTF-8 bytestring
+    """
+    return _to_format(lib.mummy_to_json, data,
+            "mummy can't be represented as json (container as a hash key)")
+
+def cffi_from_json(data, compress=True):
+    """convert JSON straight to a mummy string
+
+    :param data: the JSON, as text or UTF-8 bytes
+    :param bool compress: as for cffi_dumps
+
+    :returns: the mummy bytestring
+    """
+    return _from_format(lib.mummy_from_json, data, compress, "json",
+            "invalid json")
+
+def cffi_to_msgpack(data):
+    """convert a mummy string straight to msgpack, as the extension's
+    to_msgpack
+
+    :param bytes data: a string serialized by mummy
+
+    :returns: the msgpack bytestring
+    """
+    return _to_format(lib.mummy_to_msgpack, data,
+            "mummy can't be represented as msgpack (int too big)")
+
+def cffi_from_msgpack(data, compress=True):
+    """convert msgpack straight to a mummy string
+
+    :param bytes data: one msgpack value
+    :param bool compress: as for cffi_dumps
+
+    :returns: the mummy bytestring
+    """
+    return _from_format(lib.mummy_from_msgpack, data, compress, "msgpack",
+            "invalid msgpack (unsupported extension type)")
+
+def _profile_add(profile, data):
+    reader = _Reader(data)
+    try:
+        rc = lib.mummy_profile_add(profile, reader.s)
+    finally:
+        reader.close()
+    if rc == lib.ENOMEM:
+        raise MemoryError()
+    if rc == -2:
+        raise ValueError("invalid mummy (unrecognized type)")
+    if rc == -3:
+        raise ValueError("mummy nested too deeply")
+    if rc:
+        raise ValueError("invalid mummy (incorrect length)")
+
+def _type_name(type):
+    if type < 0:
+        return "mixed"
+    name = ffi.string(lib.mummy_type_name(type))
+    return name if str is bytes else name.decode("ascii")
+
+def cffi_profile(data, depth=2):
+    """count up where the bytes in mummy strings go, as the extension's
+    profile
+
+    :param data: a string serialized by mummy, or an iterable of them
+    :param int depth: how many levels of paths to break down
+
+    :returns: a dict of the totals
+    """
+    profile = lib.mummy_profile_new(depth)
+    if profile == ffi.NULL:
+        raise MemoryError()
+    try:
+        if isinstance(data, bytes):
+            _profile_add(profile, data)
+        else:
+            for item in data:
+                _profile_add(profile, item)
+
+        paths = []
+        for i in range(profile.npaths):
+            p = profile.paths[i]
+            path = ffi.string(p.path)
+            if str is not bytes:
+                path = path.decode("utf-8", "replace")
+            paths.append({"path": path, "type": _type_name(p.type),
+                "count": p.count, "items": p.items, "bytes": p.bytes,
+                "key_bytes": p.key_bytes, "compressed": p.compressed})
+
+        return {
+            "values": profile.values,
+            "bytes": profile.bytes,
+            "types": dict((_type_name(k), (profile.counts[k],
+                profile.sizes[k])) for k in range(lib.MUMMY_PROFILE_TYPES)
+                if profile.counts[k]),
+            "key_count": profile.key_count,
+            "key_bytes": profile.key_bytes,
+            "distinct_keys": profile.distinct_keys,
+            "header_bytes": profile.header_bytes,
+            "varint_bytes": profile.varint_bytes,
+            "keytable_bytes": profile.keytable_bytes,
+            "paths": paths,
+        }
+    finally:
+        lib.mummy_profile_free(profile)
+
+def tokens(data):
+    """walk a mummy string one tag at a time, without building the objects
+
+    generates (type, value) pairs in the order the tags appear, where `type`
+    is one of the MUMMY_TYPE_* codes. for strings, utf8 and huge ints the
+    value is the raw body bytes, for lists, tuples, sets and hashes it is the
+    number of items (or key/value pairs) that follow, and for everything else
+    it is the loaded python object.
+
+    :param bytes data: the serialized string to walk
+    """
+    reader = _Reader(data)
+    try:
+        s = reader.s
+        token = ffi.new("mummy_token *")
+        while s.offset < s.len:
+            _read_token(s, token)
+            kind = token.type
+            if kind in _RAW_KINDS:
+                value = _load_str(s, token)
+            elif kind in _CONTAINER_KINDS:
+                value = token.v.size
+            else:
+                value = _loaders[kind](s, token)
+            yield kind, value
+    finally:
+        reader.close()
@@ -0,0 +1,192 @@
+"""
+django cache backends that store values as mummies
+
+the backends here are django's own with values run through a mummy Encoder
+on the way in and a Decoder on the way out, in place of pickle::
+
+    CACHES = {
+        "default": {
+            "BACKEND": "mummy.django_cache.PyMemcacheCache",
+            "LOCATION": "127.0.0.1:11211",
+
+            # only try compressing values that serialize to at least this
+            # many bytes (default 0, meaning always try)
+            "COMPRESS_THRESHOLD": 512,
+
+            # per-key thresholds, by the longest matching key prefix
+            "COMPRESS_THRESHOLDS": {"session:": 64, "page:": 4096},
+        },
+    }
+
+on the memcached backends, get_many and set_many do all of their values in
+one C call (one per distinct threshold for set_many). locmem has no batch
+operations of its own, so there they go a key at a time. ints are stored
+as they are so incr() and decr() keep working.
+
+django's RedisCache already takes a pluggable serializer, so for that use
+MummySerializer instead::
+
+    "OPTIONS": {"serializer": "mummy.django_cache.MummySerializer"}
+"""
+
+import sys
+
+import mummy
+
+from django.core.cache.backends.base import BaseCache, DEFAULT_TIMEOUT
+from django.core.cache.backends import locmem
+
+
+if sys.version_info[0] >= 3:
+    _raw_types = (int,)
+else:
+    _raw_types = (int, long)
+
+_missing = object()
+
+
+class MummyCacheMixin(object):
+    "mummy encoding for a django cache backend, mix in ahead of the backend"
+
+    def __init__(self, *args, **kwargs):
+        super(MummyCacheMixin, self).__init__(*args, **kwargs)
+        params = kwargs.get("params", args and args[-1] or {})
+
+        self._threshold = params.get("COMPRESS_THRESHOLD", 0)
+        self._thresholds = sorted(
+                params.get("COMPRESS_THRESHOLDS", {}).items(),
+                key=lambda pair: -len(pair[0]))
+        self._encoders = {}
+        self._decoder = mummy.Decoder()
+
+        # BaseCache's get_many and set_many go through get and set, which
+        # already do the encoding. only a backend's own talk to storage
+        self._batch_get = self._backend_has("get_many")
+        self._batch_set = self._backend_has("set_many")
+
+    def _backend_has(self, name):
+        mro = type(self).__mro__
+        for cls in mro[mro.index(MummyCacheMixin) + 1:]:
+            if name in vars(cls):
+                return cls is not BaseCache
+        return False
+
+    def _encoder(self, key):
+        threshold = self._threshold
+        for prefix, value in self._thresholds:
+            if key.startswith(prefix):
+                threshold = value
+                break
+        encoder = self._encoders.get(threshold)
+        if encoder is None:
+            encoder = self._encoders[threshold] = mummy.Encoder(
+                    threshold=threshold)
+        return encoder
+
+    def _encode(self, key, value):
+        if type(value) in _raw_types:
+            return value
+        return self._encoder(key).encode(value)
+
+    def _decode(self, value):
+        if type(value) in _raw_types:
+            return value
+        return self._decoder.decode(value)
+
+    def add(self, key, value, timeout=DEFAULT_TIMEOUT, version=None):
+        return super(MummyCacheMixin, self).add(
+                key, self._encode(key, value), timeout, version)
+
+    def set(self, key, value, timeout=DEFAULT_TIMEOUT, version=None):
+        return super(MummyCacheMixin, self).set(
+                key, self._encode(key, value), timeout, version)
+
+    def get(self, key, default=None, version=None):
+        value = super(MummyCacheMixin, self).get(key, _missing, version)
+        if value is _missing:
+            return default
+        return self._decode(value)
+
+    def get_many(self, keys, version=None):
+        found = super(MummyCacheMixin, self).get_many(keys, version)
+        if not self._batch_get:
+            return found
+        mummies = [key for key, value in found.items()
+                if type(value) not in _raw_types]
+        found.update(zip(mummies,
+                self._decoder.decode_many([found[key] for key in mummies])))
+        return found
+
+    def set_many(self, data, timeout=DEFAULT_TIMEOUT, version=None):
+        if not self._batch_set:
+            return super(MummyCacheMixin, self).set_many(
+                    data, timeout, version)
+
+        encoded = {}
+        groups = {}
+        for key, value in data.items():
+            if type(value) in _raw_types:
+                encoded[key] = value
+            else:
+                groups.setdefault(self._encoder(key), []).append(key)
+
+        for encoder, keys in groups.items():
+            encoded.update(zip(keys,
+                encoder.encode_many([data[key] for key in keys])))
+
+        return super(MummyCacheMixin, self).set_many(encoded, timeout, version)
+
+
+class LocMemCache(MummyCacheMixin, locmem.LocMemCache):
+    pass
+
+try:
+    from django.core.cache.backends.memcached import \
+            PyMemcacheCache as _PyMemcacheCache
+except ImportError:
+    pass
+else:
+    class PyMemcacheCache(MummyCacheMixin, _PyMemcacheCache):
+        pass
+
+try:
+    from django.core.cache.backends.memcached import \
+            PyLibMCCache as _PyLibMCCache
+except ImportError:
+    pass
+else:
+    class PyLibMCCache(MummyCacheMixin, _PyLibMCCache):
+        pass
+
+try:
+    from django.core.cache.backends.memcached import \
+            MemcachedCache as _MemcachedCache
+except ImportError:
+    pass
+else:
+    class MemcachedCache(MummyCacheMixin, _MemcachedCache):
+        pass
+
+
+# the first byte of a stored int, which no mummy ever starts with
+_int_starts = frozenset(bytearray(b"-0123456789"))
+
+
+class MummySerializer(object):
+    """a serializer for django's RedisCache
+
+    like django's own, ints are left alone so that incr() and decr() work.
+    """
+    def __init__(self, protocol=None):
+        self._encoder = mummy.Encoder()
+        self._decoder = mummy.Decoder()
+
+    def dumps(self, obj):
+        if type(obj) in _raw_types:
+            return obj
+        return self._encoder.encode(obj)
+
+    def loads(self, data):
+        if bytearray(data[:1])[0] in _int_starts:
+            return int(data)
+        return self._decoder.decode(data)
@@ -1,5 +1,15 @@
+"""
+a django serializer that streams
+
+objects are written to the stream as mummy records (see mummy.dump_records)
+a batch at a time as they are serialized, and the Deserializer reads them
+back one record at a time, so neither side ever holds the whole dump.
+"""
+
+from io import BytesIO
+import struct
+
 import mummy
-from StringIO import StringIO
 
 from django.core.serializers.python import Serializer as PythonSerializer
 from django.core.serializers.python import Deserializer as PythonDeserializer
@@ -10,26 +20,69 @@ except ImportError:
     from django.utils import _decimal as decimal # Python 2.3 fallback
 
 
+# dumps from before records were one mummy list (maybe compressed) of every
+# object. a record's length would have to be over 200MB to start like that
+_LIST_TYPES = frozenset([0x0C, 0x10, 0x14])
+
+
 class Serializer(PythonSerializer):
     internal_use_only = False
 
+    # records are bytes, where django's default stream is text
+    stream_class = BytesIO
+
     DATE_FORMAT = "%Y-%m-%d"
     TIME_FORMAT = "%H:%M:%S"
 
+    # how many serialized objects to hold before writing them out
+    batch_size = 1000
+
+    def end_object(self, obj):
+        PythonSerializer.end_object(self, obj)
+        if len(self.objects) >= self.batch_size:
+            self.write_batch()
+
     def end_serialization(self):
         self.options.pop('stream', None)
         self.options.pop('fields', None)
-        self.stream.write(mummy.dumps(self.objects))
+        self.write_batch()
+
+    def write_batch(self):
+        mummy.dump_records(self.objects, self.stream)
+        self.objects = []
 
     def getvalue(self):
         if callable(getattr(self.stream, 'getvalue', None)):
             return self.stream.getvalue()
 
 
+def _records(stream):
+    head = stream.read(4)
+    if not head:
+        return
+
+    if bytearray(head)[0] & 0x7f in _LIST_TYPES:
+        for obj in mummy.loads(head + stream.read()):
+            yield obj
+        return
+
+    # the first record was read past to tell the format, the rest can go
+    # through the C buffered reader
+    if len(head) == 4:
+        size, = struct.unpack("!I", head)
+        data = stream.read(size)
+        if len(data) == size:
+            yield mummy.loads(data)
+            for obj in mummy.iter_records(stream):
+                yield obj
+            return
+    raise ValueError("invalid mummy record (truncated)")
+
+
 def Deserializer(stream_or_string, **options):
-    if isinstance(stream_or_string, basestring):
-        stream = StringIO(stream_or_string)
+    if isinstance(stream_or_string, bytes):
+        stream = BytesIO(stream_or_string)
     else:
         stream = stream_or_string
-    for obj in PythonDeserializer(mummy.loads(stream.read())):
+    for obj in PythonDeserializer(_records(stream)):
         yield obj
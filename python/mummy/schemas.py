@@ -70,6 +70,9 @@ UNION schemas
       sub-schemas as arguments
     - attempts matching the message against each of the sub-schemas, validates
       if any of them match
+    - sub-schemas that match the message's exact type are tried first, and
+      results for simple immutable messages (numbers, strings, dates etc.)
+      are remembered per UNION
 
 OPTIONAL schemas
 ----------------
@@ -89,6 +92,8 @@ RULE schemas
     - the RULE constructor accepts a function as an argument; the function
       should take one argument and return a boolean. the schema requires that
       the function, when called on the matched message, returns True
+    - inside a UNION the predicate may be tried before or after the other
+      options, so it should be free of side effects
 
 Examples
 --------
@@ -168,6 +173,31 @@ message receiver has the schema as well, no information is lost.
 >>> AddressBookMessage.loads(abm.dumps()).message == abm.message
 True
 
+
+Setting PACKED = True on a Message class goes a step further: values whose
+schema is exactly int, float or bool (required dict values, required tuple
+members, and items of homogeneous lists) are pulled out of the transformed
+tree and packed without type tags. ints become zigzag varints, floats 8-byte
+doubles, and bools share a bitset. The transformed message is then a pair of
+the packed bytes and the remaining tree. Note that int slots decode as ints,
+so a bool passing an int schema comes back as 0 or 1.
+
+>>> class ReadingMessage(mummy.Message):
+...     SCHEMA = {'sensor': int, 'values': [float], 'ok': [bool], 'count': int}
+...
+>>> class PackedReadingMessage(ReadingMessage):
+...     PACKED = True
+...
+>>> reading = {'sensor': 4005, 'values': [20.5, 21.0, 19.75],
+...         'ok': [True, True, False], 'count': 3}
+>>> len(ReadingMessage(reading).dumps())
+44
+>>> len(PackedReadingMessage(reading).dumps())
+39
+>>> PackedReadingMessage.loads(
+...         PackedReadingMessage(reading).dumps()).message == reading
+True
+
 """
 
 from __future__ import absolute_import
@@ -175,6 +205,7 @@ from __future__ import absolute_import
 import datetime
 import decimal
 import itertools
+import struct
 import sys
 
 from .serialization import loads, dumps
@@ -195,6 +226,8 @@ if sys.version_info[0] >= 3:
     def itervalues(d):
         return d.values()
     long = int
+    unicode = str
+    xrange = range
 else:
     izip = itertools.izip
     imap = itertools.imap
@@ -273,144 +306,263 @@ class RULE(object):
 ## Validation
 ##
 
-def _validate_simple(schema, message):
-    if isinstance(message, _type_validations[schema]):
-        return True, None
-    return False, (message, schema)
+def _flatten_optionals(schema):
+    flat = schema.copy()
+    flat.update((k.schema, v) for k, v in iteritems(schema)
+            if isinstance(k, OPTIONAL))
+    return flat
 
-def _validate_simple_instance(schema, message):
-    if schema == message:
-        return True, None
-    return False, (message, schema)
+# schemas are compiled into a tree of validator nodes once per Message class,
+# each node's validate() returns (matched, info) where info is the failing
+# (message, schema) pair.
 
-def _validate_tuple(schema, message):
-    if not isinstance(message, tuple):
-        return False, (message, schema)
+# identical values of these types always validate the same way, so UNION
+# nodes may remember their results (Decimal is left out as NaNs can't hash)
+_cacheable = frozenset([
+    type(None), bool, int, long, float, str, unicode,
+    datetime.date, datetime.time, datetime.datetime, datetime.timedelta])
+_UNION_CACHE_SIZE = 1024
 
-    if len(message) > len(schema):
-        return False, (message, schema)
+class _TypeNode(object):
+    __slots__ = ["schema", "types"]
 
-    required = izip(
-            itertools.takewhile(_required, schema),
-            message)
+    def __init__(self, schema):
+        self.schema = schema
+        self.types = _type_validations[schema]
 
-    for i, (sub_schema, sub_message) in enumerate(required):
-        matched, info = _validate(sub_schema, sub_message)
-        if not matched:
-            return False, info
+    def validate(self, message):
+        if isinstance(message, self.types):
+            return True, None
+        return False, (message, self.schema)
 
-    optional = itertools.islice(izip(schema, message), i + 1, None)
+class _EqualNode(object):
+    __slots__ = ["schema"]
 
-    for sub_schema, sub_message in optional:
-        matched, info = _validate(sub_schema, sub_message)
-        if not matched:
-            return False, info
+    def __init__(self, schema):
+        self.schema = schema
 
-    return True, None
+    def validate(self, message):
+        if self.schema == message:
+            return True, None
+        return False, (message, self.schema)
 
-def _validate_list(schema, message):
-    if not isinstance(message, list):
-        return False, (message, schema)
+class _AnyNode(object):
+    __slots__ = []
 
-    if not schema:
-        if message:
-            return False, (message, schema)
+    def validate(self, message):
         return True, None
 
-    sub_schema = schema[0]
-    if isinstance(sub_schema, OPTIONAL):
-        if not message:
+class _RuleNode(object):
+    __slots__ = ["schema", "pred"]
+
+    def __init__(self, schema):
+        self.schema = schema
+        self.pred = schema.pred
+
+    def validate(self, message):
+        if self.pred(message):
             return True, None
-        sub_schema = sub_schema.schema
-    elif not message:
-        return False, (message, schema)
+        return False, (message, self.schema)
 
-    for sub_message in message:
-        matched, info = _validate(sub_schema, sub_message)
-        if not matched:
-            return False, info
+class _TupleNode(object):
+    __slots__ = ["schema", "items", "required"]
 
-    return True, None
+    def __init__(self, schema):
+        self.schema = schema
+        self.items = tuple(
+                _compile_validator(s.schema if isinstance(s, OPTIONAL) else s)
+                for s in schema)
+        self.required = len(list(itertools.takewhile(_required, schema)))
 
-def _validate_dict(schema, message):
-    if not isinstance(message, dict):
-        return False, (message, schema)
+    def validate(self, message):
+        if not isinstance(message, tuple):
+            return False, (message, self.schema)
 
-    required_keys = set(k for k in schema if not isinstance(k, OPTIONAL))
-    required_wildcards = required_keys.intersection(_primitives)
-    required_keys.difference_update(_primitives)
+        if not self.required <= len(message) <= len(self.items):
+            return False, (message, self.schema)
 
-    msg_keys = set(message)
+        for node, sub_message in izip(self.items, message):
+            matched, info = node.validate(sub_message)
+            if not matched:
+                return False, info
 
-    # missing required keys
-    if required_keys - msg_keys:
-        return False, (message, schema)
+        return True, None
 
-    # missing required wildcards
-    if required_wildcards - set(imap(type, message)):
-        return False, (message, schema)
+class _ListNode(object):
+    __slots__ = ["schema", "item", "optional"]
 
-    wildcards = set(_primitives)
-    wildcards.intersection_update(schema)
+    def __init__(self, schema):
+        self.schema = schema
+        self.item = self.optional = None
+        if schema:
+            sub_schema = schema[0]
+            self.optional = isinstance(sub_schema, OPTIONAL)
+            if self.optional:
+                sub_schema = sub_schema.schema
+            self.item = _compile_validator(sub_schema)
+
+    def validate(self, message):
+        if not isinstance(message, list):
+            return False, (message, self.schema)
 
-    # extra non-allowed keys
-    msg_keys.difference_update(schema)
-    msg_keys.difference_update(
-            k.schema for k in schema if isinstance(k, OPTIONAL))
-    if set(imap(type, msg_keys)) - wildcards:
-        return False, (message, schema)
+        if not message:
+            if self.item is None or self.optional:
+                return True, None
+            return False, (message, self.schema)
 
-    schema = schema.copy()
-    schema.update(
-        dict((k.schema, v) for k, v in iteritems(schema)
-            if isinstance(k, OPTIONAL)))
+        if self.item is None:
+            return False, (message, self.schema)
 
-    # now validate sub_schemas/sub_messages
-    for key, sub_message in iteritems(message):
-        if key in schema:
-            sub_schema = schema[key]
-        else:
-            sub_schema = schema[type(key)]
+        validate = self.item.validate
+        for sub_message in message:
+            matched, info = validate(sub_message)
+            if not matched:
+                return False, info
 
-        matched, info = _validate(sub_schema, sub_message)
-        if not matched:
-            return False, info
+        return True, None
 
-    return True, None
+class _DictNode(object):
+    __slots__ = ["schema", "required_keys", "required_wildcards", "wildcards",
+            "allowed", "items"]
 
-def _validate_union(schema, message):
-    for sub_schema in schema.options:
-        matched, info = _validate(sub_schema, message)
-        if matched:
-            return True, None
-    return False, (message, schema)
+    def __init__(self, schema):
+        self.schema = schema
 
-def _validate_any(schema, message):
-    return True, None
+        required_keys = set(k for k in schema if not isinstance(k, OPTIONAL))
+        self.required_wildcards = frozenset(
+                required_keys.intersection(_primitives))
+        required_keys.difference_update(_primitives)
+        self.required_keys = frozenset(required_keys)
+
+        self.wildcards = frozenset(set(_primitives).intersection(schema))
+
+        allowed = set(schema)
+        allowed.update(k.schema for k in schema if isinstance(k, OPTIONAL))
+        self.allowed = frozenset(allowed)
+
+        self.items = dict((k, _compile_validator(v))
+                for k, v in iteritems(_flatten_optionals(schema)))
+
+    def validate(self, message):
+        if not isinstance(message, dict):
+            return False, (message, self.schema)
+
+        # missing required keys
+        for key in self.required_keys:
+            if key not in message:
+                return False, (message, self.schema)
+
+        # missing required wildcards
+        if self.required_wildcards and \
+                self.required_wildcards - set(imap(type, message)):
+            return False, (message, self.schema)
+
+        # extra non-allowed keys
+        allowed, wildcards = self.allowed, self.wildcards
+        for key in message:
+            if key not in allowed and type(key) not in wildcards:
+                return False, (message, self.schema)
+
+        # now validate sub_schemas/sub_messages
+        items = self.items
+        for key, sub_message in iteritems(message):
+            if key in items:
+                node = items[key]
+            else:
+                node = items[type(key)]
+
+            matched, info = node.validate(sub_message)
+            if not matched:
+                return False, info
 
-def _validate_rule(schema, message):
-    if schema.pred(message):
         return True, None
-    return False, (message, schema)
-
-_validators = {
-    bool: _validate_simple_instance,
-    int: _validate_simple_instance,
-    long: _validate_simple_instance,
-    float: _validate_simple_instance,
-    str: _validate_simple_instance,
-    unicode: _validate_simple_instance,
-    type: _validate_simple,
-    tuple: _validate_tuple,
-    list: _validate_list,
-    dict: _validate_dict,
-    UNION: _validate_union,
-    type(ANY): _validate_any,
-    RULE: _validate_rule,
+
+def _accepted_types(schema):
+    "python types a schema can match exactly, or None if it's not that simple"
+    schema_type = type(schema)
+    if schema_type in (bool, int, long, float):
+        return frozenset((bool, int, long, float))
+    if schema_type in (str, unicode):
+        return frozenset((str, unicode))
+    if schema_type is type:
+        types = _type_validations[schema]
+        if not isinstance(types, tuple):
+            types = (types,)
+        return frozenset(types)
+    if schema_type in (tuple, list, dict):
+        return frozenset((schema_type,))
+    return None
+
+class _UnionNode(object):
+    __slots__ = ["schema", "options", "orders", "cache"]
+
+    def __init__(self, schema):
+        self.schema = schema
+        self.options = tuple((_accepted_types(s), _compile_validator(s))
+                for s in schema.options)
+        self.orders = {}
+        self.cache = {}
+
+    def order(self, message_type):
+        # options that take this exact type go first, then those we can't
+        # rule out cheaply (RULEs, subclass matches), in declaration order
+        likely, unlikely = [], []
+        for types, node in self.options:
+            if isinstance(node, _AnyNode):
+                return (node,)
+            if types is not None and message_type in types:
+                likely.append(node)
+            else:
+                unlikely.append(node)
+        order = self.orders[message_type] = tuple(likely + unlikely)
+        return order
+
+    def validate(self, message):
+        message_type = type(message)
+        cacheable = message_type in _cacheable
+        if cacheable:
+            key = (message_type, message)
+            result = self.cache.get(key)
+            if result is not None:
+                return result
+
+        order = self.orders.get(message_type)
+        if order is None:
+            order = self.order(message_type)
+
+        result = True, None
+        for node in order:
+            if node.validate(message)[0]:
+                break
+        else:
+            result = False, (message, self.schema)
+
+        if cacheable:
+            if len(self.cache) >= _UNION_CACHE_SIZE:
+                self.cache.clear()
+            self.cache[key] = result
+        return result
+
+_any_node = _AnyNode()
+
+_validator_nodes = {
+    bool: _EqualNode,
+    int: _EqualNode,
+    long: _EqualNode,
+    float: _EqualNode,
+    str: _EqualNode,
+    unicode: _EqualNode,
+    type: _TypeNode,
+    tuple: _TupleNode,
+    list: _ListNode,
+    dict: _DictNode,
+    UNION: _UnionNode,
+    type(ANY): lambda schema: _any_node,
+    RULE: _RuleNode,
 }
 
-def _validate(schema, message):
-    return _validators[type(schema)](schema, message)
+def _compile_validator(schema):
+    return _validator_nodes[type(schema)](schema)
 
 
 ##
@@ -524,78 +676,342 @@ def _group_schema_keys(schema):
 
     return required, optional
 
-def _transform(schema, message):
-    if isinstance(schema, list):
-        return [_transform(s, m) for s, m in izip(schema, message)]
-
-    if isinstance(schema, tuple):
-        return tuple(_transform(s, m) for s, m in izip(schema, message))
-
-    if not isinstance(schema, dict):
-        return message
-
-    required, optional = _group_schema_keys(schema)
-
-    msgkeys = set(message)
-
-    schema = schema.copy()
-    schema.update(
-            dict((k.schema, v) for k, v in iteritems(schema)
-                if isinstance(k, OPTIONAL)))
+##
+## tagless packing of int, float and bool slots (Message.PACKED)
+##
 
-    result = []
-    for key in required:
-        result.append(_transform(schema[key], message[key]))
-    for key in optional:
-        if key in message:
-            result.append(_transform(schema[key], message[key]))
-        else:
-            result.append(None)
-    msgkeys.difference_update(required)
-    msgkeys.difference_update(optional)
+_double = struct.Struct("!d")
+
+def _write_varint(buf, num):
+    while num > 0x7f:
+        buf.append((num & 0x7f) | 0x80)
+        num >>= 7
+    buf.append(num)
+
+def _read_varint(buf, offset):
+    num = shift = 0
+    while 1:
+        byte = buf[offset]
+        offset += 1
+        num |= (byte & 0x7f) << shift
+        if not byte & 0x80:
+            return num, offset
+        shift += 7
+
+class _Packer(object):
+    "collects the bodies of packed slots in the order the plan visits them"
+    __slots__ = ["stream", "bools"]
+
+    def __init__(self):
+        self.stream = bytearray()
+        self.bools = []
+
+    def pack_int(self, num):
+        # zigzag so small negatives stay small
+        _write_varint(self.stream, (num << 1) if num >= 0 else (~num << 1) | 1)
+
+    def pack_float(self, num):
+        self.stream.extend(_double.pack(num))
+
+    def pack_bool(self, b):
+        self.bools.append(b)
+
+    def getvalue(self):
+        # varint bool count, the bools as a little-endian bitset, the stream
+        bools = self.bools
+        bits = bytearray((len(bools) + 7) >> 3)
+        for i, b in enumerate(bools):
+            if b:
+                bits[i >> 3] |= 1 << (i & 7)
+        result = bytearray()
+        _write_varint(result, len(bools))
+        result.extend(bits)
+        result.extend(self.stream)
+        return bytes(result)
+
+class _Unpacker(object):
+    __slots__ = ["data", "offset", "bits", "bit"]
+
+    def __init__(self, data):
+        self.data = data = bytearray(data)
+        count, offset = _read_varint(data, 0)
+        self.bits = offset
+        self.bit = 0
+        self.offset = offset + ((count + 7) >> 3)
+
+    def unpack_int(self):
+        num, self.offset = _read_varint(self.data, self.offset)
+        if num & 1:
+            return ~(num >> 1)
+        return num >> 1
+
+    def unpack_float(self):
+        num = _double.unpack_from(self.data, self.offset)[0]
+        self.offset += 8
+        return num
+
+    def unpack_bool(self):
+        bit = self.bit
+        self.bit += 1
+        return bool(self.data[self.bits + (bit >> 3)] & (1 << (bit & 7)))
+
+class _IntSlot(object):
+    slot = True
+
+    def pack(self, message, packer):
+        packer.pack_int(message)
+
+    def unpack(self, unpacker):
+        return unpacker.unpack_int()
+
+class _FloatSlot(object):
+    slot = True
+
+    def pack(self, message, packer):
+        packer.pack_float(message)
+
+    def unpack(self, unpacker):
+        return unpacker.unpack_float()
+
+class _BoolSlot(object):
+    slot = True
+
+    def pack(self, message, packer):
+        packer.pack_bool(message)
+
+    def unpack(self, unpacker):
+        return unpacker.unpack_bool()
+
+_slots = {int: _IntSlot(), float: _FloatSlot(), bool: _BoolSlot()}
 
-    for key in msgkeys:
-        result.append(key)
-        result.append(_transform(schema[type(message[key])], message[key]))
+##
+## [un]transformation plans
+##
 
-    return result
+# plans are compiled once per Message class. a plan of None means the node
+# passes through [un]transformation untouched, so the hot loops can skip it.
+# with packing enabled, int/float/bool sub-schemas compile to slots, which are
+# written to the packer instead of the transformed tree.
+
+class _ListPlan(object):
+    __slots__ = ["item"]
+    slot = False
+
+    def __init__(self, item):
+        self.item = item
+
+    def transform(self, message, packer):
+        item = self.item
+        return [item.transform(m, packer) for m in message]
+
+    def untransform(self, message, unpacker):
+        item = self.item
+        return [item.untransform(m, unpacker) for m in message]
+
+class _SlotListPlan(object):
+    "a homogeneous list of packed slots shrinks down to just its length"
+    __slots__ = ["item"]
+    slot = False
+
+    def __init__(self, item):
+        self.item = item
+
+    def transform(self, message, packer):
+        pack = self.item.pack
+        for m in message:
+            pack(m, packer)
+        return len(message)
+
+    def untransform(self, message, unpacker):
+        unpack = self.item.unpack
+        return [unpack(unpacker) for i in xrange(message)]
+
+class _TuplePlan(object):
+    __slots__ = ["items"]
+    slot = False
+
+    def __init__(self, items):
+        self.items = items
+
+    def transform(self, message, packer):
+        result = []
+        for plan, m in izip(self.items, message):
+            if plan is None:
+                result.append(m)
+            elif plan.slot:
+                plan.pack(m, packer)
+            else:
+                result.append(plan.transform(m, packer))
+        return tuple(result)
+
+    def untransform(self, message, unpacker):
+        # slots are all in leading (required) positions, so whatever is left
+        # over of the message lines up with the trailing items
+        result = []
+        i, length = 0, len(message)
+        for plan in self.items:
+            if plan is not None and plan.slot:
+                result.append(plan.unpack(unpacker))
+                continue
+            if i >= length:
+                break
+            m = message[i]
+            i += 1
+            result.append(m if plan is None else plan.untransform(m, unpacker))
+        return tuple(result)
+
+class _DictPlan(object):
+    __slots__ = ["slots", "required", "optional", "known", "wildcards"]
+    slot = False
+
+    def __init__(self, schema, packed):
+        required, optional = _group_schema_keys(schema)
+        flat = _flatten_optionals(schema)
+
+        plans = [(k, _compile_plan(flat[k], packed)) for k in required]
+        self.slots = tuple((k, p) for k, p in plans if p is not None and p.slot)
+        self.required = tuple(
+                (k, p) for k, p in plans if p is None or not p.slot)
+
+        # values that may be absent don't pack
+        self.optional = tuple(
+                (k, _unslotted(_compile_plan(flat[k], packed)))
+                for k in optional)
+        self.known = frozenset(required + optional)
+        self.wildcards = dict((k, _unslotted(_compile_plan(v, packed)))
+                for k, v in iteritems(flat) if k in _type_validations)
+
+    def transform(self, message, packer):
+        result = []
+        append = result.append
+
+        for key, slot in self.slots:
+            slot.pack(message[key], packer)
+
+        for key, plan in self.required:
+            if plan is None:
+                append(message[key])
+            else:
+                append(plan.transform(message[key], packer))
+
+        for key, plan in self.optional:
+            if key not in message:
+                append(None)
+            elif plan is None:
+                append(message[key])
+            else:
+                append(plan.transform(message[key], packer))
+
+        # only wildcard keys can leave anything else in a valid message
+        if self.wildcards:
+            known, wildcards = self.known, self.wildcards
+            for key, value in iteritems(message):
+                if key in known:
+                    continue
+                plan = wildcards[type(key)]
+                append(key)
+                append(value if plan is None
+                        else plan.transform(value, packer))
+
+        return result
+
+    def untransform(self, message, unpacker):
+        result = {}
+        i = 0
+
+        for key, slot in self.slots:
+            result[key] = slot.unpack(unpacker)
+
+        for key, plan in self.required:
+            value = message[i]
+            result[key] = (value if plan is None
+                    else plan.untransform(value, unpacker))
+            i += 1
+
+        for key, plan in self.optional:
+            value = message[i]
+            if value is not None:
+                result[key] = (value if plan is None
+                        else plan.untransform(value, unpacker))
+            i += 1
+
+        if self.wildcards:
+            wildcards, length = self.wildcards, len(message)
+            while i < length:
+                key, value = message[i], message[i + 1]
+                plan = wildcards[type(key)]
+                result[key] = (value if plan is None
+                        else plan.untransform(value, unpacker))
+                i += 2
+
+        return result
+
+def _unslotted(plan):
+    if plan is not None and plan.slot:
+        return None
+    return plan
+
+def _list_plan(item):
+    if item is None:
+        return None
+    if item.slot:
+        return _SlotListPlan(item)
+    return _ListPlan(item)
+
+def _compile_plan(schema, packed=False):
+    if packed and type(schema) is type and schema in _slots:
+        return _slots[schema]
 
-def _untransform(schema, message):
     if isinstance(schema, list):
-        return [_untransform(s, m) for s, m in izip(schema, message)]
+        # OPTIONAL sub-schemas of lists and tuples have always passed through
+        # untransformed, keep it that way so the wire format doesn't change
+        if not schema or isinstance(schema[0], OPTIONAL):
+            return None
+        return _list_plan(_compile_plan(schema[0], packed))
 
     if isinstance(schema, tuple):
-        return tuple(_untransform(s, m) for s, m in izip(schema, message))
-
-    if not isinstance(schema, dict):
-        return message
-
-    required, optional = _group_schema_keys(schema)
-    result = {}
-
-    for key, value in izip(required, message):
-        result[key] = _untransform(schema[key], value)
-
-    schema = schema.copy()
-    schema.update(
-            dict((k.schema, v) for k, v in iteritems(schema)
-                if isinstance(k, OPTIONAL)))
-
-    for key, value in izip(optional, itertools.islice(
-            message, len(required), None)):
-        if value is not None:
-            result[key] = _untransform(schema[key], value)
-
-    is_key = True
-    for item in itertools.islice(
-            message, len(required) + len(optional), None):
-        if is_key:
-            key = item
-        else:
-            result[key] = _untransform(schema[type(item)], item)
-        is_key = not is_key
-
-    return result
+        items = tuple(
+                None if isinstance(s, OPTIONAL) else _compile_plan(s, packed)
+                for s in schema)
+        if not any(plan is not None for plan in items):
+            return None
+        return _TuplePlan(items)
+
+    if isinstance(schema, dict):
+        return _DictPlan(schema, packed)
+
+    return None
+
+def _transform(plan, message, packed=False):
+    if not packed:
+        if plan is None:
+            return message
+        return plan.transform(message, None)
+
+    # packed messages transform to a (packed slot bodies, tree) pair
+    packer = _Packer()
+    if plan is None:
+        tree = message
+    elif plan.slot:
+        plan.pack(message, packer)
+        tree = None
+    else:
+        tree = plan.transform(message, packer)
+    return packer.getvalue(), tree
+
+def _untransform(plan, message, packed=False):
+    if not packed:
+        if plan is None:
+            return message
+        return plan.untransform(message, None)
+
+    data, tree = message
+    unpacker = _Unpacker(data)
+    if plan is None:
+        return tree
+    if plan.slot:
+        return plan.unpack(unpacker)
+    return plan.untransform(tree, unpacker)
 
 
 ##
@@ -616,11 +1032,17 @@ class _validated_schema(type):
             valid, info = _validate_schema(cls.SCHEMA)
             if not valid:
                 raise InvalidSchema(info)
+            cls._validator = _compile_validator(cls.SCHEMA)
+            cls._plan = _compile_plan(cls.SCHEMA, cls.PACKED)
+            cls._batch_plan = _list_plan(cls._plan)
 
         cls.InvalidMessage = type('InvalidMessage', (_Invalid,), {})
 
-class Message(object):
-    __metaclass__ = _validated_schema
+# instantiating the metaclass directly works under both python 2 and 3
+_MessageBase = _validated_schema('_MessageBase', (object,), {})
+
+class Message(_MessageBase):
+    PACKED = False
 
     def __init__(self, message):
         self.message = message
@@ -629,14 +1051,15 @@ class Message(object):
 
     def validate(self):
         if self._validation is None:
-            self._validation = _validate(self.SCHEMA, self.message)
+            self._validation = self._validator.validate(self.message)
         if not self._validation[0]:
             raise self.InvalidMessage(self._validation[1])
 
     def transform(self):
         self.validate()
         if self._transformation is None:
-            self._transformation = _transform(self.SCHEMA, self.message)
+            self._transformation = _transform(
+                    self._plan, self.message, self.PACKED)
         return self._transformation
 
     def dumps(self):
@@ -644,8 +1067,27 @@ class Message(object):
 
     @classmethod
     def untransform(cls, message):
-        return _untransform(cls.SCHEMA, message)
+        return _untransform(cls._plan, message, cls.PACKED)
 
     @classmethod
     def loads(cls, message):
         return cls(cls.untransform(loads(message)))
+
+    @classmethod
+    def dumps_batch(cls, messages):
+        """serialize a sequence of instances into a single string
+
+        the batch is transformed as a list of this class's schema (so packed
+        slots from every message share one bitset and stream) and goes
+        through one dumps call and one compression attempt.
+        """
+        for msg in messages:
+            msg.validate()
+        return dumps(_transform(cls._batch_plan,
+                [msg.message for msg in messages], cls.PACKED))
+
+    @classmethod
+    def loads_batch(cls, data):
+        "load a string produced by dumps_batch back into a list of instances"
+        return [cls(message) for message in
+                _untransform(cls._batch_plan, loads(data), cls.PACKED)]
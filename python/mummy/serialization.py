@@ -1,7 +1,8 @@
+import binascii
 import datetime
 import decimal
 import fractions
-import itertools
+import json
 import struct
 import sys
 
@@ -12,42 +13,24 @@ except ImportError:
 
 
 __all__ = ["loads", "dumps", "pure_python_loads", "pure_python_dumps",
-        "has_extension"]
+        "dumps_into", "dump", "load", "dump_records", "iter_records",
+        "Encoder", "Decoder", "upgrade", "pure_python_upgrade",
+        "iter_upgraded", "to_json", "from_json", "to_msgpack",
+        "from_msgpack", "pure_python_to_json", "pure_python_from_json",
+        "profile", "stats", "reset_stats", "set_timing", "timings",
+        "reset_timings", "track_allocations", "has_extension"]
 
 
 if sys.version_info[0] >= 3:
-    from functools import reduce
-    _str = unicode = str
-    class string(bytes):
-        def __getitem__(self, index):
-            if isinstance(index, int):
-                return type(self)(super().__getitem__(
-                    slice(index, index + 1, None)))
-            return type(self)(super().__getitem__(index))
-
-        def __iter__(self):
-            i, l = 0, len(self)
-            while i < l:
-                yield self[i]
-                i += 1
-
+    unicode = str
     long = int
-    map = lambda *a: list(__builtins__['map'](*a))
-    iteritems = lambda d: d.items()
-    iterkeys = lambda d: d.keys()
-    itervalues = lambda d: d.values()
     xrange = range
-    chr = lambda x: bytes([x])
-    ord = lambda x: bytes.__getitem__(x, 0)
-    bytify = lambda x: x.encode('ascii')
-    izip = zip
+    iteritems = lambda d: d.items()
+    _byte = lambda data, offset: data[offset]
 else:
     iteritems = lambda d: d.iteritems()
-    iterkeys = lambda d: d.iterkeys()
-    itervalues = lambda d: d.itervalues()
-    bytify = lambda x: x
-    bytes = string = str
-    izip = itertools.izip
+    _byte = lambda data, offset: ord(data[offset])
+    bytes = str
 
 
 MAX_DEPTH = 256
@@ -95,293 +78,205 @@ MUMMY_SPECIAL_INFINITY = 0x10
 MUMMY_SPECIAL_NAN = 0x20
 
 
-TYPEMAP = {
-    type(None): MUMMY_TYPE_NULL,
-    bool: MUMMY_TYPE_BOOL,
-    float: MUMMY_TYPE_FLOAT,
-}
 
-_BIG_ENDIAN = struct.pack("!h", 1) == struct.pack("h", 1)
-
-
-def _get_type_code(x):
-    mapped = TYPEMAP.get(type(x))
-    if mapped is not None:
-        return mapped
-
-    if type(x) is list:
-        if len(x) < 256:
-            return MUMMY_TYPE_SHORTLIST
-        if len(x) < 65536:
-            return MUMMY_TYPE_MEDLIST
-        return MUMMY_TYPE_LONGLIST
-
-    if type(x) is tuple:
-        if len(x) < 256:
-            return MUMMY_TYPE_SHORTTUPLE
-        if len(x) < 65536:
-            return MUMMY_TYPE_MEDTUPLE
-        return MUMMY_TYPE_LONGTUPLE
-
-    if type(x) in (set, frozenset):
-        if len(x) < 256:
-            return MUMMY_TYPE_SHORTSET
-        if len(x) < 65536:
-            return MUMMY_TYPE_MEDSET
-        return MUMMY_TYPE_LONGSET
-
-    if type(x) is dict:
-        if len(x) < 256:
-            return MUMMY_TYPE_SHORTHASH
-        if len(x) < 65536:
-            return MUMMY_TYPE_MEDHASH
-        return MUMMY_TYPE_LONGHASH
-
-    if type(x) is bytes:
-        if len(x) < 256:
-            return MUMMY_TYPE_SHORTSTR
-        if len(x) < 65536:
-            return MUMMY_TYPE_MEDSTR
-        return MUMMY_TYPE_LONGSTR
-
-    if type(x) is unicode:
-        if len(x.encode('utf8')) < 256:
-            return MUMMY_TYPE_SHORTUTF8
-        if len(x.encode('utf8')) < 65536:
-            return MUMMY_TYPE_MEDUTF8
-        return MUMMY_TYPE_LONGUTF8
-
-    if type(x) in (int, long):
-        if -128 <= x < 128:
-            return MUMMY_TYPE_CHAR
-        if -32768 <= x < 32768:
-            return MUMMY_TYPE_SHORT
-        if -2147483648 <= x < 2147483648:
-            return MUMMY_TYPE_INT
-        if -9223372036854775808 <= x < 9223372036854775808:
-            return MUMMY_TYPE_LONG
-        return MUMMY_TYPE_HUGE
-
-    if type(x) is datetime.date:
-        return MUMMY_TYPE_DATE
-
-    if type(x) is datetime.time:
-        return MUMMY_TYPE_TIME
-
-    if type(x) is datetime.datetime:
-        return MUMMY_TYPE_DATETIME
-
-    if type(x) is datetime.timedelta:
-        return MUMMY_TYPE_TIMEDELTA
-
-    if type(x) is decimal.Decimal:
-        if x.is_nan() or x.is_infinite():
-            return MUMMY_TYPE_SPECIALNUM
-        return MUMMY_TYPE_DECIMAL
-
-    if type(x) is fractions.Fraction:
-        return MUMMY_TYPE_FRACTION
-
-    raise ValueError("%r cannot be serialized" % type(x))
+# precompiled (type byte + body) layouts, all big-endian
+_uchar = struct.Struct("!B")
+_uint = struct.Struct("!I")
+_tagged_u8 = struct.Struct("!BB")
+_tagged_u16 = struct.Struct("!BH")
+_tagged_u32 = struct.Struct("!BI")
+_tagged_char = struct.Struct("!Bb")
+_tagged_short = struct.Struct("!Bh")
+_tagged_int = struct.Struct("!Bi")
+_tagged_long = struct.Struct("!Bq")
+_tagged_double = struct.Struct("!Bd")
+_tagged_date = struct.Struct("!BHBB")
+_tagged_time = struct.Struct("!BBBBBH")
+_tagged_datetime = struct.Struct("!BHBBBBBBH")
+_tagged_timedelta = struct.Struct("!Biii")
+_tagged_decimal = struct.Struct("!BbhH")
+_tagged_fraction = struct.Struct("!Bqq")
+
+# bodies only, for the loaders
+_char = struct.Struct("!b")
+_ushort = struct.Struct("!H")
+_short = struct.Struct("!h")
+_int = struct.Struct("!i")
+_long = struct.Struct("!q")
+_double = struct.Struct("!d")
+_date = struct.Struct("!HBB")
+_time = struct.Struct("!BBBBH")
+_datetime = struct.Struct("!HBBBBBBH")
+_timedelta = struct.Struct("!iii")
+_decimal = struct.Struct("!bhH")
+_legacy_decimal = struct.Struct("!BhH")
+_fraction = struct.Struct("!qq")
+
+_STR_KINDS = (MUMMY_TYPE_SHORTSTR, MUMMY_TYPE_MEDSTR, MUMMY_TYPE_LONGSTR)
+_UTF8_KINDS = (MUMMY_TYPE_SHORTUTF8, MUMMY_TYPE_MEDUTF8, MUMMY_TYPE_LONGUTF8)
+_LIST_KINDS = (MUMMY_TYPE_SHORTLIST, MUMMY_TYPE_MEDLIST, MUMMY_TYPE_LONGLIST)
+_TUPLE_KINDS = (
+        MUMMY_TYPE_SHORTTUPLE, MUMMY_TYPE_MEDTUPLE, MUMMY_TYPE_LONGTUPLE)
+_SET_KINDS = (MUMMY_TYPE_SHORTSET, MUMMY_TYPE_MEDSET, MUMMY_TYPE_LONGSET)
+_HASH_KINDS = (MUMMY_TYPE_SHORTHASH, MUMMY_TYPE_MEDHASH, MUMMY_TYPE_LONGHASH)
 
 
 ##
 ## DUMPERS
 ##
 
-def _dump_none(x, depth=0, default=None):
-    return bytify("")
-
-def _dump_bool(x, depth=0, default=None):
-    return bytify(x and '\x01' or '\x00')
-
-def _dump_char(x, depth=0, default=None):
-    if x < 0:
-        x += 256
-    return chr(x)
-
-def _dump_uchar(x, depth=0, default=None):
-    return chr(x)
-
-def _dump_short(x, depth=0, default=None):
-    return struct.pack("!h", x)
-
-def _dump_ushort(x, depth=0, default=None):
-    return struct.pack("!H", x)
-
-def _dump_int(x, depth=0, default=None):
-    return struct.pack("!i", x)
-
-def _dump_uint(x, depth=0, default=None):
-    return struct.pack("!I", x)
-
-def _dump_long(x, depth=0, default=None):
-    return struct.pack("!q", x)
-
-def _dump_huge(x, depth=0, default=None):
-    data = []
-    neg = x < 0
-    if neg:
-        x = ~x
-    while x:
-        data.append(x & 0xff)
-        x >>= 8
-    if neg:
-        data = map(lambda byte: byte ^ 0xff, data)
-    if not _BIG_ENDIAN:
-        data = data[::-1]
-    if neg and not data[0] & 0x80:
-        data = [255] + data
-    if not neg and data[0] & 0x80:
-        data = [0] + data
-    data = map(chr, data)
-    return _dump_uint(len(data)) + bytify("").join(data)
-
-def _dump_double(x, depth=0, default=None):
-    return struct.pack("!d", x)
-
-def _dump_shortstr(x, depth=0, default=None):
-    return _dump_uchar(len(x)) + x
-
-def _dump_medstr(x, depth=0, default=None):
-    return _dump_ushort(len(x)) + x
-
-def _dump_longstr(x, depth=0, default=None):
-    return _dump_uint(len(x)) + x
-
-def _dump_shortutf8(x, depth=0, default=None):
-    return _dump_shortstr(x.encode('utf8'))
-
-def _dump_medutf8(x, depth=0, default=None):
-    return _dump_medstr(x.encode('utf8'))
-
-def _dump_longutf8(x, depth=0, default=None):
-    return _dump_longstr(x.encode('utf8'))
-
-def _dump_list(x, depth=0, default=None):
-    return _dump_uint(len(x)) + bytify("").join(
-            pure_python_dumps(item, default, depth + 1, compress=0)
-            for item in x)
-
-_dump_set = _dump_tuple = _dump_list
-
-def _dump_dict(x, depth=0, default=None):
-    return _dump_uint(len(x)) + bytify("").join(
-            pure_python_dumps(item, default, depth + 1, compress=0) for item in
-            reduce(lambda a, b: a.extend(b) or a, iteritems(x), []))
-
-def _dump_shortlist(x, depth=0, default=None):
-    return _dump_uchar(len(x)) + bytify("").join(
-            pure_python_dumps(item, default, depth + 1, compress=0)
-            for item in x)
-
-_dump_shorttuple = _dump_shortset = _dump_shortlist
-
-def _dump_shortdict(x, depth=0, default=None):
-    return _dump_uchar(len(x)) + bytify("").join(
-            pure_python_dumps(item, default, depth + 1, compress=0) for item in
-            reduce(lambda a, b: a.extend(b) or a, iteritems(x), []))
-
-def _dump_medlist(x, depth=0, default=None):
-    return _dump_ushort(len(x)) + bytify("").join(
-            pure_python_dumps(item, default, depth + 1, compress=0)
-            for item in x)
-
-_dump_medtuple = _dump_medset = _dump_medlist
-
-def _dump_meddict(x, depth=0, default=None):
-    return _dump_ushort(len(x)) + bytify("").join(
-            pure_python_dumps(item, default, depth + 1, compress=0) for item in
-            reduce(lambda a, b: a.extend(b) or a, iteritems(x), []))
-
-def _dump_date(x, depth=0, default=None):
-    return "".join(
-            (_dump_ushort(x.year), _dump_char(x.month), _dump_char(x.day)))
+# every dumper appends the type byte and body of its object to `out`, a list
+# of chunks which pure_python_dumps joins only once at the very end
+
+def _dump_header(out, length, kinds):
+    if length < 256:
+        out.append(_tagged_u8.pack(kinds[0], length))
+    elif length < 65536:
+        out.append(_tagged_u16.pack(kinds[1], length))
+    else:
+        out.append(_tagged_u32.pack(kinds[2], length))
+
+def _dump_none(x, out, depth, default):
+    out.append(_uchar.pack(MUMMY_TYPE_NULL))
+
+def _dump_bool(x, out, depth, default):
+    out.append(_tagged_u8.pack(MUMMY_TYPE_BOOL, x and 1 or 0))
+
+def _dump_int(x, out, depth, default):
+    if -128 <= x < 128:
+        out.append(_tagged_char.pack(MUMMY_TYPE_CHAR, x))
+    elif -32768 <= x < 32768:
+        out.append(_tagged_short.pack(MUMMY_TYPE_SHORT, x))
+    elif -2147483648 <= x < 2147483648:
+        out.append(_tagged_int.pack(MUMMY_TYPE_INT, x))
+    elif -9223372036854775808 <= x < 9223372036854775808:
+        out.append(_tagged_long.pack(MUMMY_TYPE_LONG, x))
+    else:
+        _dump_huge(x, out, depth, default)
+
+def _dump_huge(x, out, depth, default):
+    # big-endian two's complement, sized the same way as the C extension
+    width = (abs(x).bit_length() >> 3) + 1
+    data = binascii.unhexlify(
+            "%0*x" % (width << 1, x & ((1 << (width << 3)) - 1)))
+    out.append(_tagged_u32.pack(MUMMY_TYPE_HUGE, width))
+    out.append(data)
+
+def _dump_double(x, out, depth, default):
+    out.append(_tagged_double.pack(MUMMY_TYPE_FLOAT, x))
+
+def _dump_str(x, out, depth, default):
+    _dump_header(out, len(x), _STR_KINDS)
+    out.append(x)
+
+def _dump_utf8(x, out, depth, default):
+    x = x.encode('utf8')
+    _dump_header(out, len(x), _UTF8_KINDS)
+    out.append(x)
+
+def _container_dumper(kinds):
+    def dumper(x, out, depth, default):
+        _dump_header(out, len(x), kinds)
+        depth += 1
+        for item in x:
+            _dump(item, out, depth, default)
+    return dumper
+
+_dump_list = _container_dumper(_LIST_KINDS)
+_dump_tuple = _container_dumper(_TUPLE_KINDS)
+_dump_set = _container_dumper(_SET_KINDS)
+
+def _dump_dict(x, out, depth, default):
+    _dump_header(out, len(x), _HASH_KINDS)
+    depth += 1
+    for key, value in iteritems(x):
+        _dump(key, out, depth, default)
+        _dump(value, out, depth, default)
+
+def _dump_date(x, out, depth, default):
+    out.append(_tagged_date.pack(MUMMY_TYPE_DATE, x.year, x.month, x.day))
+
+def _dump_time(x, out, depth, default):
+    if x.tzinfo is not None:
+        raise ValueError("can't serialize data objects with tzinfo")
+    out.append(_tagged_time.pack(MUMMY_TYPE_TIME, x.hour, x.minute, x.second,
+            x.microsecond >> 16, x.microsecond & 0xffff))
 
-def _dump_time(x, depth=0, default=None):
+def _dump_datetime(x, out, depth, default):
     if x.tzinfo is not None:
         raise ValueError("can't serialize data objects with tzinfo")
-    return "".join((
-        _dump_char(x.hour),
-        _dump_char(x.minute),
-        _dump_char(x.second),
-        struct.pack("!I", x.microsecond)[-3:]))
+    out.append(_tagged_datetime.pack(MUMMY_TYPE_DATETIME,
+            x.year, x.month, x.day, x.hour, x.minute, x.second,
+            x.microsecond >> 16, x.microsecond & 0xffff))
 
-def _dump_datetime(x, depth=0, default=None):
-    return _dump_date(x.date()) + _dump_time(x.timetz())
+def _dump_timedelta(x, out, depth, default):
+    out.append(_tagged_timedelta.pack(MUMMY_TYPE_TIMEDELTA,
+            x.days, x.seconds, x.microseconds))
 
-def _dump_timedelta(x, depth=0, default=None):
-    return "".join((
-        _dump_int(x.days), _dump_int(x.seconds), _dump_int(x.microseconds)))
+def _dump_decimal(x, out, depth, default):
+    if x.is_nan() or x.is_infinite():
+        return _dump_specialnum(x, out, depth, default)
 
-def _dump_decimal(x, depth=0, default=None):
     sign, digits, expo = x.as_tuple()
-    pairs = []
+    pairs = bytearray((len(digits) + 1) >> 1)
     for i, dig in enumerate(digits):
         if not 0 <= dig <= 9:
             raise ValueError("invalid digit")
+        # low 4 bits first, then the high 4
+        pairs[i >> 1] |= (dig << 4) if i & 1 else dig
 
-        if not (i & 1):
-            # even
-            pairs.append(0)
-        else:
-            # odd
-            dig <<= 4
-        pairs[-1] |= dig
-
-    return (struct.pack("!bhH", sign, expo, len(digits)) +
-            "".join(map(_dump_uchar, pairs)))
+    out.append(_tagged_decimal.pack(
+        MUMMY_TYPE_DECIMAL, sign, expo, len(digits)))
+    out.append(bytes(pairs))
 
-def _dump_specialnum(x, depth=0, default=None):
+def _dump_specialnum(x, out, depth, default):
     if x.is_snan():
-        return _dump_uchar(MUMMY_SPECIAL_NAN | 1)
-
-    if x.is_nan():
-        return _dump_uchar(MUMMY_SPECIAL_NAN)
-
-    if x.is_infinite():
-        return _dump_uchar(MUMMY_SPECIAL_INFINITY | int(x < 0))
+        flags = MUMMY_SPECIAL_NAN | 1
+    elif x.is_nan():
+        flags = MUMMY_SPECIAL_NAN
+    else:
+        flags = MUMMY_SPECIAL_INFINITY | int(x < 0)
+    out.append(_tagged_u8.pack(MUMMY_TYPE_SPECIALNUM, flags))
 
-def _dump_fraction(x, depth=0, default=None):
-    return struct.pack("!qq", x.numerator, x.denominator)
+def _dump_fraction(x, out, depth, default):
+    out.append(_tagged_fraction.pack(
+        MUMMY_TYPE_FRACTION, x.numerator, x.denominator))
 
 
 _dumpers = {
-    MUMMY_TYPE_NULL: _dump_none,
-    MUMMY_TYPE_BOOL: _dump_bool,
-    MUMMY_TYPE_CHAR: _dump_char,
-    MUMMY_TYPE_SHORT: _dump_short,
-    MUMMY_TYPE_INT: _dump_int,
-    MUMMY_TYPE_LONG: _dump_long,
-    MUMMY_TYPE_HUGE: _dump_huge,
-    MUMMY_TYPE_FLOAT: _dump_double,
-    MUMMY_TYPE_SHORTSTR: _dump_shortstr,
-    MUMMY_TYPE_MEDSTR: _dump_medstr,
-    MUMMY_TYPE_LONGSTR: _dump_longstr,
-    MUMMY_TYPE_SHORTUTF8: _dump_shortutf8,
-    MUMMY_TYPE_MEDUTF8: _dump_medutf8,
-    MUMMY_TYPE_LONGUTF8: _dump_longutf8,
-    MUMMY_TYPE_LONGLIST: _dump_list,
-    MUMMY_TYPE_LONGTUPLE: _dump_tuple,
-    MUMMY_TYPE_LONGSET: _dump_set,
-    MUMMY_TYPE_LONGHASH: _dump_dict,
-    MUMMY_TYPE_SHORTLIST: _dump_shortlist,
-    MUMMY_TYPE_MEDLIST: _dump_medlist,
-    MUMMY_TYPE_SHORTTUPLE: _dump_shorttuple,
-    MUMMY_TYPE_MEDTUPLE: _dump_medtuple,
-    MUMMY_TYPE_SHORTSET: _dump_shortset,
-    MUMMY_TYPE_MEDSET: _dump_medset,
-    MUMMY_TYPE_SHORTHASH: _dump_shortdict,
-    MUMMY_TYPE_MEDHASH: _dump_meddict,
-    MUMMY_TYPE_DATE: _dump_date,
-    MUMMY_TYPE_TIME: _dump_time,
-    MUMMY_TYPE_DATETIME: _dump_datetime,
-    MUMMY_TYPE_TIMEDELTA: _dump_timedelta,
-    MUMMY_TYPE_DECIMAL: _dump_decimal,
-    MUMMY_TYPE_SPECIALNUM: _dump_specialnum,
-    MUMMY_TYPE_FRACTION: _dump_fraction,
+    type(None): _dump_none,
+    bool: _dump_bool,
+    int: _dump_int,
+    long: _dump_int,
+    float: _dump_double,
+    bytes: _dump_str,
+    unicode: _dump_utf8,
+    list: _dump_list,
+    tuple: _dump_tuple,
+    set: _dump_set,
+    frozenset: _dump_set,
+    dict: _dump_dict,
+    datetime.date: _dump_date,
+    datetime.time: _dump_time,
+    datetime.datetime: _dump_datetime,
+    datetime.timedelta: _dump_timedelta,
+    decimal.Decimal: _dump_decimal,
+    fractions.Fraction: _dump_fraction,
 }
 
+def _dump(item, out, depth, default):
+    if depth >= MAX_DEPTH:
+        raise ValueError("max depth exceeded")
+    dumper = _dumpers.get(type(item))
+    if dumper is None:
+        if default is None:
+            raise TypeError("unserializable type")
+        item = default(item)
+        dumper = _dumpers.get(type(item))
+        if dumper is None:
+            raise TypeError("unserializable type")
+    dumper(item, out, depth, default)
+
 def pure_python_dumps(item, default=None, depth=0, compress=True):
     """serialize a native python object into a mummy string
     
@@ -399,239 +294,162 @@ def pure_python_dumps(item, default=None, depth=0, compress=True):
     """
     if default and not hasattr(default, "__call__"):
         raise TypeError("default must be callable or None")
-    if depth >= MAX_DEPTH:
-        raise ValueError("max depth exceeded")
-    try:
-        kind = _get_type_code(item)
-    except ValueError:
-        if default is None:
-            raise TypeError("unserializable type")
-        item = default(item)
-        kind = _get_type_code(item)
-    data = _dumpers[kind](item, depth, default)
-    datalen = len(data)
-    if compress and lzf and datalen > 5:
-        compressed = lzf.compress(data, datalen - 5)
-        if compressed:
-            data = struct.pack("!i", datalen) + compressed
-            kind = kind | 0x80
-    kind = _dump_char(kind)
 
-    return kind + data
+    out = []
+    _dump(item, out, depth, default)
+    data = b"".join(out)
+
+    if compress:
+        data = _compress(data)
+    return data
+
+def _compress(data):
+    # compressed: flagged type byte, 4 byte uncompressed size, lzf'd body
+    datalen = len(data) - 1
+    if lzf and datalen > 5:
+        compressed = lzf.compress(data[1:], datalen - 5)
+        if compressed:
+            data = b"".join((
+                _uchar.pack(_byte(data, 0) | 0x80),
+                _uint.pack(datalen),
+                compressed))
+    return data
 
 
 ##
 ## LOADERS
 ##
 
-def _load_none(x):
-    return None, 0
-
-def _load_bool(x):
-    return bool(ord(x[0])), 1
-
-def _load_char(x):
-    num = ord(x[0])
-    if num >= 128:
-        num -= 256
-    return num, 1
-
-def _load_uchar(x):
-    return ord(x[0]), 1
-
-def _load_short(x):
-    return struct.unpack("!h", x[:2])[0], 2
-
-def _load_ushort(x):
-    return struct.unpack("!H", x[:2])[0], 2
-
-def _load_int(x):
-    return struct.unpack("!i", x[:4])[0], 4
-
-def _load_uint(x):
-    return struct.unpack("!I", x[:4])[0], 4
-
-def _load_long(x):
-    return struct.unpack("!q", x[:8])[0], 8
-
-def _load_huge(x):
-    width = _load_uint(x)[0] + 4
-    num = 0
-    x = x[4:]
-    neg = ord(x[0]) & 0x80
-    data = map(ord, x[:width])
-    if neg:
-        data = map(lambda byte: byte ^ 0xff, data)
-    for c in data:
-        num = (num << 8) | c
-    if neg:
-        return -num - 1, width
-    return num, width
-
-def _load_double(x):
-    return struct.unpack("!d", x[:8])[0], 8
-
-def _load_shortstr(x):
-    width = _load_uchar(x)[0] + 1
-    return x[1:width], width
-
-def _load_medstr(x):
-    width = _load_ushort(x)[0] + 2
-    return x[2:width], width
-
-def _load_longstr(x):
-    width = _load_uint(x)[0] + 4
-    return x[4:width], width
-
-def _load_shortutf8(x):
-    str, width = _load_shortstr(x)
-    return str.decode('utf8'), width
-
-def _load_medutf8(x):
-    str, width = _load_medstr(x)
-    return str.decode('utf8'), width
-
-def _load_longutf8(x):
-    str, width = _load_longstr(x)
-    return str.decode('utf8'), width
-
-def _load_list(x):
-    length, width = _load_uint(x)
-    result = []
-    for i in xrange(length):
-        item, item_width = _loads(x[width:])
-        result.append(item)
-        width += item_width + 1
-    return result, width
-
-def _load_set(x):
-    lst, width = _load_list(x)
-    return set(lst), width
-
-def _load_tuple(x):
-    lst, width = _load_list(x)
-    return tuple(lst), width
-
-def _load_dict(x):
-    length, width = _load_uint(x)
-    result = {}
-    for i in xrange(length):
-        key, keywidth = _loads(x[width:])
-        width += keywidth + 1
-        value, valuewidth = _loads(x[width:])
-        width += valuewidth + 1
-        result[key] = value
-    return result, width
-
-def _load_shortlist(x):
-    length, width = _load_uchar(x)
-    result = []
-    for i in xrange(length):
-        item, item_width = _loads(x[width:])
-        result.append(item)
-        width += item_width + 1
-    return result, width
-
-def _load_shorttuple(x):
-    lst, width = _load_shortlist(x)
-    return tuple(lst), width
-
-def _load_shortset(x):
-    lst, width = _load_shortlist(x)
-    return set(lst), width
-
-def _load_shortdict(x):
-    length, width = _load_uchar(x)
-    result = {}
-    for i in xrange(length):
-        key, keywidth = _loads(x[width:])
-        width += keywidth + 1
-        value, valuewidth = _loads(x[width:])
-        width += valuewidth + 1
-        result[key] = value
-    return result, width
-
-def _load_medlist(x):
-    length, width = _load_ushort(x)
-    result = []
-    for i in xrange(length):
-        item, item_width = _loads(x[width:])
-        result.append(item)
-        width += item_width + 1
-    return result, width
-
-def _load_medtuple(x):
-    lst, width = _load_medlist(x)
-    return tuple(lst), width
-
-def _load_medset(x):
-    lst, width = _load_medlist(x)
-    return set(lst), width
-
-def _load_meddict(x):
-    length, width = _load_ushort(x)
-    result = {}
-    for i in xrange(length):
-        key, keywidth = _loads(x[width:])
-        width += keywidth + 1
-        value, valuewidth = _loads(x[width:])
-        width += valuewidth + 1
-        result[key] = value
-    return result, width
-
-def _load_date(x):
-    year = struct.unpack("!H", x[:2])[0]
-    month = struct.unpack("B", x[2])[0]
-    day = struct.unpack("B", x[3])[0]
-    return datetime.date(year, month, day), 4
-
-def _load_time(x):
-    hour = struct.unpack("B", x[0])[0]
-    minute = struct.unpack("B", x[1])[0]
-    second = struct.unpack("B", x[2])[0]
-    microsecond = struct.unpack("!I", '\x00' + x[3:6])[0]
-    return datetime.time(hour, minute, second, microsecond), 6
-
-def _load_datetime(x):
-    return datetime.datetime.combine(
-            _load_date(x)[0],
-            _load_time(x[4:10])[0]), 10
-
-def _load_timedelta(x):
-    return (datetime.timedelta(
-            _load_int(x)[0], _load_int(x[4:8])[0], _load_int(x[8:12])[0]), 12)
-
-def _load_decimal(x):
-    sign = _load_char(x[0])[0]
-    expo = _load_short(x[1:3])[0]
-    count = _load_ushort(x[3:5])[0]
-
-    width = 5 + (count >> 1) + (count & 1)
-    digit_bytes = map(ord, x[5:width])
-    digits = []
-    for i, b in enumerate(digit_bytes[:-1]):
-        digits.append(b & 0x0f)
-        digits.append(b >> 4)
-    digits.append(digit_bytes[-1] & 0x0f)
-    if not count & 1:
-        digits.append(digit_bytes[-1] >> 4)
-
-    return decimal.Decimal((sign, digits, expo)), width
-
-def _load_specialnum(x):
-    b = _load_uchar(x[0])[0]
+# loaders take the whole string and the offset of the body (just past the
+# type byte), and return the loaded object and the offset following it
+
+def _load_slice(data, offset, length):
+    end = offset + length
+    if end > len(data):
+        raise ValueError("invalid mummy (incorrect length)")
+    return data[offset:end], end
+
+def _load_none(data, offset):
+    return None, offset
+
+def _load_bool(data, offset):
+    return bool(_byte(data, offset)), offset + 1
+
+def _load_char(data, offset):
+    return _char.unpack_from(data, offset)[0], offset + 1
+
+def _load_short(data, offset):
+    return _short.unpack_from(data, offset)[0], offset + 2
+
+def _load_int(data, offset):
+    return _int.unpack_from(data, offset)[0], offset + 4
+
+def _load_long(data, offset):
+    return _long.unpack_from(data, offset)[0], offset + 8
+
+def _load_huge(data, offset):
+    width = _uint.unpack_from(data, offset)[0]
+    body, offset = _load_slice(data, offset + 4, width)
+    if not width:
+        return 0, offset
+    num = int(binascii.hexlify(body), 16)
+    if _byte(body, 0) & 0x80:
+        num -= 1 << (width << 3)
+    return num, offset
+
+def _load_double(data, offset):
+    return _double.unpack_from(data, offset)[0], offset + 8
+
+def _load_shortstr(data, offset):
+    return _load_slice(data, offset + 1, _byte(data, offset))
+
+def _load_medstr(data, offset):
+    return _load_slice(data, offset + 2, _ushort.unpack_from(data, offset)[0])
+
+def _load_longstr(data, offset):
+    return _load_slice(data, offset + 4, _uint.unpack_from(data, offset)[0])
+
+def _load_shortutf8(data, offset):
+    x, offset = _load_shortstr(data, offset)
+    return x.decode('utf8'), offset
+
+def _load_medutf8(data, offset):
+    x, offset = _load_medstr(data, offset)
+    return x.decode('utf8'), offset
+
+def _load_longutf8(data, offset):
+    x, offset = _load_longstr(data, offset)
+    return x.decode('utf8'), offset
+
+def _container_loader(header, build=None):
+    size = header.size
+    def loader(data, offset):
+        count = header.unpack_from(data, offset)[0]
+        offset += size
+        result = []
+        append = result.append
+        for i in xrange(count):
+            item, offset = _load(data, offset)
+            append(item)
+        if build is not None:
+            result = build(result)
+        return result, offset
+    return loader
+
+def _hash_loader(header):
+    size = header.size
+    def loader(data, offset):
+        count = header.unpack_from(data, offset)[0]
+        offset += size
+        result = {}
+        for i in xrange(count):
+            key, offset = _load(data, offset)
+            result[key], offset = _load(data, offset)
+        return result, offset
+    return loader
+
+def _load_date(data, offset):
+    return datetime.date(*_date.unpack_from(data, offset)), offset + 4
+
+def _load_time(data, offset):
+    hour, minute, second, us_high, us_low = _time.unpack_from(data, offset)
+    return (datetime.time(hour, minute, second, (us_high << 16) | us_low),
+            offset + 6)
+
+def _load_datetime(data, offset):
+    (year, month, day, hour, minute, second,
+            us_high, us_low) = _datetime.unpack_from(data, offset)
+    return datetime.datetime(year, month, day, hour, minute, second,
+            (us_high << 16) | us_low), offset + 10
+
+def _load_timedelta(data, offset):
+    return (datetime.timedelta(*_timedelta.unpack_from(data, offset)),
+            offset + 12)
+
+def _load_decimal(data, offset):
+    sign, expo, count = _decimal.unpack_from(data, offset)
+    pairs, offset = _load_slice(data, offset + 5, (count + 1) >> 1)
+    pairs = bytearray(pairs)
+    digits = [(pairs[i >> 1] >> 4) if i & 1 else (pairs[i >> 1] & 0x0f)
+            for i in xrange(count)]
+    return decimal.Decimal((sign, digits, expo)), offset
+
+def _load_specialnum(data, offset):
+    b = _byte(data, offset)
     if (b & 0xf0) == MUMMY_SPECIAL_INFINITY:
         if b & 0x01:
-            return decimal.Decimal("-Infinity"), 1
-        return decimal.Decimal("Infinity"), 1
+            return decimal.Decimal("-Infinity"), offset + 1
+        return decimal.Decimal("Infinity"), offset + 1
 
     if (b & 0xf0) == MUMMY_SPECIAL_NAN:
         if b & 0x01:
-            return decimal.Decimal("sNaN"), 1
-        return decimal.Decimal("NaN"), 1
+            return decimal.Decimal("sNaN"), offset + 1
+        return decimal.Decimal("NaN"), offset + 1
+
+    raise ValueError("invalid mummy (unrecognized specialnum type)")
 
-def _load_fraction(x):
-    return fractions.Fraction(*struct.unpack("!qq", x[:16])), 16
+def _load_fraction(data, offset):
+    return fractions.Fraction(*_fraction.unpack_from(data, offset)), offset + 16
 
 
 _loaders = {
@@ -649,18 +467,18 @@ _loaders = {
     MUMMY_TYPE_SHORTUTF8: _load_shortutf8,
     MUMMY_TYPE_MEDUTF8: _load_medutf8,
     MUMMY_TYPE_LONGUTF8: _load_longutf8,
-    MUMMY_TYPE_LONGLIST: _load_list,
-    MUMMY_TYPE_LONGTUPLE: _load_tuple,
-    MUMMY_TYPE_LONGSET: _load_set,
-    MUMMY_TYPE_LONGHASH: _load_dict,
-    MUMMY_TYPE_SHORTLIST: _load_shortlist,
-    MUMMY_TYPE_MEDLIST: _load_medlist,
-    MUMMY_TYPE_SHORTTUPLE: _load_shorttuple,
-    MUMMY_TYPE_MEDTUPLE: _load_medtuple,
-    MUMMY_TYPE_SHORTSET: _load_shortset,
-    MUMMY_TYPE_MEDSET: _load_medset,
-    MUMMY_TYPE_SHORTHASH: _load_shortdict,
-    MUMMY_TYPE_MEDHASH: _load_meddict,
+    MUMMY_TYPE_LONGLIST: _container_loader(_uint),
+    MUMMY_TYPE_LONGTUPLE: _container_loader(_uint, tuple),
+    MUMMY_TYPE_LONGSET: _container_loader(_uint, set),
+    MUMMY_TYPE_LONGHASH: _hash_loader(_uint),
+    MUMMY_TYPE_SHORTLIST: _container_loader(_uchar),
+    MUMMY_TYPE_MEDLIST: _container_loader(_ushort),
+    MUMMY_TYPE_SHORTTUPLE: _container_loader(_uchar, tuple),
+    MUMMY_TYPE_MEDTUPLE: _container_loader(_ushort, tuple),
+    MUMMY_TYPE_SHORTSET: _container_loader(_uchar, set),
+    MUMMY_TYPE_MEDSET: _container_loader(_ushort, set),
+    MUMMY_TYPE_SHORTHASH: _hash_loader(_uchar),
+    MUMMY_TYPE_MEDHASH: _hash_loader(_ushort),
     MUMMY_TYPE_DATE: _load_date,
     MUMMY_TYPE_TIME: _load_time,
     MUMMY_TYPE_DATETIME: _load_datetime,
@@ -670,9 +488,11 @@ _loaders = {
     MUMMY_TYPE_FRACTION: _load_fraction,
 }
 
-def _loads(data):
-    kind = _load_char(data)[0]
-    return _loaders[kind](data[1:])
+def _load(data, offset):
+    loader = _loaders.get(_byte(data, offset))
+    if loader is None:
+        raise ValueError("invalid mummy (unrecognized type)")
+    return loader(data, offset + 1)
 
 def pure_python_loads(data):
     """convert a mummy string into the python object it represents
@@ -681,22 +501,421 @@ def pure_python_loads(data):
 
     :returns: the python data
     """
+    data = _decompress(data)
+    try:
+        return _load(data, 0)[0]
+    except (struct.error, IndexError):
+        raise ValueError("invalid mummy (incorrect length)")
+
+def _decompress(data):
     if not data:
         raise ValueError("no data from which to load")
-    if ord(data[0]) >> 7:
+    if not isinstance(data, bytes):
+        data = bytes(bytearray(data))
+    kind = _byte(data, 0)
+    if kind >> 7:
         if not lzf:
             raise RuntimeError("can't decompress without python-lzf")
-        kind, ucsize, data = (
-                chr(ord(data[0]) & 0x7f), _load_int(data[1:5])[0], data[5:])
-        data = kind + lzf.decompress(data, ucsize + 1)
+        ucsize = _uint.unpack_from(data, 1)[0]
+        data = _uchar.pack(kind & 0x7f) + lzf.decompress(data[5:], ucsize + 1)
+    return data
+
+
+##
+## UPGRADING
+##
+
+# the old format (oldmummy) is this one but for decimals, which had a flags
+# byte (special, sign, infinity, signaling) in place of the sign, were only
+# that byte for the special values, and packed the digits high 4 bits first
+
+def _load_legacy_decimal(data, offset):
+    flags = _byte(data, offset)
+    if flags & 1:
+        if flags & 4:
+            return (decimal.Decimal(flags & 2 and "-Infinity" or "Infinity"),
+                    offset + 1)
+        return decimal.Decimal(flags & 8 and "sNaN" or "NaN"), offset + 1
+
+    flags, expo, count = _legacy_decimal.unpack_from(data, offset)
+    pairs, offset = _load_slice(data, offset + 5, (count + 1) >> 1)
+    pairs = bytearray(pairs)
+    digits = [(pairs[i >> 1] & 0x0f) if i & 1 else (pairs[i >> 1] >> 4)
+            for i in xrange(count)]
+    return decimal.Decimal(((flags & 2) >> 1, digits, expo)), offset
+
+# containers are just a count, with their contents following as more tokens
+_header_sizes = {}
+for _kinds in (_LIST_KINDS, _TUPLE_KINDS, _SET_KINDS, _HASH_KINDS):
+    _header_sizes.update(zip(_kinds, (1, 2, 4)))
+
+def pure_python_upgrade(data, compress=True):
+    """rewrite a mummy string from the old format in the current one
+
+    :param bytestring data: a string serialized by oldmummy
+    :param bool compress: as for dumps
+
+    :returns: the bytestring in the current format
+    """
+    data = _decompress(data)
+    out = []
+    offset = 0
+    try:
+        while offset < len(data):
+            kind = _byte(data, offset)
+            if kind == MUMMY_TYPE_DECIMAL:
+                value, offset = _load_legacy_decimal(data, offset + 1)
+                _dump_decimal(value, out, 0, None)
+                continue
+
+            start = offset
+            if kind in _header_sizes:
+                offset += 1 + _header_sizes[kind]
+            else:
+                loader = _loaders.get(kind)
+                if loader is None:
+                    raise ValueError("invalid mummy (unrecognized type)")
+                offset = loader(data, offset + 1)[1]
+            out.append(data[start:offset])
+    except (struct.error, IndexError):
+        raise ValueError("invalid mummy (incorrect length)")
+    if offset > len(data):
+        raise ValueError("invalid mummy (incorrect length)")
+
+    data = b"".join(out)
+    if compress:
+        data = _compress(data)
+    return data
+
+def iter_upgraded(payloads, compress=True):
+    """lazily rewrite each of an iterable of old format mummy strings
+
+    for converting stored data in bulk without holding all of it at once.
+
+    :param payloads: the strings serialized by oldmummy
+    :param bool compress: as for dumps
+
+    :returns: a generator of the bytestrings in the current format
+    """
+    for data in payloads:
+        yield upgrade(data, compress)
+
+
+def _json_default(obj):
+    if isinstance(obj, (datetime.date, datetime.time)):
+        return obj.isoformat()
+    if isinstance(obj, datetime.timedelta):
+        return obj.total_seconds()
+    if isinstance(obj, (decimal.Decimal, fractions.Fraction)):
+        return float(obj)
+    raise TypeError("%r is not JSON serializable" % (obj,))
+
+def _json_text(obj):
+    # bytes (hash keys too) as text, with anything that isn't UTF-8 made
+    # U+FFFD the same as to_json does, and sets as lists
+    if isinstance(obj, bytes):
+        return obj.decode("utf-8", "replace")
+    if isinstance(obj, dict):
+        return dict((_json_text(key), _json_text(value))
+                for key, value in iteritems(obj))
+    if isinstance(obj, (list, tuple, set, frozenset)):
+        return [_json_text(item) for item in obj]
+    return obj
+
+def pure_python_to_json(data):
+    """convert a mummy string to JSON by way of the python objects
+
+    the fallback for to_json without the extension. decimals come out as
+    floats here rather than with their exact digits. bytes that aren't UTF-8
+    come out with U+FFFD in their place, as with to_json.
+
+    :param bytestring data: a string serialized by mummy
+
+    :returns: the JSON as a UTF-8 bytestring
+    """
+    text = json.dumps(_json_text(pure_python_loads(data)),
+            separators=(",", ":"), ensure_ascii=False, default=_json_default)
+    if isinstance(text, unicode):
+        text = text.encode("utf-8")
+    return text
+
+def pure_python_from_json(data, compress=True):
+    """convert JSON to a mummy string by way of the python objects
+
+    :param data: the JSON, as text or UTF-8 bytes
+    :param bool compress: as for dumps
+
+    :returns: the mummy bytestring
+    """
+    if isinstance(data, bytes):
+        data = data.decode("utf-8")
+    return dumps(json.loads(data), compress=compress)
+
+def _no_msgpack(*args, **kwargs):
+    raise NotImplementedError("msgpack transcoding needs the C extension")
+
+def _no_profile(*args, **kwargs):
+    raise NotImplementedError("profile needs the C extension")
+
+def _no_stats():
+    """the counters of everything encoded and decoded so far
+
+    only the CPython extension keeps them, and only when built with MUMMY_STATS
+    set in the environment, so here there are none.
+
+    :returns: None
+    """
+    return None
+
+def _no_reset_stats():
+    "zero the counters returned by stats(), of which there are none here"
+
+def _no_set_timing(enabled):
+    raise NotImplementedError("timing needs the C extension")
+
+def _no_timings():
+    """the latency histograms kept since set_timing(True)
+
+    only the CPython extension keeps them, so here they are always empty.
+    """
+    return {}
+
+def _no_reset_timings():
+    "empty the histograms returned by timings(), which are empty here"
+
+
+class Encoder(object):
+    """a reusable mummy serializer
+
+    the C extension's Encoder holds its configuration and working buffer
+    between calls. this stand-in, used when the extension isn't available,
+    only holds the configuration.
+
+    :param function default:
+        If an object is not serializable and this parameter is provided, this
+        function will be used to generate a fallback value to serialize. It
+        should take one argument (the original object), and return something
+        serializable.
+    :param bool compress:
+        whether or not to attempt to compress the serialized data (default
+        True)
+    :param int threshold:
+        only attempt compression when the serialized data is at least this
+        many bytes (default 0)
+    """
+    def __init__(self, default=None, compress=True, threshold=0):
+        if default and not hasattr(default, "__call__"):
+            raise TypeError("default must be callable or None")
+        self.default = default
+        self.compress = bool(compress)
+        self.threshold = threshold
+
+    def encode(self, obj):
+        "serialize a native python object into a mummy string"
+        if not (self.compress and self.threshold):
+            return dumps(obj, self.default, self.compress)
+        data = dumps(obj, self.default, False)
+        if len(data) >= self.threshold:
+            data = dumps(obj, self.default, True)
+        return data
+
+    def encode_many(self, objects):
+        "serialize each of an iterable of python objects"
+        return [self.encode(obj) for obj in objects]
+
+    def encode_into(self, buffer, obj):
+        "serialize a native python object onto the end of a bytearray"
+        data = self.encode(obj)
+        buffer.extend(data)
+        return len(data)
+
+
+class Decoder(object):
+    """a reusable mummy deserializer
+
+    the C extension's Decoder keeps its decompression buffer and a cache of
+    short hash keys between calls. this stand-in, used when the extension
+    isn't available, is just loads().
+
+    :param bool cache_keys:
+        whether to share short string hash keys between decoded objects
+        (default True)
+    :param bool legacy:
+        read mummies written in the old format (by oldmummy), which lays out
+        decimals differently. there's no telling the two apart from the data
+        so this has to be asked for (default False)
+    """
+    def __init__(self, cache_keys=True, legacy=False):
+        self.legacy = bool(legacy)
+
+    def decode(self, data):
+        "deserialize a mummy string to a python object"
+        if self.legacy:
+            data = upgrade(data, False)
+        return loads(data)
+
+    def decode_many(self, items):
+        "deserialize each of an iterable of mummy strings"
+        return [self.decode(data) for data in items]
+
 
-    return _loads(string(data))[0]
+def dumps_into(buffer, obj, default=None, compress=True):
+    """serialize a native python object onto the end of a bytearray
+
+    :param bytearray buffer: where to put the serialized data
+    :param object: the python object to serialize
+    :param function default: as for dumps
+    :param bool compress: as for dumps
+
+    :returns: the number of bytes added to the end of the buffer
+    """
+    data = dumps(obj, default, compress)
+    buffer.extend(data)
+    return len(data)
+
+
+_record_header = struct.Struct("!I")
+
+
+def dump(obj, fp, default=None, compress=True):
+    """serialize a native python object into a file
+
+    :param object: the python object to serialize
+    :param file fp: a file opened for writing in binary mode
+    :param function default: as for dumps
+    :param bool compress: as for dumps
+    """
+    fp.write(dumps(obj, default, compress))
+
+
+def load(fp):
+    """deserialize a python object from the rest of a file
+
+    :param file fp: a file opened for reading in binary mode
+
+    :returns: the python data
+    """
+    return loads(fp.read())
+
+
+def dump_records(iterable, fp, default=None, compress=True):
+    """serialize each object in an iterable into a file
+
+    each is written as a record of its length as 4 big-endian bytes followed
+    by its serialization, and can be read back with iter_records.
+
+    :param iterable: the python objects to serialize
+    :param file fp: a file opened for writing in binary mode
+    :param function default: as for dumps
+    :param bool compress: as for dumps, applied to each record
+    """
+    for obj in iterable:
+        data = dumps(obj, default, compress)
+        fp.write(_record_header.pack(len(data)) + data)
+
+
+def iter_records(fp, cache_keys=True):
+    """iterate over the records in a file written by dump_records
+
+    :param file fp: a file opened for reading in binary mode
+    :param bool cache_keys: as for Decoder
+    """
+    decode = Decoder(cache_keys).decode
+    while 1:
+        header = fp.read(4)
+        if not header:
+            return
+        if len(header) == 4:
+            size, = _record_header.unpack(header)
+            data = fp.read(size)
+            if len(data) == size:
+                yield decode(data)
+                continue
+        raise ValueError("invalid mummy record (truncated)")
 
 
 try:
-    from _mummy import dumps, loads
+    from _mummy import dumps, loads, dumps_into, Encoder, Decoder, \
+            dump, load, dump_records, iter_records, upgrade, \
+            to_json, from_json, to_msgpack, from_msgpack, profile, \
+            stats, reset_stats, set_timing, timings, reset_timings
     has_extension = True
 except ImportError:
-    dumps = pure_python_dumps
-    loads = pure_python_loads
-    has_extension = False
+    try:
+        # PyPy gets the C core through cffi instead of the CPython extension
+        from .cffi_serialization import \
+                cffi_dumps as dumps, cffi_loads as loads, \
+                cffi_upgrade as upgrade, cffi_to_json as to_json, \
+                cffi_from_json as from_json, cffi_to_msgpack as to_msgpack, \
+                cffi_from_msgpack as from_msgpack, cffi_profile as profile
+        stats, reset_stats = _no_stats, _no_reset_stats
+        set_timing, timings, reset_timings = \
+                _no_set_timing, _no_timings, _no_reset_timings
+        has_extension = True
+    except ImportError:
+        dumps = pure_python_dumps
+        loads = pure_python_loads
+        upgrade = pure_python_upgrade
+        to_json = pure_python_to_json
+        from_json = pure_python_from_json
+        to_msgpack = from_msgpack = _no_msgpack
+        profile = _no_profile
+        stats, reset_stats = _no_stats, _no_reset_stats
+        set_timing, timings, reset_timings = \
+                _no_set_timing, _no_timings, _no_reset_timings
+        has_extension = False
+
+try:
+    from _mummy import _alloc_capture
+except ImportError:
+    _alloc_capture = None
+
+
+class track_allocations(object):
+    """count what the C core allocates in each call made inside the block
+
+    only the CPython extension built with MUMMY_TRACK_ALLOC=1 in the
+    environment can, which everything else refuses with NotImplementedError.
+    ``calls`` gets a dict for each top-level call on this thread (dumps,
+    loads, dumps_into, dump, load, dump_records and the Encoder and Decoder
+    methods) with its name as "call", and "allocs", "frees", "bytes"
+    allocated, the "peak" bytes held at once and those still "live" at the
+    end. python objects aren't counted, tracemalloc has those. blocks can
+    nest, and the calls in an inner one appear in the outer one too.
+
+    in a MUMMY_TRACK_ALLOC=1 build (so the examples are skipped as doctests):
+
+    >>> data = {"name": "mummy", "sizes": [1, 2, 3]}
+    >>> with track_allocations() as tracked:  # doctest: +SKIP
+    ...     value = loads(dumps(data))
+    >>> [call["call"] for call in tracked.calls]  # doctest: +SKIP
+    ['dumps', 'loads']
+    >>> tracked.total  # doctest: +SKIP
+    {'allocs': 3, 'frees': 3, 'bytes': 4152, 'peak': 4128, 'live': 0}
+    """
+    def __init__(self):
+        self.calls = []
+        self._previous = None
+
+    def __enter__(self):
+        if _alloc_capture is None:
+            raise NotImplementedError("allocation tracking needs the C "
+                    "extension built with MUMMY_TRACK_ALLOC=1")
+        self._previous = _alloc_capture(self.calls)
+        return self
+
+    def __exit__(self, *exc_info):
+        _alloc_capture(self._previous)
+        if self._previous is not None:
+            self._previous.extend(self.calls)
+        self._previous = None
+
+    @property
+    def total(self):
+        "the calls' counts added up, and the highest of their peaks"
+        total = {"allocs": 0, "frees": 0, "bytes": 0, "peak": 0, "live": 0}
+        for call in self.calls:
+            for key in ("allocs", "frees", "bytes", "live"):
+                total[key] += call[key]
+            total["peak"] = max(total["peak"], call["peak"])
+        return total
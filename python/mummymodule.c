@@ -1,17 +1,8 @@
-#include "Python.h"
-#include "datetime.h"
 #include "mummypy.h"
+#include "datetime.h"
 
 
-/* import decimal and datetime at mummy import time */
-PyObject *PyDecimalType;
-PyObject *PyFractionType;
-PyDateTime_CAPI *PyDateTimeCAPI;
-
-
-static PyMethodDef methods[] = {
-    {"dumps", (PyCFunction)python_dumps, METH_VARARGS | METH_KEYWORDS,
-        "serialize a native python object into an mummy string\n\
+#define DUMPS_DOC "serialize a native python object into an mummy string\n\
 \n\
     :param object: the python object to serialize\n\
     :param function default:\n\
@@ -24,69 +15,311 @@ static PyMethodDef methods[] = {
         True)\n\
 \n\
     :returns: the bytestring of the serialized data\n\
-"},
-    {"loads", (PyCFunction)python_loads, METH_O,
-        "deserialize a mummy string to a python object\n\
+"
+
+#define LOADS_DOC "deserialize a mummy string to a python object\n\
+\n\
+    :param bytestring serialized:\n\
+        the serialized string to load. any object supporting the buffer\n\
+        protocol (bytearray, memoryview, mmap...) is read in place\n\
+\n\
+    :returns: the python data\n\
+"
+
+#define DUMPS_INTO_DOC "serialize a native python object onto a bytearray\n\
+\n\
+    :param bytearray buffer: where to put the serialized data\n\
+    :param object: the python object to serialize\n\
+    :param function default: as for dumps\n\
+    :param bool compress: as for dumps\n\
+\n\
+    :returns: the number of bytes added to the end of the buffer\n\
+"
+
+#define DUMP_DOC "serialize a native python object into a file\n\
+\n\
+    :param object: the python object to serialize\n\
+    :param file fp: a file opened for writing in binary mode\n\
+    :param function default: as for dumps\n\
+    :param bool compress: as for dumps\n\
+\n\
+    if the file has a file descriptor it is flushed, then written to\n\
+    directly, otherwise the data goes through its write() method\n\
+"
+
+#define LOAD_DOC "deserialize a python object from the rest of a file\n\
 \n\
-    :param bytestring serialized: the serialized string to load\n\
+    :param file fp: a file opened for reading in binary mode\n\
 \n\
     :returns: the python data\n\
-"},
+"
+
+#define DUMP_RECORDS_DOC "serialize each object in an iterable into a file\n\
+\n\
+    each is written as a record of its length as 4 big-endian bytes\n\
+    followed by its serialization, and can be read back with iter_records.\n\
+    records are collected in a buffer and written to the file in chunks, so\n\
+    if one fails to serialize some before it may already have been written.\n\
+\n\
+    :param iterable: the python objects to serialize\n\
+    :param file fp: a file opened for writing in binary mode\n\
+    :param function default: as for dumps\n\
+    :param bool compress: as for dumps, applied to each record\n\
+"
+
+#define UPGRADE_DOC "rewrite a mummy string from the old format in the current one\n\
+\n\
+    the old format (oldmummy) differs only in how decimals are laid out, so\n\
+    everything else is copied across as it is.\n\
+\n\
+    :param bytestring data: a string serialized by oldmummy\n\
+    :param bool compress: as for dumps\n\
+\n\
+    :returns: the bytestring in the current format\n\
+"
+
+#define TO_JSON_DOC "convert a mummy string straight to JSON\n\
+\n\
+    no python objects are built along the way. the JSON is compact UTF-8,\n\
+    as json.dumps(separators=(',', ':'), ensure_ascii=False) would write\n\
+    it, except that dates and times become ISO 8601 strings, decimals and\n\
+    fractions numbers and timedeltas their total seconds.\n\
+\n\
+    :param bytestring data: a string serialized by mummy\n\
+\n\
+    :returns: the JSON as a UTF-8 bytestring\n\
+"
+
+#define FROM_JSON_DOC "convert JSON straight to a mummy string\n\
+\n\
+    :param data: the JSON, as text or UTF-8 bytes\n\
+    :param bool compress: as for dumps\n\
+\n\
+    :returns: the mummy bytestring\n\
+"
+
+#define TO_MSGPACK_DOC "convert a mummy string straight to msgpack\n\
+\n\
+    datetimes become msgpack timestamps (naive ones taken as UTC), and\n\
+    the other types msgpack has nothing for are carried in extension type\n\
+    0x4d, which from_msgpack turns back into them.\n\
+\n\
+    :param bytestring data: a string serialized by mummy\n\
+\n\
+    :returns: the msgpack bytestring\n\
+"
+
+#define FROM_MSGPACK_DOC "convert msgpack straight to a mummy string\n\
+\n\
+    :param bytestring data: one msgpack value\n\
+    :param bool compress: as for dumps\n\
+\n\
+    :returns: the mummy bytestring\n\
+"
+
+#define PROFILE_DOC "count up where the bytes in mummy strings go\n\
+\n\
+    counts and bytes by type code (so the short, medium and long widths\n\
+    each show), hash keys against everything else, and for each path down\n\
+    to `depth` levels the bytes of its subtrees and what lzf makes of them\n\
+    one at a time. paths look like '.users[].name', and the top is ''.\n\
+    varint_bytes and keytable_bytes estimate the total had ints, lengths\n\
+    and counts been varints, or had each string key been written once in\n\
+    a table for all the strings and referred to by index.\n\
+\n\
+    :param data: a string serialized by mummy, or an iterable of them\n\
+    :param int depth: how many levels of paths to break down\n\
+\n\
+    :returns: a dict of the totals, with 'types' mapping type names to\n\
+        (count, bytes) and 'paths' a list of dicts in the order they were\n\
+        first seen\n\
+"
+
+#define STATS_DOC "the counters of everything encoded and decoded so far\n\
+\n\
+    only kept when the extension was built with MUMMY_STATS set in the\n\
+    environment, and otherwise None. they are added up across all threads\n\
+    and count since import or the last reset_stats(): encodes and decodes\n\
+    (top-level values) and their bytes uncompressed, compress_attempts and\n\
+    compress_saves (the attempts that came out smaller) with the bytes in\n\
+    and out of the saves, decompressions and their bytes out, reallocs of\n\
+    growing buffers, the max_depth of any value, and encoded_types and\n\
+    decoded_types mapping type names to counts, hash keys included.\n\
+\n\
+    :returns: a dict of the counters, or None\n\
+"
+
+#define RESET_STATS_DOC "zero the counters returned by stats()\n\
+"
+
+#define SET_TIMING_DOC "turn timing of dumps and loads on or off\n\
+\n\
+    while it's on, each phase of dumping and loading (encode, compress,\n\
+    decompress and decode) is timed into a histogram for that phase and\n\
+    the payload's uncompressed size, to be read with timings(). it's off\n\
+    to start with, and costs a couple of clock reads a phase when on.\n\
+    each subinterpreter has its own switch and histograms.\n\
+\n\
+    :param bool enabled: whether to time from now on\n\
+\n\
+    :returns: whether timing was on before\n\
+"
+
+#define TIMINGS_DOC "the latency histograms kept since set_timing(True)\n\
+\n\
+    :returns: a dict from each phase ('encode', 'compress', 'decompress'\n\
+        and 'decode') to a dict from payload size ('<64B', '<256B' and\n\
+        so on by fours up to '>=1MB') to the count, total_ns and max_ns\n\
+        of the times recorded, and their p50_ns, p90_ns, p99_ns and\n\
+        p999_ns, which are within 12.5%. sizes with nothing recorded are\n\
+        left out\n\
+"
+
+#define RESET_TIMINGS_DOC "empty the histograms returned by timings()\n\
+"
+
+#define ALLOC_CAPTURE_DOC "collect this thread's calls' allocations\n\
+\n\
+    only present when built with MUMMY_TRACK_ALLOC, and used through\n\
+    mummy.track_allocations().\n\
+\n\
+    :param calls: a list to append a dict for each top-level call to, or\n\
+        None to stop collecting\n\
+\n\
+    :returns: the list that was being collected into, or None\n\
+"
+
+static PyMethodDef methods[] = {
+#if MUMMYPY_FASTCALL
+    {"dumps", (PyCFunction)(void(*)(void))python_dumps,
+        METH_FASTCALL | METH_KEYWORDS, DUMPS_DOC},
+#else
+    {"dumps", (PyCFunction)python_dumps, METH_VARARGS | METH_KEYWORDS,
+        DUMPS_DOC},
+#endif
+    {"loads", (PyCFunction)python_loads, METH_O, LOADS_DOC},
+    {"dumps_into", (PyCFunction)python_dumps_into,
+        METH_VARARGS | METH_KEYWORDS, DUMPS_INTO_DOC},
+    {"dump", (PyCFunction)python_dump, METH_VARARGS | METH_KEYWORDS,
+        DUMP_DOC},
+    {"load", (PyCFunction)python_load, METH_O, LOAD_DOC},
+    {"dump_records", (PyCFunction)python_dump_records,
+        METH_VARARGS | METH_KEYWORDS, DUMP_RECORDS_DOC},
+    {"upgrade", (PyCFunction)python_upgrade,
+        METH_VARARGS | METH_KEYWORDS, UPGRADE_DOC},
+    {"to_json", (PyCFunction)python_to_json, METH_O, TO_JSON_DOC},
+    {"from_json", (PyCFunction)python_from_json,
+        METH_VARARGS | METH_KEYWORDS, FROM_JSON_DOC},
+    {"to_msgpack", (PyCFunction)python_to_msgpack, METH_O, TO_MSGPACK_DOC},
+    {"from_msgpack", (PyCFunction)python_from_msgpack,
+        METH_VARARGS | METH_KEYWORDS, FROM_MSGPACK_DOC},
+    {"profile", (PyCFunction)python_profile, METH_VARARGS | METH_KEYWORDS,
+        PROFILE_DOC},
+    {"stats", (PyCFunction)python_stats, METH_NOARGS, STATS_DOC},
+    {"reset_stats", (PyCFunction)python_reset_stats, METH_NOARGS,
+        RESET_STATS_DOC},
+    {"set_timing", (PyCFunction)python_set_timing,
+        METH_VARARGS | METH_KEYWORDS, SET_TIMING_DOC},
+    {"timings", (PyCFunction)python_timings, METH_NOARGS, TIMINGS_DOC},
+    {"reset_timings", (PyCFunction)python_reset_timings, METH_NOARGS,
+        RESET_TIMINGS_DOC},
+#ifdef MUMMY_TRACK_ALLOC
+    {"_alloc_capture", (PyCFunction)python_alloc_capture, METH_O,
+        ALLOC_CAPTURE_DOC},
+#endif
     {NULL, NULL, 0, NULL}
 };
 
+
+/* import decimal, fractions and datetime at mummy import time */
+static int
+load_state(mummypy_state *state) {
+    PyObject *module;
+
+    PyDateTime_IMPORT;
+    if (!(state->datetime_capi = PyDateTimeAPI)) return -1;
+
+    if (!(module = PyImport_ImportModule("decimal"))) return -1;
+    state->decimal_type = PyObject_GetAttrString(module, "Decimal");
+    Py_DECREF(module);
+    if (!state->decimal_type) return -1;
+
+    if (!(module = PyImport_ImportModule("fractions"))) return -1;
+    state->fraction_type = PyObject_GetAttrString(module, "Fraction");
+    Py_DECREF(module);
+    if (!state->fraction_type) return -1;
+
+    return 0;
+}
+
 #if ISPY3
+static int
+mummy_exec(PyObject *module) {
+    if (load_state(mummypy_get_state(module))) return -1;
+    return mummypy_add_coders(module);
+}
+
+static int
+mummy_traverse(PyObject *module, visitproc visit, void *arg) {
+    mummypy_state *state = mummypy_get_state(module);
+    Py_VISIT(state->decimal_type);
+    Py_VISIT(state->fraction_type);
+    Py_VISIT(state->decoder_type);
+    return 0;
+}
+
+static int
+mummy_clear(PyObject *module) {
+    mummypy_state *state = mummypy_get_state(module);
+    Py_CLEAR(state->decimal_type);
+    Py_CLEAR(state->fraction_type);
+    Py_CLEAR(state->decoder_type);
+    return 0;
+}
+
+static void
+mummy_free(void *module) {
+    mummy_clear((PyObject *)module);
+}
+
+static PyModuleDef_Slot slots[] = {
+    {Py_mod_exec, mummy_exec},
+#ifdef Py_mod_multiple_interpreters
+    {Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED},
+#endif
+#ifdef Py_mod_gil
+    /* module state is written once in mummy_exec and only read afterwards,
+       and every dumps/loads call works in its own mummy_string */
+    {Py_mod_gil, Py_MOD_GIL_NOT_USED},
+#endif
+    {0, NULL}
+};
+
 static struct PyModuleDef _mummymodule = {
     PyModuleDef_HEAD_INIT,
     "_mummy",
     "",
-    -1,
+    sizeof(mummypy_state),
     methods,
-    NULL,
-    NULL,
-    NULL,
-    NULL
+    slots,
+    mummy_traverse,
+    mummy_clear,
+    mummy_free
 };
 
 PyMODINIT_FUNC
 PyInit__mummy(void) {
-    PyObject *mummy_module, *decimal_module, *fractions_module;
-
-    mummy_module = PyModule_Create(&_mummymodule);
-
-    PyDateTime_IMPORT;
-    PyDateTimeCAPI = PyDateTimeAPI;
-
-    decimal_module = PyImport_ImportModule("decimal");
-    PyDecimalType = PyObject_GetAttrString(decimal_module, "Decimal");
-    Py_INCREF(PyDecimalType);
-    Py_DECREF(decimal_module);
-
-    fractions_module = PyImport_ImportModule("fractions");
-    PyFractionType = PyObject_GetAttrString(fractions_module, "Fraction");
-    Py_INCREF(PyFractionType);
-    Py_DECREF(fractions_module);
-
-    return module;
+    return PyModuleDef_Init(&_mummymodule);
 }
 #else
+mummypy_state mummypy_global_state;
+
 PyMODINIT_FUNC
 init_mummy(void) {
-    PyObject *decimal_module, *fractions_module;
-
-    Py_InitModule("_mummy", methods);
-
-    PyDateTime_IMPORT;
-    PyDateTimeCAPI = PyDateTimeAPI;
-
-    decimal_module = PyImport_ImportModule("decimal");
-    PyDecimalType = PyObject_GetAttrString(decimal_module, "Decimal");
-    Py_INCREF(PyDecimalType);
-    Py_DECREF(decimal_module);
+    PyObject *module;
 
-    fractions_module = PyImport_ImportModule("fractions");
-    PyFractionType = PyObject_GetAttrString(fractions_module, "Fraction");
-    Py_INCREF(PyFractionType);
-    Py_DECREF(fractions_module);
+    if (!(module = Py_InitModule("_mummy", methods))) return;
+    if (load_state(&mummypy_global_state)) return;
+    mummypy_add_coders(module);
 }
 #endif
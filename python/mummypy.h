@@ -1,20 +1,202 @@
 #include "Python.h"
-#include "datetime.h"
 #include "mummy.h"
+#include "unaligned.h"
+#include "probes.h"
+#include "alloc.h"
 
 
 #define ISPY3 (PY_MAJOR_VERSION == 3)
 
-#if !ISPY3
+#if ISPY3
+    #define PyInt_CheckExact PyLong_CheckExact
+    #define PyInt_FromLong PyLong_FromLong
+    #define PyInt_FromSsize_t PyLong_FromSsize_t
+    #define PyInt_AsLong PyLong_AsLong
+    #define PyInt_AS_LONG PyLong_AsLong
+    #define PyInt_AsLongLong PyLong_AsLongLong
+    #define PyStr_FromString PyUnicode_FromString
+#else
     #define PyBytes_CheckExact PyString_CheckExact
     #define PyBytes_AS_STRING PyString_AS_STRING
     #define PyBytes_GET_SIZE PyString_GET_SIZE
     #define PyBytes_FromStringAndSize PyString_FromStringAndSize
+    #define _PyBytes_Resize _PyString_Resize
     #define PyInt_AsLongLong PyLong_AsLongLong
+    #define PyStr_FromString PyString_FromString
+#endif
+
+/* dumps takes its arguments with the vectorcall convention where possible */
+#define MUMMYPY_FASTCALL (PY_VERSION_HEX >= 0x03070000)
+
+/* 3.12 can read small ints straight out of the object, and 3.13 replaced
+   the private byte-array conversion with a public one */
+#define MUMMYPY_COMPACT_LONGS (PY_VERSION_HEX >= 0x030C0000)
+
+#if PY_VERSION_HEX >= 0x030D0000
+    #define mummypy_long_as_bytes(obj, buf, size) \
+        (PyLong_AsNativeBytes((obj), (buf), (size), \
+            Py_ASNATIVEBYTES_BIG_ENDIAN) < 0 ? -1 : 0)
+#else
+    #define mummypy_long_as_bytes(obj, buf, size) \
+        _PyLong_AsByteArray((PyLongObject *)(obj), \
+            (unsigned char *)(buf), (size), 0, 1)
+#endif
+
+/* free-threaded builds (3.13+) need containers locked while they're read,
+   everywhere else a critical section is just a block */
+#ifndef Py_BEGIN_CRITICAL_SECTION
+    #define Py_BEGIN_CRITICAL_SECTION(op) {
+    #define Py_END_CRITICAL_SECTION() }
 #endif
 
 #define MUMMYPY_MAX_DEPTH 256
 #define MUMMYPY_STARTING_BUFFER 0x1000
 
+
+/* the phases of a dumps or a loads, each timed into the histogram for the
+   phase and payload size (uncompressed) while mummy.set_timing(True) is in
+   effect */
+enum {
+    mummypy_phase_encode,
+    mummypy_phase_compress,
+    mummypy_phase_decompress,
+    mummypy_phase_decode,
+    MUMMYPY_PHASES
+};
+
+/*
+ * latency histograms for the phases of dumps and loads, one for each phase
+ * and payload size. the buckets are log-linear like HdrHistogram's: exact
+ * below 8ns, then every power of two split 8 ways, so a bucket is never
+ * more than 12.5% wide and percentiles come out within that of the truth.
+ * that runs up to 2**40ns (18 minutes), where everything longer piles up.
+ */
+#define MUMMYPY_SUB_BITS 3
+#define MUMMYPY_SUB_COUNT (1 << MUMMYPY_SUB_BITS)
+#define MUMMYPY_MAX_EXPONENT 40
+#define MUMMYPY_LATENCY_BUCKETS \
+    ((MUMMYPY_MAX_EXPONENT - MUMMYPY_SUB_BITS + 1) * MUMMYPY_SUB_COUNT)
+
+/* payloads of under 64 bytes, under 256 and so on by fours, with the last
+   taking 1MB and up */
+#define MUMMYPY_SIZE_BUCKETS 9
+
+typedef struct {
+    uint64_t count;
+    uint64_t total;
+    uint64_t max;
+    uint64_t buckets[MUMMYPY_LATENCY_BUCKETS];
+} mummypy_histogram;
+
+/* the types mummy needs from other modules, looked up at import time, and
+   the timing histograms. on python 3 this lives in the module object, so
+   every (sub)interpreter that imports _mummy gets its own */
+typedef struct {
+    PyObject *decimal_type;
+    PyObject *fraction_type;
+    PyObject *decoder_type;
+    void *datetime_capi; /* a PyDateTime_CAPI, see datetime.h */
+    int timing;
+    mummypy_histogram histograms[MUMMYPY_PHASES][MUMMYPY_SIZE_BUCKETS];
+} mummypy_state;
+
+#if ISPY3
+    #define mummypy_get_state(module) \
+        ((mummypy_state *)PyModule_GetState(module))
+#else
+    extern mummypy_state mummypy_global_state;
+    #define mummypy_get_state(module) (&mummypy_global_state)
+#endif
+
+/* a small direct-mapped cache of recently decoded short hash keys, so the
+   same key showing up over and over (the keys of a list of records) gets
+   shared rather than allocated every time */
+#define MUMMYPY_KEYCACHE_SIZE 512
+#define MUMMYPY_KEYCACHE_MAXLEN 32
+
+typedef struct {
+    PyObject *obj;
+    int utf8;
+    int len;
+    char data[MUMMYPY_KEYCACHE_MAXLEN];
+} mummypy_cached_key;
+
+/* compression fires the same probes (lib/probes.h) as the library's own,
+   and encoding and decoding fire name__start and name__done(size) through
+   these macros, where `t` is a uint64_t holding when the phase started, or 0
+   when `state` isn't timing */
+uint64_t mummypy_now(void);
+void mummypy_record(mummypy_state *, int, Py_ssize_t, uint64_t);
+
+#define mummypy_phase_start(state, t, name) do {                    \
+        mummy_probe0(name##__start);                                \
+        (t) = (state)->timing ? mummypy_now() : 0;                  \
+    } while (0)
+
+#define mummypy_phase_done(state, t, name, size) do {               \
+        mummy_probe1(name##__done, (size));                         \
+        if (t) mummypy_record(state, mummypy_phase_##name, size, t); \
+    } while (0)
+
+/* allocation counting for mummy.track_allocations(), in a build with
+   MUMMY_TRACK_ALLOC. the library's allocations (and the binding's own
+   mallocs) between mummypy_alloc_enter and mummypy_alloc_leave are recorded
+   under `name` as a call, while a track_allocations block is open on the
+   thread; one made inside another (from a default handler, say) is added
+   to the enclosing one instead */
+typedef struct {
+    mummy_alloc_stats stats;
+    mummy_alloc_stats *outer;
+    int active;
+} mummypy_alloc_call;
+
+#ifdef MUMMY_TRACK_ALLOC
+void mummypy_alloc_enter(mummypy_alloc_call *);
+void mummypy_alloc_leave(mummypy_alloc_call *, const char *);
+#else
+    #define mummypy_alloc_enter(call) ((void)(call))
+    #define mummypy_alloc_leave(call, name) ((void)(call))
+#endif
+
+int dump_one(mummypy_state *, PyObject *, mummy_string *, PyObject *, int);
+int mummypy_compress(mummypy_state *, mummy_string *, char *);
+PyObject *mummypy_result(mummypy_state *, mummy_string *, int);
+Py_ssize_t mummypy_append_result(mummypy_state *, PyObject *, mummy_string *,
+        int);
+PyObject *load_one(mummypy_state *, mummy_string *, mummypy_cached_key *);
+PyObject *mummypy_decode(mummypy_state *, PyObject *, char *, Py_ssize_t);
+mummy_string *mummypy_upgrade(mummy_string *);
+
+PyObject *mummypy_type_module(PyTypeObject *);
+int mummypy_add_coders(PyObject *);
+
+#if ISPY3
+extern PyType_Spec mummypy_records_spec;
+#else
+extern PyTypeObject mummypy_records_type;
+#endif
+
+#if MUMMYPY_FASTCALL
+PyObject *python_dumps(PyObject *, PyObject *const *, Py_ssize_t, PyObject *);
+#else
 PyObject *python_dumps(PyObject *, PyObject *, PyObject *);
+#endif
 PyObject *python_loads(PyObject *, PyObject *);
+PyObject *python_dumps_into(PyObject *, PyObject *, PyObject *);
+PyObject *python_dump(PyObject *, PyObject *, PyObject *);
+PyObject *python_load(PyObject *, PyObject *);
+PyObject *python_dump_records(PyObject *, PyObject *, PyObject *);
+PyObject *python_upgrade(PyObject *, PyObject *, PyObject *);
+PyObject *python_to_json(PyObject *, PyObject *);
+PyObject *python_from_json(PyObject *, PyObject *, PyObject *);
+PyObject *python_to_msgpack(PyObject *, PyObject *);
+PyObject *python_from_msgpack(PyObject *, PyObject *, PyObject *);
+PyObject *python_profile(PyObject *, PyObject *, PyObject *);
+PyObject *python_stats(PyObject *, PyObject *);
+PyObject *python_reset_stats(PyObject *, PyObject *);
+PyObject *python_set_timing(PyObject *, PyObject *, PyObject *);
+PyObject *python_timings(PyObject *, PyObject *);
+PyObject *python_reset_timings(PyObject *, PyObject *);
+#ifdef MUMMY_TRACK_ALLOC
+PyObject *python_alloc_capture(PyObject *, PyObject *);
+#endif
@@ -0,0 +1,150 @@
+#include "mummypy.h"
+
+
+static char *profile_kwargs[] = {"data", "depth", NULL};
+
+/* add one (maybe compressed) payload, or return -1 with an exception set */
+static int
+profile_one(mummy_profile *profile, PyObject *data) {
+    mummy_string *str;
+    Py_buffer view;
+    char free_buf = 0;
+    int rc;
+
+    if (PyObject_GetBuffer(data, &view, PyBUF_SIMPLE)) return -1;
+    str = mummy_string_wrap(view.buf, view.len);
+
+    if ((rc = mummy_string_decompress(str, 0, &free_buf))) {
+        PyErr_Format(PyExc_ValueError, "lzf decompression failed (%d)", rc);
+        mummy_string_free(str, free_buf);
+        PyBuffer_Release(&view);
+        return -1;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    rc = mummy_profile_add(profile, str);
+    Py_END_ALLOW_THREADS
+
+    mummy_string_free(str, free_buf);
+    PyBuffer_Release(&view);
+
+    switch (rc) {
+    case 0:
+        return 0;
+    case ENOMEM:
+        PyErr_NoMemory();
+        break;
+    case -2:
+        PyErr_SetString(PyExc_ValueError, "invalid mummy (unrecognized type)");
+        break;
+    case -3:
+        PyErr_SetString(PyExc_ValueError, "mummy nested too deeply");
+        break;
+    default:
+        PyErr_SetString(PyExc_ValueError, "invalid mummy (incorrect length)");
+    }
+    return -1;
+}
+
+/* paths spell keys out as they are, and cut them short, so they needn't be
+   valid UTF-8 */
+static PyObject *
+path_name(const char *path) {
+#if ISPY3
+    return PyUnicode_DecodeUTF8(path, strlen(path), "replace");
+#else
+    return PyString_FromString(path);
+#endif
+}
+
+static PyObject *
+profile_result(mummy_profile *profile) {
+    PyObject *result, *types, *paths, *item, *path;
+    const char *type;
+    size_t i;
+    int k;
+
+    if (!(types = PyDict_New())) return NULL;
+    for (k = 0; k < MUMMY_PROFILE_TYPES; ++k) {
+        if (!profile->counts[k]) continue;
+        if (!(item = Py_BuildValue("(KK)",
+                        (unsigned PY_LONG_LONG)profile->counts[k],
+                        (unsigned PY_LONG_LONG)profile->sizes[k])) ||
+                PyDict_SetItemString(types, mummy_type_name(k), item)) {
+            Py_XDECREF(item);
+            Py_DECREF(types);
+            return NULL;
+        }
+        Py_DECREF(item);
+    }
+
+    if (!(paths = PyList_New(profile->npaths))) {
+        Py_DECREF(types);
+        return NULL;
+    }
+    for (i = 0; i < profile->npaths; ++i) {
+        mummy_profile_path *p = &profile->paths[i];
+        type = p->type < 0 ? "mixed" : mummy_type_name(p->type);
+        if (!(path = path_name(p->path))) goto fail;
+        item = Py_BuildValue("{s:N,s:s,s:K,s:K,s:K,s:K,s:K}",
+                "path", path,
+                "type", type,
+                "count", (unsigned PY_LONG_LONG)p->count,
+                "items", (unsigned PY_LONG_LONG)p->items,
+                "bytes", (unsigned PY_LONG_LONG)p->bytes,
+                "key_bytes", (unsigned PY_LONG_LONG)p->key_bytes,
+                "compressed", (unsigned PY_LONG_LONG)p->compressed);
+        if (!item) goto fail;
+        PyList_SET_ITEM(paths, i, item);
+    }
+
+    result = Py_BuildValue("{s:K,s:K,s:N,s:K,s:K,s:K,s:K,s:K,s:K,s:N}",
+            "values", (unsigned PY_LONG_LONG)profile->values,
+            "bytes", (unsigned PY_LONG_LONG)profile->bytes,
+            "types", types,
+            "key_count", (unsigned PY_LONG_LONG)profile->key_count,
+            "key_bytes", (unsigned PY_LONG_LONG)profile->key_bytes,
+            "distinct_keys", (unsigned PY_LONG_LONG)profile->distinct_keys,
+            "header_bytes", (unsigned PY_LONG_LONG)profile->header_bytes,
+            "varint_bytes", (unsigned PY_LONG_LONG)profile->varint_bytes,
+            "keytable_bytes", (unsigned PY_LONG_LONG)profile->keytable_bytes,
+            "paths", paths);
+    return result;
+
+fail:
+    Py_DECREF(types);
+    Py_DECREF(paths);
+    return NULL;
+}
+
+PyObject *
+python_profile(PyObject *self, PyObject *args, PyObject *kwargs) {
+    PyObject *data, *iter, *item, *result = NULL;
+    mummy_profile *profile;
+    int depth = 2;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|i:profile",
+                profile_kwargs, &data, &depth))
+        return NULL;
+    if (!(profile = mummy_profile_new(depth))) return PyErr_NoMemory();
+
+    if (PyObject_CheckBuffer(data)) {
+        if (profile_one(profile, data)) goto done;
+    } else {
+        if (!(iter = PyObject_GetIter(data))) goto done;
+        while ((item = PyIter_Next(iter))) {
+            if (profile_one(profile, item)) {
+                Py_DECREF(item);
+                break;
+            }
+            Py_DECREF(item);
+        }
+        Py_DECREF(iter);
+        if (PyErr_Occurred()) goto done;
+    }
+    result = profile_result(profile);
+
+done:
+    mummy_profile_free(profile);
+    return result;
+}
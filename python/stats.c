@@ -0,0 +1,64 @@
+#include "mummypy.h"
+
+
+/* {type name: count} for the types that have been seen */
+static PyObject *
+type_counts(uint64_t *counts) {
+    PyObject *result, *count;
+    int k;
+
+    if (!(result = PyDict_New())) return NULL;
+    for (k = 0; k < MUMMY_STATS_TYPES; ++k) {
+        if (!counts[k]) continue;
+        if (!(count = PyLong_FromUnsignedLongLong(counts[k])) ||
+                PyDict_SetItemString(result, mummy_type_name(k), count)) {
+            Py_XDECREF(count);
+            Py_DECREF(result);
+            return NULL;
+        }
+        Py_DECREF(count);
+    }
+    return result;
+}
+
+PyObject *
+python_stats(PyObject *self, PyObject *noargs) {
+    mummy_stats stats;
+    PyObject *encoded, *decoded;
+
+    if (!mummy_stats_enabled()) Py_RETURN_NONE;
+    mummy_stats_read(&stats);
+
+    if (!(encoded = type_counts(stats.encoded_types))) return NULL;
+    if (!(decoded = type_counts(stats.decoded_types))) {
+        Py_DECREF(encoded);
+        return NULL;
+    }
+
+    return Py_BuildValue(
+            "{s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:N,s:N}",
+            "encodes", (unsigned PY_LONG_LONG)stats.encodes,
+            "encoded_bytes", (unsigned PY_LONG_LONG)stats.encoded_bytes,
+            "decodes", (unsigned PY_LONG_LONG)stats.decodes,
+            "decoded_bytes", (unsigned PY_LONG_LONG)stats.decoded_bytes,
+            "compress_attempts",
+                (unsigned PY_LONG_LONG)stats.compress_attempts,
+            "compress_saves", (unsigned PY_LONG_LONG)stats.compress_saves,
+            "compress_bytes_in",
+                (unsigned PY_LONG_LONG)stats.compress_bytes_in,
+            "compress_bytes_out",
+                (unsigned PY_LONG_LONG)stats.compress_bytes_out,
+            "decompressions", (unsigned PY_LONG_LONG)stats.decompressions,
+            "decompressed_bytes",
+                (unsigned PY_LONG_LONG)stats.decompressed_bytes,
+            "reallocs", (unsigned PY_LONG_LONG)stats.reallocs,
+            "max_depth", (unsigned PY_LONG_LONG)stats.max_depth,
+            "encoded_types", encoded,
+            "decoded_types", decoded);
+}
+
+PyObject *
+python_reset_stats(PyObject *self, PyObject *noargs) {
+    mummy_stats_reset();
+    Py_RETURN_NONE;
+}
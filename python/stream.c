@@ -0,0 +1,727 @@
+#include "mummypy.h"
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/* files are read this much at a time (at least), and dump_records hands its
+   buffer over to the file whenever it has this much */
+#define MUMMYPY_IO_CHUNK 0x10000
+
+
+/*
+ * file objects
+ */
+
+/* the descriptor behind `fp`, -1 if it has to be used through its methods,
+   or -2 with an exception set */
+static int
+file_descriptor(PyObject *fp) {
+    int fd;
+
+#if ISPY3
+    /* text files have a descriptor too, but bytes don't belong in them.
+       their read() and write() will say so */
+    if (PyObject_HasAttrString(fp, "encoding")) return -1;
+#endif
+    if (!PyObject_HasAttrString(fp, "fileno")) return -1;
+
+    if ((fd = PyObject_AsFileDescriptor(fp)) < 0) {
+        /* BytesIO and friends have a fileno() that always fails */
+        if (!PyErr_ExceptionMatches(PyExc_EnvironmentError) &&
+                !PyErr_ExceptionMatches(PyExc_ValueError))
+            return -2;
+        PyErr_Clear();
+        return -1;
+    }
+    return fd;
+}
+
+/* call `method` with a memoryview over C memory, which can't be allowed to
+   outlive the call */
+static PyObject *
+call_with_view(PyObject *method, char *data, Py_ssize_t size, int readonly) {
+    PyObject *view, *result;
+#if ISPY3
+    PyObject *released, *exc, *value, *tb;
+#endif
+    Py_buffer info;
+
+    if (PyBuffer_FillInfo(&info, NULL, data, size, readonly,
+                readonly ? PyBUF_CONTIG_RO : PyBUF_CONTIG))
+        return NULL;
+    if (!(view = PyMemoryView_FromBuffer(&info))) return NULL;
+
+    result = PyObject_CallFunctionObjArgs(method, view, NULL);
+
+#if ISPY3
+    PyErr_Fetch(&exc, &value, &tb);
+    if (!(released = PyObject_CallMethod(view, "release", NULL))) {
+        Py_CLEAR(result);
+        Py_XDECREF(exc);
+        Py_XDECREF(value);
+        Py_XDECREF(tb);
+    } else {
+        Py_DECREF(released);
+        PyErr_Restore(exc, value, tb);
+    }
+#endif
+    Py_DECREF(view);
+    return result;
+}
+
+
+/*
+ * buffered reading
+ */
+
+typedef struct {
+    PyObject *fp;
+    PyObject *read;     /* fp.readinto (or fp.read) when not using fd */
+    int readinto;
+    int fd;
+    int eof;
+    long long pos;      /* offset in the file of data[end] when using fd */
+    char *data;
+    Py_ssize_t start;
+    Py_ssize_t end;
+    Py_ssize_t len;
+} reader;
+
+static int
+reader_init(reader *r, PyObject *fp) {
+    PyObject *pos;
+
+    r->fp = fp;
+    r->read = NULL;
+    r->readinto = 0;
+    r->eof = 0;
+    r->data = NULL;
+    r->start = r->end = r->len = 0;
+
+    if ((r->fd = file_descriptor(fp)) < -1) return -1;
+
+    if (r->fd >= 0) {
+        /* pread() from where the file object says it is, which is past
+           anything it has read ahead. pipes and sockets can't say, and
+           what they've read ahead can only be had from their read() */
+        if ((pos = PyObject_CallMethod(fp, "tell", NULL))) {
+            r->pos = PyLong_AsLongLong(pos);
+            Py_DECREF(pos);
+            if (r->pos == -1 && PyErr_Occurred()) return -1;
+        } else if (PyErr_ExceptionMatches(PyExc_EnvironmentError)) {
+            PyErr_Clear();
+            r->fd = -1;
+        } else {
+            return -1;
+        }
+    }
+
+    if (r->fd < 0) {
+        if ((r->read = PyObject_GetAttrString(fp, "readinto"))) {
+            r->readinto = 1;
+        } else {
+            if (!PyErr_ExceptionMatches(PyExc_AttributeError)) return -1;
+            PyErr_Clear();
+            if (!(r->read = PyObject_GetAttrString(fp, "read"))) return -1;
+        }
+    }
+
+    if (!(r->data = malloc(MUMMYPY_IO_CHUNK))) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    r->len = MUMMYPY_IO_CHUNK;
+    return 0;
+}
+
+static void
+reader_clear(reader *r) {
+    Py_CLEAR(r->read);
+    free(r->data);
+    r->data = NULL;
+    r->start = r->end = r->len = 0;
+}
+
+static int
+reader_reserve(reader *r, Py_ssize_t len) {
+    char *temp;
+
+    if (r->len >= len) return 0;
+    if (!(temp = realloc(r->data, len))) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    r->data = temp;
+    r->len = len;
+    return 0;
+}
+
+static Py_ssize_t
+reader_read(reader *r, char *data, Py_ssize_t size) {
+    PyObject *result;
+    Py_ssize_t got;
+
+    if (r->fd >= 0) {
+        while (1) {
+            Py_BEGIN_ALLOW_THREADS
+            got = pread(r->fd, data, size, (off_t)r->pos);
+            Py_END_ALLOW_THREADS
+            if (got >= 0) break;
+            if (errno != EINTR) {
+                PyErr_SetFromErrno(PyExc_IOError);
+                return -1;
+            }
+            if (PyErr_CheckSignals()) return -1;
+        }
+        r->pos += got;
+        return got;
+    }
+
+    if (r->readinto) {
+        if (!(result = call_with_view(r->read, data, size, 0))) return -1;
+        if (result == Py_None) {
+            Py_DECREF(result);
+            PyErr_SetString(PyExc_IOError, "read would block");
+            return -1;
+        }
+        got = PyNumber_AsSsize_t(result, PyExc_OverflowError);
+        Py_DECREF(result);
+        if (got == -1 && PyErr_Occurred()) return -1;
+    } else {
+        if (!(result = PyObject_CallFunction(r->read, "n", size))) return -1;
+        if (!PyBytes_Check(result)) {
+            Py_DECREF(result);
+            PyErr_SetString(PyExc_TypeError, "file must return bytes");
+            return -1;
+        }
+        got = PyBytes_GET_SIZE(result);
+        if (got <= size) memcpy(data, PyBytes_AS_STRING(result), got);
+        Py_DECREF(result);
+    }
+
+    if (got < 0 || got > size) {
+        PyErr_SetString(PyExc_ValueError, "file read an invalid length");
+        return -1;
+    }
+    return got;
+}
+
+/* get at least `need` bytes buffered past r->start. returns 1 if the file
+   ends first */
+static int
+reader_fill(reader *r, Py_ssize_t need) {
+    Py_ssize_t got;
+
+    while (r->end - r->start < need) {
+        if (r->eof) return 1;
+
+        if (r->start) {
+            memmove(r->data, r->data + r->start, r->end - r->start);
+            r->end -= r->start;
+            r->start = 0;
+        }
+
+        /* grow by doubling rather than straight to `need`, so a corrupt
+           length runs into the end of the file before it runs out of
+           memory */
+        if (r->end == r->len && reader_reserve(r, r->len * 2)) return -1;
+
+        if ((got = reader_read(r, r->data + r->end, r->len - r->end)) < 0)
+            return -1;
+        if (!got) r->eof = 1;
+        r->end += got;
+    }
+    return 0;
+}
+
+/* bring the file object's position up to what has been consumed. reading
+   through its methods can't be undone, so that's already as good as it
+   gets */
+static int
+reader_sync(reader *r) {
+    PyObject *result;
+
+    if (r->fd < 0) return 0;
+    if (!(result = PyObject_CallMethod(r->fp, "seek", "L",
+                    r->pos - (r->end - r->start))))
+        return -1;
+    Py_DECREF(result);
+    return 0;
+}
+
+
+/*
+ * buffered writing
+ */
+
+typedef struct {
+    PyObject *fp;
+    PyObject *write;    /* fp.write when not using fd */
+    int fd;
+} writer;
+
+static int
+writer_init(writer *w, PyObject *fp) {
+    PyObject *result;
+
+    w->fp = fp;
+    w->write = NULL;
+
+    if ((w->fd = file_descriptor(fp)) < -1) return -1;
+
+    if (w->fd >= 0) {
+        /* whatever the file object has buffered goes first */
+        if (!(result = PyObject_CallMethod(fp, "flush", NULL))) return -1;
+        Py_DECREF(result);
+        return 0;
+    }
+
+    return (w->write = PyObject_GetAttrString(fp, "write")) ? 0 : -1;
+}
+
+static void
+writer_clear(writer *w) {
+    Py_CLEAR(w->write);
+}
+
+static int
+writer_write(writer *w, char *data, Py_ssize_t size) {
+    PyObject *result;
+    Py_ssize_t done;
+
+    while (size) {
+        if (w->fd >= 0) {
+            Py_BEGIN_ALLOW_THREADS
+            done = write(w->fd, data, size);
+            Py_END_ALLOW_THREADS
+            if (done < 0) {
+                if (errno != EINTR) {
+                    PyErr_SetFromErrno(PyExc_IOError);
+                    return -1;
+                }
+                if (PyErr_CheckSignals()) return -1;
+                continue;
+            }
+        } else {
+#if ISPY3
+            result = call_with_view(w->write, data, size, 1);
+#else
+            /* python 2 file-alikes (StringIO for one) want a str */
+            result = PyObject_CallFunction(w->write, "s#", data, (int)size);
+#endif
+            if (!result) return -1;
+
+            /* raw files can write less than they're given, and python 2
+               files (and lots of file-alikes) return None */
+            if (result == Py_None) {
+                done = size;
+            } else {
+                done = PyNumber_AsSsize_t(result, PyExc_OverflowError);
+                if (done == -1 && PyErr_Occurred()) {
+                    Py_DECREF(result);
+                    return -1;
+                }
+            }
+            Py_DECREF(result);
+
+            if (done <= 0 || done > size) {
+                PyErr_SetString(PyExc_ValueError,
+                        "file wrote an invalid length");
+                return -1;
+            }
+        }
+        data += done;
+        size -= done;
+    }
+    return 0;
+}
+
+/* catch the file object up with what went to its descriptor behind its
+   back. pipes and sockets have no position to catch up */
+static int
+writer_sync(writer *w) {
+    PyObject *result;
+
+    if (w->fd < 0) return 0;
+    if ((result = PyObject_CallMethod(w->fp, "seek", "ii", 0, SEEK_CUR))) {
+        Py_DECREF(result);
+        return 0;
+    }
+    if (!PyErr_ExceptionMatches(PyExc_EnvironmentError)) return -1;
+    PyErr_Clear();
+    return 0;
+}
+
+
+/*
+ * dump, load and dump_records
+ */
+
+static int
+makespace(mummy_string *str, int size) {
+    mummy_string_makespace(str, size);
+    return 0;
+}
+
+static int
+check_default(PyObject *default_handler) {
+    if (default_handler != Py_None && !PyCallable_Check(default_handler)) {
+        PyErr_SetString(PyExc_TypeError, "default must be callable or None");
+        return -1;
+    }
+    return 0;
+}
+
+static char *dump_kwargs[] = {"object", "fp", "default", "compress", NULL};
+
+PyObject *
+python_dump(PyObject *self, PyObject *args, PyObject *kwargs) {
+    PyObject *obj, *fp, *default_handler = Py_None, *compress = Py_True;
+    mummypy_state *state = mummypy_get_state(self);
+    mummypy_alloc_call call;
+    mummy_string *str;
+    writer w;
+    char *data, *output = NULL;
+    int size, do_compress, rc = -1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|OO:dump", dump_kwargs,
+                &obj, &fp, &default_handler, &compress))
+        return NULL;
+
+    if (check_default(default_handler)) return NULL;
+    if ((do_compress = PyObject_IsTrue(compress)) < 0) return NULL;
+
+    mummypy_alloc_enter(&call);
+    if (!(str = mummy_string_new(MUMMYPY_STARTING_BUFFER))) {
+        mummypy_alloc_leave(&call, "dump");
+        return PyErr_NoMemory();
+    }
+
+    if (dump_one(state, obj, str, default_handler, 1))
+        goto done;
+
+    data = str->data;
+    size = str->offset;
+    if (do_compress && str->offset > 6) {
+        if (!(output = malloc(str->offset - 1))) {
+            PyErr_NoMemory();
+            goto done;
+        }
+        if ((size = mummypy_compress(state, str, output)))
+            data = output;
+        else
+            size = str->offset;
+    }
+
+    if (!writer_init(&w, fp) && !writer_write(&w, data, size) &&
+            !writer_sync(&w))
+        rc = 0;
+    writer_clear(&w);
+
+done:
+    free(output);
+    mummy_string_free(str, 1);
+    mummypy_alloc_leave(&call, "dump");
+    if (rc) return NULL;
+    Py_RETURN_NONE;
+}
+
+PyObject *
+python_load(PyObject *self, PyObject *fp) {
+    mummypy_alloc_call call;
+    PyObject *result = NULL;
+    struct stat st;
+    reader r;
+    int rc;
+
+    mummypy_alloc_enter(&call);
+    if (reader_init(&r, fp)) goto done;
+
+    /* for a regular file, size the buffer so it comes in with one read */
+    if (r.fd >= 0 && !fstat(r.fd, &st) && S_ISREG(st.st_mode) &&
+            st.st_size > r.pos && reader_reserve(&r, st.st_size - r.pos + 1))
+        goto done;
+
+    /* a compressed mummy doesn't know its own length, so it's everything up
+       to the end of the file */
+    while (!(rc = reader_fill(&r, r.end - r.start + 1)));
+    if (rc < 0) goto done;
+
+    if ((result = mummypy_decode(mummypy_get_state(self), NULL,
+                    r.data + r.start, r.end - r.start))) {
+        r.start = r.end;
+        if (reader_sync(&r)) Py_CLEAR(result);
+    }
+
+done:
+    reader_clear(&r);
+    mummypy_alloc_leave(&call, "load");
+    return result;
+}
+
+static char *dump_records_kwargs[] = {
+    "iterable", "fp", "default", "compress", NULL};
+
+PyObject *
+python_dump_records(PyObject *self, PyObject *args, PyObject *kwargs) {
+    PyObject *iterable, *fp, *default_handler = Py_None, *compress = Py_True;
+    PyObject *iter, *item;
+    mummypy_state *state = mummypy_get_state(self);
+    mummypy_alloc_call call;
+    mummy_string *str = NULL, *out = NULL;
+    writer w;
+    char *frame;
+    int size, do_compress, rc = -1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|OO:dump_records",
+                dump_records_kwargs, &iterable, &fp, &default_handler,
+                &compress))
+        return NULL;
+
+    if (check_default(default_handler)) return NULL;
+    if ((do_compress = PyObject_IsTrue(compress)) < 0) return NULL;
+    if (!(iter = PyObject_GetIter(iterable))) return NULL;
+
+    mummypy_alloc_enter(&call);
+    if (writer_init(&w, fp)) goto done;
+
+    if (!(str = mummy_string_new(MUMMYPY_STARTING_BUFFER)) ||
+            !(out = mummy_string_new(MUMMYPY_IO_CHUNK))) {
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    while ((item = PyIter_Next(iter))) {
+        str->offset = 0;
+        rc = dump_one(state, item, str, default_handler, 1);
+        Py_DECREF(item);
+        if (rc) goto done;
+        rc = -1;
+
+        /* each record is its length as 4 big-endian bytes, then the
+           (possibly compressed) mummy, which is never longer than the
+           uncompressed one */
+        if (makespace(out, str->offset + 4)) {
+            PyErr_NoMemory();
+            goto done;
+        }
+        frame = out->data + out->offset;
+        if (!do_compress ||
+                !(size = mummypy_compress(state, str, frame + 4))) {
+            memcpy(frame + 4, str->data, str->offset);
+            size = str->offset;
+        }
+        mummy_pack32(frame, size);
+        out->offset += size + 4;
+
+        if (out->offset >= MUMMYPY_IO_CHUNK) {
+            if (writer_write(&w, out->data, out->offset)) goto done;
+            out->offset = 0;
+        }
+    }
+    if (PyErr_Occurred()) goto done;
+
+    if (!writer_write(&w, out->data, out->offset) && !writer_sync(&w))
+        rc = 0;
+
+done:
+    Py_DECREF(iter);
+    writer_clear(&w);
+    if (str) mummy_string_free(str, 1);
+    if (out) mummy_string_free(out, 1);
+    mummypy_alloc_leave(&call, "dump_records");
+    if (rc) return NULL;
+    Py_RETURN_NONE;
+}
+
+
+/*
+ * iter_records
+ */
+
+typedef struct {
+    PyObject_HEAD
+    PyObject *module;
+    PyObject *fp;
+    PyObject *decoder;
+    reader r;
+    int busy;
+    int done;
+} mummypy_records;
+
+static char *records_kwargs[] = {"fp", "cache_keys", NULL};
+
+static PyObject *
+records_new(PyTypeObject *type, PyObject *args, PyObject *kwargs) {
+    mummypy_records *self;
+    PyObject *fp, *cache_keys = Py_True, *module;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|O:iter_records",
+                records_kwargs, &fp, &cache_keys))
+        return NULL;
+
+    if (!(module = mummypy_type_module(type))) return NULL;
+
+    if (!(self = (mummypy_records *)type->tp_alloc(type, 0))) return NULL;
+    Py_INCREF(module);
+    self->module = module;
+    Py_INCREF(fp);
+    self->fp = fp;
+    self->busy = 0;
+    self->done = 0;
+
+    if (!(self->decoder = PyObject_CallFunctionObjArgs(
+                    mummypy_get_state(module)->decoder_type, cache_keys,
+                    NULL)) ||
+            reader_init(&self->r, fp)) {
+        Py_DECREF(self);
+        return NULL;
+    }
+    return (PyObject *)self;
+}
+
+static int
+records_traverse(mummypy_records *self, visitproc visit, void *arg) {
+    Py_VISIT(self->module);
+    Py_VISIT(self->fp);
+    Py_VISIT(self->decoder);
+    Py_VISIT(self->r.read);
+    return 0;
+}
+
+static int
+records_clear(mummypy_records *self) {
+    Py_CLEAR(self->module);
+    Py_CLEAR(self->fp);
+    Py_CLEAR(self->decoder);
+    Py_CLEAR(self->r.read);
+    return 0;
+}
+
+static void
+records_dealloc(mummypy_records *self) {
+    PyTypeObject *type = Py_TYPE(self);
+    PyObject *exc, *value, *tb;
+
+    PyObject_GC_UnTrack(self);
+
+    /* an iterator that's dropped early still leaves the file just past the
+       last record it produced */
+    if (!self->done && self->fp && self->r.data) {
+        PyErr_Fetch(&exc, &value, &tb);
+        if (reader_sync(&self->r)) PyErr_Clear();
+        PyErr_Restore(exc, value, tb);
+    }
+
+    records_clear(self);
+    reader_clear(&self->r);
+    type->tp_free((PyObject *)self);
+#if ISPY3
+    Py_DECREF(type);
+#endif
+}
+
+/* stop at the end of the file, leaving it just past the last record */
+static void
+records_finish(mummypy_records *self) {
+    self->done = 1;
+    reader_sync(&self->r);
+    reader_clear(&self->r);
+}
+
+static PyObject *
+records_next(mummypy_records *self) {
+    PyObject *result = NULL;
+    uint32_t size;
+    int rc;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+
+    if (self->busy) {
+        PyErr_SetString(PyExc_ValueError, "iter_records already executing");
+    } else if (!self->done) {
+        self->busy = 1;
+
+        if ((rc = reader_fill(&self->r, 4)) > 0 &&
+                self->r.end == self->r.start) {
+            records_finish(self);
+            goto done;
+        }
+        if (!rc) {
+            size = mummy_unpack32(self->r.data + self->r.start);
+            rc = reader_fill(&self->r, (Py_ssize_t)size + 4);
+        }
+        if (rc > 0) {
+            records_finish(self);
+            if (!PyErr_Occurred())
+                PyErr_SetString(PyExc_ValueError,
+                        "invalid mummy record (truncated)");
+            goto done;
+        }
+        if (rc) goto done;
+
+        /* a record that fails to decode is still consumed, so iteration
+           can carry on with the next one */
+        result = mummypy_decode(mummypy_get_state(self->module),
+                self->decoder, self->r.data + self->r.start + 4, size);
+        self->r.start += size + 4;
+
+done:
+        self->busy = 0;
+    }
+
+    Py_END_CRITICAL_SECTION();
+    return result;
+}
+
+#define RECORDS_DOC "iter_records(fp, cache_keys=True)\n\
+\n\
+iterate over the records in a file written by dump_records\n\
+\n\
+the file is read through a buffer, straight from its file descriptor if it\n\
+has one and can tell() its position. once the iterator is exhausted (or\n\
+dropped) the file's position is just past the last record produced. pipes\n\
+and objects without a file descriptor are read through their own readinto()\n\
+or read() methods, and anything buffered past that last record is lost.\n\
+\n\
+    :param file fp: a file opened for reading in binary mode\n\
+    :param bool cache_keys:\n\
+        whether to share short string hash keys between decoded records\n\
+        (default True)\n\
+"
+
+#if ISPY3
+static PyType_Slot records_slots[] = {
+    {Py_tp_new, records_new},
+    {Py_tp_dealloc, records_dealloc},
+    {Py_tp_traverse, records_traverse},
+    {Py_tp_clear, records_clear},
+    {Py_tp_iter, PyObject_SelfIter},
+    {Py_tp_iternext, records_next},
+    {Py_tp_doc, RECORDS_DOC},
+    {0, NULL}
+};
+
+PyType_Spec mummypy_records_spec = {
+    "_mummy.iter_records",
+    sizeof(mummypy_records),
+    0,
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,
+    records_slots
+};
+#else
+PyTypeObject mummypy_records_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "_mummy.iter_records",
+    .tp_basicsize = sizeof(mummypy_records),
+    .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,
+    .tp_doc = RECORDS_DOC,
+    .tp_new = records_new,
+    .tp_dealloc = (destructor)records_dealloc,
+    .tp_traverse = (traverseproc)records_traverse,
+    .tp_clear = (inquiry)records_clear,
+    .tp_iter = PyObject_SelfIter,
+    .tp_iternext = (iternextfunc)records_next,
+};
+#endif
@@ -2,6 +2,10 @@
 
 import datetime
 import decimal
+import io
+import json
+import os
+import struct
 try:
     import fractions
 except ImportError:
@@ -9,10 +13,20 @@ except ImportError:
 from random import randrange
 import string
 import sys
+import tempfile
+import threading
 import unittest
 
 import mummy as newmummy
 import oldmummy
+try:
+    from mummy import cffi_serialization
+except ImportError:
+    cffi_serialization = None
+try:
+    from mummy import django_cache, django_serialization
+except ImportError:
+    django_cache = django_serialization = None
 
 
 if sys.version_info[0] >= 3:
@@ -62,15 +76,13 @@ class BasicMummyTests(unittest.TestCase):
         finished = self.mummy.pure_python_loads(encoded)
 
         if isinstance(val, decimal.Decimal) and val.is_nan():
-            self.assert_(isinstance(finished, decimal.Decimal) and
+            self.assertTrue(isinstance(finished, decimal.Decimal) and
                     finished.is_nan(), finished)
         else:
             self.assertEqual(val, finished)
 
     def backwards_compatible(self, val):
-        print "new", self
         new_enc = newmummy.dumps(val)
-        print "old", self
         old_enc = oldmummy.dumps(val)
 
         # they serialize to the same string
@@ -172,13 +184,9 @@ generate({
 
     'StringList': list(bytify(string.ascii_letters)),
     'CharList': list(range(-128, 128)),
-    # broken due to a python deserializer bug (containers of huges only)
-    #'HugeList': [randrange(1 << 64, 1 << 3000) for i in range(30)],
 
     'StringTuple': tuple(bytify(string.ascii_letters)),
     'CharTuple': tuple(list(range(-128, 128))),
-    # probably the same python deserializer bug as HugeList
-    #'HugeTuple': tuple(randrange(1 << 64, 1 << 3000) for i in range(30)),
 
     'DateToday': datetime.date.today(),
     'TimeNow': datetime.datetime.now().time(),
@@ -196,13 +204,60 @@ generate({
     'DecimalNegativeEven': decimal.Decimal('-1106.1984'),
 })
 
+# containers of huges trip up oldmummy's python deserializer, so these only
+# run against the current implementation
+for title, target in iteritems({
+        'HugeList': [randrange(1 << 64, 1 << 3000) for i in range(30)],
+        'HugeTuple': tuple(randrange(1 << 64, 1 << 3000) for i in range(30))}):
+    globals()[title + 'Test'] = _make_test(
+            title, target, False, BasicMummyTests)
+
 
 class ExtensionExistsTest(unittest.TestCase):
     def runTest(self):
-        assert oldmummy.has_extension
+        # oldmummy's extension is only built for python 2
+        if sys.version_info[0] < 3:
+            assert oldmummy.has_extension
         assert newmummy.has_extension
 
 
+class CffiSerializationTest(BasicMummyTests):
+    def setUp(self):
+        if cffi_serialization is None:
+            self.skipTest("the cffi binding isn't built")
+
+    def test_encoding_reference(self):
+        for target in tests.values():
+            self.assertEqual(
+                    cffi_serialization.cffi_dumps(target, compress=False),
+                    newmummy.pure_python_dumps(target, compress=False))
+
+    def test_roundtrip(self):
+        for target in tests.values():
+            self.assertEqual(target, cffi_serialization.cffi_loads(
+                cffi_serialization.cffi_dumps(target)))
+
+    def test_tokens(self):
+        data = newmummy.pure_python_dumps(
+                {bytify('a'): [1, unicodify('b')]}, compress=False)
+        self.assertEqual(list(cffi_serialization.tokens(data)), [
+            (newmummy.serialization.MUMMY_TYPE_SHORTHASH, 1),
+            (newmummy.serialization.MUMMY_TYPE_SHORTSTR, bytify('a')),
+            (newmummy.serialization.MUMMY_TYPE_SHORTLIST, 2),
+            (newmummy.serialization.MUMMY_TYPE_CHAR, 1),
+            (newmummy.serialization.MUMMY_TYPE_SHORTUTF8, bytify('b'))])
+
+    def test_truncated(self):
+        data = newmummy.pure_python_dumps([1, 2, 3], compress=False)
+        self.assertRaises(ValueError, cffi_serialization.cffi_loads, data[:-1])
+
+    def test_upgrade(self):
+        legacy = struct.pack("!BBhH", 0x1E, 2, -4, 7) + bytes(
+                bytearray([0x10, 0x61, 0x98, 0x40]))
+        self.assertEqual(cffi_serialization.cffi_upgrade(legacy),
+                newmummy.dumps(decimal.Decimal('-106.1984')))
+
+
 class RecursionDepthTest(unittest.TestCase):
     mummy = newmummy
 
@@ -260,5 +315,822 @@ class OldMummyDefaultFormatterTest(DefaultFormatter, OldMummyTests):
     pass
 
 
+class CoderTest(unittest.TestCase):
+    records = [{unicodify('name'): unicodify('foo'), bytify('count'): i,
+        unicodify('x') * 40: [i]} for i in range(50)]
+
+    def test_matches_dumps(self):
+        encoder = newmummy.Encoder()
+        for target in tests.values():
+            self.assertEqual(encoder.encode(target), newmummy.dumps(target))
+
+    def test_config(self):
+        encoder = newmummy.Encoder(default=repr, compress=False)
+        self.assertEqual(encoder.encode(self.records),
+                newmummy.dumps(self.records, compress=False))
+        self.assertEqual(encoder.encode(object),
+                newmummy.dumps(repr(object)))
+        self.assertRaises(TypeError, newmummy.Encoder, default=5)
+
+    def test_compress_truth_error(self):
+        class Unsure(object):
+            def __bool__(self):
+                raise ZeroDivisionError()
+            __nonzero__ = __bool__
+        self.assertRaises(ZeroDivisionError, newmummy.dumps, [1],
+                compress=Unsure())
+        self.assertRaises(ZeroDivisionError, newmummy.Encoder,
+                compress=Unsure())
+
+    def test_reentrant_default(self):
+        inner = []
+        def default(o):
+            inner.append(encoder.encode([1, 2, 3]))
+            return 'placeholder'
+        encoder = newmummy.Encoder(default=default)
+        self.assertEqual(encoder.encode([object()]),
+                newmummy.dumps(['placeholder']))
+        self.assertEqual(inner, [newmummy.dumps([1, 2, 3])])
+
+    def test_decode(self):
+        decoder = newmummy.Decoder()
+        for compress in (True, False):
+            data = newmummy.dumps(self.records, compress=compress)
+            self.assertEqual(decoder.decode(data), self.records)
+            self.assertEqual(decoder.decode(data), self.records)
+
+    def test_shared_keys(self):
+        decoder = newmummy.Decoder()
+        a, b = decoder.decode(newmummy.dumps(self.records[:2]))
+        ka = sorted(a, key=repr)
+        kb = sorted(b, key=repr)
+        self.assertTrue(all(x is y for x, y in zip(ka, kb)
+            if len(x) <= 32))
+
+    def test_no_key_cache(self):
+        decoder = newmummy.Decoder(cache_keys=False)
+        self.assertEqual(decoder.decode(newmummy.dumps(self.records)),
+                self.records)
+
+    def test_threshold(self):
+        small, big = self.records[:2], self.records
+        encoder = newmummy.Encoder(threshold=len(newmummy.dumps(
+            big, compress=False)))
+        self.assertEqual(encoder.threshold, len(newmummy.dumps(
+            big, compress=False)))
+        self.assertEqual(encoder.encode(small),
+                newmummy.dumps(small, compress=False))
+        self.assertEqual(encoder.encode(big), newmummy.dumps(big))
+
+    def test_many(self):
+        encoder = newmummy.Encoder()
+        encoded = encoder.encode_many(iter(self.records))
+        self.assertEqual(encoded, [newmummy.dumps(r) for r in self.records])
+        self.assertEqual(newmummy.Decoder().decode_many(encoded),
+                self.records)
+        self.assertRaises(TypeError, encoder.encode_many, [1, object()])
+
+    def test_into(self):
+        buffer = bytearray(bytify('head'))
+        size = newmummy.dumps_into(buffer, self.records)
+        self.assertEqual(bytes(buffer[4:]), newmummy.dumps(self.records))
+        self.assertEqual(size, len(buffer) - 4)
+
+        size = newmummy.Encoder(compress=False).encode_into(buffer, [1, 2])
+        self.assertEqual(bytes(buffer[-size:]),
+                newmummy.dumps([1, 2], compress=False))
+
+    def test_buffers(self):
+        data = newmummy.dumps(self.records)
+        decoder = newmummy.Decoder()
+        for wrapped in (bytearray(data), memoryview(data)):
+            self.assertEqual(newmummy.loads(wrapped), self.records)
+            self.assertEqual(decoder.decode(wrapped), self.records)
+
+    def test_invalid(self):
+        decoder = newmummy.Decoder()
+        data = newmummy.dumps(self.records)
+        self.assertRaises(ValueError, decoder.decode, data[:-3])
+        self.assertRaises(ValueError, decoder.decode, data[:3])
+        self.assertRaises(TypeError, decoder.decode, None)
+        # a compressed size too big to allocate for
+        bad = b'\x86\xff\xff\xff\xfe\x1f' + b'z' * 32
+        self.assertRaises(ValueError, decoder.decode, bad)
+        self.assertRaises(ValueError, newmummy.loads, bad)
+        # a compressed header and nothing after it
+        bad = b'\x88\x00\x00\x00\x01'
+        self.assertRaises(ValueError, decoder.decode, bad)
+        self.assertRaises(ValueError, newmummy.loads, bad)
+        self.assertEqual(decoder.decode(data), self.records)
+
+
+class FileTest(unittest.TestCase):
+    records = [{unicodify('name'): unicodify('foo'), bytify('count'): i,
+        bytify('blob'): bytify('x') * (i * 1000)} for i in range(100)]
+
+    def setUp(self):
+        self.file = tempfile.TemporaryFile()
+
+    def tearDown(self):
+        self.file.close()
+
+    def test_dump_load(self):
+        self.file.write(bytify('head'))
+        newmummy.dump(self.records, self.file)
+        self.assertEqual(self.file.tell(),
+                4 + len(newmummy.dumps(self.records)))
+        self.file.seek(4)
+        self.assertEqual(newmummy.load(self.file), self.records)
+        self.assertEqual(self.file.read(), bytify(''))
+
+    def test_uncompressed(self):
+        newmummy.dump(self.records, self.file, compress=False)
+        self.file.seek(0)
+        self.assertEqual(self.file.read(),
+                newmummy.dumps(self.records, compress=False))
+
+    def test_bytesio(self):
+        stream = io.BytesIO()
+        newmummy.dump(self.records, stream)
+        self.assertEqual(stream.getvalue(), newmummy.dumps(self.records))
+        stream.seek(0)
+        self.assertEqual(newmummy.load(stream), self.records)
+
+    def test_records(self):
+        newmummy.dump_records(self.records, self.file)
+        self.file.seek(0)
+        self.assertEqual(list(newmummy.iter_records(self.file)),
+                self.records)
+
+        stream = io.BytesIO()
+        newmummy.dump_records(iter(self.records), stream, compress=False)
+        stream.seek(0)
+        self.assertEqual(list(newmummy.iter_records(stream)), self.records)
+
+    def test_records_position(self):
+        newmummy.dump_records(self.records, self.file)
+        self.file.seek(0)
+        records = newmummy.iter_records(self.file)
+        first = [next(records) for i in range(10)]
+        del records
+
+        self.assertEqual(first, self.records[:10])
+        self.assertEqual(self.file.tell(), sum(4 + len(newmummy.dumps(r))
+            for r in self.records[:10]))
+        self.assertEqual(list(newmummy.iter_records(self.file)),
+                self.records[10:])
+
+    def test_big_records(self):
+        blobs = [os.urandom(300000) for i in range(3)]
+        newmummy.dump_records(blobs, self.file)
+        self.file.seek(0)
+        self.assertEqual(list(newmummy.iter_records(self.file)), blobs)
+
+    def test_pipe(self):
+        rfd, wfd = os.pipe()
+        reading, writing = os.fdopen(rfd, 'rb'), os.fdopen(wfd, 'wb')
+
+        # written from another thread, as the records needn't fit in the
+        # pipe's buffer (uncompressed, they don't)
+        def write():
+            try:
+                newmummy.dump_records(self.records[:20], writing)
+            finally:
+                writing.close()
+        writer = threading.Thread(target=write)
+        writer.start()
+        try:
+            self.assertEqual(list(newmummy.iter_records(reading)),
+                    self.records[:20])
+        finally:
+            reading.close()
+            writer.join()
+
+    def test_truncated(self):
+        newmummy.dump_records(self.records[:3], self.file)
+        self.file.truncate(self.file.tell() - 2)
+        self.file.seek(0)
+        records = newmummy.iter_records(self.file)
+        self.assertEqual([next(records), next(records)], self.records[:2])
+        self.assertRaises(ValueError, next, records)
+
+
+class LegacyTest(unittest.TestCase):
+    decimals = [decimal.Decimal(d) for d in ('NaN', 'sNaN', 'Infinity',
+        '-Infinity', '106.1984', '-106.1984', '1106.1984', '-1106.1984',
+        '10', '0')]
+
+    def legacy(self, value):
+        # a decimal laid out the way oldmummy wrote them
+        sign, digits, expo = value.as_tuple()
+        if value.is_infinite():
+            return struct.pack("!BB", 0x1E, 5 | sign << 1)
+        if value.is_nan():
+            return struct.pack("!BB", 0x1E, value.is_snan() and 9 or 1)
+        pairs = bytearray((len(digits) + 1) >> 1)
+        for i, digit in enumerate(digits):
+            pairs[i >> 1] |= digit if i & 1 else digit << 4
+        return struct.pack("!BBhH", 0x1E, sign << 1, expo,
+                len(digits)) + bytes(pairs)
+
+    def legacy_list(self):
+        return (struct.pack("!BB", 0x10, len(self.decimals) + 1) +
+                bytify('').join(map(self.legacy, self.decimals)) +
+                newmummy.dumps(unicodify('end'), compress=False))
+
+    def assertDecimals(self, values):
+        self.assertEqual(len(values), len(self.decimals))
+        for value, expected in zip(values, self.decimals):
+            self.assertEqual(str(value), str(expected))
+
+    def test_upgrade(self):
+        for upgrade in (newmummy.upgrade, newmummy.pure_python_upgrade):
+            for value in self.decimals:
+                self.assertEqual(upgrade(self.legacy(value)),
+                        newmummy.dumps(value))
+
+            data = upgrade(self.legacy_list(), compress=False)
+            self.assertEqual(data, newmummy.dumps(
+                self.decimals + [unicodify('end')], compress=False))
+
+    def test_unchanged(self):
+        # without decimals the formats agree, compressed or not
+        value = [unicodify('foo'), 1.5, None] * 100
+        data = newmummy.dumps(value, compress=False)
+        for upgrade in (newmummy.upgrade, newmummy.pure_python_upgrade):
+            self.assertEqual(upgrade(data, compress=False), data)
+
+        data = newmummy.dumps(value)
+        self.assertTrue(ord(data[:1]) & 0x80)
+        self.assertEqual(newmummy.upgrade(data), data)
+        self.assertEqual(newmummy.Decoder(legacy=True).decode(data),
+                newmummy.loads(data))
+
+    def test_decoder(self):
+        decoder = newmummy.Decoder(legacy=True)
+        values = decoder.decode(self.legacy_list())
+        self.assertEqual(values[-1], unicodify('end'))
+        self.assertDecimals(values[:-1])
+
+        data = newmummy.dumps({bytify('key'): list(range(100))})
+        self.assertEqual(decoder.decode_many([data, data]),
+                [{bytify('key'): list(range(100))}] * 2)
+
+    def test_iter_upgraded(self):
+        upgraded = newmummy.iter_upgraded(
+                map(self.legacy, self.decimals), compress=False)
+        self.assertEqual(next(upgraded),
+                newmummy.dumps(self.decimals[0], compress=False))
+        self.assertDecimals([self.decimals[0]] +
+                [newmummy.loads(data) for data in upgraded])
+
+    def test_oldmummy(self):
+        for title, target in iteritems(tests):
+            try:
+                legacy = oldmummy.dumps(target)
+            except Exception:
+                self.skipTest("oldmummy can't dump on this python")
+            self.assertEqual(newmummy.upgrade(legacy), newmummy.dumps(target))
+
+    def test_invalid(self):
+        for upgrade in (newmummy.upgrade, newmummy.pure_python_upgrade):
+            self.assertRaises(ValueError, upgrade, self.legacy_list()[:-2])
+            self.assertRaises(ValueError, upgrade, bytify('\x7f'))
+            self.assertRaises(ValueError, upgrade, self.legacy(
+                decimal.Decimal('1.5'))[:-1])
+
+
+class TranscodeTest(unittest.TestCase):
+    plain = {unicodify('ints'): [0, -1, 300, -2 ** 40, 2 ** 70],
+            unicodify('floats'): [0.1, -2.5, 1e22, 1e-05],
+            unicodify('text'): unicodify('x"y\n\x01 caf\xc3\xa9'),
+            unicodify('atoms'): [None, True, False],
+            unicodify('nested'): {unicodify('a'): [[], {}]}}
+
+    def json(self, value):
+        text = json.dumps(value, separators=(',', ':'), ensure_ascii=False)
+        return text if isinstance(text, bytes) else text.encode('utf8')
+
+    def test_to_json(self):
+        data = newmummy.dumps(self.plain)
+        for to_json in (newmummy.to_json, newmummy.pure_python_to_json):
+            self.assertEqual(json.loads(to_json(data).decode('utf8')),
+                    self.plain)
+        for value in self.plain.values():
+            self.assertEqual(newmummy.to_json(newmummy.dumps(value)),
+                    self.json(value))
+
+    def test_to_json_types(self):
+        value = [datetime.date(2000, 1, 2), datetime.time(3, 4, 5),
+                datetime.datetime(2000, 1, 2, 3, 4, 5, 6),
+                datetime.timedelta(1, 2, 3), decimal.Decimal('-1.50')]
+        self.assertEqual(newmummy.to_json(newmummy.dumps(value)),
+                bytify('["2000-01-02","03:04:05","2000-01-02T03:04:05.000006",'
+                    '86402.000003,-150e-2]'))
+        self.assertEqual(newmummy.to_json(newmummy.dumps({1: 2})),
+                bytify('{"1":2}'))
+        self.assertEqual(newmummy.to_json(newmummy.dumps(
+            [datetime.timedelta(999999999), datetime.timedelta(-999999999)])),
+            bytify('[86399999913600.0,-86399999913600.0]'))
+
+    def test_to_json_floats(self):
+        # repr's shortest digits, subnormals included
+        value = [5e-324, 8.4813081342428e-310, 1e-310, 2.2250738585072014e-308,
+                -1.5e-320, 1.7976931348623157e+308, 0.1, 1e16, 123456.789]
+        self.assertEqual(newmummy.to_json(newmummy.dumps(value)),
+                self.json(value))
+
+    def test_to_json_bytes(self):
+        # bytes that aren't utf-8 come out with U+FFFD, the same both ways
+        data = newmummy.dumps(
+                {bytify('k'): [b'\xff\xfe', b'caf\xc3\xa9', b'\xe2\x82']})
+        text = (b'{"k":["\xef\xbf\xbd\xef\xbf\xbd","caf\xc3\xa9",'
+                b'"\xef\xbf\xbd"]}')
+        for to_json in (newmummy.to_json, newmummy.pure_python_to_json):
+            self.assertEqual(to_json(data), text)
+        self.assertEqual(newmummy.loads(newmummy.from_json(text)),
+                json.loads(text.decode('utf8')))
+
+    def test_from_json(self):
+        text = self.json(self.plain)
+        for from_json in (newmummy.from_json, newmummy.pure_python_from_json):
+            self.assertEqual(newmummy.loads(from_json(text)), self.plain)
+            self.assertEqual(newmummy.loads(from_json(text.decode('utf8'))),
+                    self.plain)
+        self.assertEqual(newmummy.from_json(self.json([1, 2]),
+            compress=False), newmummy.dumps([1, 2], compress=False))
+
+    def test_msgpack(self):
+        value = [self.plain[unicodify('text')], bytify('raw'), 2 ** 64 - 1,
+                datetime.datetime(2000, 1, 2, 3, 4, 5, 6),
+                datetime.datetime(1900, 1, 2), datetime.date(2000, 1, 2),
+                datetime.time(3, 4), datetime.timedelta(-1),
+                decimal.Decimal('1.5'), fractions.Fraction(1, 3),
+                {unicodify('k'): None, 5: 1.5}]
+        data = newmummy.to_msgpack(newmummy.dumps(value))
+        self.assertEqual(bytearray(data[:1]), bytearray([0x9b]))
+        self.assertEqual(newmummy.loads(newmummy.from_msgpack(data)), value)
+
+    def test_invalid(self):
+        for text in ('[1,', '[1,]', '1 x', '"\\udc00"', '{1:2}'):
+            self.assertRaises(ValueError, newmummy.from_json, text)
+        self.assertRaises(ValueError, newmummy.to_json,
+                newmummy.dumps({(1, 2): 3}))
+        self.assertRaises(ValueError, newmummy.to_msgpack,
+                newmummy.dumps(2 ** 70))
+        for data in ([0x92, 0x01], [0xc1], [0xd4, 0x05, 0x00]):
+            self.assertRaises(ValueError, newmummy.from_msgpack,
+                    bytes(bytearray(data)))
+
+
+class ProfileTest(unittest.TestCase):
+    def test_profile(self):
+        values = [{unicodify('id'): 300, unicodify('tag'): unicodify('a' * 40)},
+                {unicodify('id'): 70000}]
+        result = newmummy.profile([newmummy.dumps(v) for v in values],
+                depth=1)
+        self.assertEqual(result['values'], 2)
+        self.assertEqual(result['bytes'], 67)
+        self.assertEqual(result['types']['shorthash'], (2, 4))
+        self.assertEqual(result['types']['int'], (1, 5))
+        self.assertEqual((result['key_count'], result['key_bytes'],
+            result['distinct_keys']), (3, 13, 2))
+        self.assertEqual(result['varint_bytes'], 66)
+        self.assertEqual(result['keytable_bytes'], 69)
+        paths = dict((p['path'], p) for p in result['paths'])
+        self.assertEqual(sorted(paths), ['', '.id', '.tag'])
+        self.assertEqual(paths['.id']['type'], 'int')
+        self.assertEqual(paths['.id']['key_bytes'], 8)
+        self.assertTrue(paths['.tag']['compressed'] < paths['.tag']['bytes'])
+
+        # a single (compressed) string, and the top alone
+        result = newmummy.profile(newmummy.dumps([unicodify('b' * 100)]),
+                depth=0)
+        self.assertEqual([p['path'] for p in result['paths']], [''])
+
+    def test_invalid(self):
+        self.assertRaises(ValueError, newmummy.profile, bytify('\x10\x02\x00'))
+        self.assertRaises(TypeError, newmummy.profile, 5)
+
+
+class StatsTest(unittest.TestCase):
+    def setUp(self):
+        if newmummy.stats() is None:
+            self.skipTest("built without MUMMY_STATS")
+
+    def test_counts(self):
+        value = {unicodify('a'): [1, 300, unicodify('x' * 100)]}
+        plain = newmummy.dumps(value, None, False)
+        newmummy.reset_stats()
+        data = newmummy.dumps(value)
+        self.assertEqual(newmummy.loads(data), value)
+
+        stats = newmummy.stats()
+        self.assertEqual((stats['encodes'], stats['encoded_bytes']),
+                (1, len(plain)))
+        self.assertEqual((stats['decodes'], stats['decoded_bytes']),
+                (1, len(plain)))
+        self.assertEqual((stats['compress_attempts'],
+            stats['compress_saves'], stats['compress_bytes_in'],
+            stats['compress_bytes_out']), (1, 1, len(plain), len(data)))
+        self.assertEqual((stats['decompressions'],
+            stats['decompressed_bytes']), (1, len(plain)))
+        self.assertEqual(stats['max_depth'], 3)
+        types = {'shorthash': 1, 'shortutf8': 2, 'shortlist': 1, 'char': 1,
+                'short': 1}
+        self.assertEqual(stats['encoded_types'], types)
+        self.assertEqual(stats['decoded_types'], types)
+
+        newmummy.reset_stats()
+        stats = newmummy.stats()
+        self.assertEqual(stats['encodes'], 0)
+        self.assertEqual(stats['encoded_types'], {})
+
+    def test_reallocs(self):
+        newmummy.reset_stats()
+        newmummy.dumps(bytify('x' * 100000), None, False)
+        self.assertTrue(newmummy.stats()['reallocs'] > 0)
+
+    def test_threads(self):
+        # what a thread counted still shows after it has exited
+        newmummy.reset_stats()
+        threads = [threading.Thread(target=newmummy.dumps, args=(i,))
+                for i in range(4)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        self.assertEqual(newmummy.stats()['encodes'], 4)
+
+
+class TimingTest(unittest.TestCase):
+    def setUp(self):
+        try:
+            self.previous = newmummy.set_timing(True)
+        except NotImplementedError:
+            self.skipTest("timing needs the C extension")
+        newmummy.reset_timings()
+
+    def tearDown(self):
+        newmummy.set_timing(self.previous)
+        newmummy.reset_timings()
+
+    def test_phases(self):
+        big = [unicodify('x' * 1000)] * 10
+        for i in range(10):
+            newmummy.loads(newmummy.dumps(big))
+        newmummy.loads(newmummy.dumps(1))
+
+        timings = newmummy.timings()
+        for phase in ('encode', 'compress', 'decompress', 'decode'):
+            self.assertEqual(timings[phase]['<16KB']['count'], 10)
+        self.assertEqual(timings['encode']['<64B']['count'], 1)
+        self.assertEqual(timings['decode']['<64B']['count'], 1)
+        # too small to be worth compressing
+        self.assertFalse('<64B' in timings['compress'])
+
+        h = timings['decode']['<16KB']
+        self.assertTrue(h['p50_ns'] <= h['p90_ns'] <= h['p99_ns'] <=
+                h['p999_ns'] <= h['max_ns'] <= h['total_ns'])
+
+    def test_off(self):
+        newmummy.set_timing(False)
+        newmummy.loads(newmummy.dumps([1, 2, 3]))
+        self.assertEqual(newmummy.timings()['encode'], {})
+        self.assertEqual(newmummy.timings()['decode'], {})
+
+    def test_subinterpreter(self):
+        try:
+            import _interpreters
+        except ImportError:
+            self.skipTest("needs subinterpreters")
+        # an isolated interpreter, with its own GIL, has its own switch and
+        # histograms. (exec is a keyword on python 2)
+        run = getattr(_interpreters, 'exec')
+        interp = _interpreters.create('isolated')
+        try:
+            err = run(interp, "import sys\n"
+                "sys.path[:0] = %r\n"
+                "import mummy\n"
+                "assert not mummy.set_timing(True)\n"
+                "mummy.loads(mummy.dumps([1, 2, 3]))\n"
+                "assert mummy.timings()['encode']\n" % sys.path)
+        finally:
+            _interpreters.destroy(interp)
+        self.assertEqual(err, None)
+        self.assertEqual(newmummy.timings()['encode'], {})
+
+
+class AllocationTest(unittest.TestCase):
+    def setUp(self):
+        try:
+            with newmummy.track_allocations():
+                pass
+        except NotImplementedError:
+            self.skipTest("allocation tracking needs MUMMY_TRACK_ALLOC")
+
+    def test_calls(self):
+        big = [unicodify('x' * 1000)] * 10
+        with newmummy.track_allocations() as tracked:
+            newmummy.loads(newmummy.dumps(big))
+        newmummy.dumps(big)
+
+        self.assertEqual([c['call'] for c in tracked.calls],
+                ['dumps', 'loads'])
+        for call in tracked.calls:
+            self.assertTrue(call['allocs'] > 0)
+            self.assertTrue(call['bytes'] >= call['peak'] >= 10000)
+            self.assertEqual(call['live'], 0)
+        total = tracked.total
+        self.assertEqual(total['bytes'],
+                sum(c['bytes'] for c in tracked.calls))
+        self.assertEqual(total['peak'],
+                max(c['peak'] for c in tracked.calls))
+
+    def test_coders(self):
+        encoder, decoder = newmummy.Encoder(), newmummy.Decoder()
+        with newmummy.track_allocations() as tracked:
+            decoder.decode_many(encoder.encode_many([1, 2]))
+            decoder.decode(encoder.encode(3))
+        self.assertEqual([c['call'] for c in tracked.calls],
+                ['Encoder.encode_many', 'Decoder.decode_many',
+                    'Encoder.encode', 'Decoder.decode'])
+
+    def test_nested(self):
+        def default(obj):
+            return newmummy.loads(newmummy.dumps([1]))
+
+        with newmummy.track_allocations() as outer:
+            newmummy.dumps(object(), default)
+            with newmummy.track_allocations() as inner:
+                newmummy.dumps(1)
+        # the calls from the default handler count toward the dumps
+        self.assertEqual([c['call'] for c in outer.calls], ['dumps', 'dumps'])
+        self.assertEqual([c['call'] for c in inner.calls], ['dumps'])
+        self.assertTrue(outer.calls[0]['allocs'] > inner.calls[0]['allocs'])
+
+
+class DjangoCacheTest(unittest.TestCase):
+    value = {unicodify('list'): [1, 2, 3],
+            unicodify('text'): unicodify('x') * 100}
+
+    def setUp(self):
+        if django_cache is None:
+            self.skipTest("django isn't installed")
+
+    def batch_cache(self):
+        from django.core.cache.backends.base import BaseCache
+
+        # a backend with its own get_many and set_many, like memcached's
+        class Storage(BaseCache):
+            def __init__(self, params):
+                super(Storage, self).__init__(params)
+                self.data = {}
+
+            def get(self, key, default=None, version=None):
+                return self.data.get(key, default)
+
+            def set(self, key, value, timeout=None, version=None):
+                self.data[key] = value
+
+            def get_many(self, keys, version=None):
+                return dict((key, self.data[key]) for key in keys
+                        if key in self.data)
+
+            def set_many(self, data, timeout=None, version=None):
+                self.data.update(data)
+                return []
+
+        class Cache(django_cache.MummyCacheMixin, Storage):
+            pass
+
+        return Cache({'COMPRESS_THRESHOLD': 64})
+
+    def check_cache(self, cache):
+        cache.set('a', self.value)
+        self.assertEqual(cache.get('a'), self.value)
+        self.assertEqual(cache.get('missing', 'default'), 'default')
+
+        cache.set_many({'b': self.value, 'n': 5})
+        self.assertEqual(cache.get('b'), self.value)
+        self.assertEqual(cache.get_many(['a', 'b', 'n', 'missing']),
+                {'a': self.value, 'b': self.value, 'n': 5})
+        self.assertEqual(cache.incr('n'), 6)
+        self.assertEqual(cache.get('n'), 6)
+
+    def test_locmem(self):
+        # locmem's get_many and set_many are BaseCache's, through get and set
+        self.check_cache(django_cache.LocMemCache('mummy-tests', {}))
+
+    def test_batch(self):
+        cache = self.batch_cache()
+        self.check_cache(cache)
+        self.assertEqual(newmummy.loads(cache.data['b']), self.value)
+        self.assertEqual(cache.data['n'], 6)
+
+
+class DjangoSerializerTest(unittest.TestCase):
+    def setUp(self):
+        if django_serialization is None:
+            self.skipTest("django isn't installed")
+        import django
+        from django.conf import settings
+        if not settings.configured:
+            settings.configure(
+                    INSTALLED_APPS=['django.contrib.contenttypes'])
+            django.setup()
+        from django.contrib.contenttypes.models import ContentType
+        # a model with no relations, so serializing doesn't need a database
+        self.objects = [ContentType(pk=i, app_label='tests', model='m%d' % i)
+                for i in range(5)]
+        self.expected = [(obj.pk, obj.model) for obj in self.objects]
+
+    def deserialize(self, data):
+        return [(obj.object.pk, obj.object.model) for obj in
+                django_serialization.Deserializer(data)]
+
+    def test_round_trip(self):
+        serializer = django_serialization.Serializer()
+        serializer.batch_size = 2
+        data = serializer.serialize(self.objects)
+        self.assertEqual(self.deserialize(data), self.expected)
+        self.assertEqual(self.deserialize(io.BytesIO(data)),
+                self.deserialize(data))
+        self.assertEqual(self.deserialize(bytify('')), [])
+
+    def test_records(self):
+        # written a batch at a time, but read back as one record per object
+        stream = io.BytesIO()
+        serializer = django_serialization.Serializer()
+        serializer.batch_size = 2
+        serializer.serialize(self.objects, stream=stream)
+        stream.seek(0)
+        self.assertEqual(len(list(newmummy.iter_records(stream))), 5)
+
+    def test_old_format(self):
+        # dumps from before records were one mummy list of every object
+        serializer = django_serialization.Serializer()
+        records = list(newmummy.iter_records(
+            io.BytesIO(serializer.serialize(self.objects))))
+        self.assertEqual(self.deserialize(newmummy.dumps(records)),
+                self.expected)
+
+    def test_truncated(self):
+        data = django_serialization.Serializer().serialize(self.objects)
+        self.assertRaises(ValueError, self.deserialize, data[:-1])
+        self.assertRaises(ValueError, self.deserialize, data[:2])
+
+
+class ConcurrentMutationTest(unittest.TestCase):
+    # a default handler that shrinks the container being dumped mustn't
+    # leave an item count in the output that doesn't match the items
+    def test_list(self):
+        l = [object(), 1, 2]
+        def default(o):
+            del l[1:]
+        self.assertRaises(RuntimeError, newmummy.dumps, l, default)
+
+    def test_dict(self):
+        d = {1: object(), 2: 2}
+        def default(o):
+            d.pop(2, None)
+            d.pop(1, None)
+        self.assertRaises(RuntimeError, newmummy.dumps, d, default)
+
+
+class BookMessage(newmummy.Message):
+    SCHEMA = {
+        'title': str,
+        newmummy.OPTIONAL('pages'): int,
+        'chapters': [{'name': str, 'sections': (int, {'words': int})}],
+        str: {'value': float},
+    }
+
+class SchemaTransformTest(unittest.TestCase):
+    message = {
+        'title': 'mummy',
+        'chapters': [
+            {'name': 'one', 'sections': (1, {'words': 300})},
+            {'name': 'two', 'sections': (2, {'words': 500})},
+        ],
+        'weight': {'value': 1.5},
+    }
+
+    def test_transform(self):
+        self.assertEqual(BookMessage(self.message).transform(), [
+            [['one', (1, [300])], ['two', (2, [500])]], 'mummy', None,
+            'weight', [1.5]])
+
+    def test_roundtrip(self):
+        msg = BookMessage(self.message)
+        self.assertEqual(BookMessage.loads(msg.dumps()).message, self.message)
+
+    def test_optional_present(self):
+        message = dict(self.message, pages=12)
+        msg = BookMessage(message)
+        self.assertEqual(BookMessage.untransform(msg.transform()), message)
+
+class PackedBookMessage(BookMessage):
+    SCHEMA = dict(BookMessage.SCHEMA,
+            flags=[bool], readings=[int], ratio=float)
+    PACKED = True
+
+class PackedSchemaTransformTest(unittest.TestCase):
+    message = dict(SchemaTransformTest.message,
+            flags=[True, False, True] * 5,
+            readings=[-1 << 70, -1, 0, 1, 1 << 70],
+            ratio=-0.25)
+
+    def test_transform(self):
+        packed, tree = PackedBookMessage(self.message).transform()
+        self.assertEqual(tree, [
+            [['one', ([],)], ['two', ([],)]], 15, 5, 'mummy', None,
+            'weight', []])
+
+    def test_roundtrip(self):
+        msg = PackedBookMessage(self.message)
+        self.assertEqual(
+                PackedBookMessage.loads(msg.dumps()).message, self.message)
+
+    def test_optional_present(self):
+        message = dict(self.message, pages=12)
+        msg = PackedBookMessage(message)
+        self.assertEqual(
+                PackedBookMessage.untransform(msg.transform()), message)
+
+    def test_shorter(self):
+        class Unpacked(PackedBookMessage):
+            PACKED = False
+        self.assertTrue(len(PackedBookMessage(self.message).dumps()) <
+                len(Unpacked(self.message).dumps()))
+
+
+class MessageBatchTest(unittest.TestCase):
+    def batch_roundtrip(self, cls, message):
+        msgs = [cls(dict(message, title='book %d' % i)) for i in range(300)]
+        data = cls.dumps_batch(msgs)
+        self.assertEqual([msg.message for msg in cls.loads_batch(data)],
+                [msg.message for msg in msgs])
+        self.assertTrue(len(data) < sum(len(msg.dumps()) for msg in msgs))
+
+    def test_batch(self):
+        self.batch_roundtrip(BookMessage, SchemaTransformTest.message)
+
+    def test_packed_batch(self):
+        self.batch_roundtrip(
+                PackedBookMessage, PackedSchemaTransformTest.message)
+
+    def test_empty(self):
+        self.assertEqual(
+                BookMessage.loads_batch(BookMessage.dumps_batch([])), [])
+
+
+class ValidationTest(unittest.TestCase):
+    class Event(newmummy.Message):
+        SCHEMA = {
+            'kind': newmummy.UNION('click', 'view', int),
+            'at': (int, newmummy.OPTIONAL(float)),
+            'tags': [newmummy.OPTIONAL(
+                newmummy.UNION(str, {'name': str}, [int]))],
+        }
+
+    def assertValid(self, message):
+        self.Event(message).validate()
+
+    def assertInvalid(self, message):
+        self.assertRaises(self.Event.InvalidMessage,
+                self.Event(message).validate)
+
+    def test_valid(self):
+        self.assertValid({'kind': 'click', 'at': (1,), 'tags': []})
+        self.assertValid({'kind': 3, 'at': (1, 2.5),
+            'tags': ['a', {'name': 'b'}, [1, 2]]})
+
+    def test_invalid(self):
+        self.assertInvalid({'kind': 'scroll', 'at': (1,), 'tags': []})
+        self.assertInvalid({'kind': 'view', 'at': (), 'tags': []})
+        self.assertInvalid({'kind': 'view', 'at': (1, 2.5, 3.5), 'tags': []})
+        self.assertInvalid({'kind': 'view', 'at': (1,), 'tags': [{}]})
+        self.assertInvalid({'kind': 'view', 'at': (1,), 'tags': [['a']]})
+
+    def test_cached_union_results(self):
+        # the same value validates the same way every time it's seen,
+        # but equal values of different types are kept apart
+        for i in range(3):
+            self.assertValid({'kind': 'view', 'at': (1,), 'tags': []})
+            self.assertInvalid({'kind': 'scroll', 'at': (1,), 'tags': []})
+            self.assertValid({'kind': 1, 'at': (1,), 'tags': []})
+            self.assertInvalid({'kind': 1.0, 'at': (1,), 'tags': []})
+
+    def test_failure_info(self):
+        msg = self.Event({'kind': 'view', 'at': (1,), 'tags': [5]})
+        try:
+            msg.validate()
+        except self.Event.InvalidMessage as exc:
+            self.assertEqual(exc.args[0][0], 5)
+        else:
+            self.fail("validated")
+
+
 if __name__ == '__main__':
     unittest.main()
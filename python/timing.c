@@ -0,0 +1,171 @@
+#include "mummypy.h"
+#include <time.h>
+
+
+/* the bucket layout from mummypy.h */
+#define SUB_BITS MUMMYPY_SUB_BITS
+#define SUB_COUNT MUMMYPY_SUB_COUNT
+#define MAX_EXPONENT MUMMYPY_MAX_EXPONENT
+#define LATENCY_BUCKETS MUMMYPY_LATENCY_BUCKETS
+#define SIZE_BUCKETS MUMMYPY_SIZE_BUCKETS
+
+static const char *phase_names[MUMMYPY_PHASES] = {
+    "encode", "compress", "decompress", "decode"};
+
+static const char *size_names[SIZE_BUCKETS] = {
+    "<64B", "<256B", "<1KB", "<4KB", "<16KB", "<64KB", "<256KB", "<1MB",
+    ">=1MB"};
+
+/* with the GIL, only one thread records into a module's histograms at a
+   time (each subinterpreter has its own) */
+#ifdef Py_GIL_DISABLED
+    #define ADD(field, n) __atomic_fetch_add(&(field), (n), __ATOMIC_RELAXED)
+    #define CLEAR(field) __atomic_store_n(&(field), 0, __ATOMIC_RELAXED)
+#else
+    #define ADD(field, n) ((field) += (n))
+    #define CLEAR(field) ((field) = 0)
+#endif
+
+uint64_t
+mummypy_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+size_bucket(Py_ssize_t size) {
+    int bucket = 0;
+
+    for (size >>= 6; size && bucket < SIZE_BUCKETS - 1; size >>= 2)
+        ++bucket;
+    return bucket;
+}
+
+static int
+latency_bucket(uint64_t ns) {
+    int exponent;
+
+    if (ns < SUB_COUNT) return (int)ns;
+    if (ns >> MAX_EXPONENT) return LATENCY_BUCKETS - 1;
+    exponent = 63 - __builtin_clzll(ns);
+    return (exponent - SUB_BITS + 1) * SUB_COUNT +
+        (int)((ns >> (exponent - SUB_BITS)) & (SUB_COUNT - 1));
+}
+
+/* the highest latency that lands in `bucket` */
+static uint64_t
+bucket_top(int bucket) {
+    int exponent = bucket / SUB_COUNT + SUB_BITS - 1;
+
+    if (bucket < SUB_COUNT) return bucket;
+    return ((uint64_t)(bucket % SUB_COUNT + SUB_COUNT + 1) <<
+            (exponent - SUB_BITS)) - 1;
+}
+
+void
+mummypy_record(mummypy_state *state, int phase, Py_ssize_t size,
+        uint64_t start) {
+    uint64_t ns = mummypy_now() - start;
+    mummypy_histogram *h = &state->histograms[phase][size_bucket(size)];
+    uint64_t max = h->max;
+
+    ADD(h->count, 1);
+    ADD(h->total, ns);
+    ADD(h->buckets[latency_bucket(ns)], 1);
+#ifdef Py_GIL_DISABLED
+    while (ns > max && !__atomic_compare_exchange_n(&h->max, &max, ns, 1,
+                __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+#else
+    if (ns > max) h->max = ns;
+#endif
+}
+
+/* the latency at or under which `fraction` of those recorded came in */
+static uint64_t
+percentile(mummypy_histogram *h, double fraction) {
+    uint64_t rank = (uint64_t)(fraction * h->count + 0.5), seen = 0, top;
+    int i;
+
+    if (rank < 1) rank = 1;
+    for (i = 0; i < LATENCY_BUCKETS; ++i) {
+        if ((seen += h->buckets[i]) >= rank) break;
+    }
+    top = bucket_top(i < LATENCY_BUCKETS ? i : LATENCY_BUCKETS - 1);
+    return top < h->max ? top : h->max;
+}
+
+static PyObject *
+summary(mummypy_histogram *h) {
+    return Py_BuildValue("{s:K,s:K,s:K,s:K,s:K,s:K,s:K}",
+            "count", (unsigned PY_LONG_LONG)h->count,
+            "total_ns", (unsigned PY_LONG_LONG)h->total,
+            "max_ns", (unsigned PY_LONG_LONG)h->max,
+            "p50_ns", (unsigned PY_LONG_LONG)percentile(h, 0.5),
+            "p90_ns", (unsigned PY_LONG_LONG)percentile(h, 0.9),
+            "p99_ns", (unsigned PY_LONG_LONG)percentile(h, 0.99),
+            "p999_ns", (unsigned PY_LONG_LONG)percentile(h, 0.999));
+}
+
+static char *set_timing_kwargs[] = {"enabled", NULL};
+
+PyObject *
+python_set_timing(PyObject *self, PyObject *args, PyObject *kwargs) {
+    mummypy_state *state = mummypy_get_state(self);
+    PyObject *enabled;
+    int previous = state->timing, flag;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O:set_timing",
+                set_timing_kwargs, &enabled))
+        return NULL;
+    if ((flag = PyObject_IsTrue(enabled)) < 0) return NULL;
+    state->timing = flag;
+    return PyBool_FromLong(previous);
+}
+
+PyObject *
+python_timings(PyObject *self, PyObject *noargs) {
+    mummypy_state *state = mummypy_get_state(self);
+    mummypy_histogram *h;
+    PyObject *result, *sizes, *item;
+    int phase, size;
+
+    if (!(result = PyDict_New())) return NULL;
+    for (phase = 0; phase < MUMMYPY_PHASES; ++phase) {
+        if (!(sizes = PyDict_New())) goto fail;
+        if (PyDict_SetItemString(result, phase_names[phase], sizes)) {
+            Py_DECREF(sizes);
+            goto fail;
+        }
+        Py_DECREF(sizes);
+
+        for (size = 0; size < SIZE_BUCKETS; ++size) {
+            h = &state->histograms[phase][size];
+            if (!h->count) continue;
+            if (!(item = summary(h))) goto fail;
+            if (PyDict_SetItemString(sizes, size_names[size], item)) {
+                Py_DECREF(item);
+                goto fail;
+            }
+            Py_DECREF(item);
+        }
+    }
+    return result;
+
+fail:
+    Py_DECREF(result);
+    return NULL;
+}
+
+PyObject *
+python_reset_timings(PyObject *self, PyObject *noargs) {
+    mummypy_state *state = mummypy_get_state(self);
+    uint64_t *field = (uint64_t *)state->histograms;
+    size_t i;
+
+    /* a field at a time, as other threads may be recording meanwhile */
+    for (i = 0; i < sizeof(state->histograms) / sizeof(uint64_t); ++i)
+        CLEAR(field[i]);
+    Py_RETURN_NONE;
+}
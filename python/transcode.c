@@ -0,0 +1,131 @@
+#include "mummypy.h"
+
+
+typedef int (*transcoder)(mummy_string *, mummy_string *);
+
+/* run `convert` over the bytes in `view` (decompressing them first if they
+   are mummy) and return what it writes as a bytestring, or NULL with an
+   exception set. `source` names the input format and `invalid` is the
+   message for EINVAL, which means something different each way */
+static PyObject *
+transcode(mummypy_state *state, transcoder convert, Py_buffer *view,
+        int decompress, int compress, const char *source,
+        const char *invalid) {
+    mummy_string *str, *out;
+    PyObject *result = NULL;
+    char free_buf = 0;
+    int rc;
+
+    str = mummy_string_wrap(view->buf, view->len);
+
+    if (decompress && (rc = mummy_string_decompress(str, 0, &free_buf))) {
+        PyErr_Format(PyExc_ValueError, "lzf decompression failed (%d)", rc);
+        mummy_string_free(str, free_buf);
+        return NULL;
+    }
+
+    if (!(out = mummy_string_new(str->len + 16))) {
+        mummy_string_free(str, free_buf);
+        return PyErr_NoMemory();
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    rc = convert(str, out);
+    Py_END_ALLOW_THREADS
+
+    switch (rc) {
+    case 0:
+        result = mummypy_result(state, out, compress);
+        break;
+    case ENOMEM:
+        PyErr_NoMemory();
+        break;
+    case EINVAL:
+        PyErr_SetString(PyExc_ValueError, invalid);
+        break;
+    case -2:
+        PyErr_Format(PyExc_ValueError, "invalid %s (unrecognized type)",
+                source);
+        break;
+    case -3:
+        PyErr_Format(PyExc_ValueError, "%s nested too deeply", source);
+        break;
+    default:
+        PyErr_Format(PyExc_ValueError, "invalid %s (incorrect length)",
+                source);
+    }
+
+    mummy_string_free(out, 1);
+    mummy_string_free(str, free_buf);
+    return result;
+}
+
+static PyObject *
+to_format(PyObject *self, PyObject *data, transcoder convert,
+        const char *invalid) {
+    PyObject *result;
+    Py_buffer view;
+
+    if (PyObject_GetBuffer(data, &view, PyBUF_SIMPLE)) return NULL;
+    result = transcode(mummypy_get_state(self), convert, &view, 1, 0,
+            "mummy", invalid);
+    PyBuffer_Release(&view);
+    return result;
+}
+
+PyObject *
+python_to_json(PyObject *self, PyObject *data) {
+    return to_format(self, data, mummy_to_json,
+            "mummy can't be represented as json (container as a hash key)");
+}
+
+PyObject *
+python_to_msgpack(PyObject *self, PyObject *data) {
+    return to_format(self, data, mummy_to_msgpack,
+            "mummy can't be represented as msgpack (int too big)");
+}
+
+static char *from_kwargs[] = {"data", "compress", NULL};
+
+static PyObject *
+from_format(PyObject *self, PyObject *args, PyObject *kwargs,
+        const char *spec, transcoder convert, const char *source,
+        const char *invalid) {
+    PyObject *data, *compress = Py_True, *encoded = NULL, *result;
+    Py_buffer view;
+    int do_compress;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, spec, from_kwargs,
+                &data, &compress))
+        return NULL;
+    if ((do_compress = PyObject_IsTrue(compress)) < 0) return NULL;
+
+    /* text goes in as its utf-8 */
+    if (PyUnicode_Check(data)) {
+        if (!(encoded = PyUnicode_AsUTF8String(data))) return NULL;
+        data = encoded;
+    }
+
+    if (PyObject_GetBuffer(data, &view, PyBUF_SIMPLE)) {
+        Py_XDECREF(encoded);
+        return NULL;
+    }
+    result = transcode(mummypy_get_state(self), convert, &view, 0,
+            do_compress, source, invalid);
+    PyBuffer_Release(&view);
+    Py_XDECREF(encoded);
+    return result;
+}
+
+PyObject *
+python_from_json(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return from_format(self, args, kwargs, "O|O:from_json",
+            mummy_from_json, "json", "invalid json");
+}
+
+PyObject *
+python_from_msgpack(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return from_format(self, args, kwargs, "O|O:from_msgpack",
+            mummy_from_msgpack, "msgpack",
+            "invalid msgpack (unsupported extension type)");
+}
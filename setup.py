@@ -1,5 +1,6 @@
 import errno
 import os
+import platform
 import sys
 
 from setuptools import setup, Extension
@@ -24,23 +25,50 @@ info = {
         "Natural Language :: English",
         "Programming Language :: C",
         "Programming Language :: Python",
+        "Programming Language :: Python :: 2",
+        "Programming Language :: Python :: 3",
     ],
 }
 
-if sys.subversion[0].lower() != 'pypy':
+if platform.python_implementation() == 'PyPy':
+    # the CPython extension doesn't work on PyPy, so bind the C core via cffi
+    info['setup_requires'] = ['cffi>=1.0.0']
+    info['install_requires'] = ['cffi>=1.0.0']
+    info['cffi_modules'] = ['python/cffi_build.py:ffibuilder']
+else:
+    # MUMMY_STATS=1 in the environment builds in the counters behind
+    # mummy.stats(), which cost a little on every value
+    macros = []
+    if os.environ.get('MUMMY_STATS', '0') not in ('', '0'):
+        macros.append(('MUMMY_STATS', '1'))
+    # and MUMMY_TRACK_ALLOC=1 the allocation counting behind
+    # mummy.track_allocations(), for profiling rather than production
+    if os.environ.get('MUMMY_TRACK_ALLOC', '0') not in ('', '0'):
+        macros.append(('MUMMY_TRACK_ALLOC', '1'))
+
     info['ext_modules'] = [
         Extension(
             '_mummy',
-            ['python/dump.c', 'python/load.c', 'python/mummymodule.c',
-                'lzf/lzf_c.c', 'lzf/lzf_d.c',
-                'lib/mummy_string.c', 'lib/dump.c', 'lib/load.c'],
-            include_dirs=('python', 'lzf', 'include'),
+            ['python/dump.c', 'python/load.c', 'python/coders.c',
+                'python/stream.c', 'python/transcode.c',
+                'python/profile.c', 'python/stats.c', 'python/timing.c',
+                'python/alloc.c', 'python/mummymodule.c', 'lzf/lzf_c.c', 'lzf/lzf_d.c',
+                'lib/mummy_string.c', 'lib/dump.c', 'lib/load.c',
+                'lib/legacy.c', 'lib/walk.c', 'lib/json.c',
+                'lib/msgpack.c', 'lib/profile.c', 'lib/stats.c',
+                'lib/alloc.c'],
+            include_dirs=('python', 'lzf', 'include', 'lib'),
+            define_macros=macros,
             extra_compile_args=['-Wall']),
-        Extension(
+        ]
+
+    # the old format's extension was never ported to python 3, oldmummy
+    # falls back to its pure-python implementation there
+    if sys.version_info[0] < 3:
+        info['ext_modules'].append(Extension(
             '_oldmummy',
             ['python/_old_mummy.c', 'lzf/lzf_c.c', 'lzf/lzf_d.c'],
             include_dirs=('python', 'lzf'),
-            extra_compile_args=['-Wall']),
-        ]
+            extra_compile_args=['-Wall']))
 
 setup(**info)
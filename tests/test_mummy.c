@@ -0,0 +1,854 @@
+/*
+ * tests for the C library, against its exported API only
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mummy.h"
+
+
+static int failures = 0;
+
+#define CHECK(cond) do {                                                   \
+        if (!(cond)) {                                                     \
+            fprintf(stderr, "%s:%d: check failed: %s\n",                   \
+                    __FILE__, __LINE__, #cond);                            \
+            ++failures;                                                    \
+        }                                                                  \
+    } while (0)
+
+/* the string's contents so far are exactly `size` bytes of `expected` */
+#define CHECK_BYTES(str, expected, size)                                   \
+    CHECK((str)->offset == (size) &&                                       \
+            !memcmp((str)->data, (expected), (size)))
+
+/* start reading back what was just written */
+static void
+rewind_string(mummy_string *str) {
+    str->len = str->offset;
+    str->offset = 0;
+}
+
+
+static void
+test_version(void) {
+    CHECK(mummy_version() == MUMMY_VERSION_NUMBER);
+    CHECK(!strcmp(mummy_version_string(), MUMMY_VERSION_STRING));
+}
+
+static void
+test_ints(void) {
+    int64_t values[] = {0, -1, 127, -128, 128, -129, 32767, -32768, 32768,
+        2147483647LL, -2147483647LL - 1, 2147483648LL,
+        9223372036854775807LL, -9223372036854775807LL - 1};
+    char types[] = {MUMMY_TYPE_CHAR, MUMMY_TYPE_CHAR, MUMMY_TYPE_CHAR,
+        MUMMY_TYPE_CHAR, MUMMY_TYPE_SHORT, MUMMY_TYPE_SHORT, MUMMY_TYPE_SHORT,
+        MUMMY_TYPE_SHORT, MUMMY_TYPE_INT, MUMMY_TYPE_INT, MUMMY_TYPE_INT,
+        MUMMY_TYPE_LONG, MUMMY_TYPE_LONG, MUMMY_TYPE_LONG};
+    int i, count = sizeof(values) / sizeof(values[0]);
+    mummy_string *str = mummy_string_new(4);
+    mummy_token token;
+    int64_t result;
+
+    for (i = 0; i < count; ++i) CHECK(!mummy_feed_int(str, values[i]));
+    rewind_string(str);
+
+    for (i = 0; i < count; ++i) {
+        CHECK(mummy_type(str) == types[i]);
+        CHECK(!mummy_read_int(str, &result));
+        CHECK(result == values[i]);
+    }
+    CHECK(str->offset == str->len);
+
+    str->offset = 0;
+    for (i = 0; i < count; ++i) {
+        CHECK(!mummy_read_token(str, &token));
+        CHECK(token.type == types[i] && token.v.i == values[i]);
+    }
+
+    str->offset = 0;
+    CHECK(!mummy_feed_int(str, 300));
+    CHECK_BYTES(str, "\x03\x01\x2c", 3);
+
+    mummy_string_free(str, 1);
+}
+
+static void
+test_atoms(void) {
+    mummy_string *str = mummy_string_new(1);
+    mummy_token token;
+    char huge[] = {0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+    char *buf;
+    char flag;
+    double f;
+    int len;
+
+    CHECK(!mummy_feed_null(str));
+    CHECK(!mummy_feed_bool(str, 1));
+    CHECK(!mummy_feed_float(str, -928.346));
+    CHECK(!mummy_feed_huge(str, huge, sizeof(huge)));
+    CHECK(!mummy_feed_string(str, "hello", 5));
+    CHECK(!mummy_feed_utf8(str, "h\xc3\xa9", 3));
+    rewind_string(str);
+
+    CHECK(!mummy_read_token(str, &token));
+    CHECK(token.type == MUMMY_TYPE_NULL);
+
+    CHECK(!mummy_read_bool(str, &flag));
+    CHECK(flag == 1);
+
+    CHECK(!mummy_read_float(str, &f));
+    CHECK(f == -928.346);
+
+    CHECK(!mummy_point_to_huge(str, &buf, &len));
+    CHECK(len == sizeof(huge) && !memcmp(buf, huge, len));
+
+    CHECK(!mummy_point_to_string(str, &buf, &len));
+    CHECK(len == 5 && !memcmp(buf, "hello", 5));
+
+    CHECK(!mummy_read_token(str, &token));
+    CHECK(token.type == MUMMY_TYPE_SHORTUTF8);
+    CHECK(token.v.s.len == 3 && !memcmp(token.v.s.data, "h\xc3\xa9", 3));
+
+    CHECK(str->offset == str->len);
+    mummy_string_free(str, 1);
+}
+
+static void
+test_string_sizes(void) {
+    static char data[70000];
+    int sizes[] = {0, 255, 256, 65535, 65536};
+    char types[] = {MUMMY_TYPE_SHORTSTR, MUMMY_TYPE_SHORTSTR,
+        MUMMY_TYPE_MEDSTR, MUMMY_TYPE_MEDSTR, MUMMY_TYPE_LONGSTR};
+    int i, len;
+    mummy_string *str = mummy_string_new(16);
+    char *copy = malloc(sizeof(data));
+
+    memset(data, 'x', sizeof(data));
+    for (i = 0; i < 5; ++i) CHECK(!mummy_feed_string(str, data, sizes[i]));
+    rewind_string(str);
+
+    for (i = 0; i < 5; ++i) {
+        CHECK(mummy_type(str) == types[i]);
+        CHECK(!mummy_read_string(str, sizeof(data), &copy, &len));
+        CHECK(len == sizes[i] && !memcmp(copy, data, len));
+    }
+
+    /* too big for the caller's buffer */
+    str->offset = 0;
+    CHECK(!mummy_read_string(str, 0, &copy, &len));
+    CHECK(mummy_read_string(str, 10, &copy, &len) == -3 && len == 255);
+
+    free(copy);
+    mummy_string_free(str, 1);
+}
+
+static void
+test_containers(void) {
+    mummy_string *str = mummy_string_new(8);
+    mummy_token token;
+    uint32_t size;
+
+    /* {"a": [1, 2]} */
+    CHECK(!mummy_open_hash(str, 1));
+    CHECK(!mummy_feed_string(str, "a", 1));
+    CHECK(!mummy_open_list(str, 2));
+    CHECK(!mummy_feed_int(str, 1));
+    CHECK(!mummy_feed_int(str, 2));
+    CHECK_BYTES(str, "\x13\x01\x08\x01" "a\x10\x02\x02\x01\x02\x02", 11);
+
+    CHECK(!mummy_open_tuple(str, 300));
+    CHECK(!mummy_open_set(str, 70000));
+    rewind_string(str);
+
+    CHECK(!mummy_container_size(str, &size));
+    CHECK(size == 1);
+    CHECK(!mummy_read_token(str, &token));
+    CHECK(token.type == MUMMY_TYPE_SHORTSTR);
+    CHECK(!mummy_read_token(str, &token));
+    CHECK(token.type == MUMMY_TYPE_SHORTLIST && token.v.size == 2);
+    CHECK(!mummy_read_token(str, &token) && token.v.i == 1);
+    CHECK(!mummy_read_token(str, &token) && token.v.i == 2);
+
+    CHECK(!mummy_read_token(str, &token));
+    CHECK(token.type == MUMMY_TYPE_MEDTUPLE && token.v.size == 300);
+    CHECK(!mummy_read_token(str, &token));
+    CHECK(token.type == MUMMY_TYPE_LONGSET && token.v.size == 70000);
+
+    mummy_string_free(str, 1);
+}
+
+static void
+test_temporal(void) {
+    mummy_string *str = mummy_string_new(8);
+    mummy_token token;
+    short year;
+    char month, day, hour, minute, second;
+    int microsecond, days, seconds, microseconds;
+
+    CHECK(!mummy_feed_date(str, 2014, 3, 12));
+    CHECK_BYTES(str, "\x1a\x07\xde\x03\x0c", 5);
+    CHECK(!mummy_feed_time(str, 23, 59, 58, 999999));
+    CHECK(!mummy_feed_datetime(str, 1999, 12, 31, 1, 2, 3, 456789));
+    CHECK(!mummy_feed_timedelta(str, -3, 11, 12345));
+    rewind_string(str);
+
+    CHECK(!mummy_read_date(str, &year, &month, &day));
+    CHECK(year == 2014 && month == 3 && day == 12);
+    CHECK(!mummy_read_time(str, &hour, &minute, &second, &microsecond));
+    CHECK(hour == 23 && minute == 59 && second == 58 &&
+            microsecond == 999999);
+
+    CHECK(!mummy_read_token(str, &token));
+    CHECK(token.type == MUMMY_TYPE_DATETIME);
+    CHECK(token.v.dt.year == 1999 && token.v.dt.month == 12 &&
+            token.v.dt.day == 31 && token.v.dt.hour == 1 &&
+            token.v.dt.minute == 2 && token.v.dt.second == 3 &&
+            token.v.dt.microsecond == 456789);
+
+    CHECK(!mummy_read_timedelta(str, &days, &seconds, &microseconds));
+    CHECK(days == -3 && seconds == 11 && microseconds == 12345);
+
+    mummy_string_free(str, 1);
+}
+
+static void
+test_numbers(void) {
+    mummy_string *str = mummy_string_new(8);
+    mummy_token token;
+    char digits[] = {1, 0, 6, 1, 9, 8, 4}, *result, sign, flags;
+    int16_t exponent;
+    uint16_t count;
+    int64_t numerator, denominator;
+
+    /* -106.1984 */
+    CHECK(!mummy_feed_decimal(str, 1, -4, 7, digits));
+    CHECK_BYTES(str, "\x1e\x01\xff\xfc\x00\x07\x01\x16\x89\x04", 10);
+    CHECK(!mummy_feed_infinity(str, 1));
+    CHECK(!mummy_feed_nan(str, 0));
+    CHECK(!mummy_feed_fraction(str, -2, 3));
+
+    digits[0] = 10;
+    CHECK(mummy_feed_decimal(str, 0, 0, 1, digits) == EINVAL);
+    rewind_string(str);
+
+    CHECK(!mummy_read_decimal(str, &sign, &exponent, &count, &result));
+    CHECK(sign == 1 && exponent == -4 && count == 7);
+    CHECK(!memcmp(result, "\x01\x00\x06\x01\x09\x08\x04", 7));
+    free(result);
+
+    CHECK(!mummy_read_specialnum(str, &flags));
+    CHECK(flags == (MUMMY_SPECIAL_INFINITY | 1));
+    CHECK(!mummy_read_token(str, &token));
+    CHECK(token.type == MUMMY_TYPE_SPECIALNUM &&
+            token.v.i == MUMMY_SPECIAL_NAN);
+
+    CHECK(!mummy_read_fraction(str, &numerator, &denominator));
+    CHECK(numerator == -2 && denominator == 3);
+    CHECK(str->offset == str->len);
+
+    mummy_string_free(str, 1);
+}
+
+static void
+test_compression(void) {
+    mummy_string *str = mummy_string_new(16), *wrapped;
+    static char data[10000];
+    char *buf, freed;
+    int len;
+
+    memset(data, 'z', sizeof(data));
+    CHECK(!mummy_feed_string(str, data, sizeof(data)));
+    CHECK(!mummy_string_compress(str));
+    CHECK(str->offset < 1000);
+    CHECK((str->data[0] & 0x7f) == MUMMY_TYPE_MEDSTR);
+
+    /* decompressing a copy leaves the original alone */
+    wrapped = mummy_string_wrap(str->data, str->offset);
+    CHECK(!mummy_string_decompress(wrapped, 0, &freed));
+    CHECK(freed == 1);
+    CHECK(!mummy_point_to_string(wrapped, &buf, &len));
+    CHECK(len == sizeof(data) && !memcmp(buf, data, len));
+    mummy_string_free(wrapped, freed);
+
+    /* corrupt data comes back as an error */
+    wrapped = mummy_string_wrap(str->data, str->offset - 3);
+    CHECK(mummy_string_decompress(wrapped, 0, &freed));
+    CHECK(freed == 0);
+    mummy_string_free(wrapped, 0);
+
+    /* as is a compressed size too big to allocate for */
+    memcpy(data, "\x86\xff\xff\xff\xfe\x1fzzzzzzzz", 14);
+    wrapped = mummy_string_wrap(data, 14);
+    CHECK(mummy_string_decompress(wrapped, 0, &freed) == EINVAL);
+    CHECK(freed == 0);
+    mummy_string_free(wrapped, 0);
+
+    /* and a compressed header with no lzf data after it, on the heap and
+       exactly that long so a sanitizer catches any read past it */
+    buf = malloc(5);
+    memcpy(buf, "\x88\x00\x00\x00\x01", 5);
+    wrapped = mummy_string_wrap(buf, 5);
+    CHECK(mummy_string_decompress(wrapped, 0, &freed) == EINVAL);
+    CHECK(freed == 0);
+    mummy_string_free(wrapped, 0);
+    free(buf);
+
+    /* an empty string is left as it is */
+    wrapped = mummy_string_wrap(data, 0);
+    CHECK(!mummy_string_decompress(wrapped, 0, &freed));
+    CHECK(freed == 0);
+    mummy_string_free(wrapped, 0);
+
+    mummy_string_free(str, 1);
+}
+
+static void
+test_invalid(void) {
+    char truncated[] = {MUMMY_TYPE_INT, 0, 0};
+    char unknown[] = {0x7f};
+    mummy_string *str;
+    mummy_token token;
+
+    str = mummy_string_wrap(truncated, sizeof(truncated));
+    CHECK(mummy_read_token(str, &token) == -1);
+    mummy_string_free(str, 0);
+
+    str = mummy_string_wrap(unknown, sizeof(unknown));
+    CHECK(mummy_read_token(str, &token) == -2);
+    mummy_string_free(str, 0);
+}
+
+/* walk events, written out as text */
+typedef struct {
+    char log[256];
+    int len;
+    const char *skip_key; /* SKIP from utf8 events with this value */
+    int skip_begin; /* SKIP from begin_* with this count */
+    int stop_after; /* STOP after this many events, if positive */
+} walk_log;
+
+static int
+walk_event(walk_log *log, const char *fmt, const char *data, long num) {
+    if (data)
+        log->len += snprintf(log->log + log->len, sizeof(log->log) - log->len,
+                fmt, (int)num, data);
+    else
+        log->len += snprintf(log->log + log->len, sizeof(log->log) - log->len,
+                fmt, num);
+    return !--log->stop_after ? MUMMY_WALK_STOP : 0;
+}
+
+static int
+walk_null(void *ctx) {
+    return walk_event(ctx, "n ", NULL, 0);
+}
+
+static int
+walk_integer(void *ctx, int64_t num) {
+    return walk_event(ctx, "i%ld ", NULL, (long)num);
+}
+
+static int
+walk_utf8(void *ctx, char *data, int len) {
+    walk_log *log = ctx;
+    int rc = walk_event(log, "u%.*s ", data, len);
+    if (log->skip_key && (int)strlen(log->skip_key) == len &&
+            !memcmp(log->skip_key, data, len))
+        return MUMMY_WALK_SKIP;
+    return rc;
+}
+
+static int
+walk_begin(walk_log *log, const char *fmt, uint32_t size) {
+    int rc = walk_event(log, fmt, NULL, size);
+    return (int)size == log->skip_begin ? MUMMY_WALK_SKIP : rc;
+}
+
+static int
+walk_list(void *ctx, uint32_t size) {
+    return walk_begin(ctx, "l%ld ", size);
+}
+
+static int
+walk_hash(void *ctx, uint32_t size) {
+    return walk_begin(ctx, "h%ld ", size);
+}
+
+static int
+walk_end(void *ctx) {
+    return walk_event(ctx, "e ", NULL, 0);
+}
+
+static int
+walk_other(void *ctx, mummy_token *token) {
+    return walk_event(ctx, "o%ld ", NULL, token->type);
+}
+
+static void
+test_walk(void) {
+    mummy_walk_callbacks callbacks = {0};
+    mummy_string *str = mummy_string_new(64);
+    mummy_walker walker;
+    walk_log log;
+    int len, i;
+
+    callbacks.null = walk_null;
+    callbacks.integer = walk_integer;
+    callbacks.utf8 = walk_utf8;
+    callbacks.begin_list = walk_list;
+    callbacks.begin_hash = walk_hash;
+    callbacks.end = walk_end;
+    callbacks.other = walk_other;
+
+    /* {"a": [1, [2, 3, 4]], "b": null} date(2000, 1, 1) */
+    mummy_open_hash(str, 2);
+    mummy_feed_utf8(str, "a", 1);
+    mummy_open_list(str, 2);
+    mummy_feed_int(str, 1);
+    mummy_open_list(str, 3);
+    mummy_feed_int(str, 2);
+    mummy_feed_int(str, 3);
+    mummy_feed_int(str, 4);
+    mummy_feed_utf8(str, "b", 1);
+    mummy_feed_null(str);
+    mummy_feed_date(str, 2000, 1, 1);
+    len = str->offset;
+    str->offset = 0;
+    str->len = len;
+
+    memset(&log, 0, sizeof(log));
+    mummy_walker_init(&walker, &callbacks, &log);
+    CHECK(!mummy_walk(&walker, str) && str->offset == len);
+    CHECK(!strcmp(log.log, "h2 ua l2 i1 l3 i2 i3 i4 e e ub n e o26 "));
+
+    /* skipping a container's contents and end, or a hash value */
+    memset(&log, 0, sizeof(log));
+    log.skip_begin = 3;
+    str->offset = 0;
+    mummy_walker_init(&walker, &callbacks, &log);
+    CHECK(!mummy_walk(&walker, str));
+    CHECK(!strcmp(log.log, "h2 ua l2 i1 l3 e ub n e o26 "));
+
+    memset(&log, 0, sizeof(log));
+    log.skip_key = "a";
+    str->offset = 0;
+    mummy_walker_init(&walker, &callbacks, &log);
+    CHECK(!mummy_walk(&walker, str));
+    CHECK(!strcmp(log.log, "h2 ua ub n e o26 "));
+
+    /* stopping, and carrying on again */
+    memset(&log, 0, sizeof(log));
+    log.stop_after = 4;
+    str->offset = 0;
+    mummy_walker_init(&walker, &callbacks, &log);
+    CHECK(mummy_walk(&walker, str) == MUMMY_WALK_STOP);
+    CHECK(!strcmp(log.log, "h2 ua l2 i1 "));
+    CHECK(!mummy_walk(&walker, str));
+    CHECK(!strcmp(log.log, "h2 ua l2 i1 l3 i2 i3 i4 e e ub n e o26 "));
+
+    /* the data arriving a byte at a time */
+    memset(&log, 0, sizeof(log));
+    str->offset = 0;
+    mummy_walker_init(&walker, &callbacks, &log);
+    for (i = 1; i <= len; ++i) {
+        str->len = i;
+        CHECK(mummy_walk(&walker, str) == (i == len || i == len - 5 ? 0 : -1));
+    }
+    CHECK(!strcmp(log.log, "h2 ua l2 i1 l3 i2 i3 i4 e e ub n e o26 "));
+
+    /* unknown types, and nesting too deep */
+    str->offset = 0;
+    str->len = 1;
+    str->data[0] = 0x7f;
+    mummy_walker_init(&walker, &callbacks, &log);
+    CHECK(mummy_walk(&walker, str) == -2 && !str->offset);
+
+    str->offset = 0;
+    for (i = 0; i <= MUMMY_WALK_MAX_DEPTH; ++i) mummy_open_list(str, 1);
+    mummy_feed_null(str);
+    rewind_string(str);
+    mummy_walker_init(&walker, &(mummy_walk_callbacks){0}, NULL);
+    CHECK(mummy_walk(&walker, str) == -3);
+    CHECK(str->offset == MUMMY_WALK_MAX_DEPTH * 2);
+
+    mummy_string_free(str, 1);
+}
+
+static void
+test_upgrade_legacy(void) {
+    /* [-106.1984, -Infinity, sNaN, 1] as the old format wrote it */
+    char legacy[] = {MUMMY_TYPE_SHORTLIST, 4,
+        MUMMY_TYPE_DECIMAL, 2, 0xff, 0xfc, 0, 7, 0x10, 0x61, 0x98, 0x40,
+        MUMMY_TYPE_DECIMAL, 7,
+        MUMMY_TYPE_DECIMAL, 9,
+        MUMMY_TYPE_CHAR, 1};
+    char expected[] = {MUMMY_TYPE_SHORTLIST, 4,
+        MUMMY_TYPE_DECIMAL, 1, 0xff, 0xfc, 0, 7, 0x01, 0x16, 0x89, 0x04,
+        MUMMY_TYPE_SPECIALNUM, MUMMY_SPECIAL_INFINITY | 1,
+        MUMMY_TYPE_SPECIALNUM, MUMMY_SPECIAL_NAN | 1,
+        MUMMY_TYPE_CHAR, 1};
+    mummy_string *str = mummy_string_wrap(legacy, sizeof(legacy));
+    mummy_string *out = mummy_string_new(4);
+
+    CHECK(!mummy_upgrade_legacy(str, out));
+    CHECK_BYTES(out, expected, sizeof(expected));
+
+    str->offset = 0;
+    str->len = 10;
+    out->offset = 0;
+    CHECK(mummy_upgrade_legacy(str, out) == -1);
+
+    mummy_string_free(str, 0);
+    mummy_string_free(out, 1);
+}
+
+/* mummy_from_json on a C string, onto the end of `out` */
+static int
+from_json(const char *text, mummy_string *out) {
+    mummy_string *str = mummy_string_wrap((char *)text, strlen(text));
+    int rc = mummy_from_json(str, out);
+    mummy_string_free(str, 0);
+    return rc;
+}
+
+static void
+test_json(void) {
+    mummy_string *str = mummy_string_new(64);
+    mummy_string *out = mummy_string_new(4);
+    mummy_string *back = mummy_string_new(4);
+    char huge[] = {1, 0, 0, 0, 0, 0, 0, 0, 0};
+    const char *expected;
+
+    /* {"a": [1, -2.5, None, True, 2 ** 64], "k\n": "x\"y\x01\u00e9"} */
+    mummy_open_hash(str, 2);
+    mummy_feed_utf8(str, "a", 1);
+    mummy_open_list(str, 5);
+    mummy_feed_int(str, 1);
+    mummy_feed_float(str, -2.5);
+    mummy_feed_null(str);
+    mummy_feed_bool(str, 1);
+    mummy_feed_huge(str, huge, sizeof(huge));
+    mummy_feed_utf8(str, "k\n", 2);
+    mummy_feed_utf8(str, "x\"y\x01\xc3\xa9", 6);
+    rewind_string(str);
+
+    expected = "{\"a\":[1,-2.5,null,true,18446744073709551616],"
+        "\"k\\n\":\"x\\\"y\\u0001\xc3\xa9\"}";
+    CHECK(!mummy_to_json(str, out));
+    CHECK_BYTES(out, expected, (int)strlen(expected));
+
+    /* and back again to the same bytes */
+    out->data[out->offset] = 0;
+    CHECK(!from_json(out->data, back));
+    CHECK_BYTES(back, str->data, str->len);
+
+    /* floats as python's repr has them */
+    out->offset = 0;
+    str->offset = 0;
+    mummy_open_list(str, 4);
+    mummy_feed_float(str, 0.1);
+    mummy_feed_float(str, 1e22);
+    mummy_feed_float(str, 1e15);
+    mummy_feed_float(str, 1e-5);
+    rewind_string(str);
+    expected = "[0.1,1e+22,1000000000000000.0,1e-05]";
+    CHECK(!mummy_to_json(str, out));
+    CHECK_BYTES(out, expected, (int)strlen(expected));
+
+    /* non-string keys are quoted, temporal types are ISO 8601 */
+    out->offset = 0;
+    str->offset = 0;
+    str->len = 64;
+    mummy_open_hash(str, 1);
+    mummy_feed_int(str, 7);
+    mummy_feed_datetime(str, 2000, 1, 2, 3, 4, 5, 6);
+    rewind_string(str);
+    expected = "{\"7\":\"2000-01-02T03:04:05.000006\"}";
+    CHECK(!mummy_to_json(str, out));
+    CHECK_BYTES(out, expected, (int)strlen(expected));
+
+    /* surrogate pairs come out as the one character */
+    back->offset = 0;
+    CHECK(!from_json(" \"\\ud83d\\ude00\" ", back));
+    CHECK(back->offset == 6 && !memcmp(back->data + 2, "\xf0\x9f\x98\x80", 4));
+
+    /* failures leave the output where it was */
+    back->offset = 0;
+    CHECK(from_json("[1, 2", back) == -1 && !back->offset);
+    CHECK(from_json("[1,]", back) == EINVAL && !back->offset);
+    CHECK(from_json("1 x", back) == EINVAL && !back->offset);
+    CHECK(from_json("\"\\udc00\"", back) == EINVAL);
+    CHECK(from_json("\"a\tb\"", back) == EINVAL);
+
+    mummy_string_free(str, 1);
+    str = mummy_string_new(MUMMY_WALK_MAX_DEPTH + 1);
+    memset(str->data, '[', MUMMY_WALK_MAX_DEPTH + 1);
+    CHECK(mummy_from_json(str, back) == -3 && !back->offset);
+
+    mummy_string_free(str, 1);
+    mummy_string_free(out, 1);
+    mummy_string_free(back, 1);
+}
+
+static void
+test_msgpack(void) {
+    mummy_string *str = mummy_string_new(64);
+    mummy_string *out = mummy_string_new(4);
+    mummy_string *back = mummy_string_new(4);
+    mummy_string *input;
+    char huge[] = {0, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+    char expected[] = {0x9b, 0x01, 0xff, 0xcd, 0x01, 0x2c,
+        0xa2, 'a', 'b', 0xc4, 0x01, 'c', 0x81, 0xa1, 'k', 0xc0,
+        0xcb, 0x3f, 0xf8, 0, 0, 0, 0, 0, 0, 0xc3,
+        0xcf, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+        /* 2000-01-02 03:04:05.000006 as a 64 bit timestamp */
+        0xd7, 0xff, 0, 0, 0x5d, 0xc0, 0x38, 0x6e, 0xc0, 0x25,
+        /* the date as its mummy bytes */
+        0xc7, 0x05, 0x4d, MUMMY_TYPE_DATE, 0x07, 0xd0, 1, 2};
+    char truncated[] = {0x92, 0x01};
+    char unused[] = {0xc1};
+    char unknown_ext[] = {0xd4, 0x05, 0x00};
+    char too_many[] = {0xdd, 0x7f, 0xff, 0xff, 0xff};
+
+    /* [1, -1, 300, "ab", b"c", {"k": None}, 1.5, True, 2 ** 64 - 1,
+        datetime(2000, 1, 2, 3, 4, 5, 6), date(2000, 1, 2)] */
+    mummy_open_list(str, 11);
+    mummy_feed_int(str, 1);
+    mummy_feed_int(str, -1);
+    mummy_feed_int(str, 300);
+    mummy_feed_utf8(str, "ab", 2);
+    mummy_feed_string(str, "c", 1);
+    mummy_open_hash(str, 1);
+    mummy_feed_utf8(str, "k", 1);
+    mummy_feed_null(str);
+    mummy_feed_float(str, 1.5);
+    mummy_feed_bool(str, 1);
+    mummy_feed_huge(str, huge, sizeof(huge));
+    mummy_feed_datetime(str, 2000, 1, 2, 3, 4, 5, 6);
+    mummy_feed_date(str, 2000, 1, 2);
+    rewind_string(str);
+
+    CHECK(!mummy_to_msgpack(str, out));
+    CHECK_BYTES(out, expected, (int)sizeof(expected));
+
+    /* everything comes back as it was */
+    rewind_string(out);
+    CHECK(!mummy_from_msgpack(out, back));
+    CHECK_BYTES(back, str->data, str->len);
+
+    /* before the epoch needs the 96 bit timestamp */
+    str->offset = 0;
+    str->len = 64;
+    out->offset = 0;
+    out->len = 4;
+    back->offset = 0;
+    mummy_feed_datetime(str, 1900, 12, 31, 23, 59, 59, 999999);
+    rewind_string(str);
+    CHECK(!mummy_to_msgpack(str, out));
+    CHECK(out->offset == 15 && (unsigned char)out->data[0] == 0xc7);
+    rewind_string(out);
+    CHECK(!mummy_from_msgpack(out, back));
+    CHECK_BYTES(back, str->data, str->len);
+
+    /* bigger than msgpack's ints */
+    str->offset = 0;
+    str->len = 64;
+    out->offset = 0;
+    huge[0] = 1;
+    mummy_feed_huge(str, huge, sizeof(huge));
+    rewind_string(str);
+    CHECK(mummy_to_msgpack(str, out) == EINVAL && !out->offset);
+
+    back->offset = 0;
+    input = mummy_string_wrap(truncated, sizeof(truncated));
+    CHECK(mummy_from_msgpack(input, back) == -1 && !back->offset);
+    mummy_string_free(input, 0);
+    input = mummy_string_wrap(unused, sizeof(unused));
+    CHECK(mummy_from_msgpack(input, back) == -2);
+    mummy_string_free(input, 0);
+    input = mummy_string_wrap(unknown_ext, sizeof(unknown_ext));
+    CHECK(mummy_from_msgpack(input, back) == EINVAL);
+    mummy_string_free(input, 0);
+    input = mummy_string_wrap(too_many, sizeof(too_many));
+    CHECK(mummy_from_msgpack(input, back) == -1 && !back->offset);
+    mummy_string_free(input, 0);
+
+    mummy_string_free(str, 1);
+    mummy_string_free(out, 1);
+    mummy_string_free(back, 1);
+}
+
+
+static void
+test_profile(void) {
+    mummy_string *str = mummy_string_new(64);
+    mummy_profile *profile = mummy_profile_new(1);
+    char tag[40];
+    int i;
+
+    memset(tag, 'a', sizeof(tag));
+    /* {"id": 300, "tag": "a" * 40} twice, then {"id": 70000} */
+    for (i = 0; i < 2; ++i) {
+        mummy_open_hash(str, 2);
+        mummy_feed_utf8(str, "id", 2);
+        mummy_feed_int(str, 300);
+        mummy_feed_utf8(str, "tag", 3);
+        mummy_feed_utf8(str, tag, sizeof(tag));
+    }
+    mummy_open_hash(str, 1);
+    mummy_feed_utf8(str, "id", 2);
+    mummy_feed_int(str, 70000);
+    rewind_string(str);
+
+    for (i = 0; i < 3; ++i) CHECK(!mummy_profile_add(profile, str));
+    CHECK(str->offset == str->len);
+    CHECK(mummy_profile_add(profile, str) == -1);
+
+    CHECK(profile->values == 3 && profile->bytes == 123);
+    CHECK(profile->counts[MUMMY_TYPE_SHORTHASH] == 3 &&
+            profile->sizes[MUMMY_TYPE_SHORTHASH] == 6);
+    CHECK(profile->counts[MUMMY_TYPE_SHORTUTF8] == 7 &&
+            profile->sizes[MUMMY_TYPE_SHORTUTF8] == 106);
+    CHECK(profile->counts[MUMMY_TYPE_SHORT] == 2 &&
+            profile->counts[MUMMY_TYPE_INT] == 1);
+    CHECK(profile->key_count == 5 && profile->key_bytes == 22 &&
+            profile->distinct_keys == 2);
+    CHECK(profile->header_bytes == 23);
+
+    /* 70000 zigzags into a 3 byte varint, the rest are no smaller */
+    CHECK(profile->varint_bytes == 122);
+    /* 10 bytes of references, 9 of table, instead of 22 of keys */
+    CHECK(profile->keytable_bytes == 120);
+
+    CHECK(profile->npaths == 3);
+    CHECK(!strcmp(profile->paths[0].path, "") &&
+            profile->paths[0].type == MUMMY_TYPE_SHORTHASH &&
+            profile->paths[0].items == 5 && profile->paths[0].bytes == 123);
+    /* the widest of the ints */
+    CHECK(!strcmp(profile->paths[1].path, ".id") &&
+            profile->paths[1].type == MUMMY_TYPE_INT &&
+            profile->paths[1].count == 3 && profile->paths[1].bytes == 11 &&
+            profile->paths[1].key_bytes == 12);
+    CHECK(!strcmp(profile->paths[2].path, ".tag") &&
+            profile->paths[2].bytes == 84 &&
+            profile->paths[2].compressed < 84);
+
+    CHECK(!strcmp(mummy_type_name(MUMMY_TYPE_MEDUTF8), "medutf8"));
+    CHECK(!mummy_type_name(MUMMY_PROFILE_TYPES));
+
+    mummy_profile_free(profile);
+    mummy_string_free(str, 1);
+}
+
+static void
+test_stats(void) {
+    mummy_string *str = mummy_string_new(4);
+    mummy_stats stats;
+    char text[100], free_buf;
+    int start;
+
+    memset(text, 'x', sizeof(text));
+    mummy_stats_reset();
+    /* ["x" * 100], reported the way an encoder would */
+    mummy_open_list(str, 1);
+    start = str->offset;
+    mummy_feed_utf8(str, text, sizeof(text));
+    mummy_stats_encoded(str, start, 2);
+    mummy_stats_encoded(str, 0, 1);
+    mummy_string_compress(str);
+    rewind_string(str);
+    CHECK(!mummy_string_decompress(str, 1, &free_buf));
+    mummy_stats_read(&stats);
+
+    if (!mummy_stats_enabled()) {
+        /* built without MUMMY_STATS, nothing counts */
+        CHECK(!mummy_stats_local());
+        CHECK(!stats.encodes && !stats.reallocs && !stats.compress_attempts);
+        mummy_string_free(str, 1);
+        return;
+    }
+
+    CHECK(stats.encodes == 1 && stats.encoded_bytes == 104);
+    CHECK(stats.encoded_types[MUMMY_TYPE_SHORTLIST] == 1 &&
+            stats.encoded_types[MUMMY_TYPE_SHORTUTF8] == 1);
+    CHECK(stats.max_depth == 2);
+    CHECK(stats.reallocs > 0);
+    CHECK(stats.compress_attempts == 1 && stats.compress_saves == 1 &&
+            stats.compress_bytes_in == 104 && stats.compress_bytes_out < 104);
+    CHECK(stats.decompressions == 1 && stats.decompressed_bytes == 104);
+
+    mummy_stats_reset();
+    mummy_stats_read(&stats);
+    CHECK(!stats.encodes && !stats.reallocs);
+
+    mummy_string_free(str, 1);
+}
+
+static void
+test_alloc(void) {
+    mummy_alloc_stats stats, inner, *previous;
+    mummy_string *str;
+    char text[100], free_buf;
+    int tracking = mummy_alloc_tracking();
+
+    memset(&stats, 0, sizeof(stats));
+    memset(text, 'x', sizeof(text));
+    previous = mummy_alloc_track(&stats);
+    CHECK(!previous);
+
+    str = mummy_string_new(4);
+    mummy_feed_utf8(str, text, sizeof(text));
+    mummy_string_compress(str);
+    rewind_string(str);
+    CHECK(!mummy_string_decompress(str, 1, &free_buf));
+    mummy_string_free(str, 1);
+
+    /* the counts go where the innermost mummy_alloc_track said */
+    memset(&inner, 0, sizeof(inner));
+    CHECK(mummy_alloc_track(&inner) == (tracking ? &stats : NULL));
+    str = mummy_string_new(16);
+    CHECK(mummy_alloc_track(NULL) == (tracking ? &inner : NULL));
+    mummy_string_free(str, 1);
+
+    if (!tracking) {
+        /* built without MUMMY_TRACK_ALLOC, nothing counts */
+        CHECK(!stats.allocs && !stats.frees && !stats.peak);
+        CHECK(!inner.allocs);
+        return;
+    }
+
+    CHECK(stats.allocs > stats.frees && stats.frees > 0);
+    CHECK(stats.peak >= 103 && stats.bytes >= stats.peak);
+    CHECK(stats.live == 0);
+    CHECK(inner.allocs == 2 && !inner.frees && inner.live >= 16);
+}
+
+
+int
+main(void) {
+    test_version();
+    test_ints();
+    test_atoms();
+    test_string_sizes();
+    test_containers();
+    test_temporal();
+    test_numbers();
+    test_compression();
+    test_invalid();
+    test_upgrade_legacy();
+    test_walk();
+    test_json();
+    test_msgpack();
+    test_profile();
+    test_stats();
+    test_alloc();
+
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,372 @@
+/*
+ * tests for the header-only C++ API in mummy.hpp
+ */
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+
+#include "mummy.hpp"
+
+
+namespace app {
+
+struct point {
+    int x;
+    int y;
+
+    bool operator==(const point &o) const { return x == o.x && y == o.y; }
+};
+MUMMY_STRUCT(point, x, y)
+
+struct user {
+    std::int64_t id;
+    std::string name;
+    std::optional<std::string> email;
+    std::optional<int> age;
+    std::vector<point> path;
+
+    bool operator==(const user &o) const {
+        return id == o.id && name == o.name && email == o.email &&
+            age == o.age && path == o.path;
+    }
+};
+MUMMY_STRUCT(user, id, name, email, age, path)
+
+} // namespace app
+
+
+static int failures = 0;
+
+#define CHECK(cond) do {                                                   \
+        if (!(cond)) {                                                     \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n",              \
+                    __FILE__, __LINE__, #cond);                            \
+            ++failures;                                                    \
+        }                                                                  \
+    } while (0)
+
+/* the expression throws mummy::error */
+#define CHECK_THROWS(expr) do {                                            \
+        bool thrown = false;                                               \
+        try { (void)(expr); } catch (const mummy::error &) { thrown = true; } \
+        CHECK(thrown && #expr);                                            \
+    } while (0)
+
+template <class T>
+static bool
+round_trips(const T &value) {
+    mummy::buffer data = mummy::encode(value, false);
+    mummy::reader in(data);
+    return in.decode<T>() == value && in.done();
+}
+
+/* what mummy_feed_int writes for the same value */
+static std::string
+c_int(int64_t value) {
+    mummy_string *str = mummy_string_new(16);
+    mummy_feed_int(str, value);
+    std::string result(str->data, str->offset);
+    mummy_string_free(str, 1);
+    return result;
+}
+
+template <class T>
+static bool
+same_as_c(T value) {
+    return std::string(mummy::encode(value, false).view()) ==
+        c_int(int64_t(value));
+}
+
+
+static void
+test_ints() {
+    const int64_t values[] = {0, -1, 127, -128, 128, -129, 32767, -32768,
+        32768, 2147483647LL, -2147483647LL - 1, 2147483648LL,
+        std::numeric_limits<int64_t>::max(),
+        std::numeric_limits<int64_t>::min()};
+
+    for (int64_t value : values) {
+        CHECK(same_as_c(value));
+        CHECK(round_trips(value));
+        if (mummy::detail::fits<int32_t>(value)) {
+            CHECK(same_as_c(int32_t(value)));
+            CHECK(round_trips(int32_t(value)));
+        }
+        if (value >= 0) {
+            CHECK(same_as_c(uint64_t(value)));
+            CHECK(round_trips(uint64_t(value)));
+        }
+    }
+
+    CHECK(same_as_c(int8_t(-128)));
+    CHECK(same_as_c(uint8_t(255)));
+    CHECK(same_as_c(uint16_t(65535)));
+    CHECK(same_as_c(uint32_t(4294967295U)));
+    CHECK(round_trips(uint8_t(255)));
+    CHECK(round_trips(uint32_t(4294967295U)));
+
+    /* past INT64_MAX is a huge, as python writes it */
+    const uint64_t big = std::numeric_limits<uint64_t>::max();
+    CHECK(mummy::encode(big, false).view() == std::string_view(
+            "\x06\x00\x00\x00\x09\x00\xff\xff\xff\xff\xff\xff\xff\xff", 14));
+    CHECK(round_trips(big));
+    CHECK(round_trips(uint64_t(1) << 63));
+    CHECK_THROWS(mummy::decode<int64_t>(mummy::encode(big, false).view()));
+
+    /* narrowing on the way out checks the range */
+    CHECK_THROWS(mummy::decode<int8_t>(mummy::encode(200, false).view()));
+    CHECK_THROWS(mummy::decode<uint32_t>(mummy::encode(-1, false).view()));
+    CHECK(mummy::decode<int16_t>(mummy::encode(-300, false).view()) == -300);
+}
+
+static void
+test_atoms() {
+    CHECK(round_trips(true));
+    CHECK(round_trips(false));
+    CHECK(round_trips(nullptr));
+    CHECK(round_trips(1.5));
+    CHECK(round_trips(-0.25f));
+    CHECK(round_trips(std::numeric_limits<double>::infinity()));
+    CHECK(std::isnan(mummy::decode<double>(mummy::encode(
+            std::numeric_limits<double>::quiet_NaN(), false).view())));
+
+    /* ints read as floats, not the other way around */
+    CHECK(mummy::decode<double>(mummy::encode(7, false).view()) == 7.0);
+    CHECK_THROWS(mummy::decode<int>(mummy::encode(7.0, false).view()));
+    CHECK_THROWS(mummy::decode<bool>(mummy::encode(1, false).view()));
+
+    mummy_string *str = mummy_string_new(16);
+    mummy_feed_float(str, 1.5);
+    CHECK(mummy::encode(1.5, false).view() ==
+            std::string_view(str->data, str->offset));
+    mummy_string_free(str, 1);
+}
+
+static void
+test_strings() {
+    CHECK(round_trips(std::string()));
+    CHECK(round_trips(std::string("mummy")));
+    CHECK(round_trips(std::string(300, 'x')));
+    CHECK(round_trips(std::string(70000, 'y')));
+
+    CHECK(mummy::encode("abc", false).view() ==
+            std::string_view("\x0a\x03" "abc", 5));
+    CHECK(mummy::encode(std::string_view("abc"), false).view() ==
+            std::string_view("\x0a\x03" "abc", 5));
+
+    mummy::buffer raw = mummy::encode(mummy::bytes_view{"abc"}, false);
+    CHECK(raw.view() == std::string_view("\x08\x03" "abc", 5));
+    CHECK(mummy::decode<std::string>(raw.view()) == "abc");
+
+    /* string_views point into the data they were read from */
+    mummy::reader in(raw);
+    std::string_view view = in.decode<std::string_view>();
+    CHECK(view == "abc" && view.data() == raw.data() + 2);
+}
+
+static void
+test_containers() {
+    std::vector<int> ints{1, -2, 300, 70000};
+    CHECK(round_trips(ints));
+    CHECK(round_trips(std::vector<std::string>{"a", "", "bc"}));
+    CHECK(round_trips(std::vector<bool>{true, false}));
+    CHECK(round_trips(std::vector<std::vector<double>>{{1.5}, {}}));
+
+    std::map<std::string, std::vector<int>> hash{{"a", {1}}, {"b", {}}};
+    CHECK(round_trips(hash));
+    std::unordered_map<int, std::string> umap{{1, "one"}, {2, "two"}};
+    CHECK(round_trips(umap));
+
+    CHECK(round_trips(std::optional<int>()));
+    CHECK(round_trips(std::optional<int>(5)));
+    CHECK(round_trips(std::vector<std::optional<std::string>>{
+                std::nullopt, "x"}));
+
+    /* the same bytes as the C API */
+    mummy_string *str = mummy_string_new(16);
+    mummy_open_hash(str, 1);
+    mummy_feed_utf8(str, const_cast<char *>("a"), 1);
+    mummy_open_list(str, 1);
+    mummy_feed_int(str, 1);
+    CHECK(mummy::encode(std::map<std::string, std::vector<int>>{{"a", {1}}},
+                false).view() == std::string_view(str->data, str->offset));
+    mummy_string_free(str, 1);
+
+    /* vectors read any sequence */
+    mummy::writer out;
+    out.open_tuple(2).encode(1).encode(2);
+    CHECK((mummy::decode<std::vector<int>>(out.view()) ==
+                std::vector<int>{1, 2}));
+    CHECK_THROWS((mummy::decode<std::map<int, int>>(out.view())));
+
+    /* skip steps over whole containers */
+    out.clear();
+    out.encode(hash).encode(42);
+    mummy::reader in(out.view());
+    in.skip();
+    CHECK(in.decode<int>() == 42 && in.done());
+}
+
+static void
+test_chrono() {
+    using namespace std::chrono;
+
+    CHECK(round_trips(microseconds(0)));
+    CHECK(round_trips(microseconds(-1)));
+    CHECK(round_trips(hours(-50)));
+    CHECK(round_trips(seconds(86400 * 3 + 7)));
+
+    /* normalized like a python timedelta */
+    mummy_string *str = mummy_string_new(16);
+    mummy_feed_timedelta(str, -1, 86399, 999999);
+    CHECK(mummy::encode(microseconds(-1), false).view() ==
+            std::string_view(str->data, str->offset));
+
+    str->offset = 0;
+    mummy_feed_datetime(str, 2009, 2, 13, 23, 31, 30, 250000);
+    system_clock::time_point when(microseconds(1234567890250000LL));
+    CHECK(mummy::encode(when, false).view() ==
+            std::string_view(str->data, str->offset));
+    CHECK(round_trips(when));
+    CHECK(round_trips(time_point_cast<seconds>(system_clock::time_point())));
+    CHECK(round_trips(system_clock::time_point(microseconds(
+                        -2208988800000000LL - 1))));
+
+    /* a date reads as its midnight */
+    str->offset = 0;
+    mummy_feed_date(str, 1970, 1, 2);
+    CHECK(mummy::decode<system_clock::time_point>(
+                std::string_view(str->data, str->offset)) ==
+            system_clock::time_point(hours(24)));
+    mummy_string_free(str, 1);
+}
+
+static void
+test_buffers() {
+    std::vector<std::string> value(100, "a fairly compressible string");
+    mummy::buffer data = mummy::encode(value);
+    CHECK(data.compressed());
+    CHECK(mummy::decode<decltype(value)>(data.view()) == value);
+
+    /* moves leave the old buffer empty */
+    mummy::buffer moved(std::move(data));
+    CHECK(data.empty() && data.data() == nullptr);
+    CHECK(moved.compressed());
+
+    mummy_string *str = moved.release();
+    CHECK(moved.empty());
+    mummy::buffer adopted(str);
+    CHECK(adopted.compressed());
+
+    /* a finished writer starts over */
+    mummy::writer out(1);
+    out.encode(1);
+    mummy::buffer first = out.finish(false);
+    out.encode(2);
+    CHECK(first.view() == std::string_view("\x02\x01", 2));
+    CHECK(out.view() == std::string_view("\x02\x02", 2));
+}
+
+static void
+test_structs() {
+    using app::point;
+    using app::user;
+
+    user bob{7, "bob", std::nullopt, 40, {{1, 2}, {3, -4}}};
+    CHECK(round_trips(bob));
+    CHECK(round_trips(user{}));
+    CHECK(round_trips(std::vector<user>{bob, user{}}));
+
+    /* a hash of the fields that are there, in order */
+    mummy::writer out;
+    out.open_hash(2).encode("x").encode(1).encode("y").encode(2);
+    CHECK(mummy::encode(point{1, 2}, false).view() == out.view());
+
+    /* which reads in any order, skipping keys that aren't fields */
+    out.clear();
+    out.open_hash(3).encode("y").encode(2).encode("z").encode(
+            std::vector<int>{5}).encode("x").encode(1);
+    CHECK(mummy::decode<point>(out.view()) == (point{1, 2}));
+
+    out.clear();
+    out.open_hash(1).encode("name").encode("al");
+    user al = mummy::decode<user>(out.view());
+    CHECK(al.name == "al" && al.id == 0 && !al.email && al.path.empty());
+    CHECK_THROWS(mummy::decode<point>(mummy::encode(5, false).view()));
+
+    /* a schemas.Message: required fields by name, then optional ones */
+    const auto message = mummy::layout::message;
+    out.clear();
+    out.open_list(5).encode(7).encode("bob");
+    out.open_list(2).open_list(2).encode(1).encode(2);
+    out.open_list(2).encode(3).encode(-4);
+    out.encode(40).write_null();
+    CHECK(mummy::encode(bob, false, message).view() == out.view());
+
+    mummy::buffer data = mummy::encode(bob, true, message);
+    CHECK(mummy::decode<user>(data.view(), message) == bob);
+
+    /* trailing items are skipped, missing optional ones left empty */
+    out.clear();
+    out.open_list(3).encode(2).encode(1).encode("extra");
+    CHECK(mummy::decode<point>(out.view(), message) == (point{2, 1}));
+    out.clear();
+    out.open_list(3).encode(1).encode("x").open_list(0);
+    CHECK(mummy::decode<user>(out.view(), message) == (user{1, "x", std::nullopt, std::nullopt, {}}));
+    CHECK_THROWS(mummy::decode<user>(out.view()));
+    out.clear();
+    out.open_list(1).encode(1);
+    CHECK_THROWS(mummy::decode<point>(out.view(), message));
+
+    /* maps in messages go flat, as schemas has them */
+    std::map<std::string, int> counts{{"a", 1}, {"b", 2}};
+    out.clear();
+    out.open_list(4).encode("a").encode(1).encode("b").encode(2);
+    CHECK(mummy::encode(counts, false, message).view() == out.view());
+    CHECK(mummy::decode<decltype(counts)>(out.view(), message) == counts);
+}
+
+static void
+test_invalid() {
+    CHECK_THROWS(mummy::decode<int>(std::string_view()));
+    CHECK_THROWS(mummy::decode<int>(std::string_view("\x04\x00", 2)));
+    CHECK_THROWS(mummy::decode<int>(std::string_view("\x7f", 1)));
+    CHECK_THROWS(mummy::decode<std::string>(std::string_view("\x0a\x05" "ab")));
+    CHECK_THROWS(mummy::decode<std::vector<int>>(
+                std::string_view("\x0c\x02\x02\x01", 4)));
+    CHECK_THROWS(mummy::decode<int>(
+                std::string_view("\x82\x00\x00\x00\x09\xff", 6)));
+    /* counts the rest of the input can't hold, before anything is
+       reserved for them */
+    CHECK_THROWS(mummy::decode<std::vector<int64_t>>(
+                std::string_view("\x0c\xff\xff\xff\xf0", 5)));
+    CHECK_THROWS((mummy::decode<std::map<int, int>>(
+                std::string_view("\x0f\x00\x00\x00\x01\x02\x05", 7))));
+
+    try {
+        mummy::decode<int>(std::string_view("\x7f", 1));
+    } catch (const mummy::error &err) {
+        CHECK(err.code() == -2);
+    }
+}
+
+
+int
+main() {
+    test_ints();
+    test_atoms();
+    test_strings();
+    test_containers();
+    test_chrono();
+    test_buffers();
+    test_structs();
+    test_invalid();
+
+    if (failures) {
+        std::fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("all checks passed\n");
+    return 0;
+}
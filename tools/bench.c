@@ -0,0 +1,758 @@
+/*
+ * microbenchmarks for the C library on its own, without python in the way.
+ * each benchmark runs a batch of calls to one primitive; batches are
+ * repeated until a sample takes long enough, and the median sample is
+ * reported per call. with -p the cycles, branch misses and cache misses come
+ * from perf_event_open, otherwise cycles are read from the TSC where there
+ * is one. allocations are counted when the build wraps malloc (see
+ * CMakeLists.txt), which catches every one the library makes.
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#define HAVE_PERF 1
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#include "mummy.h"
+
+
+static const char usage[] =
+"usage: mummy_bench [options] [name ...]\n"
+"\n"
+"runs the benchmarks whose names contain any of the names given, or all\n"
+"of them.\n"
+"\n"
+"options:\n"
+"  -f FILE      also run the payload benchmarks over a mummy value read\n"
+"               from FILE (compressed or not)\n"
+"  -r           FILE is records, as dump_records writes them\n"
+"  -t SECONDS   how long to spend timing each benchmark (0.5)\n"
+"  -n SAMPLES   how many samples that time is split into (10)\n"
+"  -p           read cycles, branch misses and cache misses from perf\n"
+"  -l           list the benchmarks\n";
+
+#define BATCH 1024
+
+
+/*
+ * counting allocations, when linked with -Wl,--wrap=malloc and the rest
+ */
+
+static uint64_t allocations;
+static uint64_t allocated;
+
+#ifdef MUMMY_BENCH_WRAP
+void *__real_malloc(size_t);
+void *__real_calloc(size_t, size_t);
+void *__real_realloc(void *, size_t);
+
+void *
+__wrap_malloc(size_t size) {
+    allocations++;
+    allocated += size;
+    return __real_malloc(size);
+}
+
+void *
+__wrap_calloc(size_t count, size_t size) {
+    allocations++;
+    allocated += count * size;
+    return __real_calloc(count, size);
+}
+
+void *
+__wrap_realloc(void *ptr, size_t size) {
+    allocations++;
+    allocated += size;
+    return __real_realloc(ptr, size);
+}
+#endif
+
+
+/*
+ * cycles and perf counters
+ */
+
+enum { COUNTER_CYCLES, COUNTER_BRANCH_MISSES, COUNTER_CACHE_MISSES,
+    COUNTERS };
+
+typedef struct {
+    int fds[COUNTERS];
+    char on;
+} counters;
+
+static void
+open_counters(counters *pc) {
+#ifdef HAVE_PERF
+    static const uint64_t configs[COUNTERS] = {PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES};
+    struct perf_event_attr attr;
+    int i;
+
+    for (i = 0; i < COUNTERS; ++i) {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[i];
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        pc->fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (pc->fds[i] < 0) {
+            fprintf(stderr, "mummy_bench: perf counters unavailable: %s\n",
+                    strerror(errno));
+            while (i--) close(pc->fds[i]);
+            return;
+        }
+    }
+    pc->on = 1;
+#else
+    fputs("mummy_bench: perf counters are only on linux\n", stderr);
+#endif
+}
+
+static void
+start_counters(counters *pc) {
+#ifdef HAVE_PERF
+    int i;
+    if (!pc->on) return;
+    for (i = 0; i < COUNTERS; ++i) {
+        ioctl(pc->fds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(pc->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+}
+
+static void
+stop_counters(counters *pc, uint64_t *values) {
+#ifdef HAVE_PERF
+    int i;
+    if (!pc->on) return;
+    for (i = 0; i < COUNTERS; ++i) {
+        ioctl(pc->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        if (read(pc->fds[i], &values[i], sizeof(uint64_t)) !=
+                sizeof(uint64_t))
+            values[i] = 0;
+    }
+#endif
+}
+
+static void
+close_counters(counters *pc) {
+    int i;
+    if (!pc->on) return;
+    for (i = 0; i < COUNTERS; ++i) close(pc->fds[i]);
+}
+
+static uint64_t
+tsc(void) {
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static double
+now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/*
+ * the benchmarks
+ */
+
+typedef struct {
+    mummy_string *out; /* what the feed benchmarks write into */
+    mummy_string *in; /* what the read benchmarks read, from their setup */
+    mummy_string *payload; /* a whole value (or several) */
+    mummy_string *packed; /* and compressed */
+    int64_t ints[BATCH];
+    double floats[BATCH];
+    char text[BATCH];
+    uint64_t bytes; /* gone through in the last batch */
+    volatile uint64_t sink;
+} context;
+
+typedef struct {
+    const char *name;
+    int (*setup)(context *);
+    long (*run)(context *); /* returns the calls it made */
+    char payload; /* runs over each payload */
+} benchmark;
+
+/* the reads go over what the matching feed writes */
+static void
+reuse_output(context *c) {
+    mummy_string *swap = c->in;
+    c->in = c->out;
+    c->out = swap;
+    c->in->len = c->in->offset;
+    c->in->offset = 0;
+}
+
+static long
+run_feed_int(context *c) {
+    int i;
+    c->out->offset = 0;
+    for (i = 0; i < BATCH; ++i) mummy_feed_int(c->out, c->ints[i]);
+    c->bytes = c->out->offset;
+    return BATCH;
+}
+
+static long
+run_feed_float(context *c) {
+    int i;
+    c->out->offset = 0;
+    for (i = 0; i < BATCH; ++i) mummy_feed_float(c->out, c->floats[i]);
+    c->bytes = c->out->offset;
+    return BATCH;
+}
+
+/* short strings of 1 to 32 bytes */
+static long
+run_feed_string(context *c) {
+    int i;
+    c->out->offset = 0;
+    for (i = 0; i < BATCH; ++i)
+        mummy_feed_string(c->out, c->text + (i & 63), 1 + (i & 31));
+    c->bytes = c->out->offset;
+    return BATCH;
+}
+
+/* medium ones of 256 to 767 */
+static long
+run_feed_utf8(context *c) {
+    int i;
+    c->out->offset = 0;
+    for (i = 0; i < BATCH / 4; ++i)
+        mummy_feed_utf8(c->out, c->text, 256 + (i * 2));
+    c->bytes = c->out->offset;
+    return BATCH / 4;
+}
+
+/* headers of all three widths */
+static long
+run_open_containers(context *c) {
+    int i;
+    c->out->offset = 0;
+    for (i = 0; i < BATCH; ++i) {
+        if (i & 1) mummy_open_hash(c->out, (int)(c->ints[i] & 0x1ffff));
+        else mummy_open_list(c->out, (int)(c->ints[i] & 0x1ffff));
+    }
+    c->bytes = c->out->offset;
+    return BATCH;
+}
+
+static int
+setup_ints(context *c) {
+    run_feed_int(c);
+    reuse_output(c);
+    return 0;
+}
+
+static int
+setup_floats(context *c) {
+    run_feed_float(c);
+    reuse_output(c);
+    return 0;
+}
+
+static int
+setup_strings(context *c) {
+    run_feed_string(c);
+    reuse_output(c);
+    return 0;
+}
+
+static int
+setup_utf8(context *c) {
+    run_feed_utf8(c);
+    reuse_output(c);
+    return 0;
+}
+
+static int
+setup_containers(context *c) {
+    run_open_containers(c);
+    reuse_output(c);
+    return 0;
+}
+
+static long
+run_read_int(context *c) {
+    int64_t value;
+    long calls = 0;
+    c->in->offset = 0;
+    while (c->in->offset < c->in->len && !mummy_read_int(c->in, &value)) {
+        c->sink += value;
+        ++calls;
+    }
+    c->bytes = c->in->offset;
+    return calls;
+}
+
+static long
+run_read_float(context *c) {
+    double value;
+    long calls = 0;
+    c->in->offset = 0;
+    while (c->in->offset < c->in->len && !mummy_read_float(c->in, &value)) {
+        c->sink += (uint64_t)value;
+        ++calls;
+    }
+    c->bytes = c->in->offset;
+    return calls;
+}
+
+static long
+run_read_string(context *c) {
+    char *data;
+    int len;
+    long calls = 0;
+    c->in->offset = 0;
+    while (c->in->offset < c->in->len &&
+            !mummy_point_to_string(c->in, &data, &len)) {
+        c->sink += len + *data;
+        ++calls;
+    }
+    c->bytes = c->in->offset;
+    return calls;
+}
+
+static long
+run_read_utf8(context *c) {
+    char *data;
+    int len;
+    long calls = 0;
+    c->in->offset = 0;
+    while (c->in->offset < c->in->len &&
+            !mummy_point_to_utf8(c->in, &data, &len)) {
+        c->sink += len + *data;
+        ++calls;
+    }
+    c->bytes = c->in->offset;
+    return calls;
+}
+
+static long
+run_container_size(context *c) {
+    uint32_t size;
+    long calls = 0;
+    c->in->offset = 0;
+    while (c->in->offset < c->in->len &&
+            !mummy_container_size(c->in, &size)) {
+        c->sink += size;
+        ++calls;
+    }
+    c->bytes = c->in->offset;
+    return calls;
+}
+
+static long
+run_read_token(context *c) {
+    mummy_token token;
+    long calls = 0;
+    c->payload->offset = 0;
+    while (c->payload->offset < c->payload->len &&
+            !mummy_read_token(c->payload, &token)) {
+        c->sink += token.type;
+        ++calls;
+    }
+    c->bytes = c->payload->offset;
+    return calls;
+}
+
+static long
+run_walk(context *c) {
+    static const mummy_walk_callbacks none;
+    mummy_walker walker;
+
+    c->payload->offset = 0;
+    mummy_walker_init(&walker, &none, NULL);
+    c->sink += mummy_walk(&walker, c->payload);
+    c->bytes = c->payload->offset;
+    return 1;
+}
+
+/* compress replaces the buffer, so each call gets a fresh copy */
+static long
+run_compress(context *c) {
+    mummy_string *str = mummy_string_new(c->payload->len);
+    memcpy(str->data, c->payload->data, c->payload->len);
+    str->offset = c->payload->len;
+    c->sink += mummy_string_compress(str);
+    mummy_string_free(str, 1);
+    c->bytes = c->payload->len;
+    return 1;
+}
+
+static int
+setup_packed(context *c) {
+    if (c->packed) mummy_string_free(c->packed, 1);
+    if (!(c->packed = mummy_string_new(c->payload->len))) return ENOMEM;
+    memcpy(c->packed->data, c->payload->data, c->payload->len);
+    c->packed->offset = c->payload->len;
+    return mummy_string_compress(c->packed);
+}
+
+static long
+run_decompress(context *c) {
+    mummy_string str = *c->packed;
+    char freed;
+
+    if (!mummy_string_decompress(&str, 0, &freed) && freed) free(str.data);
+    c->bytes = c->payload->len;
+    return 1;
+}
+
+static const benchmark benchmarks[] = {
+    {"feed_int", NULL, run_feed_int, 0},
+    {"feed_float", NULL, run_feed_float, 0},
+    {"feed_string", NULL, run_feed_string, 0},
+    {"feed_utf8", NULL, run_feed_utf8, 0},
+    {"open_containers", NULL, run_open_containers, 0},
+    {"read_int", setup_ints, run_read_int, 0},
+    {"read_float", setup_floats, run_read_float, 0},
+    {"point_to_string", setup_strings, run_read_string, 0},
+    {"point_to_utf8", setup_utf8, run_read_utf8, 0},
+    {"container_size", setup_containers, run_container_size, 0},
+    {"read_token", NULL, run_read_token, 1},
+    {"walk", NULL, run_walk, 1},
+    {"compress", NULL, run_compress, 1},
+    {"decompress", setup_packed, run_decompress, 1},
+    {NULL, NULL, NULL, 0}
+};
+
+
+/*
+ * payloads
+ */
+
+/* 200 records of the sort a service would send */
+static mummy_string *
+synthetic_payload(context *c) {
+    mummy_string *str = mummy_string_new(4096);
+    int i;
+
+    if (!str) return NULL;
+    mummy_open_list(str, 200);
+    for (i = 0; i < 200; ++i) {
+        mummy_open_hash(str, 7);
+        mummy_feed_utf8(str, "id", 2);
+        mummy_feed_int(str, c->ints[i]);
+        mummy_feed_utf8(str, "name", 4);
+        mummy_feed_utf8(str, c->text + (i & 63), 8 + (i & 15));
+        mummy_feed_utf8(str, "score", 5);
+        mummy_feed_float(str, c->floats[i]);
+        mummy_feed_utf8(str, "active", 6);
+        mummy_feed_bool(str, i & 1);
+        mummy_feed_utf8(str, "created", 7);
+        mummy_feed_datetime(str, 2020, 1 + i % 12, 1 + i % 28, i % 24,
+                i % 60, i % 60, i * 1000);
+        mummy_feed_utf8(str, "tags", 4);
+        mummy_open_list(str, 3);
+        mummy_feed_string(str, "red", 3);
+        mummy_feed_string(str, "green", 5);
+        mummy_feed_string(str, "blue", 4);
+        mummy_feed_utf8(str, "extra", 5);
+        mummy_feed_null(str);
+    }
+    str->len = str->offset;
+    str->offset = 0;
+    return str;
+}
+
+static int
+append(mummy_string *str, const char *data, int len) {
+    mummy_string_makespace(str, len);
+    memcpy(str->data + str->offset, data, len);
+    str->offset += len;
+    return 0;
+}
+
+/* one value, or with `records` all of them one after another, decompressed */
+static mummy_string *
+file_payload(const char *name, int records) {
+    mummy_string *str, *value;
+    FILE *fp;
+    char *data = NULL, *grown, freed;
+    size_t len = 0, cap = 0, got, at;
+    uint32_t size;
+
+    if (!(fp = fopen(name, "rb"))) {
+        fprintf(stderr, "mummy_bench: %s: %s\n", name, strerror(errno));
+        return NULL;
+    }
+    do {
+        if (len == cap) {
+            cap = cap ? cap * 2 : 1 << 16;
+            if (!(grown = realloc(data, cap))) {
+                free(data);
+                fclose(fp);
+                return NULL;
+            }
+            data = grown;
+        }
+        len += (got = fread(data + len, 1, cap - len, fp));
+    } while (got);
+    fclose(fp);
+
+    if (!(str = mummy_string_new(len ? len : 1))) {
+        free(data);
+        return NULL;
+    }
+    for (at = 0; at < len; at += size) {
+        if (records) {
+            if (len - at < 4) break;
+            memcpy(&size, data + at, 4);
+            size = ntohl(size);
+            at += 4;
+            if (size > len - at) break;
+        } else {
+            size = len;
+        }
+        value = mummy_string_wrap(data + at, size);
+        if (!size || mummy_string_decompress(value, 0, &freed)) {
+            mummy_string_free(value, 0);
+            break;
+        }
+        if (append(str, value->data, value->len)) {
+            mummy_string_free(value, freed);
+            break;
+        }
+        mummy_string_free(value, freed);
+    }
+    free(data);
+
+    /* it has to walk cleanly, or the benchmarks measure the error path */
+    if (at == len && str->offset) {
+        static const mummy_walk_callbacks none;
+        mummy_walker walker;
+
+        str->len = str->offset;
+        str->offset = 0;
+        mummy_walker_init(&walker, &none, NULL);
+        if (mummy_walk(&walker, str) || str->offset != str->len) at = 0;
+    }
+    if (at != len || !str->len) {
+        fprintf(stderr, "mummy_bench: %s: not %s\n", name,
+                records ? "mummy records" : "a mummy value");
+        mummy_string_free(str, 1);
+        return NULL;
+    }
+    str->offset = 0;
+    return str;
+}
+
+
+/*
+ * timing
+ */
+
+typedef struct {
+    double seconds;
+    int samples;
+    counters perf;
+} options;
+
+static int
+compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void
+measure(context *c, const benchmark *b, const char *label, options *opts) {
+    double start, elapsed, per_sample = opts->seconds / opts->samples;
+    double times[64], median;
+    uint64_t counts[COUNTERS] = {0, 0, 0}, calls = 0, bytes = 0, cycles;
+    uint64_t allocs, before;
+    long batches = 1, i, ops = 0;
+    int s;
+
+    /* as many batches as fill a sample, which also warms up */
+    while (1) {
+        start = now();
+        for (i = 0; i < batches; ++i) b->run(c);
+        if ((elapsed = now() - start) >= per_sample) break;
+        batches = elapsed > 0 && per_sample / elapsed < 2 * batches ?
+            (long)(batches * 1.2 * per_sample / elapsed) + 1 : batches * 2;
+    }
+
+    before = allocations;
+    cycles = tsc();
+    start_counters(&opts->perf);
+    for (s = 0; s < opts->samples; ++s) {
+        ops = 0;
+        start = now();
+        for (i = 0; i < batches; ++i) ops += b->run(c);
+        times[s] = (now() - start) / ops;
+        calls += ops;
+        bytes += c->bytes * batches;
+    }
+    stop_counters(&opts->perf, counts);
+    cycles = opts->perf.on ? counts[COUNTER_CYCLES] : tsc() - cycles;
+    allocs = allocations - before;
+
+    qsort(times, opts->samples, sizeof(double), compare_doubles);
+    median = times[opts->samples / 2];
+
+    printf("%-16s %-12s %10.1f %10.1f", b->name, label, median * 1e9,
+            bytes / (double)calls / median / 1e6);
+    if (cycles) printf(" %8.3f", bytes / (double)cycles);
+    else printf(" %8s", "-");
+#ifdef MUMMY_BENCH_WRAP
+    printf(" %9.3f", allocs / (double)calls);
+#else
+    printf(" %9s", "-");
+#endif
+    if (opts->perf.on)
+        printf(" %9.1f %9.3f %9.3f", counts[COUNTER_CYCLES] / (double)calls,
+                counts[COUNTER_BRANCH_MISSES] / (double)calls,
+                counts[COUNTER_CACHE_MISSES] / (double)calls);
+    putchar('\n');
+    fflush(stdout);
+}
+
+static int
+selected(const char *name, char **names, int count) {
+    int i;
+    if (!count) return 1;
+    for (i = 0; i < count; ++i) if (strstr(name, names[i])) return 1;
+    return 0;
+}
+
+int
+main(int argc, char **argv) {
+    const char *file = NULL, *label, *source;
+    mummy_string *payloads[2] = {NULL, NULL};
+    const benchmark *b;
+    options opts;
+    context c;
+    int opt, records = 0, list = 0, perf = 0, i, p, status = 0;
+    uint64_t seed = 0x9e3779b97f4a7c15ull;
+
+    opts.seconds = 0.5;
+    opts.samples = 10;
+    opts.perf.on = 0;
+
+    while (-1 != (opt = getopt(argc, argv, "f:rt:n:plh"))) {
+        switch (opt) {
+        case 'f':
+            file = optarg;
+            break;
+        case 'r':
+            records = 1;
+            break;
+        case 't':
+            opts.seconds = atof(optarg);
+            break;
+        case 'n':
+            opts.samples = atoi(optarg);
+            break;
+        case 'p':
+            perf = 1;
+            break;
+        case 'l':
+            list = 1;
+            break;
+        case 'h':
+            fputs(usage, stdout);
+            return 0;
+        default:
+            fputs(usage, stderr);
+            return 2;
+        }
+    }
+    if (opts.seconds <= 0 || opts.samples < 1 || opts.samples > 64) {
+        fputs("mummy_bench: -t must be positive and -n from 1 to 64\n",
+                stderr);
+        return 2;
+    }
+
+    if (list) {
+        for (b = benchmarks; b->name; ++b)
+            printf("%s%s\n", b->name, b->payload ? " (payload)" : "");
+        return 0;
+    }
+
+    /* the same numbers every run, of every width */
+    memset(&c, 0, sizeof(c));
+    for (i = 0; i < BATCH; ++i) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        c.ints[i] = (int64_t)(seed >> (64 - 8 * (1 << (i & 3))));
+        if (i & 4) c.ints[i] = -c.ints[i];
+        c.floats[i] = (double)(int64_t)seed / 1e9;
+        c.text[i] = "abcdefghijklmnopqrstuvwxyz0123456789"[seed % 36];
+    }
+    if (!(c.out = mummy_string_new(BATCH * 16)) ||
+            !(c.in = mummy_string_new(BATCH * 16)) ||
+            !(payloads[0] = synthetic_payload(&c))) {
+        fputs("mummy_bench: out of memory\n", stderr);
+        status = 1;
+        goto done;
+    }
+    if (file && !(payloads[1] = file_payload(file, records))) {
+        status = 1;
+        goto done;
+    }
+    if (perf) open_counters(&opts.perf);
+
+#ifdef HAVE_TSC
+    source = opts.perf.on ? "perf" : "the TSC";
+#else
+    source = opts.perf.on ? "perf" : "nowhere";
+#endif
+    printf("mummy %s, cycles from %s\n", mummy_version_string(), source);
+    printf("%-16s %-12s %10s %10s %8s %9s", "benchmark", "payload", "ns/op",
+            "MB/s", "B/cycle", "allocs/op");
+    if (opts.perf.on)
+        printf(" %9s %9s %9s", "cycles/op", "br-miss", "cache-miss");
+    putchar('\n');
+
+    for (b = benchmarks; b->name; ++b) {
+        if (!selected(b->name, argv + optind, argc - optind)) continue;
+        for (p = 0; p < (b->payload ? 2 : 1); ++p) {
+            if (b->payload && !payloads[p]) continue;
+            c.payload = payloads[p];
+            label = !b->payload ? "-" : !p ? "synthetic" :
+                strrchr(file, '/') ? strrchr(file, '/') + 1 : file;
+            if (b->setup && b->setup(&c)) {
+                fprintf(stderr, "mummy_bench: %s: setup failed\n", b->name);
+                status = 1;
+                continue;
+            }
+            measure(&c, b, label, &opts);
+        }
+    }
+
+    close_counters(&opts.perf);
+done:
+    if (c.out) mummy_string_free(c.out, 1);
+    if (c.in) mummy_string_free(c.in, 1);
+    if (c.packed) mummy_string_free(c.packed, 1);
+    for (p = 0; p < 2; ++p) if (payloads[p]) mummy_string_free(payloads[p], 1);
+    return status;
+}
@@ -0,0 +1,1314 @@
+/*
+ * the mummy command: look inside, check and convert mummy data without
+ * python. files are mapped rather than read in, and handled a value at a
+ * time, so a file of records can be far bigger than memory.
+ */
+#define _XOPEN_SOURCE 700
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mummy.h"
+
+
+static const char usage[] =
+"usage: mummy <command> [options] [file ...]\n"
+"\n"
+"commands:\n"
+"  cat          print each value, as indented text unless -t says otherwise\n"
+"  get PATH     print what's at PATH (like .users[0].name) in each value\n"
+"  stats        where the bytes in the values go: by type, keys and path\n"
+"  validate     check that each value reads back in full\n"
+"  convert      rewrite the values from one format (-f) into another (-t)\n"
+"  recompress   rewrite mummy values with different compression (-c)\n"
+"\n"
+"options:\n"
+"  -r           mummy is records (a 4 byte big-endian length, then the\n"
+"               value), as dump_records writes, rather than one value\n"
+"  -f FORMAT    what the files hold: mummy (the default), json (a value\n"
+"               a line) or msgpack (values one after another)\n"
+"  -t FORMAT    what to write: text, json (a value a line), msgpack or\n"
+"               mummy (as records unless reading one mummy value)\n"
+"  -c CODEC     compression for mummy output: lzf (the default) or none\n"
+"  -d DEPTH     how many levels deep stats breaks subtrees down (2)\n"
+"  -o FILE      write to FILE instead of standard output\n"
+"\n"
+"with no files, or -, standard input is read.\n";
+
+enum { FORMAT_MUMMY, FORMAT_JSON, FORMAT_MSGPACK, FORMAT_TEXT };
+
+static const char *formats[] = {"mummy", "json", "msgpack", "text", NULL};
+
+static const char *
+describe(int rc) {
+    switch (rc) {
+    case -1: return "truncated";
+    case -2: return "unknown type";
+    case -3: return "nested too deeply";
+    case ENOMEM: return "out of memory";
+    case EINVAL: return "invalid";
+    }
+    return "invalid";
+}
+
+
+/*
+ * input: files mapped (or standard input read) whole, and taken apart into
+ * values, which all end up as decompressed mummy
+ */
+
+typedef struct {
+    const char *name;
+    char *data;
+    size_t size;
+    size_t pos;
+    int mapped;
+    long count; /* values read so far */
+    long number; /* the current one's, counting from 1 */
+    size_t start; /* where it starts in the file */
+    size_t packed; /* and how many bytes of the file it takes up */
+    mummy_string value;
+    char owned; /* value.data was allocated by decompressing */
+    mummy_string *scratch; /* json and msgpack are converted into here */
+} input;
+
+static int
+open_input(input *in, const char *name, mummy_string *scratch) {
+    struct stat st;
+    size_t cap = 1 << 16;
+    ssize_t got;
+    char *temp;
+    int fd = 0;
+
+    memset(in, 0, sizeof(*in));
+    in->scratch = scratch;
+    in->name = name && strcmp(name, "-") ? name : "<stdin>";
+
+    if (name && strcmp(name, "-") && 0 > (fd = open(name, O_RDONLY))) {
+        fprintf(stderr, "mummy: %s: %s\n", name, strerror(errno));
+        return -1;
+    }
+
+    if (!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+        in->size = (size_t)st.st_size;
+        in->data = mmap(NULL, in->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (in->data != MAP_FAILED) {
+            posix_madvise(in->data, in->size, POSIX_MADV_SEQUENTIAL);
+            in->mapped = 1;
+            if (fd) close(fd);
+            return 0;
+        }
+        in->data = NULL;
+        in->size = 0;
+    }
+
+    /* pipes and the like get read in */
+    for (;;) {
+        if (!in->data || in->size == cap) {
+            if (in->data) cap <<= 1;
+            if (!(temp = realloc(in->data, cap))) {
+                fprintf(stderr, "mummy: %s: out of memory\n", in->name);
+                break;
+            }
+            in->data = temp;
+        }
+        got = read(fd, in->data + in->size, cap - in->size);
+        if (got > 0) {
+            in->size += got;
+            continue;
+        }
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0)
+            fprintf(stderr, "mummy: %s: %s\n", in->name, strerror(errno));
+        else {
+            if (fd) close(fd);
+            return 0;
+        }
+        break;
+    }
+    free(in->data);
+    in->data = NULL;
+    if (fd) close(fd);
+    return -1;
+}
+
+static void
+release_value(input *in) {
+    if (in->owned) free(in->value.data);
+    in->owned = 0;
+    in->value.data = NULL;
+}
+
+static void
+close_input(input *in) {
+    release_value(in);
+    if (in->mapped) munmap(in->data, in->size);
+    else free(in->data);
+    in->data = NULL;
+}
+
+static int
+input_error(input *in, const char *what) {
+    fprintf(stderr, "mummy: %s: value %ld (at byte %zu): %s\n",
+            in->name, in->number, in->start, what);
+    return -1;
+}
+
+/* on to the next value, returning 1 if there is one, 0 at the end of the
+   file and -1 (having said why) when what's there can't be read */
+static int
+next_value(input *in, int from, int records) {
+    mummy_string src;
+    char *line, *end, *c;
+    size_t len;
+    int rc;
+
+    release_value(in);
+    in->number = in->count + 1;
+    in->start = in->pos;
+
+    switch (from) {
+    case FORMAT_MUMMY:
+        if (in->pos >= in->size) return 0;
+        len = in->size - in->pos;
+        if (records) {
+            if (len < 4) return input_error(in, "truncated record length");
+            c = in->data + in->pos;
+            len = (size_t)(unsigned char)c[0] << 24 |
+                (size_t)(unsigned char)c[1] << 16 |
+                (size_t)(unsigned char)c[2] << 8 | (unsigned char)c[3];
+            in->pos += 4;
+            if (in->size - in->pos < len)
+                return input_error(in, "truncated record");
+        }
+        if (!len) return input_error(in, "empty value");
+        if (len > INT_MAX)
+            return input_error(in, records ? "record too big" :
+                    "too big for one value (is it records? try -r)");
+
+        in->value.data = in->data + in->pos;
+        in->value.offset = 0;
+        in->value.len = (int)len;
+        in->packed = len;
+        in->pos += len;
+        if ((rc = mummy_string_decompress(&in->value, 0, &in->owned))) {
+            in->value.data = NULL;
+            return input_error(in, rc == ENOMEM ? "out of memory" :
+                    "corrupt compression");
+        }
+        break;
+
+    case FORMAT_JSON:
+        /* a value a line, with blank lines skipped */
+        for (;;) {
+            if (in->pos >= in->size) return 0;
+            line = in->data + in->pos;
+            end = memchr(line, '\n', in->size - in->pos);
+            len = end ? (size_t)(end - line) : in->size - in->pos;
+            in->start = in->pos;
+            in->pos += len + (end != NULL);
+            for (c = line; c < line + len; ++c)
+                if (*c != ' ' && *c != '\t' && *c != '\r') break;
+            if (c < line + len) break;
+        }
+        if (len > INT_MAX) return input_error(in, "line too long");
+
+        src.data = line;
+        src.offset = 0;
+        src.len = (int)len;
+        in->packed = len;
+        in->scratch->offset = 0;
+        if ((rc = mummy_from_json(&src, in->scratch))) {
+            fprintf(stderr, "mummy: %s: value %ld (at byte %zu): "
+                    "%s json\n", in->name, in->number,
+                    in->start + src.offset, describe(rc));
+            return -1;
+        }
+        goto converted;
+
+    case FORMAT_MSGPACK:
+        if (in->pos >= in->size) return 0;
+        len = in->size - in->pos;
+        src.data = in->data + in->pos;
+        src.offset = 0;
+        src.len = len > INT_MAX ? INT_MAX : (int)len;
+        in->scratch->offset = 0;
+        if ((rc = mummy_from_msgpack(&src, in->scratch))) {
+            fprintf(stderr, "mummy: %s: value %ld (at byte %zu): "
+                    "%s msgpack\n", in->name, in->number,
+                    in->start, describe(rc));
+            return -1;
+        }
+        in->pos += src.offset;
+        in->packed = src.offset;
+        goto converted;
+    }
+
+    in->count++;
+    return 1;
+
+converted:
+    in->value.data = in->scratch->data;
+    in->value.offset = 0;
+    in->value.len = in->scratch->offset;
+    in->count++;
+    return 1;
+}
+
+
+/*
+ * output
+ */
+
+typedef struct {
+    int command;
+    int from;
+    int to;
+    int records;
+    int frame; /* mummy output goes out as records */
+    int compress;
+    int depth;
+    const char *path;
+    FILE *out;
+    mummy_string *buf; /* output is put together in here */
+    mummy_string *scratch; /* json and msgpack input is converted into here */
+    mummy_string *numbers; /* for the text writer's numbers */
+    int failed;
+} cli;
+
+static int
+write_out(cli *c, const char *data, size_t len) {
+    if (len && fwrite(data, 1, len, c->out) != len) {
+        fprintf(stderr, "mummy: write failed: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/* indented, python-ish text, as mummy_walk callbacks */
+
+typedef struct {
+    FILE *out;
+    mummy_walker walker;
+    mummy_string *numbers; /* for borrowing the json writer's numbers */
+    mummy_string *json;
+    struct {
+        uint32_t seen;
+        char hash;
+        char empty;
+        char close;
+    } levels[MUMMY_WALK_MAX_DEPTH];
+} text_writer;
+
+static void
+indent(text_writer *text, int depth) {
+    int i;
+    for (i = 0; i < depth; ++i) fputs("  ", text->out);
+}
+
+/* what goes before an item, returning whether it is a hash key */
+static int
+text_item(text_writer *text, int depth) {
+    int is_key;
+
+    if (!depth) return 0;
+    is_key = text->levels[depth - 1].hash && !(text->levels[depth - 1].seen & 1);
+    if (text->levels[depth - 1].hash && !is_key) {
+        text->levels[depth - 1].seen++;
+        return 0;
+    }
+    fputs(text->levels[depth - 1].seen ? ",\n" : "\n", text->out);
+    text->levels[depth - 1].seen++;
+    indent(text, depth);
+    return is_key;
+}
+
+/* what comes after an atom: a hash key's colon, or the end of the line at
+   the end of the top-level value */
+static int
+text_after(text_writer *text, int is_key) {
+    if (is_key) fputs(": ", text->out);
+    if (text->walker.depth) return 0;
+    fputc('\n', text->out);
+    return MUMMY_WALK_STOP;
+}
+
+static int
+text_atom(text_writer *text, const char *repr, size_t len) {
+    int is_key = text_item(text, text->walker.depth);
+    fwrite(repr, 1, len, text->out);
+    return text_after(text, is_key);
+}
+
+static int
+text_null(void *ctx) {
+    return text_atom(ctx, "None", 4);
+}
+
+static int
+text_boolean(void *ctx, char value) {
+    return text_atom(ctx, value ? "True" : "False", value ? 4 : 5);
+}
+
+static int
+text_integer(void *ctx, int64_t value) {
+    char repr[24];
+    return text_atom(ctx, repr, sprintf(repr, "%" PRId64, value));
+}
+
+/* the json writer already spells huge ints in decimal and floats the way
+   python's repr does */
+static int
+text_number(text_writer *text, int rc) {
+    mummy_string number, *json = text->json;
+
+    if (rc) return rc;
+    number.data = text->numbers->data;
+    number.offset = 0;
+    number.len = text->numbers->offset;
+    text->numbers->offset = 0;
+    json->offset = 0;
+    if ((rc = mummy_to_json(&number, json))) return rc;
+
+    if (json->offset == 3 && !memcmp(json->data, "NaN", 3))
+        return text_atom(text, "nan", 3);
+    if (json->offset == 8 && !memcmp(json->data, "Infinity", 8))
+        return text_atom(text, "inf", 3);
+    if (json->offset == 9 && !memcmp(json->data, "-Infinity", 9))
+        return text_atom(text, "-inf", 4);
+    return text_atom(text, json->data, json->offset);
+}
+
+static int
+text_huge(void *ctx, char *data, int len) {
+    text_writer *text = ctx;
+    return text_number(text, mummy_feed_huge(text->numbers, data, len));
+}
+
+static int
+text_floating(void *ctx, double value) {
+    text_writer *text = ctx;
+    return text_number(text, mummy_feed_float(text->numbers, value));
+}
+
+static void
+text_quoted(text_writer *text, const char *data, int len, int bytes) {
+    unsigned char c;
+    int i;
+
+    if (bytes) fputc('b', text->out);
+    fputc('\'', text->out);
+    for (i = 0; i < len; ++i) {
+        c = (unsigned char)data[i];
+        switch (c) {
+        case '\'': fputs("\\'", text->out); break;
+        case '\\': fputs("\\\\", text->out); break;
+        case '\n': fputs("\\n", text->out); break;
+        case '\r': fputs("\\r", text->out); break;
+        case '\t': fputs("\\t", text->out); break;
+        default:
+            if (c < 0x20 || c == 0x7f || (bytes && c > 0x7f))
+                fprintf(text->out, "\\x%02x", c);
+            else
+                fputc(c, text->out);
+        }
+    }
+    fputc('\'', text->out);
+}
+
+static int
+text_string(void *ctx, char *data, int len) {
+    text_writer *text = ctx;
+    int is_key = text_item(text, text->walker.depth);
+    text_quoted(text, data, len, 1);
+    return text_after(text, is_key);
+}
+
+static int
+text_utf8(void *ctx, char *data, int len) {
+    text_writer *text = ctx;
+    int is_key = text_item(text, text->walker.depth);
+    text_quoted(text, data, len, 0);
+    return text_after(text, is_key);
+}
+
+static int
+text_begin(text_writer *text, uint32_t size, char hash, const char *open,
+        const char *empty, char close) {
+    /* the walker has already counted the container */
+    int depth = text->walker.depth - 1;
+
+    text_item(text, depth);
+    text->levels[depth].seen = 0;
+    text->levels[depth].hash = hash;
+    text->levels[depth].empty = !size;
+    text->levels[depth].close = close;
+    fputs(size ? open : empty, text->out);
+    return 0;
+}
+
+static int
+text_begin_list(void *ctx, uint32_t size) {
+    return text_begin(ctx, size, 0, "[", "[]", ']');
+}
+
+static int
+text_begin_tuple(void *ctx, uint32_t size) {
+    return text_begin(ctx, size, 0, "(", "()", ')');
+}
+
+static int
+text_begin_set(void *ctx, uint32_t size) {
+    return text_begin(ctx, size, 0, "{", "set()", '}');
+}
+
+static int
+text_begin_hash(void *ctx, uint32_t size) {
+    return text_begin(ctx, size, 1, "{", "{}", '}');
+}
+
+static int
+text_end(void *ctx) {
+    text_writer *text = ctx;
+    int depth = text->walker.depth;
+
+    if (!text->levels[depth].empty) {
+        fputc('\n', text->out);
+        indent(text, depth);
+        fputc(text->levels[depth].close, text->out);
+    }
+    /* a container can't be a key here: python only hashes tuples, and they
+       are written the same either way */
+    return text_after(text, 0);
+}
+
+static void
+text_decimal(text_writer *text, mummy_token *token) {
+    int i, digit;
+
+    fputs(token->v.decimal.sign ? "Decimal('-" : "Decimal('", text->out);
+    for (i = 0; i < token->v.decimal.count; ++i) {
+        digit = (unsigned char)token->v.decimal.digits[i >> 1];
+        fputc('0' + ((i & 1) ? digit >> 4 : digit & 0x0f), text->out);
+    }
+    if (!token->v.decimal.count) fputc('0', text->out);
+    if (token->v.decimal.exponent)
+        fprintf(text->out, "E%d", token->v.decimal.exponent);
+    fputs("')", text->out);
+}
+
+static int
+text_other(void *ctx, mummy_token *token) {
+    text_writer *text = ctx;
+    int is_key = text_item(text, text->walker.depth);
+    FILE *out = text->out;
+    const char *sep = "";
+
+    switch (token->type) {
+    case MUMMY_TYPE_DATE:
+        fprintf(out, "datetime.date(%d, %d, %d)", token->v.dt.year,
+                token->v.dt.month, token->v.dt.day);
+        break;
+    case MUMMY_TYPE_DATETIME:
+        fprintf(out, "datetime.datetime(%d, %d, %d, %d, %d",
+                token->v.dt.year, token->v.dt.month, token->v.dt.day,
+                token->v.dt.hour, token->v.dt.minute);
+        goto seconds;
+    case MUMMY_TYPE_TIME:
+        fprintf(out, "datetime.time(%d, %d", token->v.dt.hour,
+                token->v.dt.minute);
+seconds:
+        /* python leaves off trailing zeros */
+        if (token->v.dt.second || token->v.dt.microsecond)
+            fprintf(out, ", %d", token->v.dt.second);
+        if (token->v.dt.microsecond)
+            fprintf(out, ", %d", (int)token->v.dt.microsecond);
+        fputc(')', out);
+        break;
+    case MUMMY_TYPE_TIMEDELTA:
+        fputs("datetime.timedelta(", out);
+        if (token->v.delta.days) {
+            fprintf(out, "days=%d", (int)token->v.delta.days);
+            sep = ", ";
+        }
+        if (token->v.delta.seconds) {
+            fprintf(out, "%sseconds=%d", sep, (int)token->v.delta.seconds);
+            sep = ", ";
+        }
+        if (token->v.delta.microseconds)
+            fprintf(out, "%smicroseconds=%d", sep,
+                    (int)token->v.delta.microseconds);
+        else if (!*sep)
+            fputc('0', out);
+        fputc(')', out);
+        break;
+    case MUMMY_TYPE_DECIMAL:
+        text_decimal(text, token);
+        break;
+    case MUMMY_TYPE_SPECIALNUM:
+        fprintf(out, "Decimal('%s%s')", token->v.i & 1 ?
+                ((token->v.i & 0xf0) == MUMMY_SPECIAL_NAN ? "s" : "-") : "",
+                (token->v.i & 0xf0) == MUMMY_SPECIAL_NAN ?
+                "NaN" : "Infinity");
+        break;
+    case MUMMY_TYPE_FRACTION:
+        fprintf(out, "Fraction(%" PRId64 ", %" PRId64 ")",
+                token->v.fraction.numerator, token->v.fraction.denominator);
+        break;
+    default:
+        return EINVAL;
+    }
+    return text_after(text, is_key);
+}
+
+static const mummy_walk_callbacks text_callbacks = {
+    text_null,
+    text_boolean,
+    text_integer,
+    text_huge,
+    text_floating,
+    text_string,
+    text_utf8,
+    text_begin_list,
+    text_begin_tuple,
+    text_begin_set,
+    text_begin_hash,
+    text_end,
+    text_other
+};
+
+static int
+write_text(cli *c, mummy_string *value) {
+    text_writer *text;
+    int rc;
+
+    if (!(text = malloc(sizeof(*text)))) return ENOMEM;
+    text->out = c->out;
+    text->numbers = c->numbers;
+    text->json = c->buf;
+    text->numbers->offset = 0;
+    mummy_walker_init(&text->walker, &text_callbacks, text);
+
+    rc = mummy_walk(&text->walker, value);
+    free(text);
+    if (rc == MUMMY_WALK_STOP) return 0;
+    return rc ? rc : -1;
+}
+
+static int
+copy_value(mummy_string *buf, const char *data, int len) {
+    mummy_string_makespace(buf, len);
+    memcpy(buf->data, data, len);
+    buf->offset = len;
+    return 0;
+}
+
+/* one value (from its offset to its len) out in the format asked for */
+static int
+emit(cli *c, mummy_string *value) {
+    mummy_string *buf = c->buf;
+    char head[4];
+    int len = value->len - value->offset, rc;
+
+    buf->offset = 0;
+    switch (c->to) {
+    case FORMAT_TEXT:
+        return write_text(c, value);
+    case FORMAT_JSON:
+        if ((rc = mummy_to_json(value, buf))) return rc;
+        if (write_out(c, buf->data, buf->offset)) return -4;
+        if (write_out(c, "\n", 1)) return -4;
+        return 0;
+    case FORMAT_MSGPACK:
+        if ((rc = mummy_to_msgpack(value, buf))) return rc;
+        break;
+    case FORMAT_MUMMY:
+        /* compression works on the string's own buffer, so copy it in */
+        if ((rc = copy_value(buf, value->data + value->offset, len)))
+            return rc;
+        if (c->compress && (rc = mummy_string_compress(buf))) return rc;
+        if (c->frame) {
+            head[0] = (char)(buf->offset >> 24);
+            head[1] = (char)(buf->offset >> 16);
+            head[2] = (char)(buf->offset >> 8);
+            head[3] = (char)buf->offset;
+            if (write_out(c, head, 4)) return -4;
+        }
+        break;
+    }
+    if (write_out(c, buf->data, buf->offset)) return -4;
+    return 0;
+}
+
+/* say what went wrong writing out a value, for anything but a failed
+   write, which has already been reported */
+static int
+emit_error(input *in, int rc) {
+    if (rc == -4) return -1;
+    if (rc == EINVAL)
+        return input_error(in, "can't be written in that format");
+    return input_error(in, describe(rc));
+}
+
+
+/*
+ * get: the value at a path, walking past whatever's not on the way there
+ */
+
+typedef struct {
+    const char *key;
+    int len;
+    char numeric; /* is an index into a sequence, or can match an int key */
+    int64_t num;
+} path_part;
+
+typedef struct {
+    mummy_walker walker;
+    mummy_string *str;
+    path_part *parts;
+    int count;
+    int want; /* the part being looked for... */
+    int level; /* ...in the container at this walker depth */
+    uint64_t index; /* items seen in it so far */
+    char matched; /* the hash key just seen was the one wanted */
+    int mark; /* where the next item in it starts, when that matters */
+    int inside; /* walker depth of the container found, while in it */
+    int start;
+    int end;
+    char found;
+} getter;
+
+static int
+parse_path(const char *text, path_part **parts) {
+    path_part *part;
+    const char *c = text, *end;
+    int count = 0, cap = 8;
+    char *stop;
+
+    if (!(*parts = malloc(cap * sizeof(path_part)))) return -1;
+    if (*c == '.' && !c[1]) return 0;
+
+    while (*c) {
+        if (count == cap) {
+            cap <<= 1;
+            if (!(part = realloc(*parts, cap * sizeof(path_part)))) return -1;
+            *parts = part;
+        }
+        part = &(*parts)[count++];
+
+        if (*c == '[') {
+            errno = 0;
+            part->num = strtoll(c + 1, &stop, 10);
+            if (stop == c + 1 || *stop != ']' || errno || part->num < 0)
+                return -1;
+            part->key = NULL;
+            part->len = 0;
+            part->numeric = 1;
+            c = stop + 1;
+            continue;
+        }
+
+        if (*c == '.') ++c;
+        else if (c != text) return -1;
+        for (end = c; *end && *end != '.' && *end != '['; ++end);
+        if (end == c) return -1;
+        part->key = c;
+        part->len = (int)(end - c);
+
+        /* a numeric key matches an int key or indexes a sequence too */
+        errno = 0;
+        part->num = strtoll(c, &stop, 10);
+        part->numeric = stop == end && !errno && *c != '+' && *c != ' ';
+        c = end;
+    }
+    return count;
+}
+
+static int
+get_hit(getter *g, int begin) {
+    if (g->want + 1 == g->count) {
+        g->start = g->mark;
+        if (begin) {
+            g->inside = g->walker.depth;
+            return 0;
+        }
+        g->end = g->str->offset;
+        g->found = 1;
+        return MUMMY_WALK_STOP;
+    }
+
+    /* only containers have anything further down the path */
+    if (!begin) return MUMMY_WALK_STOP;
+    g->want++;
+    g->level = g->walker.depth;
+    g->index = 0;
+    g->matched = 0;
+    g->mark = g->str->offset;
+    return 0;
+}
+
+static int
+get_item(getter *g, int begin, const char *key, int len, int is_int,
+        int64_t num) {
+    int parent = g->walker.depth - begin;
+    path_part *part = &g->parts[g->want];
+    uint64_t index;
+
+    if (g->inside) return 0;
+
+    if (!parent) {
+        if (!g->count) {
+            /* the whole thing */
+            g->start = 0;
+            if (begin) {
+                g->inside = g->walker.depth;
+                return 0;
+            }
+            g->end = g->str->offset;
+            g->found = 1;
+            return MUMMY_WALK_STOP;
+        }
+        if (!begin) return MUMMY_WALK_STOP;
+        g->level = 1;
+        g->mark = g->str->offset;
+        return 0;
+    }
+
+    /* inside the item before the one wanted, which is walked through to
+       find where it ends */
+    if (parent != g->level) return 0;
+
+    if (g->walker.stack[parent - 1].hash) {
+        if (g->walker.stack[parent - 1].left & 1) {
+            /* a key, whose value starts right after it */
+            g->mark = g->str->offset;
+            if (is_int) g->matched = part->numeric && num == part->num;
+            else g->matched = key && part->key && len == part->len &&
+                !memcmp(key, part->key, len);
+            return g->matched ? 0 : MUMMY_WALK_SKIP;
+        }
+        if (!g->matched) return begin ? MUMMY_WALK_SKIP : 0;
+        g->matched = 0;
+        return get_hit(g, begin);
+    }
+
+    if (!part->numeric) return MUMMY_WALK_STOP;
+    index = g->index++;
+    if (index + 1 < (uint64_t)part->num) return begin ? MUMMY_WALK_SKIP : 0;
+    if (index + 1 == (uint64_t)part->num) {
+        if (!begin) g->mark = g->str->offset;
+        return 0;
+    }
+    return get_hit(g, begin);
+}
+
+static int
+get_value(void *ctx) {
+    return get_item(ctx, 0, NULL, 0, 0, 0);
+}
+
+static int
+get_boolean(void *ctx, char value) {
+    return get_item(ctx, 0, NULL, 0, 0, 0);
+}
+
+static int
+get_integer(void *ctx, int64_t value) {
+    return get_item(ctx, 0, NULL, 0, 1, value);
+}
+
+static int
+get_bytes(void *ctx, char *data, int len) {
+    return get_item(ctx, 0, data, len, 0, 0);
+}
+
+static int
+get_floating(void *ctx, double value) {
+    return get_item(ctx, 0, NULL, 0, 0, 0);
+}
+
+static int
+get_begin(void *ctx, uint32_t size) {
+    return get_item(ctx, 1, NULL, 0, 0, 0);
+}
+
+static int
+get_other(void *ctx, mummy_token *token) {
+    return get_item(ctx, 0, NULL, 0, 0, 0);
+}
+
+static int
+get_end(void *ctx) {
+    getter *g = ctx;
+
+    if (g->inside) {
+        if (g->walker.depth >= g->inside) return 0;
+        g->end = g->str->offset;
+        g->found = 1;
+        return MUMMY_WALK_STOP;
+    }
+    /* the end of an item in the container being searched, or the end of
+       that container without finding it */
+    if (g->walker.depth == g->level) g->mark = g->str->offset;
+    return g->walker.depth < g->level ? MUMMY_WALK_STOP : 0;
+}
+
+static const mummy_walk_callbacks get_callbacks = {
+    get_value,
+    get_boolean,
+    get_integer,
+    get_bytes,
+    get_floating,
+    get_bytes,
+    get_bytes,
+    get_begin,
+    get_begin,
+    get_begin,
+    get_begin,
+    get_end,
+    get_other
+};
+
+static int
+command_get(cli *c, input *in, path_part *parts, int count) {
+    mummy_string value;
+    getter *g;
+    int rc;
+
+    if (!(g = calloc(1, sizeof(*g)))) return input_error(in, "out of memory");
+    g->str = &in->value;
+    g->parts = parts;
+    g->count = count;
+    mummy_walker_init(&g->walker, &get_callbacks, g);
+
+    rc = mummy_walk(&g->walker, &in->value);
+    if (rc && rc != MUMMY_WALK_STOP) {
+        free(g);
+        return input_error(in, describe(rc));
+    }
+    if (!g->found) {
+        free(g);
+        c->failed++;
+        return 0;
+    }
+
+    value.data = in->value.data;
+    value.offset = g->start;
+    value.len = g->end;
+    free(g);
+    if ((rc = emit(c, &value))) return emit_error(in, rc);
+    return 0;
+}
+
+
+/*
+ * stats: the library's profile of all the values, where their bytes go
+ */
+
+typedef struct {
+    mummy_profile *profile;
+    uint64_t packed;
+} stats;
+
+static int
+command_stats(stats *st, input *in) {
+    int rc;
+
+    if ((rc = mummy_profile_add(st->profile, &in->value)))
+        return input_error(in, rc == ENOMEM ? "out of memory" : describe(rc));
+    st->packed += in->packed;
+    return 0;
+}
+
+static double
+share(uint64_t part, uint64_t whole) {
+    return whole ? 100.0 * part / whole : 0;
+}
+
+static void
+print_estimate(FILE *out, const char *what, uint64_t bytes, uint64_t whole) {
+    fprintf(out, "%-14s %14" PRIu64 " %+6.1f%%\n", what, bytes,
+            share(bytes, whole) - (whole ? 100 : 0));
+}
+
+static void
+print_stats(stats *st, FILE *out) {
+    mummy_profile *pr = st->profile;
+    size_t i;
+    int width = 4, len, k;
+
+    fprintf(out, "values  %" PRIu64 "\n", pr->values);
+    fprintf(out, "bytes   %" PRIu64, pr->bytes);
+    if (st->packed != pr->bytes)
+        fprintf(out, " (%" PRIu64 " as stored)", st->packed);
+    fputs("\n\n", out);
+
+    fprintf(out, "%-14s %14s %7s\n", "part", "bytes", "share");
+    fprintf(out, "%-14s %14" PRIu64 " %6.1f%%   %" PRIu64 " keys, %" PRIu64
+            " strings distinct\n", "keys", pr->key_bytes,
+            share(pr->key_bytes, pr->bytes), pr->key_count,
+            pr->distinct_keys);
+    fprintf(out, "%-14s %14" PRIu64 " %6.1f%%\n", "headers",
+            pr->header_bytes, share(pr->header_bytes, pr->bytes));
+    fputs("\nwhat if\n", out);
+    print_estimate(out, "varints", pr->varint_bytes, pr->bytes);
+    print_estimate(out, "key table", pr->keytable_bytes, pr->bytes);
+
+    fprintf(out, "\n%-14s %12s %14s %7s\n", "type", "count", "bytes",
+            "share");
+    for (k = 0; k < MUMMY_PROFILE_TYPES; ++k) {
+        if (!pr->counts[k]) continue;
+        fprintf(out, "%-14s %12" PRIu64 " %14" PRIu64 " %6.1f%%\n",
+                mummy_type_name(k), pr->counts[k], pr->sizes[k],
+                share(pr->sizes[k], pr->bytes));
+    }
+
+    for (i = 0; i < pr->npaths; ++i)
+        if ((len = (int)strlen(pr->paths[i].path) + 1) > width) width = len;
+    ++width;
+    if (width > 48) width = 48;
+
+    fprintf(out, "\n%-*s %-10s %12s %12s %14s %12s %7s %7s\n", width, "path",
+            "type", "count", "items", "bytes", "keys", "lzf", "share");
+    for (i = 0; i < pr->npaths; ++i) {
+        mummy_profile_path *p = &pr->paths[i];
+        /* everything is spelled from the top, which is "." */
+        fprintf(out, "%s%-*s %-10s %12" PRIu64, *p->path == '.' ? "" : ".",
+                width - (*p->path != '.'), p->path,
+                p->type < 0 ? "mixed" : mummy_type_name(p->type), p->count);
+        if (p->items || (MUMMY_TYPE_LONGLIST <= p->type &&
+                    p->type <= MUMMY_TYPE_MEDHASH))
+            fprintf(out, " %12" PRIu64, p->items);
+        else
+            fprintf(out, " %12s", "-");
+        fprintf(out, " %14" PRIu64 " %12" PRIu64 " %6.1f%% %6.1f%%\n",
+                p->bytes, p->key_bytes, share(p->compressed, p->bytes),
+                share(p->bytes, pr->bytes));
+    }
+}
+
+
+/*
+ * validate: everything reads, strings are UTF-8 where they should be, and
+ * there's exactly the one value
+ */
+
+typedef struct {
+    mummy_walker walker;
+    long tops;
+} validator;
+
+static int
+valid_utf8(const unsigned char *s, int len) {
+    int i = 0, n, k;
+    uint32_t cp;
+
+    while (i < len) {
+        if (s[i] < 0x80) {
+            ++i;
+            continue;
+        }
+        if ((s[i] & 0xe0) == 0xc0) { n = 1; cp = s[i] & 0x1f; }
+        else if ((s[i] & 0xf0) == 0xe0) { n = 2; cp = s[i] & 0x0f; }
+        else if ((s[i] & 0xf8) == 0xf0) { n = 3; cp = s[i] & 0x07; }
+        else return 0;
+        if (len - i <= n) return 0;
+        for (k = 1; k <= n; ++k) {
+            if ((s[i + k] & 0xc0) != 0x80) return 0;
+            cp = (cp << 6) | (s[i + k] & 0x3f);
+        }
+        /* overlong, surrogates and past the last code point */
+        if ((n == 1 && cp < 0x80) || (n == 2 && cp < 0x800) ||
+                (n == 3 && cp < 0x10000) || cp > 0x10ffff ||
+                (cp >= 0xd800 && cp < 0xe000))
+            return 0;
+        i += n + 1;
+    }
+    return 1;
+}
+
+static int
+validate_top(validator *v) {
+    if (!v->walker.depth) v->tops++;
+    return 0;
+}
+
+static int
+validate_utf8(void *ctx, char *data, int len) {
+    if (!valid_utf8((unsigned char *)data, len)) return EINVAL;
+    return validate_top(ctx);
+}
+
+static int
+validate_atom(void *ctx) {
+    return validate_top(ctx);
+}
+
+static int
+validate_other(void *ctx, mummy_token *token) {
+    return validate_top(ctx);
+}
+
+static int
+validate_boolean(void *ctx, char value) {
+    return validate_top(ctx);
+}
+
+static int
+validate_integer(void *ctx, int64_t value) {
+    return validate_top(ctx);
+}
+
+static int
+validate_bytes(void *ctx, char *data, int len) {
+    return validate_top(ctx);
+}
+
+static int
+validate_floating(void *ctx, double value) {
+    return validate_top(ctx);
+}
+
+static const mummy_walk_callbacks validate_callbacks = {
+    validate_atom,
+    validate_boolean,
+    validate_integer,
+    validate_bytes,
+    validate_floating,
+    validate_bytes,
+    validate_utf8,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    validate_atom,
+    validate_other
+};
+
+static int
+command_validate(cli *c, input *in) {
+    validator v;
+    int rc;
+
+    v.tops = 0;
+    mummy_walker_init(&v.walker, &validate_callbacks, &v);
+    rc = mummy_walk(&v.walker, &in->value);
+    if (rc == EINVAL) {
+        fprintf(stderr, "mummy: %s: value %ld (at byte %zu): bad utf-8 "
+                "in a string ending at byte %d\n", in->name, in->count,
+                in->start, in->value.offset);
+        c->failed++;
+    } else if (rc) {
+        fprintf(stderr, "mummy: %s: value %ld (at byte %zu): %s at "
+                "byte %d\n", in->name, in->count, in->start, describe(rc),
+                in->value.offset);
+        c->failed++;
+    } else if (v.tops != 1) {
+        fprintf(stderr, "mummy: %s: value %ld (at byte %zu): %ld values "
+                "in one\n", in->name, in->count, in->start, v.tops);
+        c->failed++;
+    }
+    return 0;
+}
+
+
+/*
+ * main
+ */
+
+enum {
+    COMMAND_CAT, COMMAND_GET, COMMAND_STATS, COMMAND_VALIDATE,
+    COMMAND_CONVERT, COMMAND_RECOMPRESS
+};
+
+static const char *commands[] = {"cat", "get", "stats", "validate",
+    "convert", "recompress", NULL};
+
+static int
+lookup(const char **names, const char *name) {
+    int i;
+    for (i = 0; names[i]; ++i) if (!strcmp(names[i], name)) return i;
+    return -1;
+}
+
+static int
+bad_usage(const char *why, const char *what) {
+    fprintf(stderr, "mummy: %s%s\n\n%s", why, what ? what : "", usage);
+    return 2;
+}
+
+int
+main(int argc, char **argv) {
+    const char *output = NULL, *codec = NULL;
+    path_part *parts = NULL;
+    stats *st = NULL;
+    input in;
+    cli c;
+    int opt, parts_count = 0, rc, i, status = 0;
+    char **files;
+    int nfiles;
+    long values = 0;
+
+    memset(&c, 0, sizeof(c));
+    c.from = FORMAT_MUMMY;
+    c.to = -1;
+    c.compress = 1;
+    c.depth = 2;
+
+    if (argc < 2 || !strcmp(argv[1], "-h") || !strcmp(argv[1], "--help")) {
+        fputs(usage, argc < 2 ? stderr : stdout);
+        return argc < 2 ? 2 : 0;
+    }
+    if (0 > (c.command = lookup(commands, argv[1])))
+        return bad_usage("unknown command ", argv[1]);
+
+    /* getopt takes the command for the program name */
+    while (-1 != (opt = getopt(argc - 1, argv + 1, "rf:t:c:d:o:h"))) {
+        switch (opt) {
+        case 'r':
+            c.records = 1;
+            break;
+        case 'f':
+            if (0 > (c.from = lookup(formats, optarg)) ||
+                    c.from == FORMAT_TEXT)
+                return bad_usage("can't read ", optarg);
+            break;
+        case 't':
+            if (0 > (c.to = lookup(formats, optarg)))
+                return bad_usage("can't write ", optarg);
+            break;
+        case 'c':
+            codec = optarg;
+            if (!strcmp(optarg, "none")) c.compress = 0;
+            else if (strcmp(optarg, "lzf"))
+                return bad_usage("unknown codec ", optarg);
+            break;
+        case 'd':
+            c.depth = atoi(optarg);
+            if (c.depth < 0)
+                return bad_usage("depth can't be negative", NULL);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'h':
+            fputs(usage, stdout);
+            return 0;
+        default:
+            return bad_usage("bad option", NULL);
+        }
+    }
+    files = argv + 1 + optind;
+    nfiles = argc - 1 - optind;
+
+    if (c.command == COMMAND_GET) {
+        if (!nfiles) return bad_usage("get needs a path", NULL);
+        c.path = *files++;
+        nfiles--;
+        if (0 > (parts_count = parse_path(c.path, &parts))) {
+            free(parts);
+            return bad_usage("bad path ", c.path);
+        }
+    }
+
+    if (c.to < 0) {
+        switch (c.command) {
+        case COMMAND_CONVERT:
+        case COMMAND_RECOMPRESS:
+            c.to = FORMAT_MUMMY;
+            break;
+        default:
+            c.to = FORMAT_TEXT;
+        }
+    }
+    if (c.command == COMMAND_RECOMPRESS && c.to != FORMAT_MUMMY)
+        return bad_usage("recompress only writes mummy", NULL);
+    if (codec && c.to != FORMAT_MUMMY)
+        return bad_usage("-c is only for mummy output", NULL);
+    c.frame = c.records || c.from != FORMAT_MUMMY;
+
+    if (!output || !strcmp(output, "-")) {
+        c.out = stdout;
+    } else if (!(c.out = fopen(output, "wb"))) {
+        fprintf(stderr, "mummy: %s: %s\n", output, strerror(errno));
+        return 1;
+    }
+    setvbuf(c.out, NULL, _IOFBF, 1 << 16);
+
+    if (!(c.buf = mummy_string_new(4096)) ||
+            !(c.scratch = mummy_string_new(4096)) ||
+            !(c.numbers = mummy_string_new(64)) ||
+            (c.command == COMMAND_STATS &&
+             (!(st = calloc(1, sizeof(stats))) ||
+              !(st->profile = mummy_profile_new(c.depth))))) {
+        fputs("mummy: out of memory\n", stderr);
+        return 1;
+    }
+
+    for (i = 0; i < (nfiles ? nfiles : 1); ++i) {
+        if (open_input(&in, nfiles ? files[i] : NULL, c.scratch)) {
+            status = 1;
+            continue;
+        }
+
+        while (1 == (rc = next_value(&in, c.from, c.records))) {
+            switch (c.command) {
+            case COMMAND_GET:
+                rc = command_get(&c, &in, parts, parts_count);
+                break;
+            case COMMAND_STATS:
+                rc = command_stats(st, &in);
+                break;
+            case COMMAND_VALIDATE:
+                rc = command_validate(&c, &in);
+                break;
+            default:
+                if ((rc = emit(&c, &in.value))) rc = emit_error(&in, rc);
+            }
+            if (rc) break;
+        }
+        values += in.count;
+        if (rc) status = 1;
+        close_input(&in);
+    }
+
+    switch (c.command) {
+    case COMMAND_STATS:
+        print_stats(st, c.out);
+        break;
+    case COMMAND_GET:
+        if (c.failed) {
+            fprintf(stderr, "mummy: nothing at %s in %d of %ld values\n",
+                    c.path, c.failed, values);
+            status = 1;
+        }
+        break;
+    case COMMAND_VALIDATE:
+        fprintf(c.out, "%ld values, %ld ok\n", values, values - c.failed);
+        if (c.failed) status = 1;
+        break;
+    }
+
+    if (fflush(c.out) || (c.out != stdout && fclose(c.out))) {
+        fprintf(stderr, "mummy: write failed: %s\n", strerror(errno));
+        status = 1;
+    }
+
+    if (st) {
+        mummy_profile_free(st->profile);
+        free(st);
+    }
+    free(parts);
+    mummy_string_free(c.buf, 1);
+    mummy_string_free(c.scratch, 1);
+    mummy_string_free(c.numbers, 1);
+    return status;
+}